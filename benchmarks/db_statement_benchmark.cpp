@@ -0,0 +1,203 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <string>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <mysqlx/xdevapi.h>
+
+#include "src/DbSessionPool.h"
+#include "src/DbStatementCache.h"
+
+/**
+ * Measures per-call overhead of building MySqlStorageEngine statements from
+ * scratch versus reusing them from a DbStatementCache. The remove benchmarks
+ * delete the edge of peripheral 0, which never exists (ids start at 1). The
+ * insert benchmarks write readings of sensor 0 and a peripheral, each inside
+ * a transaction that is rolled back, so this is safe to point at a live
+ * database.
+ */
+
+namespace
+{
+DEFINE_string(db_url, "mysqlx://trevor@localhost", "MySQL X Protocol URL");
+DEFINE_string(db_name, "plantsandthings", "MySQL schema");
+DEFINE_int32(iterations, 10000, "Calls per benchmark");
+DEFINE_int32(batch_rows, 256, "Readings per upsert in the readings benchmarks");
+
+constexpr const char *RPI_PERIPHERAL_EDGES_TABLE = "rpi_peripheral_edges";
+constexpr const char *SOIL_MOISTURE_MEASUREMENTS_TABLE = "soil_moisture_readings";
+constexpr const char *PERIPHERALS_TABLE = "peripherals";
+constexpr const char *SOIL_MOISTURE_MEASUREMENT_COLUMNS = "sensor_id, time_ms, seq, reading";
+constexpr const char *PERIPHERAL_COLUMNS = "name, time";
+constexpr const char *UPSERT_READING_SUFFIX =
+    "ON DUPLICATE KEY UPDATE reading = VALUES(reading)";
+constexpr const char *BENCHMARK_PERIPHERAL_NAME = "db_statement_benchmark";
+constexpr const char *BENCHMARK_TIMESTAMP = "1970-01-01 00-00-00";
+constexpr size_t MISSING_PERIPHERAL_ID = 0;
+constexpr uint64_t MISSING_SENSOR_ID = 0;
+
+using organicdump::DbSessionLease;
+using organicdump::DbSessionPool;
+
+void RunBenchmark(const char *name, const std::function<void()> &call)
+{
+  // Warm up, which also gives the connector a chance to prepare server-side
+  for (int i = 0; i < 100; ++i)
+  {
+    call();
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < FLAGS_iterations; ++i)
+  {
+    call();
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  auto ns_per_call =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() /
+      FLAGS_iterations;
+
+  LOG(INFO) << name << ": " << ns_per_call << " ns/call";
+}
+
+/** Runs |insert| in a transaction that is rolled back, leaving no rows. */
+void InRolledBackTransaction(DbSessionLease *lease, const std::function<void()> &insert)
+{
+  lease->GetSession()->startTransaction();
+  insert();
+  lease->GetSession()->rollback();
+}
+
+/** The upsert MySqlStorageEngine built per call before DbStatementCache. */
+std::string BuildReadingsUpsert(size_t row_count)
+{
+  std::string statement = std::string{"INSERT INTO "} +
+      SOIL_MOISTURE_MEASUREMENTS_TABLE + " (" + SOIL_MOISTURE_MEASUREMENT_COLUMNS + ") VALUES ";
+  for (size_t i = 0; i < row_count; ++i)
+  {
+    statement += (i == 0) ? "(?, ?, ?, ?)" : ", (?, ?, ?, ?)";
+  }
+  return statement + " " + UPSERT_READING_SUFFIX;
+}
+
+void BindReadings(size_t row_count, mysqlx::SqlStatement *insert)
+{
+  for (size_t i = 0; i < row_count; ++i)
+  {
+    insert->bind(MISSING_SENSOR_ID, static_cast<int64_t>(i), static_cast<uint64_t>(0), 0.5f);
+  }
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv)
+{
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  FLAGS_logtostderr = 1;
+  google::InitGoogleLogging(argv[0]);
+
+  DbSessionPool pool;
+  if (!DbSessionPool::Create(
+        FLAGS_db_url,
+        FLAGS_db_name,
+        1,
+        1,
+        std::chrono::milliseconds{60000},
+        std::chrono::milliseconds{5000},
+        &pool))
+  {
+    LOG(ERROR) << "Failed to create db session pool";
+    return EXIT_FAILURE;
+  }
+
+  DbSessionLease lease;
+  if (!pool.Checkout(&lease))
+  {
+    LOG(ERROR) << "Failed to check out db session";
+    return EXIT_FAILURE;
+  }
+
+  try
+  {
+    // Client-side cost only: no round trip
+    RunBenchmark("table handle (uncached)", [&lease]() {
+      mysqlx::Table table =
+          lease.GetSchema()->getTable(SOIL_MOISTURE_MEASUREMENTS_TABLE);
+      (void)table;
+    });
+
+    RunBenchmark("table handle (cached)", [&lease]() {
+      mysqlx::Table *table =
+          lease.GetStatements()->GetTable(SOIL_MOISTURE_MEASUREMENTS_TABLE);
+      (void)table;
+    });
+
+    RunBenchmark("edge remove (uncached)", [&lease]() {
+      lease.GetSchema()->getTable(RPI_PERIPHERAL_EDGES_TABLE)
+          .remove()
+          .where("peripheral_id = :id")
+          .bind("id", MISSING_PERIPHERAL_ID)
+          .execute();
+    });
+
+    RunBenchmark("edge remove (cached)", [&lease]() {
+      lease.GetStatements()
+          ->GetRemove(RPI_PERIPHERAL_EDGES_TABLE, "peripheral_id = :id")
+          ->bind("id", MISSING_PERIPHERAL_ID)
+          .execute();
+    });
+
+    size_t batch_rows = static_cast<size_t>(FLAGS_batch_rows);
+
+    RunBenchmark("readings upsert (uncached)", [&lease, batch_rows]() {
+      InRolledBackTransaction(&lease, [&lease, batch_rows]() {
+        mysqlx::SqlStatement insert =
+            lease.GetSession()->sql(BuildReadingsUpsert(batch_rows));
+        BindReadings(batch_rows, &insert);
+        insert.execute();
+      });
+    });
+
+    RunBenchmark("readings upsert (cached)", [&lease, batch_rows]() {
+      InRolledBackTransaction(&lease, [&lease, batch_rows]() {
+        mysqlx::SqlStatement insert = lease.GetSession()->sql(
+            lease.GetStatements()->GetInsertSql(
+                SOIL_MOISTURE_MEASUREMENTS_TABLE,
+                SOIL_MOISTURE_MEASUREMENT_COLUMNS,
+                batch_rows,
+                UPSERT_READING_SUFFIX));
+        BindReadings(batch_rows, &insert);
+        insert.execute();
+      });
+    });
+
+    RunBenchmark("peripheral insert (uncached)", [&lease]() {
+      InRolledBackTransaction(&lease, [&lease]() {
+        lease.GetSchema()->getTable(PERIPHERALS_TABLE)
+            .insert("name", "time")
+            .values(BENCHMARK_PERIPHERAL_NAME, BENCHMARK_TIMESTAMP)
+            .execute();
+      });
+    });
+
+    RunBenchmark("peripheral insert (cached)", [&lease]() {
+      InRolledBackTransaction(&lease, [&lease]() {
+        lease.GetSession()
+            ->sql(lease.GetStatements()->GetInsertSql(PERIPHERALS_TABLE, PERIPHERAL_COLUMNS, 1))
+            .bind(BENCHMARK_PERIPHERAL_NAME, BENCHMARK_TIMESTAMP)
+            .execute();
+      });
+    });
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Benchmark failed. Error: " << e;
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
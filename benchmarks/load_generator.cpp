@@ -0,0 +1,840 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "organic_dump.pb.h"
+
+#include "OrganicDumpProtoMessage.h"
+#include "src/EpollReactor.h"
+#include "src/ProtobufClient.h"
+#include "src/TlsContext.h"
+#include "src/TlsStream.h"
+
+/**
+ * Open-loop load generator for organic_dump_server.
+ *
+ * Holds --connections mutually authenticated control connections open and
+ * sends --rate requests per second across them on a fixed schedule, whether
+ * or not earlier requests have been answered, so a struggling server shows
+ * up as latency rather than as less offered load. Latency is measured from
+ * when a request was due rather than when it went out, so a generator that
+ * falls behind can't hide a server stall (coordinated omission).
+ *
+ * The server answers every request with one BasicResponse, in order, which
+ * is how responses are matched to requests. RegisterRpi and
+ * SetIrrigationSchedule write real rows, so point it at a scratch database,
+ * or run the server with --storage=memory to leave MySQL out of the picture.
+ * A fresh in-memory server has no irrigation system, so schedule requests
+ * are answered with errors unless one is registered first.
+ * All connections come from one address: run the server with
+ * --accept_rate_per_ip=0 and --max_pending_connections of at least
+ * --connections, or admission control will reset most of them.
+ */
+
+namespace
+{
+DEFINE_string(host, "127.0.0.1", "IPv4 address of the server");
+DEFINE_int32(port, -1, "Server port");
+DEFINE_string(cert, "", "Client certificate file");
+DEFINE_string(key, "", "Client private key file");
+DEFINE_string(ca, "", "CA file the server's certificate is checked against");
+DEFINE_int32(connections, 1000, "Control connections to hold open");
+DEFINE_int32(threads, 4, "Threads driving the connections, each with its own epoll loop");
+DEFINE_double(rate, 1000, "Requests per second across all connections");
+DEFINE_int32(duration_s, 30, "Length of the measured run");
+DEFINE_int32(connect_timeout_ms, 30000, "Time allowed for every connection to finish its TLS handshake");
+DEFINE_int32(drain_timeout_ms, 10000, "Time allowed after the run for outstanding requests to be answered");
+DEFINE_int32(measurement_weight, 90, "Relative share of SendSoilMoistureMeasurement requests");
+DEFINE_int32(register_rpi_weight, 5, "Relative share of RegisterRpi requests");
+DEFINE_int32(set_schedule_weight, 5, "Relative share of SetIrrigationSchedule requests");
+DEFINE_int32(sensor_id, 1, "Existing soil moisture sensor that measurements are sent for");
+DEFINE_int32(irrigation_system_id, 1, "Existing irrigation system whose schedule is replaced");
+DEFINE_int32(client_id_base, 100000, "HELLO client id of the first connection. Later connections count up from it");
+
+using Clock = std::chrono::steady_clock;
+using organicdump::EpollReactor;
+using organicdump::OrganicDumpProtoMessage;
+using organicdump::ProtobufClient;
+using organicdump::TlsContext;
+using organicdump::TlsIoStatus;
+using organicdump::TlsStream;
+using organicdump_proto::ClientType;
+using organicdump_proto::ErrorCode;
+using organicdump_proto::MessageType;
+
+constexpr size_t MAX_EPOLL_EVENTS = 256;
+constexpr uint32_t SOCKET_EVENTS = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+constexpr std::chrono::seconds PROGRESS_INTERVAL{1};
+
+// Connection failures are logged once per this many
+constexpr int FAILURE_LOG_INTERVAL = 100;
+
+enum RequestKind
+{
+  MEASUREMENT,
+  REGISTER_RPI,
+  SET_SCHEDULE,
+  REQUEST_KIND_COUNT,
+};
+
+const char *ToString(RequestKind kind)
+{
+  switch (kind)
+  {
+    case MEASUREMENT:
+      return "SendSoilMoistureMeasurement";
+    case REGISTER_RPI:
+      return "RegisterRpi";
+    case SET_SCHEDULE:
+      return "SetIrrigationSchedule";
+    default:
+      return "Unknown";
+  }
+}
+
+struct PendingRequest
+{
+  Clock::time_point due;
+  RequestKind kind;
+};
+
+struct Connection
+{
+  ProtobufClient client;
+
+  // Sent but unanswered, oldest first
+  std::deque<PendingRequest> in_flight;
+};
+
+/** Live totals for the progress log, shared by every worker. */
+struct Progress
+{
+  std::atomic<size_t> connected{0};
+  std::atomic<size_t> ready_workers{0};
+  std::atomic<size_t> finished_workers{0};
+  std::atomic<uint64_t> sent{0};
+  std::atomic<uint64_t> completed{0};
+};
+
+struct WorkerResult
+{
+  uint64_t sent{0};
+  uint64_t error_responses{0};
+
+  // Requests whose connection closed, or still unanswered after the drain
+  uint64_t lost{0};
+
+  // Furthest a request went out behind schedule. Large values mean the
+  // generator, not the server, was the bottleneck.
+  Clock::duration max_send_lag{0};
+  std::array<std::vector<int64_t>, REQUEST_KIND_COUNT> latencies_ns;
+};
+
+/**
+ * Drives one share of the connections on its own thread and epoll instance.
+ */
+class Worker
+{
+public:
+  Worker(
+      size_t index,
+      size_t connection_count,
+      uint32_t first_client_id,
+      std::string run_tag,
+      std::shared_ptr<TlsContext> context,
+      struct sockaddr_in server,
+      std::shared_future<Clock::time_point> start,
+      Progress *progress);
+
+  /** Connects, waits for |start|, runs the schedule and drains. */
+  void Run(WorkerResult *out_result);
+
+private:
+  void OpenConnections();
+  void ContinueHandshake(int fd, uint32_t events);
+  void SendRequests(Clock::time_point now);
+  void SendRequest(Clock::time_point due, Clock::time_point now);
+  OrganicDumpProtoMessage MakeRequest(RequestKind kind);
+  RequestKind PickRequestKind();
+  void Poll(int timeout_ms);
+  void ProcessConnection(int fd, uint32_t events);
+  bool FlushConnection(Connection *connection);
+  void DropConnection(int fd);
+  size_t GetInFlightCount() const;
+
+private:
+  Worker(const Worker &other) = delete;
+  Worker &operator=(const Worker &other) = delete;
+
+private:
+  size_t index_;
+  size_t connection_count_;
+  uint32_t first_client_id_;
+  std::string run_tag_;
+  std::shared_ptr<TlsContext> context_;
+  struct sockaddr_in server_;
+  std::shared_future<Clock::time_point> start_;
+  Progress *progress_;
+  EpollReactor reactor_;
+  std::mt19937 random_;
+  uint64_t next_sequence_;
+  Clock::time_point next_send_;
+  Clock::duration send_interval_;
+  std::unordered_map<int, TlsStream> handshakes_;
+  std::unordered_map<int, Connection> connections_;
+
+  // Requests go to connections round-robin
+  std::vector<int> ready_fds_;
+  size_t next_ready_fd_;
+  WorkerResult *result_;
+};
+
+Worker::Worker(
+    size_t index,
+    size_t connection_count,
+    uint32_t first_client_id,
+    std::string run_tag,
+    std::shared_ptr<TlsContext> context,
+    struct sockaddr_in server,
+    std::shared_future<Clock::time_point> start,
+    Progress *progress)
+  : index_{index},
+    connection_count_{connection_count},
+    first_client_id_{first_client_id},
+    run_tag_{std::move(run_tag)},
+    context_{std::move(context)},
+    server_{server},
+    start_{std::move(start)},
+    progress_{progress},
+    random_{static_cast<std::mt19937::result_type>(index)},
+    next_sequence_{0},
+    send_interval_{0},
+    next_ready_fd_{0},
+    result_{nullptr} {}
+
+void Worker::Run(WorkerResult *out_result)
+{
+  assert(out_result);
+  result_ = out_result;
+
+  if (!EpollReactor::Create(MAX_EPOLL_EVENTS, &reactor_))
+  {
+    LOG(ERROR) << "Worker " << index_ << " failed to create epoll reactor";
+    ++progress_->ready_workers;
+    ++progress_->finished_workers;
+    return;
+  }
+
+  OpenConnections();
+  ++progress_->ready_workers;
+
+  // Every worker starts the schedule at the same instant, once all
+  // connections are up
+  Clock::time_point start = start_.get();
+  Clock::time_point end = start + std::chrono::seconds{FLAGS_duration_s};
+
+  send_interval_ = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>{FLAGS_threads / FLAGS_rate});
+
+  // Stagger the workers so that their sends interleave
+  next_send_ = start + send_interval_ * index_ / FLAGS_threads;
+
+  while (!ready_fds_.empty())
+  {
+    Clock::time_point now = Clock::now();
+    if (next_send_ >= end)
+    {
+      break;
+    }
+
+    SendRequests(now);
+
+    auto until_next = std::chrono::duration_cast<std::chrono::milliseconds>(
+        next_send_ - Clock::now());
+    Poll(std::max<int>(0, static_cast<int>(until_next.count())));
+  }
+
+  Clock::time_point drain_deadline =
+      Clock::now() + std::chrono::milliseconds{FLAGS_drain_timeout_ms};
+  while (GetInFlightCount() > 0)
+  {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        drain_deadline - Clock::now());
+    if (remaining.count() <= 0)
+    {
+      break;
+    }
+
+    Poll(static_cast<int>(remaining.count()));
+  }
+
+  result_->lost += GetInFlightCount();
+  ++progress_->finished_workers;
+}
+
+void Worker::OpenConnections()
+{
+  for (size_t i = 0; i < connection_count_; ++i)
+  {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+      LOG_EVERY_N(ERROR, FAILURE_LOG_INTERVAL) << "Failed to create socket: " << strerror(errno);
+      continue;
+    }
+
+    // Requests are small and latency is the point
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    if (connect(fd, reinterpret_cast<struct sockaddr *>(&server_), sizeof(server_)) == -1 &&
+        errno != EINPROGRESS)
+    {
+      LOG_EVERY_N(ERROR, FAILURE_LOG_INTERVAL) << "Failed to connect: " << strerror(errno);
+      close(fd);
+      continue;
+    }
+
+    SSL *ssl = SSL_new(context_->Get());
+    if (!ssl)
+    {
+      organicdump::LogSslErrors("Failed to create SSL session");
+      close(fd);
+      continue;
+    }
+
+    SSL_set_fd(ssl, fd);
+    SSL_set_connect_state(ssl);
+    TlsStream stream{fd, ssl};
+
+    if (!reactor_.Add(fd, SOCKET_EVENTS))
+    {
+      LOG(ERROR) << "Failed to register connection with epoll reactor";
+      continue;
+    }
+
+    handshakes_.emplace(fd, std::move(stream));
+  }
+
+  // Connected sockets report writable straight away, which starts the
+  // handshake
+  Clock::time_point deadline = Clock::now() + std::chrono::milliseconds{FLAGS_connect_timeout_ms};
+  while (!handshakes_.empty())
+  {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - Clock::now());
+    if (remaining.count() <= 0)
+    {
+      LOG(ERROR) << "Worker " << index_ << ": " << handshakes_.size()
+                 << " connection(s) did not finish their handshake in time";
+      break;
+    }
+
+    Poll(static_cast<int>(remaining.count()));
+  }
+
+  for (auto &entry : handshakes_)
+  {
+    reactor_.Remove(entry.first);
+  }
+  handshakes_.clear();
+}
+
+void Worker::ContinueHandshake(int fd, uint32_t events)
+{
+  auto it = handshakes_.find(fd);
+  assert(it != handshakes_.end());
+
+  TlsIoStatus status = (events & EPOLLERR) ? TlsIoStatus::FAILURE : it->second.Handshake();
+  switch (status)
+  {
+    case TlsIoStatus::WANT_READ:
+    case TlsIoStatus::WANT_WRITE:
+      return;
+    case TlsIoStatus::COMPLETE:
+      break;
+    default:
+      LOG_EVERY_N(ERROR, FAILURE_LOG_INTERVAL)
+          << "TLS handshake failed: " << organicdump::ToString(status)
+          << ". Is admission control resetting connections?";
+      reactor_.Remove(fd);
+      handshakes_.erase(it);
+      return;
+  }
+
+  uint32_t client_id = first_client_id_ + static_cast<uint32_t>(connections_.size());
+  Connection *connection = &connections_.emplace(
+      fd,
+      Connection{ProtobufClient{std::move(it->second), client_id, nullptr}, {}}).first->second;
+  handshakes_.erase(it);
+
+  organicdump_proto::Hello hello;
+  hello.set_type(ClientType::CONTROL);
+  hello.set_client_id(client_id);
+
+  OrganicDumpProtoMessage msg{hello};
+  if (!connection->client.Write(&msg) || !FlushConnection(connection))
+  {
+    LOG(ERROR) << "Failed to send HELLO";
+    DropConnection(fd);
+    return;
+  }
+
+  ready_fds_.push_back(fd);
+  ++progress_->connected;
+}
+
+void Worker::SendRequests(Clock::time_point now)
+{
+  while (next_send_ <= now && !ready_fds_.empty())
+  {
+    SendRequest(next_send_, now);
+    next_send_ += send_interval_;
+  }
+}
+
+void Worker::SendRequest(Clock::time_point due, Clock::time_point now)
+{
+  int fd = ready_fds_[next_ready_fd_++ % ready_fds_.size()];
+  Connection *connection = &connections_.at(fd);
+
+  RequestKind kind = PickRequestKind();
+  OrganicDumpProtoMessage msg = MakeRequest(kind);
+
+  if (!connection->client.Write(&msg))
+  {
+    LOG(ERROR) << "Failed to encode " << ToString(kind) << " request";
+    return;
+  }
+
+  connection->in_flight.push_back(PendingRequest{due, kind});
+  ++result_->sent;
+  ++progress_->sent;
+  result_->max_send_lag = std::max(result_->max_send_lag, now - due);
+
+  if (!FlushConnection(connection))
+  {
+    DropConnection(fd);
+  }
+}
+
+OrganicDumpProtoMessage Worker::MakeRequest(RequestKind kind)
+{
+  uint64_t sequence = next_sequence_++;
+
+  switch (kind)
+  {
+    case REGISTER_RPI:
+    {
+      // Names are unique, so every registration is a real insert
+      organicdump_proto::RegisterRpi request;
+      request.set_name(
+          "loadgen-" + run_tag_ + "-" + std::to_string(index_) + "-" + std::to_string(sequence));
+      request.set_location("load generator");
+      return OrganicDumpProtoMessage{request};
+    }
+    case SET_SCHEDULE:
+    {
+      organicdump_proto::SetIrrigationSchedule request;
+      request.set_irrigation_system_id(FLAGS_irrigation_system_id);
+
+      organicdump_proto::DailySchedule *schedule = request.add_daily_schedules();
+      schedule->set_day_of_week_index(static_cast<uint32_t>(sequence % 7));
+      schedule->set_water_time_military("0630");
+      schedule->set_water_duration_ms(1000);
+      return OrganicDumpProtoMessage{request};
+    }
+    case MEASUREMENT:
+    default:
+    {
+      organicdump_proto::SendSoilMoistureMeasurement request;
+      request.set_sensor_id(FLAGS_sensor_id);
+      request.set_value(static_cast<float>(sequence % 1000) / 10.0f);
+      return OrganicDumpProtoMessage{request};
+    }
+  }
+}
+
+RequestKind Worker::PickRequestKind()
+{
+  std::uniform_int_distribution<int> distribution{
+      0,
+      FLAGS_measurement_weight + FLAGS_register_rpi_weight + FLAGS_set_schedule_weight - 1};
+  int pick = distribution(random_);
+
+  if (pick < FLAGS_measurement_weight)
+  {
+    return MEASUREMENT;
+  }
+
+  pick -= FLAGS_measurement_weight;
+  return (pick < FLAGS_register_rpi_weight) ? REGISTER_RPI : SET_SCHEDULE;
+}
+
+void Worker::Poll(int timeout_ms)
+{
+  size_t ready_count = 0;
+  if (!reactor_.Wait(timeout_ms, &ready_count))
+  {
+    LOG(ERROR) << "Failed to wait for socket events";
+    return;
+  }
+
+  for (size_t i = 0; i < ready_count; ++i)
+  {
+    const struct epoll_event &event = reactor_.GetReadyEvent(i);
+    int fd = event.data.fd;
+
+    if (handshakes_.count(fd))
+    {
+      ContinueHandshake(fd, event.events);
+    }
+    else if (connections_.count(fd))
+    {
+      ProcessConnection(fd, event.events);
+    }
+  }
+}
+
+void Worker::ProcessConnection(int fd, uint32_t events)
+{
+  Connection *connection = &connections_.at(fd);
+
+  if (events & EPOLLERR)
+  {
+    DropConnection(fd);
+    return;
+  }
+
+  if ((events & EPOLLOUT) && !FlushConnection(connection))
+  {
+    DropConnection(fd);
+    return;
+  }
+
+  if (!(events & (EPOLLIN | EPOLLRDHUP)))
+  {
+    return;
+  }
+
+  std::vector<OrganicDumpProtoMessage> msgs;
+  bool cxn_closed = false;
+  bool is_read = connection->client.ReadMessages(&msgs, &cxn_closed);
+  Clock::time_point now = Clock::now();
+
+  for (const OrganicDumpProtoMessage &msg : msgs)
+  {
+    if (msg.type != MessageType::BASIC_RESPONSE)
+    {
+      continue;
+    }
+
+    if (connection->in_flight.empty())
+    {
+      LOG(ERROR) << "Received a response with no request outstanding";
+      continue;
+    }
+
+    PendingRequest request = connection->in_flight.front();
+    connection->in_flight.pop_front();
+
+    result_->latencies_ns[request.kind].push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - request.due).count());
+    ++progress_->completed;
+
+    if (msg.basic_response.code() != ErrorCode::OK)
+    {
+      ++result_->error_responses;
+    }
+  }
+
+  if (!is_read || cxn_closed)
+  {
+    DropConnection(fd);
+  }
+}
+
+bool Worker::FlushConnection(Connection *connection)
+{
+  bool cxn_closed = false;
+  return connection->client.Flush(&cxn_closed);
+}
+
+void Worker::DropConnection(int fd)
+{
+  auto it = connections_.find(fd);
+  assert(it != connections_.end());
+
+  LOG_EVERY_N(ERROR, FAILURE_LOG_INTERVAL)
+      << "Connection closed with " << it->second.in_flight.size()
+      << " request(s) outstanding";
+
+  result_->lost += it->second.in_flight.size();
+  reactor_.Remove(fd);
+  connections_.erase(it);
+
+  auto ready_it = std::find(ready_fds_.begin(), ready_fds_.end(), fd);
+  if (ready_it != ready_fds_.end())
+  {
+    ready_fds_.erase(ready_it);
+    --progress_->connected;
+  }
+}
+
+size_t Worker::GetInFlightCount() const
+{
+  size_t count = 0;
+  for (const auto &entry : connections_)
+  {
+    count += entry.second.in_flight.size();
+  }
+  return count;
+}
+
+double ToMs(int64_t ns)
+{
+  return static_cast<double>(ns) / 1e6;
+}
+
+/** Sorts |latencies_ns| and logs its percentiles. */
+void ReportLatencies(const char *name, std::vector<int64_t> *latencies_ns)
+{
+  if (latencies_ns->empty())
+  {
+    return;
+  }
+
+  std::sort(latencies_ns->begin(), latencies_ns->end());
+
+  auto percentile = [latencies_ns](double p)
+  {
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * latencies_ns->size()));
+    return (*latencies_ns)[std::max<size_t>(rank, 1) - 1];
+  };
+
+  LOG(INFO) << name << ": n=" << latencies_ns->size()
+            << ", p50=" << ToMs(percentile(50)) << "ms"
+            << ", p99=" << ToMs(percentile(99)) << "ms"
+            << ", p999=" << ToMs(percentile(99.9)) << "ms"
+            << ", max=" << ToMs(latencies_ns->back()) << "ms";
+}
+
+/** Every connection holds a socket, so lift the soft fd limit to the hard one. */
+void RaiseFdLimit()
+{
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+  {
+    LOG(ERROR) << "Failed to query RLIMIT_NOFILE";
+    return;
+  }
+
+  limit.rlim_cur = limit.rlim_max;
+  if (setrlimit(RLIMIT_NOFILE, &limit) != 0)
+  {
+    LOG(ERROR) << "Failed to raise RLIMIT_NOFILE to " << limit.rlim_max;
+  }
+}
+
+bool CheckFlags()
+{
+  if (FLAGS_port <= 0)
+  {
+    LOG(ERROR) << "--port must be set";
+    return false;
+  }
+
+  if (FLAGS_connections <= 0 || FLAGS_threads <= 0 || FLAGS_rate <= 0 || FLAGS_duration_s <= 0)
+  {
+    LOG(ERROR) << "--connections, --threads, --rate and --duration_s must be positive";
+    return false;
+  }
+
+  if (FLAGS_measurement_weight < 0 || FLAGS_register_rpi_weight < 0 ||
+      FLAGS_set_schedule_weight < 0 ||
+      FLAGS_measurement_weight + FLAGS_register_rpi_weight + FLAGS_set_schedule_weight == 0)
+  {
+    LOG(ERROR) << "Request weights must not be negative and must not all be zero";
+    return false;
+  }
+
+  return true;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv)
+{
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  FLAGS_logtostderr = 1;
+  google::InitGoogleLogging(argv[0]);
+
+  SSL_library_init();
+  OpenSSL_add_all_algorithms();
+  SSL_load_error_strings();
+
+  // A connection the server resets mid-write must fail, not kill the run
+  signal(SIGPIPE, SIG_IGN);
+
+  if (!CheckFlags())
+  {
+    return EXIT_FAILURE;
+  }
+
+  RaiseFdLimit();
+
+  struct sockaddr_in server;
+  memset(&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_port = htons(static_cast<uint16_t>(FLAGS_port));
+  if (inet_pton(AF_INET, FLAGS_host.c_str(), &server.sin_addr) != 1)
+  {
+    LOG(ERROR) << "--host must be an IPv4 address: " << FLAGS_host;
+    return EXIT_FAILURE;
+  }
+
+  auto context = std::make_shared<TlsContext>();
+  if (!TlsContext::CreateClient(FLAGS_cert, FLAGS_key, FLAGS_ca, context.get()))
+  {
+    LOG(ERROR) << "Failed to create TLS context";
+    return EXIT_FAILURE;
+  }
+
+  // Keeps RegisterRpi names unique across runs
+  std::string run_tag = std::to_string(getpid()) + "-" + std::to_string(
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count());
+
+  size_t thread_count = std::min(FLAGS_threads, FLAGS_connections);
+  FLAGS_threads = static_cast<int32_t>(thread_count);
+
+  Progress progress;
+  std::promise<Clock::time_point> start_promise;
+  std::shared_future<Clock::time_point> start = start_promise.get_future().share();
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<WorkerResult> results(thread_count);
+  std::vector<std::thread> threads;
+
+  size_t next_connection = 0;
+  for (size_t i = 0; i < thread_count; ++i)
+  {
+    size_t share = FLAGS_connections / thread_count + (i < FLAGS_connections % thread_count ? 1 : 0);
+    workers.push_back(std::make_unique<Worker>(
+        i,
+        share,
+        static_cast<uint32_t>(FLAGS_client_id_base + next_connection),
+        run_tag,
+        context,
+        server,
+        start,
+        &progress));
+    next_connection += share;
+  }
+
+  LOG(INFO) << "Opening " << FLAGS_connections << " connection(s) on "
+            << thread_count << " thread(s)";
+
+  for (size_t i = 0; i < thread_count; ++i)
+  {
+    threads.emplace_back(&Worker::Run, workers[i].get(), &results[i]);
+  }
+
+  while (progress.ready_workers.load() < thread_count)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds{10});
+  }
+
+  LOG(INFO) << progress.connected.load() << "/" << FLAGS_connections
+            << " connection(s) established. Sending " << FLAGS_rate << " request(s)/s for "
+            << FLAGS_duration_s << "s";
+
+  Clock::time_point start_time = Clock::now();
+  start_promise.set_value(start_time);
+
+  while (progress.finished_workers.load() < thread_count)
+  {
+    std::this_thread::sleep_for(PROGRESS_INTERVAL);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - start_time);
+    uint64_t sent = progress.sent.load();
+    uint64_t completed = progress.completed.load();
+    LOG(INFO) << elapsed.count() << "s: sent=" << sent << ", completed=" << completed
+              << ", outstanding=" << sent - completed
+              << ", connections=" << progress.connected.load();
+  }
+
+  for (std::thread &thread : threads)
+  {
+    thread.join();
+  }
+
+  WorkerResult total;
+  std::vector<int64_t> all_latencies_ns;
+  for (WorkerResult &result : results)
+  {
+    total.sent += result.sent;
+    total.error_responses += result.error_responses;
+    total.lost += result.lost;
+    total.max_send_lag = std::max(total.max_send_lag, result.max_send_lag);
+
+    for (size_t kind = 0; kind < REQUEST_KIND_COUNT; ++kind)
+    {
+      std::vector<int64_t> &latencies = result.latencies_ns[kind];
+      all_latencies_ns.insert(all_latencies_ns.end(), latencies.begin(), latencies.end());
+      total.latencies_ns[kind].insert(
+          total.latencies_ns[kind].end(),
+          latencies.begin(),
+          latencies.end());
+    }
+  }
+
+  double duration_s = FLAGS_duration_s;
+  LOG(INFO) << "Sent " << total.sent << " request(s): "
+            << total.sent / duration_s << "/s against " << FLAGS_rate << "/s offered";
+  LOG(INFO) << "Completed " << all_latencies_ns.size() << " request(s): "
+            << all_latencies_ns.size() / duration_s << "/s, "
+            << total.error_responses << " error response(s), "
+            << total.lost << " lost";
+  LOG(INFO) << "Max send lag: "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(total.max_send_lag).count()
+            << "ms. Latencies include it; if it is large, add --threads";
+
+  for (size_t kind = 0; kind < REQUEST_KIND_COUNT; ++kind)
+  {
+    ReportLatencies(ToString(static_cast<RequestKind>(kind)), &total.latencies_ns[kind]);
+  }
+  ReportLatencies("All", &all_latencies_ns);
+
+  return progress.connected.load() > 0 || total.sent > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
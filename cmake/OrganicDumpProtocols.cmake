@@ -0,0 +1,81 @@
+# organic-dump-protocols is built from a sibling checkout with no releases to
+# pin, so the revision the server needs is pinned by content instead: every
+# message, enum value and field the server handles beyond the original
+# protocol is required below, and a checkout that lacks one fails here
+# rather than deep in the compile. README.md lists the same requirements.
+
+set(ORGANICDUMP_PROTOCOLS_DIR
+  "${CMAKE_CURRENT_SOURCE_DIR}/../../organic-dump-protocols/repo"
+  CACHE PATH "Checkout of organic-dump-protocols to build against")
+
+file(GLOB_RECURSE ORGANICDUMP_PROTO_FILES "${ORGANICDUMP_PROTOCOLS_DIR}/organic_dump.proto")
+file(GLOB_RECURSE ORGANICDUMP_PROTO_MESSAGE_FILES "${ORGANICDUMP_PROTOCOLS_DIR}/OrganicDumpProtoMessage.h")
+
+if(ORGANICDUMP_PROTO_FILES AND ORGANICDUMP_PROTO_MESSAGE_FILES)
+  list(GET ORGANICDUMP_PROTO_FILES 0 ORGANICDUMP_PROTO_FILE)
+  list(GET ORGANICDUMP_PROTO_MESSAGE_FILES 0 ORGANICDUMP_PROTO_MESSAGE_FILE)
+  file(READ "${ORGANICDUMP_PROTO_FILE}" ORGANICDUMP_PROTO_TEXT)
+  file(READ "${ORGANICDUMP_PROTO_MESSAGE_FILE}" ORGANICDUMP_PROTO_MESSAGE_TEXT)
+else()
+  message(WARNING "organic_dump.proto or OrganicDumpProtoMessage.h not found under "
+    "${ORGANICDUMP_PROTOCOLS_DIR}, so the protocol revision can't be checked")
+endif()
+
+function(organicdump_protocol_missing what)
+  message(SEND_ERROR "organic-dump-protocols at ${ORGANICDUMP_PROTOCOLS_DIR} is too old: "
+    "${what} is missing. See \"Protocol revision\" in README.md")
+endfunction()
+
+# Requires MessageType or another enum in organic_dump.proto to declare |value|
+function(organicdump_require_proto_enum_value value)
+  if(DEFINED ORGANICDUMP_PROTO_TEXT AND
+     NOT ORGANICDUMP_PROTO_TEXT MATCHES "[ \t\r\n]${value}[ \t]*=")
+    organicdump_protocol_missing("enum value ${value}")
+  endif()
+endfunction()
+
+# Requires |message| in organic_dump.proto to declare each field in ARGN
+function(organicdump_require_proto_message message)
+  if(NOT DEFINED ORGANICDUMP_PROTO_TEXT)
+    return()
+  endif()
+
+  string(REGEX MATCH "message[ \t\r\n]+${message}[ \t\r\n]*{[^}]*}" body "${ORGANICDUMP_PROTO_TEXT}")
+  if(NOT body)
+    organicdump_protocol_missing("message ${message}")
+    return()
+  endif()
+
+  foreach(field ${ARGN})
+    if(NOT body MATCHES "[ \t\r\n]${field}[ \t]*=")
+      organicdump_protocol_missing("field ${message}.${field}")
+    endif()
+  endforeach()
+endfunction()
+
+# Requires OrganicDumpProtoMessage to carry a |member| for its message type
+function(organicdump_require_proto_message_member member)
+  if(DEFINED ORGANICDUMP_PROTO_MESSAGE_TEXT AND
+     NOT ORGANICDUMP_PROTO_MESSAGE_TEXT MATCHES "[ \t*&]${member}[ \t]*;")
+    organicdump_protocol_missing("OrganicDumpProtoMessage::${member}")
+  endif()
+endfunction()
+
+# GET_SOIL_MOISTURE_HISTORY, answered from SensorHistoryCache
+organicdump_require_proto_enum_value(GET_SOIL_MOISTURE_HISTORY)
+organicdump_require_proto_enum_value(SOIL_MOISTURE_HISTORY)
+organicdump_require_proto_message(GetSoilMoistureHistory sensor_id max_readings window_seconds)
+organicdump_require_proto_message(SoilMoistureHistory code sensor_id time_ms value)
+organicdump_require_proto_message_member(get_soil_moisture_history)
+organicdump_require_proto_message_member(soil_moisture_history)
+
+# SEND_SOIL_MOISTURE_MEASUREMENTS, the bulk counterpart of
+# SEND_SOIL_MOISTURE_MEASUREMENT
+organicdump_require_proto_enum_value(SEND_SOIL_MOISTURE_MEASUREMENTS)
+organicdump_require_proto_message(SendSoilMoistureMeasurements sensor_id value time_ms)
+organicdump_require_proto_message_member(send_soil_moisture_measurements)
+
+# HEARTBEAT, which keeps idle connections from being reaped
+organicdump_require_proto_enum_value(HEARTBEAT)
+organicdump_require_proto_message(Heartbeat)
+organicdump_require_proto_message_member(heartbeat)
@@ -29,13 +29,54 @@ CREATE TABLE soil_moisture_sensors (
   ceiling FLOAT NOT NULL,
   floor FLOAT NOT NULL);
 
+-- time_ms is UTC epoch milliseconds. seq is 0 for readings the client
+-- timestamped and tells apart readings the server stamped in the same
+-- millisecond. Partitioned tables cannot carry foreign keys, so the server
+-- checks sensor_id against its registry of soil_moisture_sensors instead. The server adds upcoming monthly partitions at startup and
+-- hourly after by splitting p_future.
 CREATE TABLE soil_moisture_readings (
-  id INT AUTO_INCREMENT,
-  PRIMARY KEY(id),
-  time VARCHAR(32) NOT NULL,
+  sensor_id INT NOT NULL,
+  time_ms BIGINT NOT NULL,
+  seq INT UNSIGNED NOT NULL DEFAULT 0,
   reading FLOAT NOT NULL,
+  PRIMARY KEY(sensor_id, time_ms, seq))
+PARTITION BY RANGE (time_ms) (
+  PARTITION p_history VALUES LESS THAN (1790812800000), -- 2026-10-01
+  PARTITION p_future VALUES LESS THAN MAXVALUE);
+
+-- Per-sensor aggregates of soil_moisture_readings. bucket_ms is the UTC epoch
+-- millisecond at which the bucket starts. The server rebuilds the buckets of
+-- new readings; these outlive pruned raw readings.
+CREATE TABLE soil_moisture_rollups_1m (
   sensor_id INT NOT NULL,
-  FOREIGN KEY(sensor_id) REFERENCES soil_moisture_sensors(peripheral_id));
+  bucket_ms BIGINT NOT NULL,
+  min_reading FLOAT NOT NULL,
+  max_reading FLOAT NOT NULL,
+  mean_reading DOUBLE NOT NULL,
+  reading_count INT UNSIGNED NOT NULL,
+  PRIMARY KEY(sensor_id, bucket_ms));
+
+CREATE TABLE soil_moisture_rollups_1h LIKE soil_moisture_rollups_1m;
+
+CREATE TABLE soil_moisture_rollups_1d LIKE soil_moisture_rollups_1m;
+
+-- Hours of each sensor whose rollups are older than its readings. Written in
+-- the same transaction as the readings and deleted once the rollups of the
+-- hour are rebuilt, so no stale hour is forgotten across restarts.
+CREATE TABLE soil_moisture_stale_rollups (
+  sensor_id INT NOT NULL,
+  hour_ms BIGINT NOT NULL,
+  PRIMARY KEY(sensor_id, hour_ms));
+
+-- Raw readings before pruned_before_ms may have been pruned, so the server
+-- keeps the 1-minute rollups of those minutes instead of rebuilding them.
+-- Raised before each prune deletes anything; prunes cut on hour boundaries.
+CREATE TABLE soil_moisture_prune_watermark (
+  id TINYINT NOT NULL,
+  pruned_before_ms BIGINT NOT NULL,
+  PRIMARY KEY(id));
+
+INSERT INTO soil_moisture_prune_watermark VALUES (0, 0);
 
 CREATE TABLE irrigation_systems (
   peripheral_id INT NOT NULL,
@@ -0,0 +1,16 @@
+-- Adds soil_moisture_prune_watermark from create-tables.sql. Earlier servers
+-- pruned at any millisecond, so the hour of the oldest reading may be partly
+-- pruned; the watermark starts after it, and the rollups of older minutes
+-- are kept as they are from then on. Run this while the server is stopped.
+USE plantsandthings;
+
+CREATE TABLE soil_moisture_prune_watermark (
+  id TINYINT NOT NULL,
+  pruned_before_ms BIGINT NOT NULL,
+  PRIMARY KEY(id));
+
+INSERT INTO soil_moisture_prune_watermark
+SELECT 0, COALESCE(MIN(time_ms) - MOD(MIN(time_ms), 3600000) + 3600000, 0)
+FROM soil_moisture_readings;
+
+SELECT * FROM soil_moisture_prune_watermark;
@@ -0,0 +1,24 @@
+-- Moves soil_moisture_readings to the time-series layout in create-tables.sql.
+--
+-- The old table is kept as soil_moisture_readings_legacy. Copy its rows with
+-- tools/backfill_soil_moisture_readings, then drop it once the counts match.
+-- Run this while the server is stopped; the server refuses to start until
+-- the new table exists.
+USE plantsandthings;
+
+RENAME TABLE soil_moisture_readings TO soil_moisture_readings_legacy;
+
+-- The old foreign key to soil_moisture_sensors can't be kept on a
+-- partitioned table; the server rejects readings of unregistered sensors.
+
+CREATE TABLE soil_moisture_readings (
+  sensor_id INT NOT NULL,
+  time_ms BIGINT NOT NULL,
+  seq INT UNSIGNED NOT NULL DEFAULT 0,
+  reading FLOAT NOT NULL,
+  PRIMARY KEY(sensor_id, time_ms, seq))
+PARTITION BY RANGE (time_ms) (
+  PARTITION p_history VALUES LESS THAN (1790812800000), -- 2026-10-01
+  PARTITION p_future VALUES LESS THAN MAXVALUE);
+
+SHOW CREATE TABLE soil_moisture_readings;
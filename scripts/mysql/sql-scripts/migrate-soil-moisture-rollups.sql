@@ -0,0 +1,51 @@
+-- Adds the soil moisture rollup tables from create-tables.sql, including the
+-- stale hours table, and fills them from the readings already stored. The
+-- server keeps them current from then on. Run this while the server is
+-- stopped.
+USE plantsandthings;
+
+CREATE TABLE soil_moisture_rollups_1m (
+  sensor_id INT NOT NULL,
+  bucket_ms BIGINT NOT NULL,
+  min_reading FLOAT NOT NULL,
+  max_reading FLOAT NOT NULL,
+  mean_reading DOUBLE NOT NULL,
+  reading_count INT UNSIGNED NOT NULL,
+  PRIMARY KEY(sensor_id, bucket_ms));
+
+CREATE TABLE soil_moisture_rollups_1h LIKE soil_moisture_rollups_1m;
+
+CREATE TABLE soil_moisture_rollups_1d LIKE soil_moisture_rollups_1m;
+
+-- Hours of each sensor whose rollups are older than its readings. Written in
+-- the same transaction as the readings and deleted once the rollups of the
+-- hour are rebuilt, so no stale hour is forgotten across restarts.
+CREATE TABLE soil_moisture_stale_rollups (
+  sensor_id INT NOT NULL,
+  hour_ms BIGINT NOT NULL,
+  PRIMARY KEY(sensor_id, hour_ms));
+
+-- Each level is built from the one below it
+INSERT INTO soil_moisture_rollups_1m
+SELECT sensor_id, time_ms - MOD(time_ms, 60000),
+       MIN(reading), MAX(reading), AVG(reading), COUNT(*)
+FROM soil_moisture_readings
+GROUP BY sensor_id, time_ms - MOD(time_ms, 60000);
+
+INSERT INTO soil_moisture_rollups_1h
+SELECT sensor_id, bucket_ms - MOD(bucket_ms, 3600000),
+       MIN(min_reading), MAX(max_reading),
+       SUM(mean_reading * reading_count) / SUM(reading_count), SUM(reading_count)
+FROM soil_moisture_rollups_1m
+GROUP BY sensor_id, bucket_ms - MOD(bucket_ms, 3600000);
+
+INSERT INTO soil_moisture_rollups_1d
+SELECT sensor_id, bucket_ms - MOD(bucket_ms, 86400000),
+       MIN(min_reading), MAX(max_reading),
+       SUM(mean_reading * reading_count) / SUM(reading_count), SUM(reading_count)
+FROM soil_moisture_rollups_1h
+GROUP BY sensor_id, bucket_ms - MOD(bucket_ms, 86400000);
+
+SELECT COUNT(*) FROM soil_moisture_rollups_1m;
+SELECT COUNT(*) FROM soil_moisture_rollups_1h;
+SELECT COUNT(*) FROM soil_moisture_rollups_1d;
@@ -0,0 +1,98 @@
+#include "AcceptRateLimiter.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <mutex>
+
+namespace
+{
+constexpr std::chrono::seconds MIN_SWEEP_INTERVAL{1};
+} // namespace
+
+namespace organicdump
+{
+
+AcceptRateLimiter::AcceptRateLimiter() : AcceptRateLimiter{0, 0, 0} {}
+
+AcceptRateLimiter::AcceptRateLimiter(
+    double rate_per_second,
+    double burst,
+    size_t max_sources)
+  : rate_per_second_{rate_per_second},
+    burst_{std::max(burst, 1.0)},
+    max_sources_{max_sources},
+    mutex_{},
+    buckets_{},
+    last_sweep_{} {}
+
+bool AcceptRateLimiter::Admit(uint32_t address, Clock::time_point now)
+{
+  if (rate_per_second_ <= 0)
+  {
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock{mutex_};
+
+  auto it = buckets_.find(address);
+  if (it == buckets_.end())
+  {
+    if (buckets_.size() >= max_sources_)
+    {
+      ForgetFullBuckets(now);
+      if (buckets_.size() >= max_sources_)
+      {
+        return false;
+      }
+    }
+
+    it = buckets_.emplace(address, Bucket{burst_, now}).first;
+  }
+
+  Bucket *bucket = &it->second;
+  Refill(bucket, now);
+
+  if (bucket->tokens < 1.0)
+  {
+    return false;
+  }
+
+  bucket->tokens -= 1.0;
+  return true;
+}
+
+void AcceptRateLimiter::Refill(Bucket *bucket, Clock::time_point now) const
+{
+  assert(bucket);
+
+  std::chrono::duration<double> elapsed = now - bucket->updated;
+  if (elapsed.count() <= 0)
+  {
+    return;
+  }
+
+  bucket->tokens = std::min(burst_, bucket->tokens + elapsed.count() * rate_per_second_);
+  bucket->updated = now;
+}
+
+void AcceptRateLimiter::ForgetFullBuckets(Clock::time_point now)
+{
+  if (now - last_sweep_ < MIN_SWEEP_INTERVAL)
+  {
+    return;
+  }
+
+  last_sweep_ = now;
+
+  // A full bucket behaves exactly like a missing one
+  for (auto it = buckets_.begin(); it != buckets_.end();)
+  {
+    Refill(&it->second, now);
+    it = (it->second.tokens >= burst_) ? buckets_.erase(it) : std::next(it);
+  }
+}
+
+} // namespace organicdump
@@ -0,0 +1,72 @@
+#ifndef ORGANICDUMP_SERVER_ACCEPTRATELIMITER_H
+#define ORGANICDUMP_SERVER_ACCEPTRATELIMITER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace organicdump
+{
+
+/**
+ * Per-source-address token buckets that bound how fast one peer may open
+ * connections. Each address may open |burst| connections at once and then
+ * |rate_per_second| per second. A rate of zero admits everything.
+ *
+ * Buckets that have refilled are forgotten, so the table only holds peers
+ * that connected recently. If it still reaches |max_sources| connections
+ * from further addresses are refused until it drains.
+ *
+ * One limiter is shared by every reactor, so a peer's rate holds however
+ * the kernel spreads its connections across them. Safe to call from any
+ * thread.
+ */
+class AcceptRateLimiter
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+public:
+  AcceptRateLimiter();
+  AcceptRateLimiter(
+      double rate_per_second,
+      double burst,
+      size_t max_sources);
+
+  /** Takes a token for |address| if one is available. */
+  bool Admit(uint32_t address, Clock::time_point now);
+
+private:
+  struct Bucket
+  {
+    double tokens;
+    Clock::time_point updated;
+  };
+
+private:
+  void Refill(Bucket *bucket, Clock::time_point now) const;
+  void ForgetFullBuckets(Clock::time_point now);
+
+private:
+  AcceptRateLimiter(const AcceptRateLimiter &other) = delete;
+  AcceptRateLimiter &operator=(const AcceptRateLimiter &other) = delete;
+
+private:
+  double rate_per_second_;
+  double burst_;
+  size_t max_sources_;
+
+  // Guards the buckets and |last_sweep_|
+  std::mutex mutex_;
+  std::unordered_map<uint32_t, Bucket> buckets_;
+
+  // Sweeps are rate limited too, or a flood of new addresses would make
+  // every accept walk the whole table.
+  Clock::time_point last_sweep_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_ACCEPTRATELIMITER_H
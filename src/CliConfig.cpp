@@ -1,5 +1,6 @@
 #include "CliConfig.h"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <utility>
@@ -32,15 +33,91 @@ bool CheckFileExists(const char *param, const std::string &file_name)
     return true;
 }
 
+bool CheckPositive(const char *param, int32_t value)
+{
+    if (value <= 0)
+    {
+        LOG(ERROR) << "--" << param << " must be positive";
+        return false;
+    }
+    return true;
+}
+
+bool CheckNonNegative(const char *param, int32_t value)
+{
+    if (value < 0)
+    {
+        LOG(ERROR) << "--" << param << " must not be negative";
+        return false;
+    }
+    return true;
+}
+
+bool CheckStorageEngine(const char *param, const std::string &engine)
+{
+    if (engine != "mysql" && engine != "memory" && engine != "sqlite")
+    {
+        LOG(ERROR) << "--" << param << " must be mysql, memory or sqlite: " << engine;
+        return false;
+    }
+    return true;
+}
+
 DEFINE_int32(port, BAD_PORT, "Port");
 DEFINE_string(cert, "", "Certificate file");
 DEFINE_string(key, "", "Private key file");
 DEFINE_string(ca, "", "CA file");
+DEFINE_int32(reactor_threads, 1, "Number of reactor threads sharing the port via SO_REUSEPORT");
+DEFINE_int32(handshake_timeout_ms, 10000, "Deadline for a new connection to finish its TLS handshake");
+DEFINE_int32(hello_timeout_ms, 10000, "Deadline for a connection to send HELLO once its TLS handshake completes");
+DEFINE_int32(max_pending_connections, 1024, "Connections per reactor that may be handshaking or awaiting HELLO at once. Further connections are reset on accept");
+DEFINE_int32(accept_rate_per_ip, 10, "Connections per second one source address may open after its burst. 0 disables the limit");
+DEFINE_int32(accept_burst_per_ip, 20, "Connections one source address may open at once");
+DEFINE_int32(idle_timeout_ms, 90000, "Silence after which a connection is presumed dead and closed. Clients keep idle connections alive with HEARTBEAT");
+DEFINE_int32(write_high_water_bytes, 256 * 1024, "Queued outbound bytes at which a client's reads are paused");
+DEFINE_int32(write_kick_bytes, 4 * 1024 * 1024, "Queued outbound bytes at which a client is kicked");
+DEFINE_int32(measurement_batch_size, 256, "Soil moisture measurements per group-committed insert");
+DEFINE_int32(measurement_flush_ms, 20, "Longest a soil moisture measurement waits for its batch to commit");
+DEFINE_int32(rollup_interval_ms, 10000, "How often new soil moisture readings are folded into the rollup tables");
+DEFINE_int32(raw_retention_days, 0, "Age after which raw soil moisture readings are pruned. 0 keeps them forever");
+DEFINE_int32(history_readings_per_sensor, 1024, "Recent soil moisture readings kept in memory per sensor for history queries");
+DEFINE_string(measurement_wal_dir, "", "Directory of the local measurement log that buffers writes to MySQL. Empty disables it");
+DEFINE_string(storage, "mysql", "Storage engine: mysql, sqlite for a single local file, or memory to keep everything in process and lose it on exit");
+DEFINE_string(sqlite_path, "organicdump.db", "Database file of the sqlite storage engine. Created if missing");
+DEFINE_int32(db_threads, 4, "Database worker threads");
+DEFINE_string(db_url, "mysqlx://trevor@localhost", "MySQL X Protocol URL");
+DEFINE_string(db_name, "plantsandthings", "MySQL schema");
+DEFINE_int32(db_pool_min_sessions, 2, "MySQL sessions opened at startup");
+DEFINE_int32(db_pool_max_sessions, 8, "Most MySQL sessions open at once");
+DEFINE_int32(db_idle_ping_ms, 30000, "Idle time after which a MySQL session is pinged before reuse");
+DEFINE_int32(db_checkout_timeout_ms, 5000, "Longest a query waits for a free MySQL session");
+DEFINE_int32(metrics_port, 0, "Loopback port serving Prometheus metrics over plaintext HTTP at /metrics. 0 disables it");
 
 DEFINE_validator(port, FailBadPort);
 DEFINE_validator(cert, CheckFileExists);
 DEFINE_validator(key, CheckFileExists);
 DEFINE_validator(ca, CheckFileExists);
+DEFINE_validator(reactor_threads, CheckPositive);
+DEFINE_validator(handshake_timeout_ms, CheckPositive);
+DEFINE_validator(idle_timeout_ms, CheckPositive);
+DEFINE_validator(hello_timeout_ms, CheckPositive);
+DEFINE_validator(max_pending_connections, CheckPositive);
+DEFINE_validator(accept_rate_per_ip, CheckNonNegative);
+DEFINE_validator(accept_burst_per_ip, CheckPositive);
+DEFINE_validator(write_high_water_bytes, CheckPositive);
+DEFINE_validator(write_kick_bytes, CheckPositive);
+DEFINE_validator(measurement_batch_size, CheckPositive);
+DEFINE_validator(measurement_flush_ms, CheckPositive);
+DEFINE_validator(history_readings_per_sensor, CheckPositive);
+DEFINE_validator(rollup_interval_ms, CheckPositive);
+DEFINE_validator(raw_retention_days, CheckNonNegative);
+DEFINE_validator(storage, CheckStorageEngine);
+DEFINE_validator(db_threads, CheckPositive);
+DEFINE_validator(db_pool_min_sessions, CheckNonNegative);
+DEFINE_validator(db_pool_max_sessions, CheckPositive);
+DEFINE_validator(db_idle_ping_ms, CheckPositive);
+DEFINE_validator(db_checkout_timeout_ms, CheckPositive);
+DEFINE_validator(metrics_port, CheckNonNegative);
 } // namespace
 
 namespace organicdump
@@ -59,10 +136,45 @@ bool CliConfig::Parse(int argc, char **argv, CliConfig *out_config)
       FLAGS_cert,
       FLAGS_key,
       FLAGS_ca};
+
+  // Tuning knobs
+  out_config->reactor_threads_ = static_cast<size_t>(FLAGS_reactor_threads);
+  out_config->handshake_timeout_ = std::chrono::milliseconds{FLAGS_handshake_timeout_ms};
+  out_config->idle_timeout_ = std::chrono::milliseconds{FLAGS_idle_timeout_ms};
+  out_config->hello_timeout_ = std::chrono::milliseconds{FLAGS_hello_timeout_ms};
+  out_config->max_pending_connections_ = static_cast<size_t>(FLAGS_max_pending_connections);
+  out_config->accept_rate_per_ip_ = static_cast<double>(FLAGS_accept_rate_per_ip);
+  out_config->accept_burst_per_ip_ = static_cast<size_t>(FLAGS_accept_burst_per_ip);
+  out_config->write_high_water_bytes_ = static_cast<size_t>(FLAGS_write_high_water_bytes);
+  out_config->write_kick_bytes_ = static_cast<size_t>(FLAGS_write_kick_bytes);
+  out_config->measurement_batch_size_ = static_cast<size_t>(FLAGS_measurement_batch_size);
+  out_config->measurement_flush_delay_ = std::chrono::milliseconds{FLAGS_measurement_flush_ms};
+  out_config->measurement_wal_dir_ = FLAGS_measurement_wal_dir;
+  out_config->history_readings_per_sensor_ = static_cast<size_t>(FLAGS_history_readings_per_sensor);
+  out_config->rollup_interval_ = std::chrono::milliseconds{FLAGS_rollup_interval_ms};
+  out_config->raw_retention_ = std::chrono::hours{24 * FLAGS_raw_retention_days};
+  out_config->storage_engine_ = FLAGS_storage;
+  out_config->sqlite_path_ = FLAGS_sqlite_path;
+  out_config->db_threads_ = static_cast<size_t>(FLAGS_db_threads);
+  out_config->db_url_ = FLAGS_db_url;
+  out_config->db_name_ = FLAGS_db_name;
+  if (FLAGS_db_pool_min_sessions > FLAGS_db_pool_max_sessions)
+  {
+    LOG(ERROR) << "--db_pool_min_sessions (" << FLAGS_db_pool_min_sessions
+               << ") must not exceed --db_pool_max_sessions ("
+               << FLAGS_db_pool_max_sessions << ")";
+    return false;
+  }
+
+  out_config->db_pool_min_sessions_ = static_cast<size_t>(FLAGS_db_pool_min_sessions);
+  out_config->db_pool_max_sessions_ = static_cast<size_t>(FLAGS_db_pool_max_sessions);
+  out_config->db_idle_ping_interval_ = std::chrono::milliseconds{FLAGS_db_idle_ping_ms};
+  out_config->db_checkout_timeout_ = std::chrono::milliseconds{FLAGS_db_checkout_timeout_ms};
+  out_config->metrics_port_ = FLAGS_metrics_port;
   return true; 
 }
 
-CliConfig::CliConfig() {}
+CliConfig::CliConfig() : CliConfig{BAD_PORT, "", "", ""} {}
 
 CliConfig::CliConfig(
     int32_t port,
@@ -72,7 +184,32 @@ CliConfig::CliConfig(
   : port_{port},
     cert_file_{std::move(cert_file)},
     key_file_{std::move(key_file)},
-    ca_file_{std::move(ca_file)}
+    ca_file_{std::move(ca_file)},
+    reactor_threads_{1},
+    handshake_timeout_{0},
+    idle_timeout_{0},
+    hello_timeout_{0},
+    max_pending_connections_{1},
+    accept_rate_per_ip_{0},
+    accept_burst_per_ip_{1},
+    write_high_water_bytes_{0},
+    write_kick_bytes_{0},
+    measurement_batch_size_{1},
+    measurement_flush_delay_{0},
+    measurement_wal_dir_{},
+    history_readings_per_sensor_{1},
+    rollup_interval_{0},
+    raw_retention_{0},
+    storage_engine_{},
+    sqlite_path_{},
+    db_threads_{1},
+    db_url_{},
+    db_name_{},
+    db_pool_min_sessions_{0},
+    db_pool_max_sessions_{1},
+    db_idle_ping_interval_{0},
+    db_checkout_timeout_{0},
+    metrics_port_{0}
 {}
 
 int32_t CliConfig::GetPort() const
@@ -95,5 +232,130 @@ const std::string& CliConfig::GetCaFile() const
     return ca_file_;
 }
 
+size_t CliConfig::GetReactorThreads() const
+{
+    return reactor_threads_;
+}
+
+std::chrono::milliseconds CliConfig::GetHandshakeTimeout() const
+{
+    return handshake_timeout_;
+}
+
+std::chrono::milliseconds CliConfig::GetIdleTimeout() const
+{
+    return idle_timeout_;
+}
+
+std::chrono::milliseconds CliConfig::GetHelloTimeout() const
+{
+    return hello_timeout_;
+}
+
+size_t CliConfig::GetMaxPendingConnections() const
+{
+    return max_pending_connections_;
+}
+
+double CliConfig::GetAcceptRatePerIp() const
+{
+    return accept_rate_per_ip_;
+}
+
+size_t CliConfig::GetAcceptBurstPerIp() const
+{
+    return accept_burst_per_ip_;
+}
+
+size_t CliConfig::GetWriteHighWaterBytes() const
+{
+    return write_high_water_bytes_;
+}
+
+size_t CliConfig::GetWriteKickBytes() const
+{
+    return write_kick_bytes_;
+}
+
+size_t CliConfig::GetMeasurementBatchSize() const
+{
+    return measurement_batch_size_;
+}
+
+std::chrono::milliseconds CliConfig::GetMeasurementFlushDelay() const
+{
+    return measurement_flush_delay_;
+}
+
+const std::string& CliConfig::GetMeasurementWalDir() const
+{
+    return measurement_wal_dir_;
+}
+
+size_t CliConfig::GetHistoryReadingsPerSensor() const
+{
+    return history_readings_per_sensor_;
+}
+
+std::chrono::milliseconds CliConfig::GetRollupInterval() const
+{
+    return rollup_interval_;
+}
+
+std::chrono::hours CliConfig::GetRawRetention() const
+{
+    return raw_retention_;
+}
+
+const std::string& CliConfig::GetStorageEngine() const
+{
+    return storage_engine_;
+}
+
+const std::string& CliConfig::GetSqlitePath() const
+{
+    return sqlite_path_;
+}
+
+size_t CliConfig::GetDbThreads() const
+{
+    return db_threads_;
+}
+
+const std::string& CliConfig::GetDbUrl() const
+{
+    return db_url_;
+}
+
+const std::string& CliConfig::GetDbName() const
+{
+    return db_name_;
+}
+
+size_t CliConfig::GetDbPoolMinSessions() const
+{
+    return db_pool_min_sessions_;
+}
+
+size_t CliConfig::GetDbPoolMaxSessions() const
+{
+    return db_pool_max_sessions_;
+}
+
+std::chrono::milliseconds CliConfig::GetDbIdlePingInterval() const
+{
+    return db_idle_ping_interval_;
+}
+
+std::chrono::milliseconds CliConfig::GetDbCheckoutTimeout() const
+{
+    return db_checkout_timeout_;
+}
+
+int32_t CliConfig::GetMetricsPort() const
+{
+    return metrics_port_;
+}
+
 }; // namespace organicdump
 
@@ -1,7 +1,10 @@
 #ifndef ORGANICDUMP_CLICONFIG_H
 #define ORGANICDUMP_CLICONFIG_H
 
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <string>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -26,12 +29,68 @@ public:
   const std::string& GetCertFile() const;
   const std::string& GetKeyFile() const;
   const std::string& GetCaFile() const;
+  size_t GetReactorThreads() const;
+  std::chrono::milliseconds GetHandshakeTimeout() const;
+  std::chrono::milliseconds GetIdleTimeout() const;
+  std::chrono::milliseconds GetHelloTimeout() const;
+  size_t GetMaxPendingConnections() const;
+  double GetAcceptRatePerIp() const;
+  size_t GetAcceptBurstPerIp() const;
+  size_t GetWriteHighWaterBytes() const;
+  size_t GetWriteKickBytes() const;
+  size_t GetMeasurementBatchSize() const;
+  std::chrono::milliseconds GetMeasurementFlushDelay() const;
+  const std::string& GetMeasurementWalDir() const;
+  size_t GetHistoryReadingsPerSensor() const;
+  std::chrono::milliseconds GetRollupInterval() const;
+
+  /** Zero means raw readings are never pruned. */
+  std::chrono::hours GetRawRetention() const;
+
+  /** "mysql", "memory" or "sqlite". */
+  const std::string& GetStorageEngine() const;
+  const std::string& GetSqlitePath() const;
+  size_t GetDbThreads() const;
+  const std::string& GetDbUrl() const;
+  const std::string& GetDbName() const;
+  size_t GetDbPoolMinSessions() const;
+  size_t GetDbPoolMaxSessions() const;
+  std::chrono::milliseconds GetDbIdlePingInterval() const;
+  std::chrono::milliseconds GetDbCheckoutTimeout() const;
+
+  /** Zero disables the metrics endpoint. */
+  int32_t GetMetricsPort() const;
 
 private:
   int32_t port_;
   std::string cert_file_;
   std::string key_file_;
   std::string ca_file_;
+  size_t reactor_threads_;
+  std::chrono::milliseconds handshake_timeout_;
+  std::chrono::milliseconds idle_timeout_;
+  std::chrono::milliseconds hello_timeout_;
+  size_t max_pending_connections_;
+  double accept_rate_per_ip_;
+  size_t accept_burst_per_ip_;
+  size_t write_high_water_bytes_;
+  size_t write_kick_bytes_;
+  size_t measurement_batch_size_;
+  std::chrono::milliseconds measurement_flush_delay_;
+  std::string measurement_wal_dir_;
+  size_t history_readings_per_sensor_;
+  std::chrono::milliseconds rollup_interval_;
+  std::chrono::hours raw_retention_;
+  std::string storage_engine_;
+  std::string sqlite_path_;
+  size_t db_threads_;
+  std::string db_url_;
+  std::string db_name_;
+  size_t db_pool_min_sessions_;
+  size_t db_pool_max_sessions_;
+  std::chrono::milliseconds db_idle_ping_interval_;
+  std::chrono::milliseconds db_checkout_timeout_;
+  int32_t metrics_port_;
 };
 
 }; // namespace organicdump
@@ -0,0 +1,108 @@
+#include "ClientDirectory.h"
+
+#include <cassert>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "organic_dump.pb.h"
+
+#include "ClientStore.h"
+#include "ProtobufClient.h"
+
+namespace organicdump
+{
+
+ClientDirectory::ClientDirectory() {}
+
+void ClientDirectory::Register(
+    organicdump_proto::ClientType type,
+    size_t id,
+    Entry entry)
+{
+  assert(entry.completions);
+  assert(entry.clients);
+
+  std::unique_lock<std::shared_mutex> lock{mutex_};
+  entries_[type][id] = std::move(entry);
+}
+
+void ClientDirectory::Unregister(
+    organicdump_proto::ClientType type,
+    size_t id,
+    const ClientStore *clients,
+    uint64_t serial)
+{
+  std::unique_lock<std::shared_mutex> lock{mutex_};
+
+  auto type_it = entries_.find(type);
+  if (type_it == entries_.end())
+  {
+    return;
+  }
+
+  // A reconnect may already have replaced the entry
+  auto it = type_it->second.find(id);
+  if (it != type_it->second.end() &&
+      it->second.clients == clients &&
+      it->second.serial == serial)
+  {
+    type_it->second.erase(it);
+  }
+}
+
+bool ClientDirectory::Find(
+    organicdump_proto::ClientType type,
+    size_t id,
+    Entry *out_entry) const
+{
+  assert(out_entry);
+
+  std::shared_lock<std::shared_mutex> lock{mutex_};
+
+  auto type_it = entries_.find(type);
+  if (type_it == entries_.end())
+  {
+    return false;
+  }
+
+  auto it = type_it->second.find(id);
+  if (it == type_it->second.end())
+  {
+    return false;
+  }
+
+  *out_entry = it->second;
+  return true;
+}
+
+bool ClientDirectory::Post(
+    organicdump_proto::ClientType type,
+    size_t id,
+    std::function<void(ProtobufClient *client)> work) const
+{
+  Entry entry;
+  if (!Find(type, id, &entry))
+  {
+    return false;
+  }
+
+  entry.completions->Post([type, id, entry, work]()
+  {
+    ProtobufClient *client = entry.clients->FindClient(entry.fd, entry.serial);
+    if (!client)
+    {
+      LOG(ERROR) << "Client disconnected before work posted to it could run. Type: "
+                 << organicdump_proto::ClientType_Name(type) << ", ID: " << id;
+      return;
+    }
+
+    work(client);
+  });
+
+  return true;
+}
+
+} // namespace organicdump
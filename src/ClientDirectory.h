@@ -0,0 +1,77 @@
+#ifndef ORGANICDUMP_SERVER_CLIENTDIRECTORY_H
+#define ORGANICDUMP_SERVER_CLIENTDIRECTORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+
+#include "organic_dump.pb.h"
+
+#include "CompletionQueue.h"
+
+namespace organicdump
+{
+
+class ClientStore;
+class ProtobufClient;
+
+/**
+ * Process-wide index of differentiated clients by type and id. Clients live
+ * on whichever reactor accepted them, so an entry names the reactor's
+ * CompletionQueue and ClientStore: work for the client is posted to the
+ * queue and looks the client up in the store once it runs on that reactor.
+ *
+ * Safe to call from any thread.
+ */
+class ClientDirectory
+{
+public:
+  struct Entry
+  {
+    std::shared_ptr<CompletionQueue> completions;
+
+    // Only dereference on the reactor that runs |completions|
+    ClientStore *clients;
+    int fd;
+    uint64_t serial;
+  };
+
+public:
+  ClientDirectory();
+
+  /** A later registration under the same type and id replaces earlier ones. */
+  void Register(organicdump_proto::ClientType type, size_t id, Entry entry);
+
+  /** Only removes the entry if it still refers to |clients| and |serial|. */
+  void Unregister(
+      organicdump_proto::ClientType type,
+      size_t id,
+      const ClientStore *clients,
+      uint64_t serial);
+
+  bool Find(organicdump_proto::ClientType type, size_t id, Entry *out_entry) const;
+
+  /**
+   * Runs |work| on the client's reactor if the client is still connected
+   * once it gets there. False if no such client is registered.
+   */
+  bool Post(
+      organicdump_proto::ClientType type,
+      size_t id,
+      std::function<void(ProtobufClient *client)> work) const;
+
+private:
+  ClientDirectory(const ClientDirectory &other) = delete;
+  ClientDirectory &operator=(const ClientDirectory &other) = delete;
+
+private:
+  mutable std::shared_mutex mutex_;
+  std::unordered_map<int, std::unordered_map<size_t, Entry>> entries_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_CLIENTDIRECTORY_H
@@ -2,8 +2,8 @@
 #define ORGANICDUMP_SERVER_CLIENTHANDLER_H
 
 #include <memory>
-#include <unordered_map>
 
+#include "ClientStore.h"
 #include "ProtobufClient.h"
 #include "OrganicDumpProtoMessage.h"
 
@@ -17,7 +17,18 @@ public:
   virtual bool Handle(
       const OrganicDumpProtoMessage &msg,
       ProtobufClient *client,
-      std::unordered_map<int, ProtobufClient> *clients) = 0;
+      ClientStore *clients) = 0;
+
+  /**
+   * Milliseconds until the handler next needs Poll(), or -1 if it has no
+   * deferred work. Folded into the reactor's wait timeout.
+   */
+  virtual int GetPollTimeoutMs() { return -1; }
+
+  /**
+   * Called once per reactor wakeup to run deferred work that is due.
+   */
+  virtual void Poll(ClientStore * /* clients */) {}
 };
 
 }; // namespace organicdump
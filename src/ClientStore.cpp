@@ -1,19 +1,66 @@
 #include "ClientStore.h"
 
+#include <cassert>
+#include <memory>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include <glog/logging.h>
 
+#include "organic_dump.pb.h"
+
+#include "ClientDirectory.h"
+#include "CompletionQueue.h"
+#include "Metrics.h"
+#include "OrganicDumpProtoMessage.h"
+#include "ProtobufClient.h"
+
 namespace
 {
+using organicdump::Gauge;
+using organicdump::Metrics;
+using organicdump_proto::ClientType;
+
+/** Connected clients of |type| across all reactors. */
+Gauge *GetConnectionGauge(ClientType type)
+{
+  static const std::vector<Gauge *> gauges = []()
+  {
+    std::vector<Gauge *> by_type(organicdump_proto::ClientType_ARRAYSIZE, nullptr);
+    for (int i = 0; i < organicdump_proto::ClientType_ARRAYSIZE; ++i)
+    {
+      if (organicdump_proto::ClientType_IsValid(i))
+      {
+        by_type[i] = Metrics::GetGauge(
+            "organicdump_connections",
+            "Connected clients by type. UNKNOWN clients have not sent HELLO yet.",
+            "client_type",
+            organicdump::ToString(static_cast<ClientType>(i)));
+      }
+    }
+    return by_type;
+  }();
+
+  assert(gauges.at(type));
+  return gauges.at(type);
 }
+} // namespace
 
 namespace organicdump
 {
 
-ClientStore::ClientStore() {}
+ClientStore::ClientStore() : differentiated_count_{0} {}
+
+ClientStore::ClientStore(
+    std::shared_ptr<ClientDirectory> directory,
+    std::shared_ptr<CompletionQueue> completions)
+  : directory_{std::move(directory)},
+    completions_{std::move(completions)},
+    differentiated_count_{0} {}
 
 ClientStore::ClientStore(ClientStore &&other)
+  : differentiated_count_{0}
 {
   StealResources(&other);
 }
@@ -33,70 +80,153 @@ ClientStore::~ClientStore()
   CloseResources();
 }
 
-void ClientStore::Add(ProtobufClient client)
+ProtobufClient *ClientStore::Add(int fd, ProtobufClient client)
 {
-  FdInt fd = static_cast<FdInt>(client.GetFd().Get());
   assert(clients_.count(fd) == 0);
 
-  clients_.emplace(fd, std::move(client));
-  return true;
+  auto result = clients_.emplace(fd, std::move(client));
+  GetConnectionGauge(result.first->second.GetType())->Add(1);
+  return &result.first->second;
 }
 
-bool ClientStore::Remove(FdInt fd)
+void ClientStore::Remove(int fd)
 {
-  assert(clients_.count(fd) != 0);
-  ProtobufClient *client = clients_.at(fd);
+  auto it = clients_.find(fd);
+  assert(it != clients_.end());
 
-  switch (client->GetType())
-  {
-    case organicdump_proto::ClientType::
-  }
-
-  clients_.erase(fd);
-  return true;
+  GetConnectionGauge(it->second.GetType())->Add(-1);
+  Unindex(it->second);
+  clients_.erase(it);
 }
 
 void ClientStore::RemoveAll()
 {
+  for (const auto &entry : clients_)
+  {
+    GetConnectionGauge(entry.second.GetType())->Add(-1);
+    Unindex(entry.second);
+  }
+
   clients_.clear();
-  irrigation_systems_.clear();
+  fds_by_id_.clear();
+  differentiated_count_ = 0;
 }
 
-std::vector<FdInt> GetFds() const
+std::vector<int> ClientStore::GetFds() const
 {
-  // TODO(bozkurtus): this is inefficient but likely good enough
-  std::vector<FdInt> fds;
-  fds.reserve(clients.size());
-  for (const auto& entry : fds)
+  std::vector<int> fds;
+  fds.reserve(clients_.size());
+  for (const auto &entry : clients_)
   {
     fds.push_back(entry.first);
   }
   return fds;
 }
 
-ProtobufClient* ClientStore::GetClient(FdInt fd)
+size_t ClientStore::GetUndifferentiatedCount() const
+{
+  assert(differentiated_count_ <= clients_.size());
+  return clients_.size() - differentiated_count_;
+}
+
+bool ClientStore::Contains(int fd) const
+{
+  return clients_.count(fd) > 0;
+}
+
+ProtobufClient *ClientStore::GetClient(int fd)
+{
+  auto it = clients_.find(fd);
+  return (it == clients_.end()) ? nullptr : &it->second;
+}
+
+ProtobufClient *ClientStore::FindClient(int fd, uint64_t serial)
+{
+  ProtobufClient *client = GetClient(fd);
+  return (client && client->GetSerial() == serial) ? client : nullptr;
+}
+
+ProtobufClient *ClientStore::FindClient(
+    organicdump_proto::ClientType type,
+    size_t id)
 {
-  assert(clients_.count(fd) == 1);
-  return &clients_.at(fd);
+  auto type_it = fds_by_id_.find(type);
+  if (type_it == fds_by_id_.end())
+  {
+    return nullptr;
+  }
+
+  auto it = type_it->second.find(id);
+  return (it == type_it->second.end()) ? nullptr : GetClient(it->second);
 }
 
-ProtobufClient* ClientStore::GetIrrigationSystemClient(IrrigationSystemId id)
+void ClientStore::Differentiate(
+    ProtobufClient *client,
+    organicdump_proto::ClientType type,
+    size_t id)
 {
-  assert(irrigation_systems_.count(id) == 1);
-  FdInt fd = irrigation_systems_.at(id);
+  assert(client);
+  assert(!client->IsDifferentiated());
+  assert(GetClient(client->GetFd()) == client);
+
+  client->Differentiate(type, id);
+  GetConnectionGauge(ClientType::UNKNOWN)->Add(-1);
+  GetConnectionGauge(type)->Add(1);
+  fds_by_id_[type][id] = client->GetFd();
+  ++differentiated_count_;
 
-  assert(clients_.count(fd) == 1);
-  return &clients_.at(fd);
+  if (directory_)
+  {
+    directory_->Register(
+        type,
+        id,
+        ClientDirectory::Entry{completions_, this, client->GetFd(), client->GetSerial()});
+  }
 }
 
-bool ClientStore::HasIrrigationSystemClient(IrrigationSystemId id)
+void ClientStore::Unindex(const ProtobufClient &client)
 {
-  if (irrigation_systems_.count(id) == 0)
+  if (!client.IsDifferentiated())
+  {
+    return;
+  }
+
+  assert(differentiated_count_ > 0);
+  --differentiated_count_;
+
+  auto type_it = fds_by_id_.find(client.GetType());
+  if (type_it != fds_by_id_.end())
+  {
+    // Leave the entry alone if a reconnect has taken it over
+    auto it = type_it->second.find(client.GetId());
+    if (it != type_it->second.end() && it->second == client.GetFd())
+    {
+      type_it->second.erase(it);
+    }
+  }
+
+  if (directory_)
   {
-    return false;
+    directory_->Unregister(client.GetType(), client.GetId(), this, client.GetSerial());
   }
+}
+
+void ClientStore::CloseResources()
+{
+  RemoveAll();
+  directory_.reset();
+  completions_.reset();
+}
+
+void ClientStore::StealResources(ClientStore *other)
+{
+  assert(other);
+
+  // The directory refers to stores by address, so only empty stores move
+  assert(other->clients_.empty());
 
-  return clients_.count(irrigation_systems_.at(id)) == 1;
+  directory_ = std::move(other->directory_);
+  completions_ = std::move(other->completions_);
 }
 
-}  // namespace organicdump
+} // namespace organicdump
@@ -1,38 +1,69 @@
 #ifndef ORGANICDUMP_SERVER_CLIENTSTORE_H
 #define ORGANICDUMP_SERVER_CLIENTSTORE_H
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
-#include <string>
 #include <unordered_map>
+#include <vector>
 
+#include "organic_dump.pb.h"
+
+#include "ClientDirectory.h"
+#include "CompletionQueue.h"
 #include "ProtobufClient.h"
 
 namespace organicdump
 {
 
+/**
+ * The connected clients of one reactor, indexed by fd and, once they have
+ * sent HELLO, by type and id. Differentiated clients are also published to
+ * the shared ClientDirectory so that other reactors can route to them.
+ *
+ * Confined to the reactor's thread.
+ */
 class ClientStore
 {
-public:
-  using FdInt = int;
-  using IrrigationSystemId = int;
-
 public:
   ClientStore();
+  ClientStore(
+      std::shared_ptr<ClientDirectory> directory,
+      std::shared_ptr<CompletionQueue> completions);
   ClientStore(ClientStore &&other);
   ClientStore &operator=(ClientStore &&other);
   ~ClientStore();
 
-  void Add(ProtobufClient client);
-  void Remove(FdInt fd);
+  ProtobufClient *Add(int fd, ProtobufClient client);
+  void Remove(int fd);
   void RemoveAll();
 
-  std::vector<FdInt> GetFds() const;
-  ProtobufClient* GetClient(FdInt fd);
-  ProtobufClient* GetIrrigationSystemClient(IrrigationSystemId id);
-  bool HasIrrigationSystemClient(IrrigationSystemId id);
+  std::vector<int> GetFds() const;
+
+  /** Clients that have not sent HELLO yet. */
+  size_t GetUndifferentiatedCount() const;
+  bool Contains(int fd) const;
+  ProtobufClient *GetClient(int fd);
+
+  /**
+   * Null if the client has disconnected, including when its fd has since
+   * been reused by another connection.
+   */
+  ProtobufClient *FindClient(int fd, uint64_t serial);
+  ProtobufClient *FindClient(organicdump_proto::ClientType type, size_t id);
+
+  /**
+   * Differentiates |client| and indexes it by |type| and |id|. A client that
+   * reconnects under the same type and id takes over the index entry.
+   */
+  void Differentiate(
+      ProtobufClient *client,
+      organicdump_proto::ClientType type,
+      size_t id);
 
 private:
+  void Unindex(const ProtobufClient &client);
+  void CloseResources();
   void StealResources(ClientStore *other);
 
 private:
@@ -40,11 +71,15 @@ private:
   ClientStore &operator=(const ClientStore &other) = delete;
 
 private:
-  std::unordered_map<FdInt, ProfobufClient> clients_;
-  std::unordered_map<IrrigationSystemId, FdInt> irrigation_system_id_to_fd_table_;
-  std::unordered_map<FdInt, IrrigationSystemInt> irrigation_system_fd_to_id_table_;
+  std::shared_ptr<ClientDirectory> directory_;
+  std::shared_ptr<CompletionQueue> completions_;
+  std::unordered_map<int, ProtobufClient> clients_;
+
+  // type -> id -> fd
+  std::unordered_map<int, std::unordered_map<size_t, int>> fds_by_id_;
+  size_t differentiated_count_;
 };
 
-}; // namespace organicdump
+} // namespace organicdump
 
 #endif // ORGANICDUMP_SERVER_CLIENTSTORE_H
@@ -0,0 +1,54 @@
+#include "CompletionQueue.h"
+
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "EventNotifier.h"
+
+namespace organicdump
+{
+
+CompletionQueue::CompletionQueue(EventNotifier notifier)
+  : notifier_{std::move(notifier)},
+    mutex_{},
+    completions_{} {}
+
+int CompletionQueue::GetFd() const
+{
+  return notifier_.GetFd();
+}
+
+void CompletionQueue::Post(Completion completion)
+{
+  bool was_empty = false;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    was_empty = completions_.empty();
+    completions_.push_back(std::move(completion));
+  }
+
+  // A non-empty queue already has a wakeup in flight
+  if (was_empty)
+  {
+    notifier_.Notify();
+  }
+}
+
+void CompletionQueue::RunAll()
+{
+  notifier_.Drain();
+
+  std::vector<Completion> completions;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    completions.swap(completions_);
+  }
+
+  for (Completion &completion : completions)
+  {
+    completion();
+  }
+}
+
+} // namespace organicdump
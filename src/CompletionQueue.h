@@ -0,0 +1,42 @@
+#ifndef ORGANICDUMP_SERVER_COMPLETIONQUEUE_H
+#define ORGANICDUMP_SERVER_COMPLETIONQUEUE_H
+
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "EventNotifier.h"
+
+namespace organicdump
+{
+
+/**
+ * Hands callbacks from other threads (e.g. db workers) back to a reactor.
+ * Post() may be called from any thread; the reactor watches GetFd() and calls
+ * RunAll() on its own thread when it becomes readable.
+ */
+class CompletionQueue
+{
+public:
+  using Completion = std::function<void()>;
+
+public:
+  CompletionQueue(EventNotifier notifier);
+
+  int GetFd() const;
+  void Post(Completion completion);
+  void RunAll();
+
+private:
+  CompletionQueue(const CompletionQueue &other) = delete;
+  CompletionQueue &operator=(const CompletionQueue &other) = delete;
+
+private:
+  EventNotifier notifier_;
+  std::mutex mutex_;
+  std::vector<Completion> completions_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_COMPLETIONQUEUE_H
@@ -1,13 +1,29 @@
 #include "ControlClientHandler.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
 #include <memory>
+#include <set>
+#include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <mysqlx/xdevapi.h>
 
+#include "CompletionQueue.h"
+#include "DbExecutor.h"
+#include "HotLog.h"
+#include "IrrigationScheduler.h"
+#include "MeasurementBatcher.h"
+#include "Metrics.h"
 #include "ProtobufClient.h"
 #include "OrganicDumpProtoMessage.h"
+#include "SensorHistoryCache.h"
 #include "SqlUtils.h"
 
 #define UNUSED(x) (void)(x)
@@ -20,33 +36,132 @@ using organicdump_proto::ErrorCode;
 using organicdump_proto::MessageType;
 using organicdump_proto::RegisterRpi;
 
-using ClientMap = std::unordered_map<int, organicdump::ProtobufClient>;
+using organicdump::ClientStore;
+using organicdump::LatencyHistogram;
+using organicdump::Metrics;
+
+// Caps a history response well below MAX_FRAME_BODY_SIZE
+constexpr size_t MAX_HISTORY_READINGS = 10000;
+
+// Caps the readings in one SendSoilMoistureMeasurements
+constexpr size_t MAX_BULK_MEASUREMENTS = 10000;
+
+// Caps the schedules in one SetIrrigationSchedule at one a minute all week
+constexpr int MAX_DAILY_SCHEDULES = 7 * 24 * 60;
+
+// How far ahead of the server's clock a client may timestamp a reading.
+// Further out is a broken clock, and would land past retention and the
+// partitions prepared so far.
+constexpr int64_t MAX_MEASUREMENT_CLOCK_SKEW_MS = 60 * 60 * 1000;
+
+// How long a control client waits for an irrigation system to acknowledge
+// an unscheduled irrigation request before it is told the request failed
+constexpr std::chrono::seconds IRRIGATION_ACK_TIMEOUT{10};
+
+// Executor shard that runs every registry change, whichever connection
+// sent it
+constexpr size_t REGISTRY_SHARD = 0;
+
+// Measurement errors recur per batch, so each is logged at most this often
+constexpr int64_t ERROR_LOG_INTERVAL_MS = 1000;
+
+int64_t NowMs()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Time the reactor spends in Handle() per request type. Registered on first
+ * use so that types no control client sends don't clutter the scrape.
+ */
+LatencyHistogram *GetHandleLatency(MessageType type)
+{
+  static std::array<std::atomic<LatencyHistogram *>, organicdump_proto::MessageType_ARRAYSIZE>
+      histograms{};
+
+  assert(type >= 0 && type < organicdump_proto::MessageType_ARRAYSIZE);
+  LatencyHistogram *histogram = histograms[type].load(std::memory_order_acquire);
+  if (!histogram)
+  {
+    // Reactors racing here get the same histogram from the registry
+    histogram = Metrics::GetHistogram(
+        "organicdump_control_handle_seconds",
+        "Time a reactor spends handling a control request, by message type. Database "
+        "work is handed off, so see organicdump_db_seconds for the rest",
+        "type",
+        organicdump::ToString(type));
+    histograms[type].store(histogram, std::memory_order_release);
+  }
+  return histogram;
+}
 
 } // namespace
 
 namespace organicdump
 {
 
-bool ControlClientHandler::Create(ControlClientHandler *out_handler)
+bool ControlClientHandler::Create(
+    std::shared_ptr<DbExecutor> db_executor,
+    std::shared_ptr<CompletionQueue> completions,
+    std::shared_ptr<MeasurementLog> measurement_log,
+    std::shared_ptr<SensorHistoryCache> history,
+    std::shared_ptr<ClientDirectory> directory,
+    std::shared_ptr<IrrigationScheduler> scheduler,
+    size_t measurement_batch_size,
+    std::chrono::milliseconds measurement_flush_delay,
+    std::chrono::hours raw_retention,
+    ControlClientHandler *out_handler)
 {
+  assert(db_executor);
+  assert(completions);
+  assert(history);
+  assert(directory);
+  assert(scheduler);
   assert(out_handler);
 
-  DbManager db;
-  if (!DbManager::Create(&db))
+  std::vector<MeasurementBatcher> measurement_batchers;
+  for (size_t i = 0; i < db_executor->GetShardCount(); ++i)
   {
-    LOG(ERROR) << "Failed to create DbManager";
-    return false;
+    measurement_batchers.emplace_back(
+        measurement_batch_size,
+        measurement_flush_delay);
   }
 
-  *out_handler = ControlClientHandler{std::move(db)};
+  *out_handler = ControlClientHandler{
+      std::move(db_executor),
+      std::move(completions),
+      std::move(measurement_log),
+      std::move(history),
+      std::move(directory),
+      std::move(scheduler),
+      std::move(measurement_batchers),
+      raw_retention};
   return true;
 }
 
-ControlClientHandler::ControlClientHandler() : is_initialized_{false} {}
-
-ControlClientHandler::ControlClientHandler(DbManager db)
+ControlClientHandler::ControlClientHandler()
+  : is_initialized_{false},
+    raw_retention_{0} {}
+
+ControlClientHandler::ControlClientHandler(
+    std::shared_ptr<DbExecutor> db_executor,
+    std::shared_ptr<CompletionQueue> completions,
+    std::shared_ptr<MeasurementLog> measurement_log,
+    std::shared_ptr<SensorHistoryCache> history,
+    std::shared_ptr<ClientDirectory> directory,
+    std::shared_ptr<IrrigationScheduler> scheduler,
+    std::vector<MeasurementBatcher> measurement_batchers,
+    std::chrono::hours raw_retention)
   : is_initialized_{true},
-    db_{std::move(db)} {}
+    db_executor_{std::move(db_executor)},
+    completions_{std::move(completions)},
+    measurement_log_{std::move(measurement_log)},
+    history_{std::move(history)},
+    directory_{std::move(directory)},
+    scheduler_{std::move(scheduler)},
+    measurement_batchers_{std::move(measurement_batchers)},
+    raw_retention_{raw_retention} {}
 
 ControlClientHandler::ControlClientHandler(ControlClientHandler &&other)
 {
@@ -67,26 +182,62 @@ ControlClientHandler &ControlClientHandler::operator=(ControlClientHandler &&oth
 bool ControlClientHandler::Handle(
     const OrganicDumpProtoMessage &msg,
     ProtobufClient *client,
-    ClientMap *all_clients)
+    ClientStore *all_clients)
 {
   assert(client);
   assert(all_clients);
   assert(client->IsDifferentiated());
   assert(client->GetType() == ClientType::CONTROL);
 
+  LatencyTimer timer{GetHandleLatency(msg.type)};
+
+  // Submit buffered measurements ahead of anything else on this client's
+  // shard so that responses reach the client in request order.
+  size_t shard = db_executor_->GetShard(client->GetSerial());
+  if (msg.type != MessageType::SEND_SOIL_MOISTURE_MEASUREMENT &&
+      !measurement_batchers_[shard].IsEmpty())
+  {
+    FlushMeasurements(shard, all_clients);
+  }
+
   switch (msg.type) {
     case MessageType::REGISTER_RPI:
-      return RegisterRpi(msg.register_rpi, client);
+      return RegisterRpi(msg.register_rpi, client, all_clients);
     case MessageType::REGISTER_SOIL_MOISTURE_SENSOR:
-      return RegisterSoilMoistureSensor(msg.register_soil_moisture_sensor, client);
+      return RegisterSoilMoistureSensor(
+            msg.register_soil_moisture_sensor,
+            client,
+            all_clients);
     case MessageType::UPDATE_PERIPHERAL_OWNERSHIP:
-      return UpdatePeripheralOwnership(msg.update_peripheral_ownership, client);
+      return UpdatePeripheralOwnership(
+            msg.update_peripheral_ownership,
+            client,
+            all_clients);
     case MessageType::SEND_SOIL_MOISTURE_MEASUREMENT:
-      return StoreSoilMoistureMeasurement(msg.send_soil_moisture_measurement, client);
+      return StoreSoilMoistureMeasurement(
+            msg.send_soil_moisture_measurement,
+            client,
+            all_clients);
+    case MessageType::SEND_SOIL_MOISTURE_MEASUREMENTS:
+      return StoreSoilMoistureMeasurements(
+            msg.send_soil_moisture_measurements,
+            client,
+            all_clients);
+    case MessageType::GET_SOIL_MOISTURE_HISTORY:
+      return GetSoilMoistureHistory(
+            msg.get_soil_moisture_history,
+            client,
+            all_clients);
     case MessageType::REGISTER_IRRIGATION_SYSTEM:
-      return RegisterIrrigationSystem(msg.register_irrigation_system, client);
+      return RegisterIrrigationSystem(
+            msg.register_irrigation_system,
+            client,
+            all_clients);
     case MessageType::SET_IRRIGATION_SCHEDULE:
-      return SetIrrigationSchedule(msg.set_irrigation_schedule, client);
+      return SetIrrigationSchedule(
+            msg.set_irrigation_schedule,
+            client,
+            all_clients);
     case MessageType::UNSCHEDULED_IRRIGATION_REQUEST:
       return HandleUnscheduledIrrigationRequest(
             msg.unscheduled_irrigation_request,
@@ -98,10 +249,78 @@ bool ControlClientHandler::Handle(
   }
 }
 
+int ControlClientHandler::GetPollTimeoutMs()
+{
+  int timeout_ms = -1;
+  for (const MeasurementBatcher &batcher : measurement_batchers_)
+  {
+    int batcher_timeout_ms = batcher.GetTimeoutMs();
+    if (batcher_timeout_ms >= 0 &&
+        (timeout_ms < 0 || batcher_timeout_ms < timeout_ms))
+    {
+      timeout_ms = batcher_timeout_ms;
+    }
+  }
+
+  if (!pending_irrigation_acks_.empty())
+  {
+    auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+        pending_irrigation_acks_.front().deadline - std::chrono::steady_clock::now());
+    int ack_timeout_ms = static_cast<int>(std::max<int64_t>(remaining.count(), 0));
+    if (timeout_ms < 0 || ack_timeout_ms < timeout_ms)
+    {
+      timeout_ms = ack_timeout_ms;
+    }
+  }
+
+  return timeout_ms;
+}
+
+void ControlClientHandler::Poll(ClientStore *all_clients)
+{
+  assert(all_clients);
+
+  for (size_t shard = 0; shard < measurement_batchers_.size(); ++shard)
+  {
+    if (measurement_batchers_[shard].IsDue())
+    {
+      FlushMeasurements(shard, all_clients);
+    }
+  }
+
+  // Deadlines are pushed in order since they share one timeout
+  auto now = std::chrono::steady_clock::now();
+  while (!pending_irrigation_acks_.empty() &&
+         (pending_irrigation_acks_.front().ack->is_answered ||
+          pending_irrigation_acks_.front().deadline <= now))
+  {
+    std::shared_ptr<IrrigationAck> ack = std::move(pending_irrigation_acks_.front().ack);
+    pending_irrigation_acks_.pop_front();
+
+    if (!ack->is_answered)
+    {
+      LOG(ERROR) << "Irrigation system " << ack->irrigation_system_id
+                 << " did not acknowledge unscheduled irrigation request in time";
+
+      BasicResponse resp;
+      resp.set_code(ErrorCode::INTERNAL_SERVER_ERROR);
+      resp.set_message("Irrigation system did not acknowledge the request");
+      AnswerIrrigationRequest(resp, ack.get());
+    }
+  }
+}
+
 void ControlClientHandler::CloseResources()
 {
   is_initialized_ = false;
-  db_ = DbManager{};
+  db_executor_.reset();
+  completions_.reset();
+  measurement_log_.reset();
+  history_.reset();
+  directory_.reset();
+  scheduler_.reset();
+  measurement_batchers_.clear();
+  pending_irrigation_acks_.clear();
 }
 
 void ControlClientHandler::StealResources(ControlClientHandler *other)
@@ -109,247 +328,731 @@ void ControlClientHandler::StealResources(ControlClientHandler *other)
   assert(other);
   is_initialized_ = other->is_initialized_;
   other->is_initialized_ = false;
-  db_ = std::move(other->db_);
+  db_executor_ = std::move(other->db_executor_);
+  completions_ = std::move(other->completions_);
+  measurement_log_ = std::move(other->measurement_log_);
+  history_ = std::move(other->history_);
+  directory_ = std::move(other->directory_);
+  scheduler_ = std::move(other->scheduler_);
+  measurement_batchers_ = std::move(other->measurement_batchers_);
+  raw_retention_ = other->raw_retention_;
+  pending_irrigation_acks_ = std::move(other->pending_irrigation_acks_);
 }
 
-bool ControlClientHandler::RegisterRpi(
-    const organicdump_proto::RegisterRpi &msg,
-    ProtobufClient *client)
+void ControlClientHandler::SubmitDbWork(
+    ProtobufClient *client,
+    ClientStore *all_clients,
+    DbWork work)
 {
-  UNUSED(client);
+  assert(client);
+  SubmitDbWork(
+      db_executor_->GetShard(client->GetSerial()),
+      client,
+      all_clients,
+      std::move(work));
+}
 
-  if (db_.ContainsRpi(msg.name()))
-  {
-    LOG(ERROR) << "RPi already exists with name: " << msg.name();
+void ControlClientHandler::SubmitRegistryWork(
+    ProtobufClient *client,
+    ClientStore *all_clients,
+    DbWork work)
+{
+  SubmitDbWork(REGISTRY_SHARD, client, all_clients, std::move(work));
+}
 
-    return SendFailedBasicResponse(
-        ErrorCode::INVALID_PARAMETER,
-        "RPi with that name already exists",
-        client);
-  }
+void ControlClientHandler::SubmitDbWork(
+    size_t shard,
+    ProtobufClient *client,
+    ClientStore *all_clients,
+    DbWork work)
+{
+  assert(client);
+  assert(all_clients);
 
-  size_t id; 
-  if (!db_.InsertRpi(
-        msg.name(),
-        msg.location(),
-        &id))
-  {
-    LOG(ERROR) << "Failed to insert RPi record";
+  int fd = client->GetFd();
+  uint64_t serial = client->GetSerial();
+  uint64_t slot = client->AddPendingReply();
+  std::shared_ptr<CompletionQueue> completions = completions_;
+
+  // Neither job nor completion may capture |this|: the handler only lives as
+  // long as its reactor, while the executor is shared by all of them.
+  db_executor_->Submit(
+      shard,
+      [fd, serial, slot, all_clients, completions, work](DbManager *db)
+      {
+        auto reply = std::make_shared<DbReply>();
+        work(db, reply.get());
+
+        completions->Post([fd, serial, slot, all_clients, reply]()
+        {
+          ProtobufClient *client = all_clients->FindClient(fd, serial);
+          if (!client)
+          {
+            return;
+          }
+
+          client->CompletePendingReply(slot, [reply](ProtobufClient *client)
+          {
+            if (reply->has_response &&
+                !SendBasicResponse(reply->response, client))
+            {
+              LOG(ERROR) << "Failed to send basic response to client";
+            }
+
+            if (reply->has_history &&
+                !SendSoilMoistureHistory(reply->history, client))
+            {
+              LOG(ERROR) << "Failed to send soil moisture history to client";
+            }
+
+            if (!reply->keep_connection)
+            {
+              client->RequestClose();
+            }
+          });
+        });
+      });
+}
+
+bool ControlClientHandler::RejectRequest(
+    ErrorCode code,
+    const std::string &message,
+    ProtobufClient *client,
+    ClientStore *all_clients)
+{
+  assert(client);
+  assert(all_clients);
 
-    SendFailedBasicResponse(
-        ErrorCode::INTERNAL_SERVER_ERROR,
-        "Failed to insert RPi record",
-        client);
+  DbReply reply;
+  SetFailedBasicResponse(code, message, &reply);
 
-    return false;
+  if (!client->HasPendingReplies())
+  {
+    return SendBasicResponse(reply.response, client);
   }
 
-  LOG(INFO) << "Registered RPi with ID: " << id;
+  SubmitDbWork(
+      client,
+      all_clients,
+      [reply](DbManager * /* db */, DbReply *out_reply)
+      {
+        *out_reply = reply;
+      });
+
+  return true;
+}
 
-  if (!SendSuccessfulBasicResponse(id, client))
+bool ControlClientHandler::RegisterRpi(
+    const organicdump_proto::RegisterRpi &msg,
+    ProtobufClient *client,
+    ClientStore *all_clients)
+{
+  SubmitRegistryWork(client, all_clients, [msg](DbManager *db, DbReply *reply)
   {
-    LOG(ERROR) << "Failed to send basic response with rpi id: " << id;
-    return false;
-  }
+    if (db->ContainsRpi(msg.name()))
+    {
+      LOG(ERROR) << "RPi already exists with name: " << msg.name();
+
+      SetFailedBasicResponse(
+          ErrorCode::INVALID_PARAMETER,
+          "RPi with that name already exists",
+          reply);
+      return;
+    }
+
+    size_t id;
+    if (!db->InsertRpi(
+          msg.name(),
+          msg.location(),
+          &id))
+    {
+      LOG(ERROR) << "Failed to insert RPi record";
+
+      SetFailedBasicResponse(
+          ErrorCode::INTERNAL_SERVER_ERROR,
+          "Failed to insert RPi record",
+          reply);
+      reply->keep_connection = false;
+      return;
+    }
+
+    LOG(INFO) << "Registered RPi with ID: " << id;
+
+    SetSuccessfulBasicResponse(id, reply);
+  });
 
   return true;
 }
 
 bool ControlClientHandler::RegisterSoilMoistureSensor(
     const organicdump_proto::RegisterSoilMoistureSensor &msg,
-    ProtobufClient *client)
+    ProtobufClient *client,
+    ClientStore *all_clients)
 {
-  UNUSED(client);
+  SubmitRegistryWork(client, all_clients, [msg](DbManager *db, DbReply *reply)
+  {
+    if (msg.meta().has_rpi_id() && !db->ContainsRpi(msg.meta().rpi_id())) {
+      LOG(ERROR) << "RPI does not exist. ID: " << msg.meta().rpi_id();
+      reply->keep_connection = false;
+      return;
+    }
 
-  if (msg.meta().has_rpi_id() && !db_.ContainsRpi(msg.meta().rpi_id())) {
-    LOG(ERROR) << "RPI does not exist. ID: " << msg.meta().rpi_id();
-    return false;
-  }
+    if (db->ContainsPeripheral(msg.meta().name())) {
+      LOG(ERROR) << "Peripheral already exists with name: " << msg.meta().name();
 
-  if (db_.ContainsPeripheral(msg.meta().name())) {
-    LOG(ERROR) << "Peripheral already exists with name: " << msg.meta().name();
-    return false;
-  }
+      SetFailedBasicResponse(
+          ErrorCode::INVALID_PARAMETER,
+          "Peripheral with that name already exists",
+          reply);
+      return;
+    }
 
-  size_t id;
-  if (!db_.InsertSoilMoistureSensor(
-          msg.meta().name(),
-          msg.floor(),
-          msg.ceil(),
-          &id)) {
-    LOG(ERROR) << "Failed to insert soil moisture sensor";
-    return false;
-  }
+    size_t id;
+    if (!db->InsertSoilMoistureSensor(
+            msg.meta().name(),
+            msg.floor(),
+            msg.ceil(),
+            &id)) {
+      LOG(ERROR) << "Failed to insert soil moisture sensor";
+      reply->keep_connection = false;
+      return;
+    }
 
-  LOG(INFO) << "Registered soil moisture sensor with ID: " << id;
+    LOG(INFO) << "Registered soil moisture sensor with ID: " << id;
 
-  if (!SendSuccessfulBasicResponse(id, client))
-  {
-    LOG(ERROR) << "Failed to send successful response to client.";
-    return false;
-  }
+    SetSuccessfulBasicResponse(id, reply);
+  });
 
   return true;
 }
 
 bool ControlClientHandler::UpdatePeripheralOwnership(
     const organicdump_proto::UpdatePeripheralOwnership &msg,
-    ProtobufClient *client)
-
+    ProtobufClient *client,
+    ClientStore *all_clients)
 {
-  UNUSED(client);
-
   LOG(INFO) << "Updating peripheral ownership: "
             << "rpi_id=" << msg.rpi_id() << ", "
             << "peripheral_id=" << msg.peripheral_id();
 
-  // Ensure RPI and peripheral both exist
-  if (!db_.ContainsRpi(msg.rpi_id()))
+  SubmitRegistryWork(client, all_clients, [msg](DbManager *db, DbReply *reply)
   {
-    LOG(ERROR) << "No RPI exists with id=" << msg.rpi_id();
-    return false;
-  }
+    // Ensure RPI and peripheral both exist
+    if (!db->ContainsRpi(msg.rpi_id()))
+    {
+      LOG(ERROR) << "No RPI exists with id=" << msg.rpi_id();
+      reply->keep_connection = false;
+      return;
+    }
 
-  if (!db_.ContainsPeripheral(msg.peripheral_id()))
-  {
-    LOG(ERROR) << "No peripheral exists with id=" << msg.peripheral_id();
-    return false;
-  }
+    if (!db->ContainsPeripheral(msg.peripheral_id()))
+    {
+      LOG(ERROR) << "No peripheral exists with id=" << msg.peripheral_id();
+      reply->keep_connection = false;
+      return;
+    }
 
-  // Remove current association record if it exists. If the request does not represent a
-  // delete operation, add the new entry.
-  db_.OrphanRpiOwnedPeripheral(msg.peripheral_id());
+    // Remove current association record if it exists. If the request does not represent a
+    // delete operation, add the new entry.
+    db->OrphanRpiOwnedPeripheral(msg.peripheral_id());
 
-  // This request asks to delete the association, resulting in an orphaned peripheral
-  if (msg.orphan_peripheral()) {
-    return true;
-  }
+    // This request asks to delete the association, resulting in an orphaned peripheral
+    if (msg.orphan_peripheral()) {
+      return;
+    }
 
-  if (!db_.AssignPeripheralToRpi(msg.rpi_id(), msg.peripheral_id()))
-  {
-    LOG(ERROR) << "Failed to reparent peripheral";
-  }
+    if (!db->AssignPeripheralToRpi(msg.rpi_id(), msg.peripheral_id()))
+    {
+      LOG(ERROR) << "Failed to reparent peripheral";
+    }
 
-  if (!SendSuccessfulBasicResponse(client))
-  {
-    LOG(ERROR) << "Failed to send basic response to client";
-    return false;
-  }
+    SetSuccessfulBasicResponse(reply);
+  });
 
   return true;
 }
 
 bool ControlClientHandler::StoreSoilMoistureMeasurement(
       const organicdump_proto::SendSoilMoistureMeasurement &msg,
-      ProtobufClient *client)
+      ProtobufClient *client,
+      ClientStore *all_clients)
 {
   assert(client);
+  assert(all_clients);
 
-  size_t measurement_id;
+  // Checked here rather than at commit, so that one bad sensor id can't
+  // fail the batch it would share with other clients' readings
+  if (!db_executor_->GetDb()->ContainsSoilMoistureSensor(msg.sensor_id()))
+  {
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Soil moisture measurement for unknown sensor: sensor_id="
+        << msg.sensor_id();
 
-  if (!db_.InsertSoilMoistureMeasurement(
+    return RejectRequest(
+        ErrorCode::INVALID_PARAMETER,
+        "Unknown soil moisture sensor",
+        client,
+        all_clients);
+  }
+
+  // The client is acknowledged once the batch holding this measurement has
+  // been committed.
+  size_t shard = db_executor_->GetShard(client->GetSerial());
+  MeasurementBatcher *batcher = &measurement_batchers_[shard];
+  batcher->Add(
+      MeasurementBatcher::Sender{
+          client->GetFd(),
+          client->GetSerial(),
+          client->AddPendingReply()},
+      SoilMoistureMeasurement{
           msg.sensor_id(),
           msg.value(),
-          &measurement_id))
+          NowMs(),
+          NextSoilMoistureReadingSeq()});
+
+  if (batcher->IsDue())
   {
-    LOG(ERROR) << "Failed to insert soil moisture measurement"
-               << ". Id: " << msg.sensor_id()
-               << ". Measurement: " << msg.value();
-    return false;
+    FlushMeasurements(shard, all_clients);
+  }
+
+  return true;
+}
+
+bool ControlClientHandler::StoreSoilMoistureMeasurements(
+    const organicdump_proto::SendSoilMoistureMeasurements &msg,
+    ProtobufClient *client,
+    ClientStore *all_clients)
+{
+  assert(client);
+  assert(all_clients);
+
+  size_t count = static_cast<size_t>(msg.sensor_id_size());
+  bool has_times = msg.time_ms_size() > 0;
+
+  if (count == 0 ||
+      count > MAX_BULK_MEASUREMENTS ||
+      static_cast<size_t>(msg.value_size()) != count ||
+      (has_times && static_cast<size_t>(msg.time_ms_size()) != count))
+  {
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Malformed soil moisture measurement batch: sensor_ids="
+        << msg.sensor_id_size() << ", time_ms=" << msg.time_ms_size()
+        << ", values=" << msg.value_size();
+
+    return RejectRequest(
+        ErrorCode::INVALID_PARAMETER,
+        "Malformed soil moisture measurement batch",
+        client,
+        all_clients);
   }
 
-  if (!SendSuccessfulBasicResponse(measurement_id, client))
+  // A reading older than raw retention could land in an hour whose raw
+  // readings are pruned, and refreshing that hour's rollups from the rest
+  // would overwrite them
+  int64_t now_ms = NowMs();
+  int64_t oldest_ms = std::max<int64_t>(0, GetRawRetentionCutoffMs(now_ms, raw_retention_));
+  for (int i = 0; has_times && i < msg.time_ms_size(); ++i)
   {
-    LOG(ERROR) << "Failed to send basic response to client";
-    return false;
+    if (msg.time_ms(i) < oldest_ms || msg.time_ms(i) > now_ms + MAX_MEASUREMENT_CLOCK_SKEW_MS)
+    {
+      HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+          << "Soil moisture measurement time out of range: sensor_id="
+          << msg.sensor_id(i) << ", time_ms=" << msg.time_ms(i)
+          << ", now_ms=" << now_ms;
+
+      return RejectRequest(
+          ErrorCode::INVALID_PARAMETER,
+          "Soil moisture measurement time out of range",
+          client,
+          all_clients);
+    }
   }
 
+  DbManager *db = db_executor_->GetDb();
+  for (int i = 0; i < msg.sensor_id_size(); ++i)
+  {
+    if (!db->ContainsSoilMoistureSensor(msg.sensor_id(i)))
+    {
+      HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+          << "Soil moisture measurement for unknown sensor: sensor_id="
+          << msg.sensor_id(i);
+
+      return RejectRequest(
+          ErrorCode::INVALID_PARAMETER,
+          "Unknown soil moisture sensor",
+          client,
+          all_clients);
+    }
+  }
+
+  // Readings the client did not timestamp are stamped on receipt, with a
+  // seq each so that they don't overwrite one another
+  std::vector<SoilMoistureMeasurement> measurements;
+  measurements.reserve(count);
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    measurements.push_back(SoilMoistureMeasurement{
+        msg.sensor_id(i),
+        msg.value(i),
+        has_times ? msg.time_ms(i) : now_ms,
+        has_times ? 0 : NextSoilMoistureReadingSeq()});
+  }
+
+  // A client-timestamped reading repeated within the batch would overwrite
+  // itself in storage anyway, so only its last value is kept
+  if (has_times)
+  {
+    std::set<std::pair<size_t, int64_t>> seen;
+    auto last = std::remove_if(
+        measurements.rbegin(),
+        measurements.rend(),
+        [&seen](const SoilMoistureMeasurement &measurement)
+        {
+          return !seen.emplace(measurement.sensor_id, measurement.time_ms).second;
+        });
+    measurements.erase(measurements.begin(), last.base());
+  }
+
+  // Already a batch, so it skips the batcher and commits as one job with a
+  // single aggregate response
+  std::shared_ptr<MeasurementLog> measurement_log = measurement_log_;
+  std::shared_ptr<SensorHistoryCache> history = history_;
+
+  SubmitDbWork(
+      client,
+      all_clients,
+      [measurements, measurement_log, history](DbManager *db, DbReply *reply)
+      {
+        if (!CommitMeasurements(
+              measurements,
+              db,
+              measurement_log.get(),
+              history.get()))
+        {
+          SetFailedBasicResponse(
+              ErrorCode::INTERNAL_SERVER_ERROR,
+              "Failed to store soil moisture measurements",
+              reply);
+          return;
+        }
+
+        SetSuccessfulBasicResponse(reply);
+      });
+
   return true;
 }
 
-bool ControlClientHandler::SendSuccessfulBasicResponse(ProtobufClient *client)
+void ControlClientHandler::FlushMeasurements(size_t shard, ClientStore *all_clients)
 {
-  BasicResponse resp;
-  resp.set_code(ErrorCode::OK);
-  OrganicDumpProtoMessage msg{std::move(resp)};
+  assert(shard < measurement_batchers_.size());
+  assert(all_clients);
 
-  if (!client->Write(&msg))
+  std::vector<MeasurementBatcher::Sender> senders;
+  std::vector<SoilMoistureMeasurement> measurements;
+  measurement_batchers_[shard].Take(&senders, &measurements);
+
+  if (measurements.empty())
   {
-    LOG(ERROR) << "Failed to send successful basic response";
-    return false;
+    return;
+  }
+
+  std::shared_ptr<CompletionQueue> completions = completions_;
+  std::shared_ptr<MeasurementLog> measurement_log = measurement_log_;
+  std::shared_ptr<SensorHistoryCache> history = history_;
+
+  // Appending on the shard worker keeps acks in per-connection order
+  db_executor_->Submit(
+      shard,
+      [senders, measurements, all_clients, completions, measurement_log, history](DbManager *db)
+      {
+        // A reading the database rejects must not fail every client that
+        // shares its batch, so a failed batch is retried client by client
+        std::vector<bool> is_committed(measurements.size(), true);
+        if (!CommitMeasurements(
+              measurements,
+              db,
+              measurement_log.get(),
+              history.get()))
+        {
+          CommitMeasurementsPerSender(
+              senders,
+              measurements,
+              db,
+              measurement_log.get(),
+              history.get(),
+              &is_committed);
+        }
+
+        completions->Post(
+            [senders, measurements, all_clients, is_committed]()
+            {
+              for (size_t i = 0; i < senders.size(); ++i)
+              {
+                const MeasurementBatcher::Sender &sender = senders[i];
+
+                ProtobufClient *client = all_clients->FindClient(sender.fd, sender.serial);
+                if (!client)
+                {
+                  continue;
+                }
+
+                DbReply reply;
+                if (is_committed[i])
+                {
+                  SetSuccessfulBasicResponse(&reply);
+                }
+                else
+                {
+                  SetFailedBasicResponse(
+                      ErrorCode::INTERNAL_SERVER_ERROR,
+                      "Failed to store soil moisture measurement",
+                      &reply);
+                }
+
+                client->CompletePendingReply(
+                    sender.reply_slot,
+                    [reply](ProtobufClient *client)
+                    {
+                      if (!SendBasicResponse(reply.response, client))
+                      {
+                        LOG(ERROR) << "Failed to send basic response to client";
+                      }
+                    });
+              }
+            });
+      });
+}
+
+bool ControlClientHandler::GetSoilMoistureHistory(
+    const organicdump_proto::GetSoilMoistureHistory &msg,
+    ProtobufClient *client,
+    ClientStore *all_clients)
+{
+  assert(client);
+  assert(all_clients);
+
+  size_t sensor_id = msg.sensor_id();
+  size_t max_readings = (msg.max_readings() > 0)
+      ? std::min<size_t>(msg.max_readings(), MAX_HISTORY_READINGS)
+      : MAX_HISTORY_READINGS;
+  int64_t since_ms = (msg.window_seconds() > 0)
+      ? NowMs() - static_cast<int64_t>(msg.window_seconds()) * 1000
+      : 0;
+
+  // Answer inline from the cache unless an earlier response is still in
+  // flight
+  if (!client->HasPendingReplies())
+  {
+    std::vector<int64_t> times;
+    std::vector<float> values;
+    int64_t covered_since_ms = history_->Read(
+        sensor_id,
+        since_ms,
+        max_readings,
+        &times,
+        &values);
+
+    if (times.size() == max_readings || since_ms >= covered_since_ms)
+    {
+      organicdump_proto::SoilMoistureHistory history;
+      SetSoilMoistureHistory(sensor_id, times, values, &history);
+      return SendSoilMoistureHistory(history, client);
+    }
   }
 
+  std::shared_ptr<SensorHistoryCache> history = history_;
+
+  SubmitDbWork(
+      client,
+      all_clients,
+      [sensor_id, max_readings, since_ms, history](DbManager *db, DbReply *reply)
+      {
+        reply->has_history = true;
+
+        // Read the cache only now, after the client's earlier measurements
+        // have been committed to it on this shard
+        std::vector<int64_t> times;
+        std::vector<float> values;
+        int64_t covered_since_ms = history->Read(
+            sensor_id,
+            since_ms,
+            max_readings,
+            &times,
+            &values);
+
+        if (times.size() == max_readings || since_ms >= covered_since_ms)
+        {
+          SetSoilMoistureHistory(sensor_id, times, values, &reply->history);
+          return;
+        }
+
+        // Only the range older than the cache comes from MySQL
+        std::vector<int64_t> all_times;
+        std::vector<float> all_values;
+        size_t missing = max_readings - times.size();
+
+        if (!db->GetSoilMoistureReadings(
+              sensor_id,
+              since_ms,
+              covered_since_ms,
+              missing,
+              &all_times,
+              &all_values))
+        {
+          reply->history.set_code(ErrorCode::INTERNAL_SERVER_ERROR);
+          reply->history.set_message("Failed to read soil moisture history");
+          reply->history.set_sensor_id(sensor_id);
+          return;
+        }
+
+        // A short read means MySQL holds nothing else since |since_ms|
+        int64_t fetched_since_ms = (all_times.size() < missing)
+            ? since_ms
+            : all_times.front();
+        history->Backfill(
+            sensor_id,
+            covered_since_ms,
+            fetched_since_ms,
+            all_times,
+            all_values);
+
+        all_times.insert(all_times.end(), times.begin(), times.end());
+        all_values.insert(all_values.end(), values.begin(), values.end());
+        SetSoilMoistureHistory(sensor_id, all_times, all_values, &reply->history);
+      });
+
   return true;
 }
 
 bool ControlClientHandler::RegisterIrrigationSystem(
     const organicdump_proto::RegisterIrrigationSystem &msg,
-    ProtobufClient *client)
+    ProtobufClient *client,
+    ClientStore *all_clients)
 {
   assert(client);
 
-  if (msg.meta().has_rpi_id() && !db_.ContainsRpi(msg.meta().rpi_id())) {
-    LOG(ERROR) << "RPI does not exist. ID: " << msg.meta().rpi_id();
-    return false;
-  }
+  SubmitRegistryWork(client, all_clients, [msg](DbManager *db, DbReply *reply)
+  {
+    if (msg.meta().has_rpi_id() && !db->ContainsRpi(msg.meta().rpi_id())) {
+      LOG(ERROR) << "RPI does not exist. ID: " << msg.meta().rpi_id();
+      reply->keep_connection = false;
+      return;
+    }
 
-  if (db_.ContainsPeripheral(msg.meta().name())) {
-    LOG(ERROR) << "Peripheral already exists with name: " << msg.meta().name();
-    return false;
-  }
+    if (db->ContainsPeripheral(msg.meta().name())) {
+      LOG(ERROR) << "Peripheral already exists with name: " << msg.meta().name();
 
-  size_t id;
-  if (!db_.InsertIrrigationSystem(
-          msg.meta().name(),
-          &id)) {
-    LOG(ERROR) << "Failed to insert irrigation system";
-    return false;
-  }
+      SetFailedBasicResponse(
+          ErrorCode::INVALID_PARAMETER,
+          "Peripheral with that name already exists",
+          reply);
+      return;
+    }
 
-  LOG(INFO) << "Registered irrigaion system with ID: " << id;
+    size_t id;
+    if (!db->InsertIrrigationSystem(
+            msg.meta().name(),
+            &id)) {
+      LOG(ERROR) << "Failed to insert irrigation system";
+      reply->keep_connection = false;
+      return;
+    }
 
-  if (!SendSuccessfulBasicResponse(id, client))
-  {
-    LOG(ERROR) << "Failed to send successful response to client.";
-    return false;
-  }
+    LOG(INFO) << "Registered irrigaion system with ID: " << id;
+
+    SetSuccessfulBasicResponse(id, reply);
+  });
 
   return true;
 }
 
 bool ControlClientHandler::SetIrrigationSchedule(
     const organicdump_proto::SetIrrigationSchedule &msg,
-    ProtobufClient *client)
+    ProtobufClient *client,
+    ClientStore *all_clients)
 {
   assert(client);
+  assert(all_clients);
 
-  if (!db_.ContainsPeripheral(msg.irrigation_system_id())) {
-    LOG(ERROR) << "Failed to set irrigation schedule since irrigation system with id "
-               << msg.irrigation_system_id() << " does not exist.";
-    return false;
+  if (msg.daily_schedules_size() > MAX_DAILY_SCHEDULES)
+  {
+    LOG(ERROR) << "Rejecting " << msg.daily_schedules_size()
+               << " daily irrigation schedules for irrigation system "
+               << msg.irrigation_system_id();
+
+    return RejectRequest(
+        ErrorCode::INVALID_PARAMETER,
+        "Too many daily irrigation schedules",
+        client,
+        all_clients);
   }
 
-  for (const auto& entry : msg.daily_schedules()) {
-    if (!db_.InsertDailyIrrigationSchedule(
-            msg.irrigation_system_id(),
-            entry.day_of_week_index(),
-            entry.water_time_military(),
-            entry.water_duration_ms()))
+  std::shared_ptr<IrrigationScheduler> scheduler = scheduler_;
+  SubmitRegistryWork(client, all_clients, [msg, scheduler](DbManager *db, DbReply *reply)
+  {
+    size_t irrigation_system_id = msg.irrigation_system_id();
+    if (!db->ContainsIrrigationSystem(irrigation_system_id)) {
+      LOG(ERROR) << "Failed to set irrigation schedule since irrigation system with id "
+                 << irrigation_system_id << " does not exist.";
+
+      SetFailedBasicResponse(
+          ErrorCode::INVALID_PARAMETER,
+          "Irrigation system does not exist",
+          reply);
+      return;
+    }
+
+    std::vector<DailyIrrigationSchedule> schedules;
+    schedules.reserve(msg.daily_schedules_size());
+    for (const auto& entry : msg.daily_schedules()) {
+      DailyIrrigationSchedule schedule{
+          irrigation_system_id,
+          entry.day_of_week_index(),
+          entry.water_time_military(),
+          entry.water_duration_ms()};
+
+      if (!IrrigationScheduler::IsValid(schedule)) {
+        LOG(ERROR) << "Rejecting malformed daily irrigation schedule:"
+                   << " day_of_week_index=" << schedule.day_of_week_index
+                   << ", water_time_military=" << schedule.water_time_military;
+
+        SetFailedBasicResponse(
+            ErrorCode::INVALID_PARAMETER,
+            "Malformed daily irrigation schedule",
+            reply);
+        return;
+      }
+
+      schedules.push_back(std::move(schedule));
+    }
+
+    if (!db->ReplaceDailyIrrigationSchedules(irrigation_system_id, schedules))
     {
-      LOG(ERROR) << "Failed to insert daily irrigation schedule";
-      return false;
+      LOG(ERROR) << "Failed to replace daily irrigation schedules";
+
+      SetFailedBasicResponse(
+          ErrorCode::INTERNAL_SERVER_ERROR,
+          "Failed to store daily irrigation schedules",
+          reply);
+      reply->keep_connection = false;
+      return;
     }
-  }
 
-  LOG(INFO) << "Successfully inserted daily irrigation schedule for irrigation system "
-            << msg.irrigation_system_id();
+    LOG(INFO) << "Successfully set daily irrigation schedules for irrigation system "
+              << irrigation_system_id;
+
+    scheduler->Replace(irrigation_system_id, schedules);
+    SetSuccessfulBasicResponse(irrigation_system_id, reply);
+  });
+
   return true;
 }
 
 bool ControlClientHandler::HandleUnscheduledIrrigationRequest(
     const organicdump_proto::UnscheduledIrrigationRequest &msg,
     ProtobufClient *client,
-    std::unordered_map<int, ProtobufClient> *all_clients)
+    ClientStore *all_clients)
 {
   assert(client);
   assert(all_clients);
@@ -358,42 +1061,286 @@ bool ControlClientHandler::HandleUnscheduledIrrigationRequest(
             << " irrigation_system_id=" << msg.irrigation_system_id()
             << ", water_duration_ms=" << msg.duration_ms();
 
-  UNUSED(msg);
-  LOG(ERROR) << "bozkurtus -- HandleUnscheduledIrrigationRequest() -- UNIMPLEMENTED";
+  // Answered with the device's ack, in order with the client's other
+  // responses
+  auto ack = std::make_shared<IrrigationAck>(IrrigationAck{
+      all_clients,
+      client->GetFd(),
+      client->GetSerial(),
+      client->AddPendingReply(),
+      msg.irrigation_system_id(),
+      false});
+
+  if (!PushUnscheduledIrrigationRequest(msg, directory_.get(), completions_, ack))
+  {
+    BasicResponse resp;
+    resp.set_code(ErrorCode::INVALID_PARAMETER);
+    resp.set_message("Irrigation system not connected");
+    AnswerIrrigationRequest(resp, ack.get());
+    return true;
+  }
+
+  pending_irrigation_acks_.push_back(PendingIrrigationAck{
+      std::chrono::steady_clock::now() + IRRIGATION_ACK_TIMEOUT,
+      std::move(ack)});
   return true;
 }
 
-bool ControlClientHandler::SendSuccessfulBasicResponse(
+bool ControlClientHandler::PushUnscheduledIrrigationRequest(
+    const organicdump_proto::UnscheduledIrrigationRequest &msg,
+    ClientDirectory *directory,
+    std::shared_ptr<CompletionQueue> completions,
+    std::shared_ptr<IrrigationAck> ack)
+{
+  assert(directory);
+  assert(completions);
+  assert(ack);
+
+  bool is_routed = directory->Post(
+      ClientType::IRRIGATION_SYSTEM,
+      msg.irrigation_system_id(),
+      [msg, completions, ack](ProtobufClient *device)
+      {
+        OrganicDumpProtoMessage command{msg};
+        if (!device->Write(&command))
+        {
+          LOG(ERROR) << "Failed to queue unscheduled irrigation request for irrigation system "
+                     << msg.irrigation_system_id();
+          device->RequestClose();
+
+          BasicResponse resp;
+          resp.set_code(ErrorCode::INTERNAL_SERVER_ERROR);
+          resp.set_message("Failed to send request to irrigation system");
+          completions->Post([resp, ack]()
+          {
+            AnswerIrrigationRequest(resp, ack.get());
+          });
+          return;
+        }
+
+        device->ExpectAck([completions, ack](const BasicResponse &resp)
+        {
+          completions->Post([resp, ack]()
+          {
+            AnswerIrrigationRequest(resp, ack.get());
+          });
+        });
+      });
+
+  if (!is_routed)
+  {
+    LOG(ERROR) << "Irrigation system not connected. ID: " << msg.irrigation_system_id();
+  }
+
+  return is_routed;
+}
+
+void ControlClientHandler::AnswerIrrigationRequest(
+    const organicdump_proto::BasicResponse &resp,
+    IrrigationAck *ack)
+{
+  assert(ack);
+
+  // The device's ack and the timeout race, and only the first one answers
+  if (ack->is_answered)
+  {
+    return;
+  }
+
+  ack->is_answered = true;
+
+  ProtobufClient *client = ack->clients->FindClient(ack->fd, ack->serial);
+  if (!client)
+  {
+    return;
+  }
+
+  client->CompletePendingReply(ack->reply_slot, [resp](ProtobufClient *client)
+  {
+    if (!SendBasicResponse(resp, client))
+    {
+      LOG(ERROR) << "Failed to send basic response to client";
+    }
+  });
+}
+
+bool ControlClientHandler::CommitMeasurements(
+    const std::vector<SoilMoistureMeasurement> &measurements,
+    DbManager *db,
+    MeasurementLog *log,
+    SensorHistoryCache *history)
+{
+  assert(db);
+  assert(history);
+
+  bool is_committed = log
+      ? log->Append(measurements)
+      : db->InsertSoilMoistureMeasurements(measurements);
+
+  if (!is_committed)
+  {
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Failed to store batch of " << measurements.size()
+        << " soil moisture measurements";
+    return false;
+  }
+
+  if (!log)
+  {
+    history->Add(measurements);
+    return true;
+  }
+
+  // The engine rejects unregistered sensors but the log doesn't, and each
+  // new sensor id would cost the history cache a ring it never frees
+  std::vector<SoilMoistureMeasurement> registered;
+  registered.reserve(measurements.size());
+  for (const SoilMoistureMeasurement &measurement : measurements)
+  {
+    if (db->ContainsSoilMoistureSensor(measurement.sensor_id))
+    {
+      registered.push_back(measurement);
+    }
+  }
+
+  history->Add(registered);
+  return true;
+}
+
+void ControlClientHandler::CommitMeasurementsPerSender(
+    const std::vector<MeasurementBatcher::Sender> &senders,
+    const std::vector<SoilMoistureMeasurement> &measurements,
+    DbManager *db,
+    MeasurementLog *log,
+    SensorHistoryCache *history,
+    std::vector<bool> *out_is_committed)
+{
+  assert(senders.size() == measurements.size());
+  assert(out_is_committed);
+
+  out_is_committed->assign(measurements.size(), false);
+
+  // Serials are unique per connection, so they group each client's readings.
+  // Clients are retried in the order they first appear in the batch.
+  std::unordered_map<uint64_t, std::vector<size_t>> indices_by_serial;
+  std::vector<uint64_t> serials;
+  for (size_t i = 0; i < senders.size(); ++i)
+  {
+    std::vector<size_t> &indices = indices_by_serial[senders[i].serial];
+    if (indices.empty())
+    {
+      serials.push_back(senders[i].serial);
+    }
+    indices.push_back(i);
+  }
+
+  // The batch that just failed held nothing else
+  if (serials.size() < 2)
+  {
+    return;
+  }
+
+  size_t failed_count = 0;
+  std::vector<SoilMoistureMeasurement> subset;
+
+  for (uint64_t serial : serials)
+  {
+    const std::vector<size_t> &indices = indices_by_serial.at(serial);
+
+    subset.clear();
+    for (size_t index : indices)
+    {
+      subset.push_back(measurements[index]);
+    }
+
+    if (!CommitMeasurements(subset, db, log, history))
+    {
+      ++failed_count;
+      continue;
+    }
+
+    for (size_t index : indices)
+    {
+      (*out_is_committed)[index] = true;
+    }
+  }
+
+  HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+      << "Retried failed measurement batch per client: " << failed_count
+      << " of " << serials.size() << " client(s) still failed";
+}
+
+void ControlClientHandler::SetSuccessfulBasicResponse(DbReply *reply)
+{
+  assert(reply);
+  reply->has_response = true;
+  reply->response.set_code(ErrorCode::OK);
+}
+
+void ControlClientHandler::SetSuccessfulBasicResponse(
     size_t id,
+    DbReply *reply)
+{
+  assert(reply);
+  reply->has_response = true;
+  reply->response.set_code(ErrorCode::OK);
+  reply->response.set_id(id);
+}
+
+void ControlClientHandler::SetFailedBasicResponse(
+    organicdump_proto::ErrorCode code,
+    const std::string& message,
+    DbReply *reply)
+{
+  assert(reply);
+  reply->has_response = true;
+  reply->response.set_code(code);
+  reply->response.set_message(message);
+}
+
+bool ControlClientHandler::SendBasicResponse(
+    const organicdump_proto::BasicResponse &resp,
     ProtobufClient *client)
 {
-  BasicResponse resp;
-  resp.set_code(ErrorCode::OK);
-  resp.set_id(id);
-  OrganicDumpProtoMessage msg{std::move(resp)};
+  assert(client);
+
+  OrganicDumpProtoMessage msg{resp};
 
   if (!client->Write(&msg))
   {
-    LOG(ERROR) << "Failed to send successful basic response";
+    LOG(ERROR) << "Failed to send basic response";
     return false;
   }
 
   return true;
 }
 
-bool ControlClientHandler::SendFailedBasicResponse(
-    organicdump_proto::ErrorCode code,
-    const std::string& message,
+void ControlClientHandler::SetSoilMoistureHistory(
+    size_t sensor_id,
+    const std::vector<int64_t> &times,
+    const std::vector<float> &values,
+    organicdump_proto::SoilMoistureHistory *history)
+{
+  assert(times.size() == values.size());
+  assert(history);
+
+  history->set_code(ErrorCode::OK);
+  history->set_sensor_id(sensor_id);
+  history->mutable_time_ms()->Add(times.begin(), times.end());
+  history->mutable_value()->Add(values.begin(), values.end());
+}
+
+bool ControlClientHandler::SendSoilMoistureHistory(
+    const organicdump_proto::SoilMoistureHistory &history,
     ProtobufClient *client)
 {
-  BasicResponse resp;
-  resp.set_code(code);
-  resp.set_message(message);
-  OrganicDumpProtoMessage msg{std::move(resp)};
+  assert(client);
+
+  OrganicDumpProtoMessage msg{history};
 
   if (!client->Write(&msg))
   {
-    LOG(ERROR) << "Failed to send failed basic response";
+    LOG(ERROR) << "Failed to send soil moisture history";
     return false;
   }
 
@@ -1,73 +1,253 @@
 #ifndef ORGANICDUMP_SERVER_CONTROLCLIENTHANDLER_H
 #define ORGANICDUMP_SERVER_CONTROLCLIENTHANDLER_H
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
-
+#include "ClientDirectory.h"
 #include "ClientHandler.h"
+#include "ClientStore.h"
+#include "CompletionQueue.h"
+#include "DbExecutor.h"
 #include "DbManager.h"
+#include "IrrigationScheduler.h"
+#include "MeasurementBatcher.h"
+#include "MeasurementLog.h"
 #include "ProtobufClient.h"
+#include "SensorHistoryCache.h"
 #include "OrganicDumpProtoMessage.h"
 
 namespace organicdump
 {
 
+/**
+ * Handles requests from control clients. Database work runs on the shared
+ * DbExecutor; results come back through this reactor's CompletionQueue.
+ * Each client's work is pinned to one executor shard, except registry
+ * changes, which all run on one shard so that concurrent clients can't race
+ * them. Reply slots keep every client's responses in request order. When
+ * |measurement_log| is set, measurements are acknowledged once they reach
+ * the log rather than MySQL. History queries are answered
+ * from |history|, which every committed measurement also lands in.
+ * Unscheduled irrigation commands are routed to the target device, on
+ * whichever reactor holds it, through |directory|, and answered with the
+ * device's ack or an error if none arrives in time. Schedule changes are
+ * applied to |scheduler| once they are committed.
+ */
 class ControlClientHandler : public ClientHandler
 {
 public:
-  static bool Create(ControlClientHandler *out_handler);
+  static bool Create(
+      std::shared_ptr<DbExecutor> db_executor,
+      std::shared_ptr<CompletionQueue> completions,
+      std::shared_ptr<MeasurementLog> measurement_log,
+      std::shared_ptr<SensorHistoryCache> history,
+      std::shared_ptr<ClientDirectory> directory,
+      std::shared_ptr<IrrigationScheduler> scheduler,
+      size_t measurement_batch_size,
+      std::chrono::milliseconds measurement_flush_delay,
+      std::chrono::hours raw_retention,
+      ControlClientHandler *out_handler);
 
 public:
   ControlClientHandler();
-  ControlClientHandler(DbManager db);
+  ControlClientHandler(
+      std::shared_ptr<DbExecutor> db_executor,
+      std::shared_ptr<CompletionQueue> completions,
+      std::shared_ptr<MeasurementLog> measurement_log,
+      std::shared_ptr<SensorHistoryCache> history,
+      std::shared_ptr<ClientDirectory> directory,
+      std::shared_ptr<IrrigationScheduler> scheduler,
+      std::vector<MeasurementBatcher> measurement_batchers,
+      std::chrono::hours raw_retention);
   virtual ~ControlClientHandler() {}
   ControlClientHandler(ControlClientHandler &&other);
   ControlClientHandler &operator=(ControlClientHandler &&other);
   bool Handle(
       const OrganicDumpProtoMessage &msg,
       ProtobufClient *client,
-      std::unordered_map<int, ProtobufClient> *clients) override;
+      ClientStore *clients) override;
+  int GetPollTimeoutMs() override;
+  void Poll(ClientStore *clients) override;
+
+private:
+  /** Outcome of a db job, applied to the client on the reactor thread. */
+  struct DbReply
+  {
+    bool keep_connection{true};
+    bool has_response{false};
+    organicdump_proto::BasicResponse response;
+    bool has_history{false};
+    organicdump_proto::SoilMoistureHistory history;
+  };
+
+  using DbWork = std::function<void(DbManager *db, DbReply *reply)>;
+
+  /**
+   * An unscheduled irrigation request waiting on the device's ack. Only
+   * touched on this reactor's thread.
+   */
+  struct IrrigationAck
+  {
+    ClientStore *clients;
+    int fd;
+    uint64_t serial;
+    uint64_t reply_slot;
+    size_t irrigation_system_id;
+    bool is_answered;
+  };
+
+  struct PendingIrrigationAck
+  {
+    std::chrono::steady_clock::time_point deadline;
+    std::shared_ptr<IrrigationAck> ack;
+  };
 
 private:
   void CloseResources();
   void StealResources(ControlClientHandler *other);
 
+  /** Runs |work| on the client's shard, so its requests run in order. */
+  void SubmitDbWork(
+      ProtobufClient *client,
+      ClientStore *all_clients,
+      DbWork work);
+
+  /**
+   * Runs |work| on REGISTRY_SHARD, like every registry change from any
+   * connection, so that each check-then-insert is atomic and the scheduler
+   * replaces schedules in the order MySQL stored them. Replies still go out
+   * in request order.
+   */
+  void SubmitRegistryWork(
+      ProtobufClient *client,
+      ClientStore *all_clients,
+      DbWork work);
+
+  void SubmitDbWork(
+      size_t shard,
+      ProtobufClient *client,
+      ClientStore *all_clients,
+      DbWork work);
+
+  /**
+   * Rejects a request without touching the database. Answers inline unless
+   * that would overtake responses still in flight.
+   */
+  bool RejectRequest(
+      organicdump_proto::ErrorCode code,
+      const std::string &message,
+      ProtobufClient *client,
+      ClientStore *all_clients);
+
   // Generic handlers
   bool RegisterRpi(
       const organicdump_proto::RegisterRpi &msg,
-      ProtobufClient *client);
+      ProtobufClient *client,
+      ClientStore *all_clients);
   bool UpdatePeripheralOwnership(
       const organicdump_proto::UpdatePeripheralOwnership &msg,
-      ProtobufClient *client);
+      ProtobufClient *client,
+      ClientStore *all_clients);
 
   // Soil moisture handlers
   bool RegisterSoilMoistureSensor(
       const organicdump_proto::RegisterSoilMoistureSensor &msg,
-      ProtobufClient *client);
+      ProtobufClient *client,
+      ClientStore *all_clients);
   bool StoreSoilMoistureMeasurement(
       const organicdump_proto::SendSoilMoistureMeasurement &msg,
-      ProtobufClient *client);
+      ProtobufClient *client,
+      ClientStore *all_clients);
+  bool StoreSoilMoistureMeasurements(
+      const organicdump_proto::SendSoilMoistureMeasurements &msg,
+      ProtobufClient *client,
+      ClientStore *all_clients);
+  void FlushMeasurements(
+      size_t shard,
+      ClientStore *all_clients);
+  bool GetSoilMoistureHistory(
+      const organicdump_proto::GetSoilMoistureHistory &msg,
+      ProtobufClient *client,
+      ClientStore *all_clients);
 
   // Irrigation system handlers
   bool RegisterIrrigationSystem(
       const organicdump_proto::RegisterIrrigationSystem &msg,
-      ProtobufClient *client);
+      ProtobufClient *client,
+      ClientStore *all_clients);
   bool SetIrrigationSchedule(
       const organicdump_proto::SetIrrigationSchedule &msg,
-      ProtobufClient *client);
+      ProtobufClient *client,
+      ClientStore *all_clients);
   bool HandleUnscheduledIrrigationRequest(
       const organicdump_proto::UnscheduledIrrigationRequest &msg,
       ProtobufClient *client,
-      std::unordered_map<int, ProtobufClient> *all_clients);
+      ClientStore *all_clients);
 
 private:
-  bool SendSuccessfulBasicResponse(ProtobufClient *client);
-  bool SendSuccessfulBasicResponse(size_t id, ProtobufClient *client);
-  bool SendFailedBasicResponse(
+  /**
+   * Makes |measurements| durable through |log| if set, otherwise MySQL, and
+   * records those of registered sensors in |history|. Runs on a db worker.
+   */
+  static bool CommitMeasurements(
+      const std::vector<SoilMoistureMeasurement> &measurements,
+      DbManager *db,
+      MeasurementLog *log,
+      SensorHistoryCache *history);
+
+  /**
+   * Commits each sender's share of a batch that failed as a whole on its
+   * own, so that one rejected reading only fails the client that sent it.
+   * |out_is_committed|[i] reports whether |measurements|[i] was stored.
+   */
+  static void CommitMeasurementsPerSender(
+      const std::vector<MeasurementBatcher::Sender> &senders,
+      const std::vector<SoilMoistureMeasurement> &measurements,
+      DbManager *db,
+      MeasurementLog *log,
+      SensorHistoryCache *history,
+      std::vector<bool> *out_is_committed);
+  static void SetSuccessfulBasicResponse(DbReply *reply);
+  static void SetSuccessfulBasicResponse(size_t id, DbReply *reply);
+  static void SetFailedBasicResponse(
       organicdump_proto::ErrorCode code,
       const std::string& message,
+      DbReply *reply);
+  static bool SendBasicResponse(
+      const organicdump_proto::BasicResponse &resp,
       ProtobufClient *client);
+  static void SetSoilMoistureHistory(
+      size_t sensor_id,
+      const std::vector<int64_t> &times,
+      const std::vector<float> &values,
+      organicdump_proto::SoilMoistureHistory *history);
+  static bool SendSoilMoistureHistory(
+      const organicdump_proto::SoilMoistureHistory &history,
+      ProtobufClient *client);
+
+  /**
+   * Hands |msg| to the reactor holding the irrigation system's connection,
+   * which queues it for the device. The device's ack, or a failure to queue
+   * it, is posted back to |completions| to answer |ack|. False if the
+   * device isn't connected.
+   */
+  static bool PushUnscheduledIrrigationRequest(
+      const organicdump_proto::UnscheduledIrrigationRequest &msg,
+      ClientDirectory *directory,
+      std::shared_ptr<CompletionQueue> completions,
+      std::shared_ptr<IrrigationAck> ack);
+
+  /** Sends |resp| for |ack| unless it has already been answered. */
+  static void AnswerIrrigationRequest(
+      const organicdump_proto::BasicResponse &resp,
+      IrrigationAck *ack);
 
 private:
   ControlClientHandler(const ControlClientHandler &other);
@@ -75,7 +255,29 @@ private:
 
 private:
   bool is_initialized_;
-  DbManager db_;
+  std::shared_ptr<DbExecutor> db_executor_;
+  std::shared_ptr<CompletionQueue> completions_;
+
+  // Null when measurements go straight to MySQL
+  std::shared_ptr<MeasurementLog> measurement_log_;
+
+  // Shared with every reactor
+  std::shared_ptr<SensorHistoryCache> history_;
+
+  // Shared with every reactor
+  std::shared_ptr<ClientDirectory> directory_;
+  std::shared_ptr<IrrigationScheduler> scheduler_;
+
+  // One batcher per executor shard so that a batch only holds measurements
+  // whose acks are ordered on that shard.
+  std::vector<MeasurementBatcher> measurement_batchers_;
+
+  // Client timestamps older than this allows are rejected, so that a late
+  // reading can't make a pruned hour's rollups stale
+  std::chrono::hours raw_retention_;
+
+  // Unscheduled irrigation requests in deadline order
+  std::deque<PendingIrrigationAck> pending_irrigation_acks_;
 };
 
 } // namespace organicdump
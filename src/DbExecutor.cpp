@@ -0,0 +1,198 @@
+#include "DbExecutor.h"
+
+#include <cassert>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "DbManager.h"
+#include "Metrics.h"
+
+namespace
+{
+using organicdump::Gauge;
+using organicdump::LatencyHistogram;
+using organicdump::Metrics;
+
+LatencyHistogram *GetQueueLatency()
+{
+  static LatencyHistogram *latency = Metrics::GetHistogram(
+      "organicdump_db_queue_seconds",
+      "Time database jobs wait for a worker");
+  return latency;
+}
+
+Gauge *GetQueuedJobs()
+{
+  static Gauge *queued = Metrics::GetGauge(
+      "organicdump_db_queued_jobs",
+      "Database jobs waiting for a worker");
+  return queued;
+}
+} // namespace
+
+namespace organicdump
+{
+
+bool DbExecutor::Create(
+    size_t worker_count,
+    std::shared_ptr<DbManager> db,
+    DbExecutor *out_executor)
+{
+  assert(worker_count > 0);
+  assert(db);
+  assert(out_executor);
+
+  *out_executor = DbExecutor{worker_count, std::move(db)};
+  out_executor->Start();
+
+  LOG(INFO) << "Started " << worker_count << " db worker(s)";
+  return true;
+}
+
+DbExecutor::DbExecutor() {}
+
+DbExecutor::DbExecutor(size_t worker_count, std::shared_ptr<DbManager> db)
+  : db_{std::move(db)}
+{
+  workers_.reserve(worker_count);
+
+  for (size_t i = 0; i < worker_count; ++i)
+  {
+    auto worker = std::make_unique<Worker>();
+    worker->is_stopping = false;
+    workers_.push_back(std::move(worker));
+  }
+}
+
+DbExecutor::DbExecutor(DbExecutor &&other)
+{
+  StealResources(&other);
+}
+
+DbExecutor &DbExecutor::operator=(DbExecutor &&other)
+{
+  if (this != &other)
+  {
+    CloseResources();
+    StealResources(&other);
+  }
+  return *this;
+}
+
+DbExecutor::~DbExecutor()
+{
+  CloseResources();
+}
+
+size_t DbExecutor::GetShardCount() const
+{
+  return workers_.size();
+}
+
+DbManager *DbExecutor::GetDb() const
+{
+  return db_.get();
+}
+
+size_t DbExecutor::GetShard(uint64_t key) const
+{
+  assert(!workers_.empty());
+  return static_cast<size_t>(key % workers_.size());
+}
+
+void DbExecutor::Submit(size_t shard, Job job)
+{
+  assert(shard < workers_.size());
+
+  Worker *worker = workers_[shard].get();
+  {
+    std::lock_guard<std::mutex> lock{worker->mutex};
+    worker->jobs.push_back(QueuedJob{std::move(job), std::chrono::steady_clock::now()});
+    GetQueuedJobs()->Add(1);
+  }
+  worker->cv.notify_one();
+}
+
+void DbExecutor::Start()
+{
+  // Workers are heap-allocated, so their threads survive moves of the executor
+  for (auto &worker : workers_)
+  {
+    worker->thread = std::thread{RunWorker, worker.get(), db_.get()};
+  }
+}
+
+void DbExecutor::RunWorker(Worker *worker, DbManager *db)
+{
+  assert(worker);
+  assert(db);
+
+  std::deque<QueuedJob> jobs;
+
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock{worker->mutex};
+      worker->cv.wait(lock, [worker]() {
+        return worker->is_stopping || !worker->jobs.empty();
+      });
+
+      // Finish queued work before honoring a stop request
+      if (worker->jobs.empty())
+      {
+        return;
+      }
+
+      jobs.swap(worker->jobs);
+    }
+
+    for (QueuedJob &queued : jobs)
+    {
+      GetQueuedJobs()->Add(-1);
+      GetQueueLatency()->Record(std::chrono::steady_clock::now() - queued.submitted_at);
+      queued.job(db);
+    }
+
+    jobs.clear();
+  }
+}
+
+void DbExecutor::CloseResources()
+{
+  for (auto &worker : workers_)
+  {
+    {
+      std::lock_guard<std::mutex> lock{worker->mutex};
+      worker->is_stopping = true;
+    }
+    worker->cv.notify_one();
+  }
+
+  for (auto &worker : workers_)
+  {
+    if (worker->thread.joinable())
+    {
+      worker->thread.join();
+    }
+  }
+
+  workers_.clear();
+  db_.reset();
+}
+
+void DbExecutor::StealResources(DbExecutor *other)
+{
+  assert(other);
+  db_ = std::move(other->db_);
+  workers_ = std::move(other->workers_);
+  other->workers_.clear();
+}
+
+} // namespace organicdump
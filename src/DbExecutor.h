@@ -0,0 +1,88 @@
+#ifndef ORGANICDUMP_SERVER_DBEXECUTOR_H
+#define ORGANICDUMP_SERVER_DBEXECUTOR_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "DbManager.h"
+
+namespace organicdump
+{
+
+/**
+ * Pool of database worker threads sharing one DbManager, whose calls each
+ * check out a pooled MySQL session. Jobs are sharded: jobs submitted to the
+ * same shard run in submission order on the same worker, which is how
+ * per-connection request ordering is preserved.
+ */
+class DbExecutor
+{
+public:
+  using Job = std::function<void(DbManager *db)>;
+
+public:
+  static bool Create(
+      size_t worker_count,
+      std::shared_ptr<DbManager> db,
+      DbExecutor *out_executor);
+
+public:
+  DbExecutor();
+  DbExecutor(size_t worker_count, std::shared_ptr<DbManager> db);
+  DbExecutor(DbExecutor &&other);
+  DbExecutor &operator=(DbExecutor &&other);
+  ~DbExecutor();
+
+  size_t GetShardCount() const;
+  size_t GetShard(uint64_t key) const;
+  void Submit(size_t shard, Job job);
+
+  /**
+   * The shared DbManager, for the lookups that every engine serves from
+   * memory and that may therefore be made outside a job.
+   */
+  DbManager *GetDb() const;
+
+private:
+  struct QueuedJob
+  {
+    Job job;
+    std::chrono::steady_clock::time_point submitted_at;
+  };
+
+  struct Worker
+  {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<QueuedJob> jobs;
+    bool is_stopping;
+    std::thread thread;
+  };
+
+private:
+  void Start();
+  static void RunWorker(Worker *worker, DbManager *db);
+  void CloseResources();
+  void StealResources(DbExecutor *other);
+
+private:
+  DbExecutor(const DbExecutor &other) = delete;
+  DbExecutor &operator=(const DbExecutor &other) = delete;
+
+private:
+  // Shared by every worker, and with anything else that outlives a job
+  std::shared_ptr<DbManager> db_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_DBEXECUTOR_H
@@ -1,82 +1,86 @@
 #include "DbManager.h"
 
 #include <cassert>
-#include <ctime>
-#include <iostream>
-#include <iomanip>
-#include <sstream>
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 
-#include <mysqlx/xdevapi.h>
 #include <glog/logging.h>
 
-namespace {
-constexpr const char *DB_URL = "mysqlx://trevor@localhost";
-constexpr const char *DB_NAME = "plantsandthings";
-
-constexpr const char *RPIS_TABLE = "rpis";
-constexpr const char *PERIPHERALS_TABLE = "peripherals";
-constexpr const char *RPI_PERIPHERAL_EDGES_TABLE = "rpi_peripheral_edges";
-constexpr const char *SOIL_MOISTURE_SENSORS_TABLE = "soil_moisture_sensors";
-constexpr const char *SOIL_MOISTURE_MEASUREMENTS_TABLE = "soil_moisture_readings";
-constexpr const char *IRRIGATION_SYSTEMS_TABLE = "irrigation_systems";
-constexpr const char *DAILY_IRRIGATION_SCHEDULES_TABLE = "daily_irrigation_schedules";
-
-std::string MakeTimestamp() {
-  auto t = std::time(nullptr);
-  auto tm = *std::localtime(&t);
-
-  std::ostringstream oss;
-  oss << std::put_time(&tm, "%Y-%m-%d %H-%M-%S");
-  return oss.str();
-}
+#include "CliConfig.h"
+#include "InMemoryStorageEngine.h"
+#include "Metrics.h"
+#include "MySqlStorageEngine.h"
+#include "SqliteStorageEngine.h"
+#include "StorageEngine.h"
 
-bool ContainsRecordById(mysqlx::Schema *schema, const char *table_name, size_t id)
+namespace
 {
-  assert(table_name);
-
-  mysqlx::Table table = schema->getTable(table_name);
-
-  size_t record_count =
-      table.select("id")
-          .where("id = :key")
-          .bind("key", id)
-          .execute()
-          .count();
+constexpr const char *MYSQL_ENGINE = "mysql";
+constexpr const char *MEMORY_ENGINE = "memory";
+constexpr const char *SQLITE_ENGINE = "sqlite";
 
-  return record_count > 0;
+organicdump::LatencyHistogram *GetDbLatency(const char *op)
+{
+  return organicdump::Metrics::GetHistogram(
+      "organicdump_db_seconds",
+      "Time taken by each storage operation, including any wait for a pooled session",
+      "op",
+      op);
 }
 } // namespace
 
 namespace organicdump
 {
 
-bool DbManager::Create(DbManager *out_manager) {
-  assert(out_manager);
-
-  auto session = std::make_unique<mysqlx::Session>(DB_URL);
-  bool check_db_existence = true;
+bool DbManager::Create(const CliConfig &config, DbManager *out_db)
+{
+  assert(out_db);
 
-  auto db = std::make_unique<mysqlx::Schema>(
-      session->getSchema(DB_NAME, check_db_existence));
+  const std::string &engine_name = config.GetStorageEngine();
+  std::unique_ptr<StorageEngine> engine;
 
-  if (!db->existsInDatabase()) {
-    LOG(ERROR) << "Schema " << DB_NAME << " does not exist in db";
+  if (engine_name == MYSQL_ENGINE)
+  {
+    auto mysql = std::make_unique<MySqlStorageEngine>();
+    if (!MySqlStorageEngine::Create(config, mysql.get()))
+    {
+      LOG(ERROR) << "Failed to create MySQL storage engine";
+      return false;
+    }
+    engine = std::move(mysql);
+  }
+  else if (engine_name == SQLITE_ENGINE)
+  {
+    auto sqlite = std::make_unique<SqliteStorageEngine>();
+    if (!SqliteStorageEngine::Create(config.GetSqlitePath(), sqlite.get()))
+    {
+      LOG(ERROR) << "Failed to create SQLite storage engine";
+      return false;
+    }
+    engine = std::move(sqlite);
+  }
+  else if (engine_name == MEMORY_ENGINE)
+  {
+    LOG(WARNING) << "Keeping all data in memory. It is lost when the server exits";
+    engine = std::make_unique<InMemoryStorageEngine>();
+  }
+  else
+  {
+    LOG(ERROR) << "Unknown storage engine: " << engine_name;
     return false;
   }
 
-  *out_manager = DbManager{std::move(session), std::move(db)};
+  *out_db = DbManager{std::move(engine)};
   return true;
 }
 
-DbManager::DbManager() : is_initialized_{false} {}
+DbManager::DbManager() {}
 
-DbManager::DbManager(
-    std::unique_ptr<mysqlx::Session> session,
-    std::unique_ptr<mysqlx::Schema> db)
-    : is_initialized_{true},
-      session_{std::move(session)},
-      db_{std::move(db)} {}
+DbManager::DbManager(std::unique_ptr<StorageEngine> engine)
+  : engine_{std::move(engine)} {}
 
 DbManager::~DbManager()
 {
@@ -100,154 +104,56 @@ DbManager &DbManager::operator=(DbManager &&other)
 
 bool DbManager::OrphanRpiOwnedPeripheral(size_t peripheral_id)
 {
-  mysqlx::Table edges_table = db_->getTable(RPI_PERIPHERAL_EDGES_TABLE);
-
-  const mysqlx::Result result = edges_table
-      .remove()
-      .where("peripheral_id = :id")
-      .bind("id", peripheral_id)
-      .execute();
-
-  if (result.getAffectedItemsCount() == 0)
-  {
-    LOG(ERROR) << "Peripheral " << peripheral_id << " not owned by any rpi";
-    return false;
-  }
-
-  return true;
+  static LatencyHistogram *latency = GetDbLatency("orphan_rpi_owned_peripheral");
+  LatencyTimer timer{latency};
+  return engine_->OrphanRpiOwnedPeripheral(peripheral_id);
 }
 
 bool DbManager::AssignPeripheralToRpi(size_t rpi_id, size_t peripheral_id)
 {
-  mysqlx::Table edges_table = db_->getTable(RPI_PERIPHERAL_EDGES_TABLE);
-
-  const mysqlx::Result result = edges_table
-      .insert("rpi_id", "peripheral_id")
-      .values(rpi_id, peripheral_id)
-      .execute();
-
-  if (result.getAffectedItemsCount() == 0)
-  {
-    LOG(ERROR) << "Failed to insert rpi-peripheral edge";
-    return false;
-  }
-
-  return true;
+  static LatencyHistogram *latency = GetDbLatency("assign_peripheral_to_rpi");
+  LatencyTimer timer{latency};
+  return engine_->AssignPeripheralToRpi(rpi_id, peripheral_id);
 }
 
 bool DbManager::ContainsRpi(size_t id)
 {
-  return ContainsRecordById(db_.get(), RPIS_TABLE, id);
+  return engine_->ContainsRpi(id);
 }
 
 bool DbManager::ContainsRpi(const std::string &name)
 {
-  mysqlx::Table table = db_->getTable(RPIS_TABLE);
-  size_t record_count =
-      table.select("name")
-          .where("name = :rpi_name")
-          .bind("rpi_name", name)
-          .execute()
-          .count();
-
-  return record_count > 0;
+  return engine_->ContainsRpi(name);
 }
 
 bool DbManager::ContainsPeripheral(const std::string &name)
 {
-  mysqlx::Table table = db_->getTable(PERIPHERALS_TABLE);
-
-  size_t record_count =
-      table.select("id")
-          .where("name = :name")
-          .bind("name", name)
-          .execute()
-          .count();
-
-  return record_count > 0;
+  return engine_->ContainsPeripheral(name);
 }
 
 bool DbManager::ContainsPeripheral(size_t id)
 {
-  return ContainsRecordById(db_.get(), PERIPHERALS_TABLE, id);
+  return engine_->ContainsPeripheral(id);
 }
 
-bool DbManager::ContainsIrrigationSystem(size_t id) {
-  return ContainsRecordById(db_.get(), IRRIGATION_SYSTEMS_TABLE, id);
-}
-
-bool DbManager::InsertPeripheral(const std::string &name, size_t *out_id)
+bool DbManager::ContainsSoilMoistureSensor(size_t id)
 {
-  assert(out_id);
-
-  mysqlx::Table peripherals_table = db_->getTable(PERIPHERALS_TABLE);
-
-  const mysqlx::Result result = peripherals_table
-      .insert("name", "time")
-      .values(name, MakeTimestamp())
-      .execute();
-
-  if (result.getAffectedItemsCount() == 0)
-  {
-    LOG(ERROR) << "Failed to insert peripheral";
-    return false;
-  }
-
-  *out_id = result.getAutoIncrementValue();
-  return true;
+  return engine_->ContainsSoilMoistureSensor(id);
 }
 
-bool DbManager::DeletePeripheralOwnership(size_t peripheral_id)
+bool DbManager::ContainsIrrigationSystem(size_t id)
 {
-  try
-  {
-    mysqlx::Table rpi_peripheral_edges =
-        db_->getTable(RPI_PERIPHERAL_EDGES_TABLE);
-
-    const mysqlx::Result result = rpi_peripheral_edges
-      .remove()
-      .where("peripheral_id = :pid")
-      .bind("pid", peripheral_id)
-      .execute();
-
-    LOG(INFO) << "Removed " << result.getAffectedItemsCount()
-              << " from " << RPI_PERIPHERAL_EDGES_TABLE;
-  }
-  catch (const mysqlx::Error e)
-  {
-    LOG(ERROR) << "Failed to remove record from " << RPI_PERIPHERAL_EDGES_TABLE
-               << ". Error: " << e;
-    return false;
-  }
-
-  return true;
+  return engine_->ContainsIrrigationSystem(id);
 }
 
-bool DbManager::InsertPeripheralOwnership(
-    size_t peripheral_id,
-    size_t rpi_id)
+bool DbManager::InsertRpi(
+    const std::string &name,
+    const std::string &location,
+    size_t *out_id)
 {
-  try
-  {
-    mysqlx::Table rpi_peripheral_edges =
-        db_->getTable(RPI_PERIPHERAL_EDGES_TABLE);
-
-    const mysqlx::Result result = rpi_peripheral_edges
-      .insert("peripheral_id", "rpi_id")
-      .values(peripheral_id, rpi_id)
-      .execute();
-
-    LOG(INFO) << "Inserted " << result.getAffectedItemsCount() << " rows into "
-              << RPI_PERIPHERAL_EDGES_TABLE;
-
-    return true;
-  }
-  catch (const mysqlx::Error e)
-  {
-    LOG(ERROR) << "Failed to insert record into " << RPI_PERIPHERAL_EDGES_TABLE
-               << ". Error: " << e;
-    return false;
-  }
+  static LatencyHistogram *latency = GetDbLatency("insert_rpi");
+  LatencyTimer timer{latency};
+  return engine_->InsertRpi(name, location, out_id);
 }
 
 bool DbManager::InsertSoilMoistureSensor(
@@ -256,291 +162,110 @@ bool DbManager::InsertSoilMoistureSensor(
     float ceil,
     size_t *out_id)
 {
-  LOG(INFO) << "Registering soil moisture sensor w/database, {name="
-            << name << ", floor=" << floor << ", ceil=" << ceil << "}";
-
-  try
-  {
-    session_->startTransaction();
-
-    if (!InsertPeripheral(name, out_id))
-    {
-      LOG(ERROR) << "Failed to insert peripheral record";
-      goto error;
-    }
-
-    mysqlx::Table table = db_->getTable(SOIL_MOISTURE_SENSORS_TABLE);
-
-    const mysqlx::Result result = table
-        .insert("peripheral_id", "ceiling", "floor")
-        .values(*out_id, ceil, floor)
-        .execute();
-
-    if (result.getAffectedItemsCount() == 0)
-    {
-      LOG(ERROR) << "Failed to insert soil moisture sensor record";
-      goto error;
-    }
-
-    LOG(INFO) << "Soil moisture sensor registered successfully";
-    session_->commit();
-    return true;
-  }
-  catch (const mysqlx::Error e)
-  {
-    LOG(ERROR) << e;
-    goto error;
-  }
-
-error:
-    LOG(ERROR) << "Transaction failure when inserting soil moisture sensor. Rolling back...";
-    session_->rollback();
-    return false;
+  static LatencyHistogram *latency = GetDbLatency("insert_soil_moisture_sensor");
+  LatencyTimer timer{latency};
+  return engine_->InsertSoilMoistureSensor(name, floor, ceil, out_id);
 }
 
-bool DbManager::UpdatePeripheralOwnership(size_t peripheral_id, size_t rpi_id) {
-  // Check peripheral exists
-  if (!ContainsPeripheral(peripheral_id)) {
-    LOG(ERROR) << "Could not find peripheral w/id: " << peripheral_id;
-    return false;
-  }
-
-  // Check RPI exists
-  if (!ContainsRpi(rpi_id)) {
-    LOG(ERROR) << "Could not find rpi w/id: " << rpi_id;
-    return false;
-  }
-
-  try
-  {
-    session_->startTransaction();
-
-    // Try to ownership record
-    if (!DeletePeripheralOwnership(peripheral_id))
-    {
-      LOG(ERROR) << "Failed to delete peripheral ownership record. Id: "
-                 << peripheral_id;
-      goto error;
-    }
-
-    // Insert new ownership record
-    if (!InsertPeripheralOwnership(peripheral_id, rpi_id))
-    {
-      LOG(ERROR) << "Failed to insert peripheral ownership record"
-                 << ". Peripheral ID: " << peripheral_id
-                 << ". RPI ID: " << rpi_id;
-      goto error;
-    }
-
-    LOG(INFO) << "Peripheral ownership updated successfully!";
-    session_->commit();
-    return true;
-  }
-  catch (const mysqlx::Error &e)
-  {
-    LOG(ERROR) << e;
-    goto error;
-  }
+bool DbManager::InsertSoilMoistureMeasurements(
+    const std::vector<SoilMoistureMeasurement> &measurements)
+{
+  static LatencyHistogram *latency = GetDbLatency("insert_soil_moisture_measurements");
+  LatencyTimer timer{latency};
 
-error:
-  LOG(ERROR) << "Transaction failure when updating peripheral paranetage. Rolling back...";
-  session_->rollback();
-  return false;
+  assert(!measurements.empty());
+  return engine_->InsertSoilMoistureMeasurements(measurements);
 }
 
-bool DbManager::InsertSoilMoistureMeasurement(
+bool DbManager::GetSoilMoistureReadings(
     size_t sensor_id,
-    float measurement,
-    size_t *out_measurement_id)
+    int64_t start_ms,
+    int64_t end_ms,
+    size_t max_readings,
+    std::vector<int64_t> *out_times,
+    std::vector<float> *out_values)
 {
-  assert(out_measurement_id);
-
-  try
-  {
-    auto now = MakeTimestamp();
-    LOG(INFO) << "Inserting soil moisture reading: sensor_id="
-              << sensor_id << ", reading=" << measurement << ", time="
-              << now;
-
-    mysqlx::Table table = db_->getTable(SOIL_MOISTURE_MEASUREMENTS_TABLE);
-    const mysqlx::Result result = table
-        .insert("sensor_id", "reading", "time")
-        .values(sensor_id, measurement, now)
-        .execute();
-
-    if (result.getAffectedItemsCount() == 0)
-    {
-      LOG(ERROR) << "Failed to insert soil moisture measurement record";
-      return false;
-    }
-
-    *out_measurement_id = result.getAutoIncrementValue();
-    LOG(INFO) << "Successfully inserted soil moisture reading. Id=" << *out_measurement_id;
-
-    return true;
-  }
-  catch (const mysqlx::Error e)
-  {
-    LOG(ERROR) << "Failed to insert into " << SOIL_MOISTURE_MEASUREMENTS_TABLE
-               << ". Error: " << e;
-    return false;
-  }
+  static LatencyHistogram *latency = GetDbLatency("get_soil_moisture_readings");
+  LatencyTimer timer{latency};
+
+  assert(out_times);
+  assert(out_values);
+  return engine_->GetSoilMoistureReadings(
+      sensor_id,
+      start_ms,
+      end_ms,
+      max_readings,
+      out_times,
+      out_values);
 }
 
-bool DbManager::InsertRpi(
-    const std::string &name,
-    const std::string &location,
-    size_t *out_id)
+bool DbManager::RefreshSoilMoistureRollups()
 {
-  try
-  {
-    assert(out_id);
-    mysqlx::Table rpi_table = db_->getTable(RPIS_TABLE);
+  static LatencyHistogram *latency = GetDbLatency("refresh_soil_moisture_rollups");
+  LatencyTimer timer{latency};
+  return engine_->RefreshSoilMoistureRollups();
+}
 
-    const mysqlx::Result result = rpi_table
-        .insert("name", "time", "location")
-        .values(name, MakeTimestamp(), location)
-        .execute();
+bool DbManager::PruneSoilMoistureReadings(int64_t cutoff_ms)
+{
+  static LatencyHistogram *latency = GetDbLatency("prune_soil_moisture_readings");
+  LatencyTimer timer{latency};
+  return engine_->PruneSoilMoistureReadings(cutoff_ms);
+}
 
-    if (result.getAffectedItemsCount() == 0)
-    {
-      LOG(ERROR) << "Failed to insert peripheral";
-      return false;
-    }
+bool DbManager::EnsureSoilMoistureReadingPartitions()
+{
+  static LatencyHistogram *latency = GetDbLatency("ensure_soil_moisture_reading_partitions");
+  LatencyTimer timer{latency};
+  return engine_->EnsureSoilMoistureReadingPartitions();
+}
 
-    *out_id = result.getAutoIncrementValue();
-    return true;
-  }
-  catch (const mysqlx::Error e)
-  {
-    LOG(ERROR) << "Failed to insert into " << RPIS_TABLE << ". Error: " << e;
-    return false;
-  }
+bool DbManager::UpdatePeripheralOwnership(size_t peripheral_id, size_t rpi_id)
+{
+  static LatencyHistogram *latency = GetDbLatency("update_peripheral_ownership");
+  LatencyTimer timer{latency};
+  return engine_->UpdatePeripheralOwnership(peripheral_id, rpi_id);
 }
 
 bool DbManager::InsertIrrigationSystem(
     const std::string& name,
     size_t *out_id)
 {
-  assert(out_id);
-
-  LOG(INFO) << "Registering irrigation system w/database: name="
-            << name;
-  try
-  {
-    session_->startTransaction();
-
-    if (!InsertPeripheral(name, out_id))
-    {
-      LOG(ERROR) << "Failed to insert peripheral record";
-      goto error;
-    }
-
-    mysqlx::Table table = db_->getTable(IRRIGATION_SYSTEMS_TABLE);
-
-    const mysqlx::Result result = table
-        .insert("peripheral_id")
-        .values(*out_id)
-        .execute();
+  static LatencyHistogram *latency = GetDbLatency("insert_irrigation_system");
+  LatencyTimer timer{latency};
 
-    if (result.getAffectedItemsCount() == 0)
-    {
-      LOG(ERROR) << "Failed to insert irrigation systems record";
-      goto error;
-    }
-
-    LOG(INFO) << "Irrigation system " << *out_id << " registered successfully";
-    session_->commit();
-    return true;
-  }
-  catch (const mysqlx::Error e)
-  {
-    LOG(ERROR) << e;
-    goto error;
-  }
-
-error:
-    LOG(ERROR) << "Transaction failure when inserting irrigation system. Rolling back...";
-    session_->rollback();
-    return false;
+  assert(out_id);
+  return engine_->InsertIrrigationSystem(name, out_id);
 }
 
-bool DbManager::InsertDailyIrrigationSchedule(
+bool DbManager::ReplaceDailyIrrigationSchedules(
     size_t irrigation_system_id,
-    size_t day_of_week_index,
-    std::string water_time_military,
-    size_t water_duration_ms)
+    const std::vector<DailyIrrigationSchedule> &schedules)
 {
-  LOG(INFO) << "Inserting daily irrigation schedule:"
-            << " irrigation_system_id=" << irrigation_system_id
-            << " day_of_week_index=" << day_of_week_index
-            << " water_time_=" << water_time_military
-            << " water_duration_ms=" << water_duration_ms;
-  try
-  {
-    session_->startTransaction();
-    mysqlx::Table table = db_->getTable(DAILY_IRRIGATION_SCHEDULES_TABLE);
-
-    const mysqlx::Result result = table
-        .insert(
-              "irrigation_system_id",
-              "day_of_week_index",
-              "irrigation_time_military",
-              "duration_ms")
-        .values(
-              irrigation_system_id,
-              day_of_week_index,
-              water_time_military,
-              water_duration_ms)
-        .execute();
-
-    if (result.getAffectedItemsCount() == 0)
-    {
-      LOG(ERROR) << "Failed to insert daily irrigation system record. irrigation_system_id="
-                 << irrigation_system_id << ", day_of_week_index=" << day_of_week_index
-                 << ", water_time_military=" << water_time_military << ", water_duration_ms="
-                 << water_duration_ms;
-      goto error;
-    }
+  static LatencyHistogram *latency = GetDbLatency("replace_daily_irrigation_schedules");
+  LatencyTimer timer{latency};
+  return engine_->ReplaceDailyIrrigationSchedules(irrigation_system_id, schedules);
+}
 
-    size_t schedule_id = result.getAutoIncrementValue();
-    LOG(INFO) << "Daily irrigation schedule " << schedule_id << " inserted successfully";
-    session_->commit();
-    return true;
-  }
-  catch (const mysqlx::Error e)
-  {
-    LOG(ERROR) << e;
-    goto error;
-  }
+bool DbManager::GetDailyIrrigationSchedules(
+    std::vector<DailyIrrigationSchedule> *out_schedules)
+{
+  static LatencyHistogram *latency = GetDbLatency("get_daily_irrigation_schedules");
+  LatencyTimer timer{latency};
 
-error:
-    LOG(ERROR) << "Transaction failure when inserting daily irrigation "
-               << "schedule. Rolling back...";
-    session_->rollback();
-    return false;
+  assert(out_schedules);
+  return engine_->GetDailyIrrigationSchedules(out_schedules);
 }
 
 void DbManager::CloseResources()
 {
-  if (!is_initialized_)
-  {
-    return;
-  }
-
-  is_initialized_ = false;
-  session_->close();
-  session_.reset();
-  db_.reset();
+  engine_.reset();
 }
 
 void DbManager::StealResources(DbManager *other)
 {
   assert(other);
-  is_initialized_ = other->is_initialized_;
-  other->is_initialized_ = false;
-  session_ = std::move(other->session_);
-  db_ = std::move(other->db_);
+  engine_ = std::move(other->engine_);
 }
 
 } // namespace organicdump
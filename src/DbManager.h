@@ -1,22 +1,34 @@
 #ifndef ORGANICDUMP_SERVER_DBMANAGER_H
 #define ORGANICDUMP_SERVER_DBMANAGER_H
 
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <vector>
 
-#include <mysqlx/xdevapi.h>
+#include "CliConfig.h"
+#include "StorageEngine.h"
 
 namespace organicdump
 {
 
+/**
+ * Front door to the StorageEngine picked by --storage: MySQL; a local SQLite
+ * file for single-board sites with no room for MySQL; or an in-process
+ * engine for profiling the server without a database, whose data is lost on
+ * restart. Every call is timed into organicdump_db_seconds whichever engine
+ * serves it.
+ *
+ * Engines are safe to call concurrently, so one DbManager may be shared by
+ * every database worker thread.
+ */
 class DbManager {
 public:
-  static bool Create(DbManager *out_db);
+  static bool Create(const CliConfig &config, DbManager *out_db);
 
 public:
   DbManager();
-  DbManager(
-      std::unique_ptr<mysqlx::Session> session,
-      std::unique_ptr<mysqlx::Schema> db);
+  explicit DbManager(std::unique_ptr<StorageEngine> engine);
   ~DbManager();
   DbManager(DbManager &&other);
   DbManager &operator=(DbManager &&other);
@@ -26,6 +38,7 @@ public:
   bool ContainsRpi(const std::string &name);
   bool ContainsPeripheral(const std::string &name);
   bool ContainsPeripheral(size_t id);
+  bool ContainsSoilMoistureSensor(size_t id);
   bool ContainsIrrigationSystem(size_t id);
   bool InsertRpi(
       const std::string &name,
@@ -36,37 +49,70 @@ public:
       float floor,
       float ceil,
       size_t *out_id);
-  bool InsertSoilMoistureMeasurement(
+  /**
+   * Inserts all |measurements| in one write. Readings are keyed by
+   * (sensor_id, time_ms, seq) and a replayed reading overwrites the stored
+   * one, so retrying a batch is harmless. Fails the whole batch if any
+   * reading names a sensor that isn't registered.
+   */
+  bool InsertSoilMoistureMeasurements(
+      const std::vector<SoilMoistureMeasurement> &measurements);
+
+  /**
+   * Reads the newest readings of |sensor_id| in [start_ms, end_ms), at most
+   * |max_readings| of them, and appends them oldest first.
+   */
+  bool GetSoilMoistureReadings(
       size_t sensor_id,
-      float measurement,
-      size_t *out_measurement_id);
+      int64_t start_ms,
+      int64_t end_ms,
+      size_t max_readings,
+      std::vector<int64_t> *out_times,
+      std::vector<float> *out_values);
+
+  /**
+   * Recomputes the 1-minute, 1-hour and 1-day rollup buckets of every hour
+   * that readings committed since the last call touched. Hours that fail
+   * stay stale for the next call, across restarts too.
+   */
+  bool RefreshSoilMoistureRollups();
+
+  /**
+   * Deletes raw readings older than |cutoff_ms| rounded down to the hour.
+   * Rollups are kept.
+   */
+  bool PruneSoilMoistureReadings(int64_t cutoff_ms);
+
+  /** Adds the partitions that upcoming readings will land in, if any. */
+  bool EnsureSoilMoistureReadingPartitions();
   bool UpdatePeripheralOwnership(
       size_t peripheral_id,
       size_t rpi_id);
   bool InsertIrrigationSystem(
       const std::string& name,
       size_t *out_id);
-  bool InsertDailyIrrigationSchedule(
+
+  /**
+   * Replaces every daily schedule of |irrigation_system_id| with |schedules|
+   * in one transaction, so a failure leaves the previous set untouched.
+   */
+  bool ReplaceDailyIrrigationSchedules(
       size_t irrigation_system_id,
-      size_t day_of_week_index,
-      std::string water_time_military,
-      size_t water_duration_ms);
+      const std::vector<DailyIrrigationSchedule> &schedules);
+
+  /** Reads every daily irrigation schedule, e.g. to seed the scheduler. */
+  bool GetDailyIrrigationSchedules(std::vector<DailyIrrigationSchedule> *out_schedules);
 
 private:
   void CloseResources();
   void StealResources(DbManager *other);
-  bool InsertPeripheral(const std::string &name, size_t *out_id);
-  bool DeletePeripheralOwnership(size_t peripheral_id);
-  bool InsertPeripheralOwnership(size_t peripheral_id, size_t rpi_id);
 
 private:
   DbManager(const DbManager &other) = delete;
   DbManager &operator=(const DbManager &other) = delete;
 
 private:
-  bool is_initialized_;
-  std::unique_ptr<mysqlx::Session> session_;
-  std::unique_ptr<mysqlx::Schema> db_;
+  std::unique_ptr<StorageEngine> engine_;
 };
 
 } // namespace organicdump
@@ -0,0 +1,352 @@
+#include "DbSessionPool.h"
+
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <mysqlx/xdevapi.h>
+
+namespace organicdump
+{
+
+struct DbSessionLease::State
+{
+  std::string url;
+  std::string schema_name;
+  size_t max_sessions;
+  std::chrono::milliseconds idle_ping_interval;
+  std::chrono::milliseconds checkout_timeout;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<std::unique_ptr<Entry>> idle;
+
+  // Sessions in |idle|, checked out, or being opened
+  size_t open_count;
+
+  bool Open(std::unique_ptr<Entry> *out_entry);
+  bool Verify(Entry *entry);
+  void Return(std::unique_ptr<Entry> entry);
+  void Discard();
+};
+
+bool DbSessionLease::State::Open(std::unique_ptr<Entry> *out_entry)
+{
+  assert(out_entry);
+
+  try
+  {
+    auto session = std::make_unique<mysqlx::Session>(url);
+    bool check_db_existence = true;
+
+    auto schema = std::make_unique<mysqlx::Schema>(
+        session->getSchema(schema_name, check_db_existence));
+
+    if (!schema->existsInDatabase()) {
+      LOG(ERROR) << "Schema " << schema_name << " does not exist in db";
+      return false;
+    }
+
+    auto entry = std::make_unique<Entry>();
+    entry->session = std::move(session);
+    entry->schema = std::move(schema);
+    entry->statements = std::make_unique<DbStatementCache>(entry->schema.get());
+    entry->last_verified = std::chrono::steady_clock::now();
+    entry->is_suspect = false;
+    *out_entry = std::move(entry);
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to open db session to " << url << ". Error: " << e;
+    return false;
+  }
+}
+
+bool DbSessionLease::State::Verify(Entry *entry)
+{
+  assert(entry);
+
+  auto now = std::chrono::steady_clock::now();
+  if (!entry->is_suspect && now - entry->last_verified < idle_ping_interval)
+  {
+    return true;
+  }
+
+  try
+  {
+    entry->session->sql("SELECT 1").execute();
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Db session failed ping. Reconnecting. Error: " << e;
+    return false;
+  }
+
+  entry->last_verified = now;
+  entry->is_suspect = false;
+  return true;
+}
+
+void DbSessionLease::State::Return(std::unique_ptr<Entry> entry)
+{
+  assert(entry);
+
+  if (!entry->is_suspect)
+  {
+    // A call that completed without error proves the session is alive
+    entry->last_verified = std::chrono::steady_clock::now();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    idle.push_back(std::move(entry));
+  }
+  cv.notify_one();
+}
+
+void DbSessionLease::State::Discard()
+{
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    assert(open_count > 0);
+    --open_count;
+  }
+  cv.notify_one();
+}
+
+DbSessionLease::DbSessionLease() : pool_{nullptr} {}
+
+DbSessionLease::DbSessionLease(State *pool, std::unique_ptr<Entry> entry)
+  : pool_{pool},
+    entry_{std::move(entry)} {}
+
+DbSessionLease::~DbSessionLease()
+{
+  CloseResources();
+}
+
+DbSessionLease::DbSessionLease(DbSessionLease &&other)
+  : pool_{nullptr}
+{
+  StealResources(&other);
+}
+
+DbSessionLease &DbSessionLease::operator=(DbSessionLease &&other)
+{
+  if (this != &other)
+  {
+    CloseResources();
+    StealResources(&other);
+  }
+  return *this;
+}
+
+mysqlx::Session *DbSessionLease::GetSession()
+{
+  assert(entry_);
+  return entry_->session.get();
+}
+
+mysqlx::Schema *DbSessionLease::GetSchema()
+{
+  assert(entry_);
+  return entry_->schema.get();
+}
+
+DbStatementCache *DbSessionLease::GetStatements()
+{
+  assert(entry_);
+  return entry_->statements.get();
+}
+
+void DbSessionLease::MarkSuspect()
+{
+  assert(entry_);
+  entry_->is_suspect = true;
+}
+
+void DbSessionLease::CloseResources()
+{
+  if (pool_ && entry_)
+  {
+    pool_->Return(std::move(entry_));
+  }
+
+  pool_ = nullptr;
+  entry_.reset();
+}
+
+void DbSessionLease::StealResources(DbSessionLease *other)
+{
+  assert(other);
+  pool_ = other->pool_;
+  other->pool_ = nullptr;
+  entry_ = std::move(other->entry_);
+}
+
+bool DbSessionPool::Create(
+    std::string url,
+    std::string schema_name,
+    size_t min_sessions,
+    size_t max_sessions,
+    std::chrono::milliseconds idle_ping_interval,
+    std::chrono::milliseconds checkout_timeout,
+    DbSessionPool *out_pool)
+{
+  assert(out_pool);
+
+  if (max_sessions == 0 || min_sessions > max_sessions)
+  {
+    LOG(ERROR) << "Invalid db session pool bounds: min=" << min_sessions
+               << ", max=" << max_sessions;
+    return false;
+  }
+
+  auto state = std::make_unique<DbSessionLease::State>();
+  state->url = std::move(url);
+  state->schema_name = std::move(schema_name);
+  state->max_sessions = max_sessions;
+  state->idle_ping_interval = idle_ping_interval;
+  state->checkout_timeout = checkout_timeout;
+  state->open_count = 0;
+
+  for (size_t i = 0; i < min_sessions; ++i)
+  {
+    std::unique_ptr<DbSessionLease::Entry> entry;
+    if (!state->Open(&entry))
+    {
+      LOG(ERROR) << "Failed to open db session " << i << " of " << min_sessions;
+      return false;
+    }
+
+    state->idle.push_back(std::move(entry));
+    ++state->open_count;
+  }
+
+  *out_pool = DbSessionPool{std::move(state)};
+  return true;
+}
+
+DbSessionPool::DbSessionPool() {}
+
+DbSessionPool::DbSessionPool(std::unique_ptr<DbSessionLease::State> state)
+  : state_{std::move(state)} {}
+
+DbSessionPool::~DbSessionPool()
+{
+  CloseResources();
+}
+
+DbSessionPool::DbSessionPool(DbSessionPool &&other)
+{
+  StealResources(&other);
+}
+
+DbSessionPool &DbSessionPool::operator=(DbSessionPool &&other)
+{
+  if (this != &other)
+  {
+    CloseResources();
+    StealResources(&other);
+  }
+  return *this;
+}
+
+bool DbSessionPool::Checkout(DbSessionLease *out_lease)
+{
+  assert(state_);
+  assert(out_lease);
+
+  DbSessionLease::State *state = state_.get();
+  auto deadline = std::chrono::steady_clock::now() + state->checkout_timeout;
+
+  std::unique_lock<std::mutex> lock{state->mutex};
+
+  while (true)
+  {
+    std::unique_ptr<DbSessionLease::Entry> entry;
+
+    if (!state->idle.empty())
+    {
+      // Most recently used first; it is the least likely to need a ping
+      entry = std::move(state->idle.back());
+      state->idle.pop_back();
+      lock.unlock();
+
+      if (!state->Verify(entry.get()))
+      {
+        // Replace the dead session in place; its slot stays counted
+        entry.reset();
+        if (!state->Open(&entry))
+        {
+          state->Discard();
+          return false;
+        }
+      }
+
+      *out_lease = DbSessionLease{state, std::move(entry)};
+      return true;
+    }
+
+    if (state->open_count < state->max_sessions)
+    {
+      ++state->open_count;
+      lock.unlock();
+
+      if (!state->Open(&entry))
+      {
+        state->Discard();
+        return false;
+      }
+
+      *out_lease = DbSessionLease{state, std::move(entry)};
+      return true;
+    }
+
+    if (state->cv.wait_until(lock, deadline) == std::cv_status::timeout &&
+        state->idle.empty() &&
+        state->open_count >= state->max_sessions)
+    {
+      LOG(ERROR) << "Timed out waiting for one of " << state->max_sessions
+                 << " db sessions";
+      return false;
+    }
+  }
+}
+
+void DbSessionPool::CloseResources()
+{
+  if (!state_)
+  {
+    return;
+  }
+
+  for (auto &entry : state_->idle)
+  {
+    try
+    {
+      entry->session->close();
+    }
+    catch (const mysqlx::Error &e)
+    {
+      LOG(ERROR) << "Failed to close db session. Error: " << e;
+    }
+  }
+
+  state_.reset();
+}
+
+void DbSessionPool::StealResources(DbSessionPool *other)
+{
+  assert(other);
+  state_ = std::move(other->state_);
+}
+
+} // namespace organicdump
@@ -0,0 +1,119 @@
+#ifndef ORGANICDUMP_SERVER_DBSESSIONPOOL_H
+#define ORGANICDUMP_SERVER_DBSESSIONPOOL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <mysqlx/xdevapi.h>
+
+#include "DbStatementCache.h"
+
+namespace organicdump
+{
+
+class DbSessionPool;
+
+/**
+ * A pooled MySQL session checked out for the duration of one
+ * MySqlStorageEngine call.
+ * The session goes back to the pool when the lease is destroyed, so a lease
+ * must not outlive its pool.
+ */
+class DbSessionLease
+{
+public:
+  DbSessionLease();
+  ~DbSessionLease();
+  DbSessionLease(DbSessionLease &&other);
+  DbSessionLease &operator=(DbSessionLease &&other);
+
+  mysqlx::Session *GetSession();
+  mysqlx::Schema *GetSchema();
+  DbStatementCache *GetStatements();
+
+  /**
+   * Call after a mysqlx::Error. The session is pinged, and replaced if dead,
+   * before anyone reuses it.
+   */
+  void MarkSuspect();
+
+private:
+  friend class DbSessionPool;
+
+  struct Entry
+  {
+    std::unique_ptr<mysqlx::Session> session;
+    std::unique_ptr<mysqlx::Schema> schema;
+
+    // Declared after |schema|, which it references
+    std::unique_ptr<DbStatementCache> statements;
+    std::chrono::steady_clock::time_point last_verified;
+    bool is_suspect;
+  };
+
+  struct State;
+
+private:
+  DbSessionLease(State *pool, std::unique_ptr<Entry> entry);
+  void CloseResources();
+  void StealResources(DbSessionLease *other);
+
+private:
+  DbSessionLease(const DbSessionLease &other) = delete;
+  DbSessionLease &operator=(const DbSessionLease &other) = delete;
+
+private:
+  State *pool_;
+  std::unique_ptr<Entry> entry_;
+};
+
+/**
+ * Bounded pool of MySQL sessions. |min_sessions| are opened up front; more
+ * are opened on demand up to |max_sessions|, beyond which checkouts wait.
+ * A session idle for longer than |idle_ping_interval| (or one marked suspect)
+ * is pinged on checkout and transparently reconnected if the ping fails, so a
+ * MySQL restart costs a reconnect rather than a wedged server.
+ */
+class DbSessionPool
+{
+public:
+  static bool Create(
+      std::string url,
+      std::string schema_name,
+      size_t min_sessions,
+      size_t max_sessions,
+      std::chrono::milliseconds idle_ping_interval,
+      std::chrono::milliseconds checkout_timeout,
+      DbSessionPool *out_pool);
+
+public:
+  DbSessionPool();
+  ~DbSessionPool();
+  DbSessionPool(DbSessionPool &&other);
+  DbSessionPool &operator=(DbSessionPool &&other);
+
+  /** Safe to call from any thread. */
+  bool Checkout(DbSessionLease *out_lease);
+
+private:
+  DbSessionPool(std::unique_ptr<DbSessionLease::State> state);
+  void CloseResources();
+  void StealResources(DbSessionPool *other);
+
+private:
+  DbSessionPool(const DbSessionPool &other) = delete;
+  DbSessionPool &operator=(const DbSessionPool &other) = delete;
+
+private:
+  // Heap-allocated so that outstanding leases survive moves of the pool
+  std::unique_ptr<DbSessionLease::State> state_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_DBSESSIONPOOL_H
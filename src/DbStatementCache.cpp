@@ -0,0 +1,95 @@
+#include "DbStatementCache.h"
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include <mysqlx/xdevapi.h>
+
+namespace organicdump
+{
+
+DbStatementCache::DbStatementCache(mysqlx::Schema *schema)
+  : schema_{schema}
+{
+  assert(schema_);
+}
+
+mysqlx::Table *DbStatementCache::GetTable(const std::string &table_name)
+{
+  auto it = tables_.find(table_name);
+  if (it == tables_.end())
+  {
+    it = tables_.emplace(table_name, schema_->getTable(table_name)).first;
+  }
+
+  return &it->second;
+}
+
+mysqlx::TableRemove *DbStatementCache::GetRemove(
+    const std::string &table_name,
+    const std::string &condition)
+{
+  std::string key = table_name + " WHERE " + condition;
+
+  auto it = removes_.find(key);
+  if (it == removes_.end())
+  {
+    auto remove = std::make_unique<mysqlx::TableRemove>(
+        GetTable(table_name)->remove());
+    remove->where(condition);
+    it = removes_.emplace(std::move(key), std::move(remove)).first;
+  }
+
+  return it->second.get();
+}
+
+const std::string &DbStatementCache::GetInsertSql(
+    const std::string &table_name,
+    const std::string &columns,
+    size_t row_count,
+    const std::string &suffix)
+{
+  assert(!columns.empty());
+  assert(row_count > 0);
+
+  std::string key = table_name + " (" + columns + ") x" +
+      std::to_string(row_count) + " " + suffix;
+
+  auto it = inserts_.find(key);
+  if (it == inserts_.end())
+  {
+    std::string row = "(?";
+    for (char c : columns)
+    {
+      if (c == ',')
+      {
+        row += ", ?";
+      }
+    }
+    row += ")";
+
+    std::string statement = "INSERT INTO " + table_name + " (" + columns + ") VALUES ";
+    statement.reserve(statement.size() + row_count * (row.size() + 2) + suffix.size() + 1);
+    for (size_t i = 0; i < row_count; ++i)
+    {
+      if (i > 0)
+      {
+        statement += ", ";
+      }
+      statement += row;
+    }
+
+    if (!suffix.empty())
+    {
+      statement += " " + suffix;
+    }
+
+    it = inserts_.emplace(std::move(key), std::move(statement)).first;
+  }
+
+  return it->second;
+}
+
+} // namespace organicdump
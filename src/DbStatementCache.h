@@ -0,0 +1,62 @@
+#ifndef ORGANICDUMP_SERVER_DBSTATEMENTCACHE_H
+#define ORGANICDUMP_SERVER_DBSTATEMENTCACHE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <mysqlx/xdevapi.h>
+
+namespace organicdump
+{
+
+/**
+ * Table handles, parameterized statements and insert statement text built
+ * once per session and reused with fresh bindings. Re-executing the same CRUD
+ * statement object lets Connector/C++ prepare it server-side after the first
+ * execution, so repeat calls skip statement parsing on both ends.
+ *
+ * Belongs to exactly one session and is not thread-safe.
+ */
+class DbStatementCache
+{
+public:
+  DbStatementCache(mysqlx::Schema *schema);
+
+  mysqlx::Table *GetTable(const std::string &table_name);
+
+  /**
+   * Returns the cached "DELETE FROM |table_name| WHERE |condition|". Bind the
+   * condition's placeholders before each execute().
+   */
+  mysqlx::TableRemove *GetRemove(
+      const std::string &table_name,
+      const std::string &condition);
+
+  /**
+   * Returns the cached text of "INSERT INTO |table_name| (|columns|) VALUES"
+   * with |row_count| rows of placeholders, followed by |suffix|. |columns| is
+   * comma separated. Only the text is reused: positional bindings accumulate
+   * on a SqlStatement, so each execution binds a fresh session->sql() of it.
+   */
+  const std::string &GetInsertSql(
+      const std::string &table_name,
+      const std::string &columns,
+      size_t row_count,
+      const std::string &suffix = "");
+
+private:
+  DbStatementCache(const DbStatementCache &other) = delete;
+  DbStatementCache &operator=(const DbStatementCache &other) = delete;
+
+private:
+  mysqlx::Schema *schema_;
+  std::unordered_map<std::string, mysqlx::Table> tables_;
+  std::unordered_map<std::string, std::unique_ptr<mysqlx::TableRemove>> removes_;
+  std::unordered_map<std::string, std::string> inserts_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_DBSTATEMENTCACHE_H
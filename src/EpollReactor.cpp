@@ -0,0 +1,166 @@
+#include "EpollReactor.h"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <glog/logging.h>
+
+namespace organicdump
+{
+
+bool EpollReactor::Create(size_t max_events, EpollReactor *out_reactor)
+{
+  assert(out_reactor);
+  assert(max_events > 0);
+
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1)
+  {
+    LOG(ERROR) << "Failed to create epoll instance: " << strerror(errno);
+    return false;
+  }
+
+  *out_reactor = EpollReactor{epoll_fd, max_events};
+  return true;
+}
+
+EpollReactor::EpollReactor() : is_initialized_{false}, epoll_fd_{-1} {}
+
+EpollReactor::EpollReactor(int epoll_fd, size_t max_events)
+  : is_initialized_{true},
+    epoll_fd_{epoll_fd},
+    ready_events_(max_events) {}
+
+EpollReactor::EpollReactor(EpollReactor &&other)
+  : is_initialized_{false},
+    epoll_fd_{-1}
+{
+  StealResources(&other);
+}
+
+EpollReactor &EpollReactor::operator=(EpollReactor &&other)
+{
+  if (this != &other)
+  {
+    CloseResources();
+    StealResources(&other);
+  }
+  return *this;
+}
+
+EpollReactor::~EpollReactor()
+{
+  CloseResources();
+}
+
+bool EpollReactor::Add(int fd, uint32_t events)
+{
+  assert(is_initialized_);
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = fd;
+
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) == -1)
+  {
+    LOG(ERROR) << "Failed to add fd " << fd << " to epoll: " << strerror(errno);
+    return false;
+  }
+
+  return true;
+}
+
+bool EpollReactor::Modify(int fd, uint32_t events)
+{
+  assert(is_initialized_);
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = events;
+  event.data.fd = fd;
+
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) == -1)
+  {
+    LOG(ERROR) << "Failed to modify fd " << fd << " in epoll: " << strerror(errno);
+    return false;
+  }
+
+  return true;
+}
+
+bool EpollReactor::Remove(int fd)
+{
+  assert(is_initialized_);
+
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr) == -1)
+  {
+    LOG(ERROR) << "Failed to remove fd " << fd << " from epoll: " << strerror(errno);
+    return false;
+  }
+
+  return true;
+}
+
+bool EpollReactor::Wait(int timeout_ms, size_t *out_ready_count)
+{
+  assert(is_initialized_);
+  assert(out_ready_count);
+
+  int result = epoll_wait(
+      epoll_fd_,
+      ready_events_.data(),
+      static_cast<int>(ready_events_.size()),
+      timeout_ms);
+
+  if (result == -1)
+  {
+    if (errno == EINTR)
+    {
+      *out_ready_count = 0;
+      return true;
+    }
+
+    LOG(ERROR) << "Failed during epoll_wait(): " << strerror(errno);
+    return false;
+  }
+
+  *out_ready_count = static_cast<size_t>(result);
+  return true;
+}
+
+const struct epoll_event &EpollReactor::GetReadyEvent(size_t index) const
+{
+  assert(index < ready_events_.size());
+  return ready_events_[index];
+}
+
+void EpollReactor::CloseResources()
+{
+  if (!is_initialized_)
+  {
+    return;
+  }
+
+  is_initialized_ = false;
+  close(epoll_fd_);
+  epoll_fd_ = -1;
+  ready_events_.clear();
+}
+
+void EpollReactor::StealResources(EpollReactor *other)
+{
+  assert(other);
+  is_initialized_ = other->is_initialized_;
+  other->is_initialized_ = false;
+  epoll_fd_ = other->epoll_fd_;
+  other->epoll_fd_ = -1;
+  ready_events_ = std::move(other->ready_events_);
+}
+
+} // namespace organicdump
@@ -0,0 +1,57 @@
+#ifndef ORGANICDUMP_SERVER_EPOLLREACTOR_H
+#define ORGANICDUMP_SERVER_EPOLLREACTOR_H
+
+#include <sys/epoll.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace organicdump
+{
+
+/**
+ * Thin owner of an epoll instance. Sockets are registered once (on accept) and
+ * removed once (on kick), so each wakeup only costs O(ready fds) instead of
+ * rebuilding and scanning an fd_set.
+ */
+class EpollReactor
+{
+public:
+  static bool Create(size_t max_events, EpollReactor *out_reactor);
+
+public:
+  EpollReactor();
+  EpollReactor(int epoll_fd, size_t max_events);
+  EpollReactor(EpollReactor &&other);
+  EpollReactor &operator=(EpollReactor &&other);
+  ~EpollReactor();
+
+  bool Add(int fd, uint32_t events);
+  bool Modify(int fd, uint32_t events);
+  bool Remove(int fd);
+
+  /**
+   * Blocks for at most |timeout_ms| (-1 waits forever) and reports how many
+   * events are ready. Interrupted waits report zero ready events.
+   */
+  bool Wait(int timeout_ms, size_t *out_ready_count);
+  const struct epoll_event &GetReadyEvent(size_t index) const;
+
+private:
+  void CloseResources();
+  void StealResources(EpollReactor *other);
+
+private:
+  EpollReactor(const EpollReactor &other) = delete;
+  EpollReactor &operator=(const EpollReactor &other) = delete;
+
+private:
+  bool is_initialized_;
+  int epoll_fd_;
+  std::vector<struct epoll_event> ready_events_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_EPOLLREACTOR_H
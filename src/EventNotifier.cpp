@@ -0,0 +1,105 @@
+#include "EventNotifier.h"
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <glog/logging.h>
+
+namespace organicdump
+{
+
+bool EventNotifier::Create(EventNotifier *out_notifier)
+{
+  assert(out_notifier);
+
+  int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd == -1)
+  {
+    LOG(ERROR) << "Failed to create eventfd: " << strerror(errno);
+    return false;
+  }
+
+  *out_notifier = EventNotifier{fd};
+  return true;
+}
+
+EventNotifier::EventNotifier() : is_initialized_{false}, fd_{-1} {}
+
+EventNotifier::EventNotifier(int fd) : is_initialized_{true}, fd_{fd} {}
+
+EventNotifier::EventNotifier(EventNotifier &&other)
+  : is_initialized_{false},
+    fd_{-1}
+{
+  StealResources(&other);
+}
+
+EventNotifier &EventNotifier::operator=(EventNotifier &&other)
+{
+  if (this != &other)
+  {
+    CloseResources();
+    StealResources(&other);
+  }
+  return *this;
+}
+
+EventNotifier::~EventNotifier()
+{
+  CloseResources();
+}
+
+int EventNotifier::GetFd() const
+{
+  return fd_;
+}
+
+bool EventNotifier::Notify() const
+{
+  assert(is_initialized_);
+
+  uint64_t value = 1;
+  if (write(fd_, &value, sizeof(value)) != sizeof(value) && errno != EAGAIN)
+  {
+    LOG(ERROR) << "Failed to signal eventfd: " << strerror(errno);
+    return false;
+  }
+
+  return true;
+}
+
+void EventNotifier::Drain() const
+{
+  assert(is_initialized_);
+
+  uint64_t value;
+  while (read(fd_, &value, sizeof(value)) == sizeof(value)) {}
+}
+
+void EventNotifier::CloseResources()
+{
+  if (!is_initialized_)
+  {
+    return;
+  }
+
+  is_initialized_ = false;
+  close(fd_);
+  fd_ = -1;
+}
+
+void EventNotifier::StealResources(EventNotifier *other)
+{
+  assert(other);
+  is_initialized_ = other->is_initialized_;
+  other->is_initialized_ = false;
+  fd_ = other->fd_;
+  other->fd_ = -1;
+}
+
+} // namespace organicdump
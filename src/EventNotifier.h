@@ -0,0 +1,42 @@
+#ifndef ORGANICDUMP_SERVER_EVENTNOTIFIER_H
+#define ORGANICDUMP_SERVER_EVENTNOTIFIER_H
+
+namespace organicdump
+{
+
+/**
+ * eventfd wrapper used to wake a reactor thread blocked in epoll_wait() from
+ * another thread. Notify() is safe to call from any thread.
+ */
+class EventNotifier
+{
+public:
+  static bool Create(EventNotifier *out_notifier);
+
+public:
+  EventNotifier();
+  EventNotifier(int fd);
+  EventNotifier(EventNotifier &&other);
+  EventNotifier &operator=(EventNotifier &&other);
+  ~EventNotifier();
+
+  int GetFd() const;
+  bool Notify() const;
+  void Drain() const;
+
+private:
+  void CloseResources();
+  void StealResources(EventNotifier *other);
+
+private:
+  EventNotifier(const EventNotifier &other) = delete;
+  EventNotifier &operator=(const EventNotifier &other) = delete;
+
+private:
+  bool is_initialized_;
+  int fd_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_EVENTNOTIFIER_H
@@ -0,0 +1,299 @@
+#include "HotLog.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glog/logging.h>
+
+namespace
+{
+using organicdump::HotLogLine;
+
+// Lines per thread the flusher may fall behind by before lines are dropped
+constexpr size_t RING_CAPACITY = 1024;
+constexpr std::chrono::milliseconds FLUSH_INTERVAL{20};
+
+struct Entry
+{
+  const char *file;
+  int line;
+  int severity;
+  size_t size;
+  char text[HotLogLine::MAX_LINE_SIZE];
+};
+
+/** Single-producer, single-consumer ring of lines owned by one thread. */
+class Ring
+{
+public:
+  bool Push(const char *file, int line, int severity, const char *text, size_t size)
+  {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == RING_CAPACITY)
+    {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    Entry *entry = &entries_[head % RING_CAPACITY];
+    entry->file = file;
+    entry->line = line;
+    entry->severity = severity;
+    entry->size = std::min(size, sizeof(entry->text));
+    memcpy(entry->text, text, entry->size);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /** Consumer side; only ever called by the flusher. */
+  void Drain()
+  {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+
+    for (; tail != head; ++tail)
+    {
+      const Entry &entry = entries_[tail % RING_CAPACITY];
+      google::LogMessage(entry.file, entry.line, entry.severity).stream().write(
+          entry.text,
+          entry.size);
+
+      // Release each slot as soon as it is written out
+      tail_.store(tail + 1, std::memory_order_release);
+    }
+
+    uint64_t dropped = dropped_.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+      LOG(WARNING) << "Dropped " << dropped << " log lines since the flusher fell behind";
+    }
+  }
+
+  bool IsEmpty() const
+  {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+
+private:
+  std::array<Entry, RING_CAPACITY> entries_;
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+  std::atomic<uint64_t> dropped_{0};
+};
+
+struct Registry
+{
+  std::mutex mutex;
+  std::condition_variable stop_cv;
+  std::vector<std::shared_ptr<Ring>> rings;
+  std::thread flusher;
+  bool stop_requested{false};
+  std::atomic<bool> is_running{false};
+};
+
+Registry &GetRegistry()
+{
+  static Registry registry;
+  return registry;
+}
+
+// Shared with the registry so lines outlive the thread that wrote them
+thread_local std::shared_ptr<Ring> local_ring;
+
+Ring *GetLocalRing()
+{
+  if (!local_ring)
+  {
+    local_ring = std::make_shared<Ring>();
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    registry.rings.push_back(local_ring);
+  }
+  return local_ring.get();
+}
+
+void DrainAll()
+{
+  Registry &registry = GetRegistry();
+  std::vector<std::shared_ptr<Ring>> rings;
+  {
+    std::lock_guard<std::mutex> lock{registry.mutex};
+
+    // Forget rings of threads that have exited once they are drained
+    registry.rings.erase(
+        std::remove_if(
+            registry.rings.begin(),
+            registry.rings.end(),
+            [](const std::shared_ptr<Ring> &ring)
+            {
+              return ring.use_count() == 1 && ring->IsEmpty();
+            }),
+        registry.rings.end());
+    rings = registry.rings;
+  }
+
+  // Write to glog outside the lock so that new threads can register meanwhile
+  for (const std::shared_ptr<Ring> &ring : rings)
+  {
+    ring->Drain();
+  }
+}
+
+void RunFlusher()
+{
+  Registry &registry = GetRegistry();
+  std::unique_lock<std::mutex> lock{registry.mutex};
+
+  while (!registry.stop_requested)
+  {
+    registry.stop_cv.wait_for(lock, FLUSH_INTERVAL);
+    lock.unlock();
+    DrainAll();
+    lock.lock();
+  }
+}
+
+int64_t NowMs()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+} // namespace
+
+namespace organicdump
+{
+
+void HotLog::Start()
+{
+  Registry &registry = GetRegistry();
+  assert(!registry.is_running.load());
+
+  registry.stop_requested = false;
+  registry.flusher = std::thread{&RunFlusher};
+  registry.is_running.store(true, std::memory_order_release);
+}
+
+void HotLog::Stop()
+{
+  Registry &registry = GetRegistry();
+  if (!registry.is_running.exchange(false, std::memory_order_acq_rel))
+  {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock{registry.mutex};
+    registry.stop_requested = true;
+  }
+  registry.stop_cv.notify_one();
+  registry.flusher.join();
+
+  // Lines written since the flusher's last pass
+  DrainAll();
+}
+
+void HotLog::Write(
+    const char *file,
+    int line,
+    int severity,
+    const char *text,
+    size_t size)
+{
+  if (!GetRegistry().is_running.load(std::memory_order_acquire))
+  {
+    google::LogMessage(file, line, severity).stream().write(text, size);
+    return;
+  }
+
+  GetLocalRing()->Push(file, line, severity, text, size);
+}
+
+bool HotLogSite::Allow(int64_t interval_ms)
+{
+  int64_t now = NowMs();
+  int64_t next_allowed = next_allowed_ms_.load(std::memory_order_relaxed);
+
+  // Losing the race means another thread just took this interval's line
+  if (now < next_allowed ||
+      !next_allowed_ms_.compare_exchange_strong(
+          next_allowed,
+          now + interval_ms,
+          std::memory_order_relaxed))
+  {
+    suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  return true;
+}
+
+uint64_t HotLogSite::TakeSuppressed()
+{
+  return suppressed_.exchange(0, std::memory_order_relaxed);
+}
+
+HotLogLine::Buffer::Buffer(char *begin, size_t size)
+{
+  setp(begin, begin + size);
+}
+
+size_t HotLogLine::Buffer::GetSize() const
+{
+  return static_cast<size_t>(pptr() - pbase());
+}
+
+HotLogLine::Buffer::int_type HotLogLine::Buffer::overflow(int_type /* c */)
+{
+  // Full: fail the stream so that the rest of the line is skipped cheaply
+  return traits_type::eof();
+}
+
+HotLogLine::HotLogLine(
+    const char *file,
+    int line,
+    int severity,
+    uint64_t suppressed)
+  : file_{file},
+    line_{line},
+    severity_{severity},
+    suppressed_{suppressed},
+    buffer_{text_, sizeof(text_)},
+    stream_{&buffer_} {}
+
+HotLogLine::~HotLogLine()
+{
+  size_t size = buffer_.GetSize();
+
+  if (suppressed_ > 0 && size < sizeof(text_))
+  {
+    int written = snprintf(
+        text_ + size,
+        sizeof(text_) - size,
+        " [%llu similar suppressed]",
+        static_cast<unsigned long long>(suppressed_));
+    if (written > 0)
+    {
+      // snprintf() saves room for its terminator, which isn't part of the line
+      size = std::min(size + static_cast<size_t>(written), sizeof(text_) - 1);
+    }
+  }
+
+  HotLog::Write(file_, line_, severity_, text_, size);
+}
+
+std::ostream &HotLogLine::stream()
+{
+  return stream_;
+}
+
+} // namespace organicdump
@@ -0,0 +1,122 @@
+#ifndef ORGANICDUMP_SERVER_HOTLOG_H
+#define ORGANICDUMP_SERVER_HOTLOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <streambuf>
+
+// HOT_LOG lines below this severity are compiled out: 0 keeps INFO, 1 keeps
+// WARNING and up, 2 keeps only ERROR.
+#ifndef ORGANICDUMP_HOT_LOG_MIN_SEVERITY
+#define ORGANICDUMP_HOT_LOG_MIN_SEVERITY 1
+#endif
+
+namespace organicdump
+{
+
+// Numbered like glog's severities
+constexpr int HOT_LOG_INFO = 0;
+constexpr int HOT_LOG_WARNING = 1;
+constexpr int HOT_LOG_ERROR = 2;
+
+/**
+ * Logging for per-message paths, where writing to stderr under glog's lock
+ * would cost more than the work being logged.
+ *
+ * Each thread formats its lines into its own fixed-size ring without taking
+ * a lock; a background flusher drains every ring into glog. A thread whose
+ * ring is full drops lines (and says how many once there is room) rather
+ * than wait. Lines from one thread keep their order; glog stamps them when
+ * they are flushed, at most one flush interval late.
+ *
+ * Before Start() and after Stop() lines go straight to glog.
+ */
+class HotLog
+{
+public:
+  static void Start();
+
+  /** Flushes whatever is buffered and stops the flusher. */
+  static void Stop();
+
+  static void Write(
+      const char *file,
+      int line,
+      int severity,
+      const char *text,
+      size_t size);
+};
+
+/** Per-call-site state for HOT_LOG_EVERY_MS. */
+class HotLogSite
+{
+public:
+  /** Whether the site may log now; counts the lines it suppresses. */
+  bool Allow(int64_t interval_ms);
+  uint64_t TakeSuppressed();
+
+private:
+  std::atomic<int64_t> next_allowed_ms_{0};
+  std::atomic<uint64_t> suppressed_{0};
+};
+
+/** One line being formatted. Hands itself to HotLog when destroyed. */
+class HotLogLine
+{
+public:
+  HotLogLine(const char *file, int line, int severity, uint64_t suppressed = 0);
+  ~HotLogLine();
+  std::ostream &stream();
+
+public:
+  static constexpr size_t MAX_LINE_SIZE = 224;
+
+private:
+  /** Formats into |text_| and silently truncates long lines. */
+  class Buffer : public std::streambuf
+  {
+  public:
+    Buffer(char *begin, size_t size);
+    size_t GetSize() const;
+
+  protected:
+    int_type overflow(int_type c) override;
+  };
+
+private:
+  HotLogLine(const HotLogLine &other) = delete;
+  HotLogLine &operator=(const HotLogLine &other) = delete;
+
+private:
+  const char *file_;
+  int line_;
+  int severity_;
+  uint64_t suppressed_;
+  char text_[MAX_LINE_SIZE];
+  Buffer buffer_;
+  std::ostream stream_;
+};
+
+} // namespace organicdump
+
+#define HOT_LOG_IS_ON(severity) \
+  (::organicdump::HOT_LOG_##severity >= ORGANICDUMP_HOT_LOG_MIN_SEVERITY)
+
+/** Like LOG(severity), but buffered and stripped below the minimum severity. */
+#define HOT_LOG(severity) \
+  if constexpr (!HOT_LOG_IS_ON(severity)) {} \
+  else ::organicdump::HotLogLine( \
+      __FILE__, __LINE__, ::organicdump::HOT_LOG_##severity).stream()
+
+/** HOT_LOG that lets through at most one line per |interval_ms| per call site. */
+#define HOT_LOG_EVERY_MS(severity, interval_ms) \
+  if constexpr (!HOT_LOG_IS_ON(severity)) {} \
+  else if (static ::organicdump::HotLogSite hot_log_site; \
+           !hot_log_site.Allow(interval_ms)) {} \
+  else ::organicdump::HotLogLine( \
+      __FILE__, __LINE__, ::organicdump::HOT_LOG_##severity, \
+      hot_log_site.TakeSuppressed()).stream()
+
+#endif // ORGANICDUMP_SERVER_HOTLOG_H
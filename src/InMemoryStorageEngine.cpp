@@ -0,0 +1,441 @@
+#include "InMemoryStorageEngine.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include <glog/logging.h>
+
+namespace
+{
+// Matches AUTO_INCREMENT, so ids look the same whichever engine issued them
+constexpr size_t FIRST_ID = 1;
+
+constexpr int64_t HOUR_MS = 60 * 60 * 1000;
+
+/**
+ * Inserts or overwrites the reading at (|time_ms|, |seq|), keeping the
+ * columns sorted by that pair.
+ */
+void UpsertReading(
+    int64_t time_ms,
+    uint32_t seq,
+    float value,
+    std::vector<int64_t> *times,
+    std::vector<uint32_t> *seqs,
+    std::vector<float> *values)
+{
+  assert(times);
+  assert(seqs);
+  assert(values);
+
+  // Readings almost always arrive in time order, so appending is the norm
+  if (times->empty() ||
+      time_ms > times->back() ||
+      (time_ms == times->back() && seq > seqs->back()))
+  {
+    times->push_back(time_ms);
+    seqs->push_back(seq);
+    values->push_back(value);
+    return;
+  }
+
+  size_t index = static_cast<size_t>(
+      std::lower_bound(times->begin(), times->end(), time_ms) - times->begin());
+  while (index < times->size() && (*times)[index] == time_ms && (*seqs)[index] < seq)
+  {
+    ++index;
+  }
+
+  if (index < times->size() && (*times)[index] == time_ms && (*seqs)[index] == seq)
+  {
+    (*values)[index] = value;
+    return;
+  }
+
+  times->insert(times->begin() + index, time_ms);
+  seqs->insert(seqs->begin() + index, seq);
+  values->insert(values->begin() + index, value);
+}
+} // namespace
+
+namespace organicdump
+{
+
+InMemoryStorageEngine::InMemoryStorageEngine()
+  : next_rpi_id_{FIRST_ID},
+    next_peripheral_id_{FIRST_ID} {}
+
+InMemoryStorageEngine::~InMemoryStorageEngine() {}
+
+bool InMemoryStorageEngine::OrphanRpiOwnedPeripheral(size_t peripheral_id)
+{
+  std::unique_lock<std::shared_mutex> lock{registry_mutex_};
+
+  if (peripheral_owners_.erase(peripheral_id) == 0)
+  {
+    // Expected when a peripheral is assigned for the first time
+    LOG(INFO) << "Peripheral " << peripheral_id << " not owned by any rpi. Nothing to orphan";
+    return false;
+  }
+
+  return true;
+}
+
+bool InMemoryStorageEngine::AssignPeripheralToRpi(size_t rpi_id, size_t peripheral_id)
+{
+  std::unique_lock<std::shared_mutex> lock{registry_mutex_};
+
+  if (rpis_.count(rpi_id) == 0 || peripherals_.count(peripheral_id) == 0)
+  {
+    LOG(ERROR) << "Failed to insert rpi-peripheral edge. Unknown rpi " << rpi_id
+               << " or peripheral " << peripheral_id;
+    return false;
+  }
+
+  if (!peripheral_owners_.emplace(peripheral_id, rpi_id).second)
+  {
+    LOG(ERROR) << "Failed to insert rpi-peripheral edge. Peripheral "
+               << peripheral_id << " already owned";
+    return false;
+  }
+
+  return true;
+}
+
+bool InMemoryStorageEngine::ContainsRpi(size_t id)
+{
+  std::shared_lock<std::shared_mutex> lock{registry_mutex_};
+  return rpis_.count(id) > 0;
+}
+
+bool InMemoryStorageEngine::ContainsRpi(const std::string &name)
+{
+  std::shared_lock<std::shared_mutex> lock{registry_mutex_};
+  return rpi_ids_by_name_.count(name) > 0;
+}
+
+bool InMemoryStorageEngine::ContainsPeripheral(const std::string &name)
+{
+  std::shared_lock<std::shared_mutex> lock{registry_mutex_};
+  return peripheral_ids_by_name_.count(name) > 0;
+}
+
+bool InMemoryStorageEngine::ContainsPeripheral(size_t id)
+{
+  std::shared_lock<std::shared_mutex> lock{registry_mutex_};
+  return peripherals_.count(id) > 0;
+}
+
+bool InMemoryStorageEngine::ContainsSoilMoistureSensor(size_t id)
+{
+  std::shared_lock<std::shared_mutex> lock{registry_mutex_};
+  return soil_moisture_sensors_.count(id) > 0;
+}
+
+bool InMemoryStorageEngine::ContainsIrrigationSystem(size_t id)
+{
+  std::shared_lock<std::shared_mutex> lock{registry_mutex_};
+  return irrigation_system_ids_.count(id) > 0;
+}
+
+bool InMemoryStorageEngine::InsertRpi(
+    const std::string &name,
+    const std::string &location,
+    size_t *out_id)
+{
+  assert(out_id);
+
+  std::unique_lock<std::shared_mutex> lock{registry_mutex_};
+  *out_id = next_rpi_id_++;
+  rpis_.emplace(*out_id, Rpi{name, location});
+  rpi_ids_by_name_[name] = *out_id;
+  return true;
+}
+
+bool InMemoryStorageEngine::InsertSoilMoistureSensor(
+    const std::string& name,
+    float floor,
+    float ceil,
+    size_t *out_id)
+{
+  assert(out_id);
+
+  std::unique_lock<std::shared_mutex> lock{registry_mutex_};
+  if (!InsertPeripheral(name, out_id))
+  {
+    return false;
+  }
+
+  soil_moisture_sensors_.emplace(*out_id, SoilMoistureSensor{floor, ceil});
+  LOG(INFO) << "Soil moisture sensor " << *out_id << " registered successfully";
+  return true;
+}
+
+bool InMemoryStorageEngine::InsertSoilMoistureMeasurements(
+    const std::vector<SoilMoistureMeasurement> &measurements)
+{
+  // Check the whole batch first so that it is stored all or nothing, like a
+  // MySQL transaction. Sensors are never removed, so the check holds after
+  // the lock is released.
+  {
+    std::shared_lock<std::shared_mutex> lock{registry_mutex_};
+
+    size_t checked_id = 0;
+    bool is_checked = false;
+    for (const SoilMoistureMeasurement &measurement : measurements)
+    {
+      if (is_checked && measurement.sensor_id == checked_id)
+      {
+        continue;
+      }
+
+      if (soil_moisture_sensors_.count(measurement.sensor_id) == 0)
+      {
+        LOG(ERROR) << "Failed to insert soil moisture measurements. Unknown sensor "
+                   << measurement.sensor_id;
+        return false;
+      }
+
+      checked_id = measurement.sensor_id;
+      is_checked = true;
+    }
+  }
+
+  // Batches usually hold runs of one sensor's readings, so only relock when
+  // the sensor changes
+  SensorReadings *readings = nullptr;
+  size_t sensor_id = 0;
+  std::unique_lock<std::mutex> lock;
+
+  for (const SoilMoistureMeasurement &measurement : measurements)
+  {
+    if (!readings || measurement.sensor_id != sensor_id)
+    {
+      // Never hold a sensor's lock while waiting on the map's
+      if (lock.owns_lock())
+      {
+        lock.unlock();
+      }
+
+      sensor_id = measurement.sensor_id;
+      readings = GetSensorReadings(sensor_id, true);
+      lock = std::unique_lock<std::mutex>{readings->mutex};
+    }
+
+    UpsertReading(
+        measurement.time_ms,
+        measurement.seq,
+        measurement.value,
+        &readings->times,
+        &readings->seqs,
+        &readings->values);
+  }
+
+  return true;
+}
+
+bool InMemoryStorageEngine::GetSoilMoistureReadings(
+    size_t sensor_id,
+    int64_t start_ms,
+    int64_t end_ms,
+    size_t max_readings,
+    std::vector<int64_t> *out_times,
+    std::vector<float> *out_values)
+{
+  assert(out_times);
+  assert(out_values);
+
+  SensorReadings *readings = GetSensorReadings(sensor_id, false);
+  if (!readings)
+  {
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock{readings->mutex};
+
+  auto begin = std::lower_bound(readings->times.begin(), readings->times.end(), start_ms);
+  auto end = std::lower_bound(begin, readings->times.end(), end_ms);
+
+  // Keep the newest readings when there are too many
+  if (static_cast<size_t>(end - begin) > max_readings)
+  {
+    begin = end - static_cast<std::ptrdiff_t>(max_readings);
+  }
+
+  size_t first = static_cast<size_t>(begin - readings->times.begin());
+  size_t last = static_cast<size_t>(end - readings->times.begin());
+
+  out_times->insert(out_times->end(), begin, end);
+  out_values->insert(
+      out_values->end(),
+      readings->values.begin() + first,
+      readings->values.begin() + last);
+  return true;
+}
+
+bool InMemoryStorageEngine::RefreshSoilMoistureRollups()
+{
+  return true;
+}
+
+bool InMemoryStorageEngine::EnsureSoilMoistureReadingPartitions()
+{
+  return true;
+}
+
+bool InMemoryStorageEngine::PruneSoilMoistureReadings(int64_t cutoff_ms)
+{
+  // Whole hours only, like the engines that keep rollups
+  cutoff_ms -= cutoff_ms % HOUR_MS;
+
+  std::vector<SensorReadings *> sensors;
+  {
+    std::shared_lock<std::shared_mutex> lock{readings_mutex_};
+    sensors.reserve(readings_.size());
+    for (const auto &entry : readings_)
+    {
+      sensors.push_back(entry.second.get());
+    }
+  }
+
+  size_t deleted = 0;
+  for (SensorReadings *readings : sensors)
+  {
+    std::lock_guard<std::mutex> lock{readings->mutex};
+
+    auto end = std::lower_bound(readings->times.begin(), readings->times.end(), cutoff_ms);
+    size_t count = static_cast<size_t>(end - readings->times.begin());
+
+    readings->times.erase(readings->times.begin(), end);
+    readings->seqs.erase(readings->seqs.begin(), readings->seqs.begin() + count);
+    readings->values.erase(readings->values.begin(), readings->values.begin() + count);
+    deleted += count;
+  }
+
+  LOG(INFO) << "Pruned " << deleted << " soil moisture reading(s) older than " << cutoff_ms;
+  return true;
+}
+
+bool InMemoryStorageEngine::UpdatePeripheralOwnership(size_t peripheral_id, size_t rpi_id)
+{
+  std::unique_lock<std::shared_mutex> lock{registry_mutex_};
+
+  if (peripherals_.count(peripheral_id) == 0)
+  {
+    LOG(ERROR) << "Could not find peripheral w/id: " << peripheral_id;
+    return false;
+  }
+
+  if (rpis_.count(rpi_id) == 0)
+  {
+    LOG(ERROR) << "Could not find rpi w/id: " << rpi_id;
+    return false;
+  }
+
+  peripheral_owners_[peripheral_id] = rpi_id;
+  return true;
+}
+
+bool InMemoryStorageEngine::InsertIrrigationSystem(
+    const std::string& name,
+    size_t *out_id)
+{
+  assert(out_id);
+
+  std::unique_lock<std::shared_mutex> lock{registry_mutex_};
+  if (!InsertPeripheral(name, out_id))
+  {
+    return false;
+  }
+
+  irrigation_system_ids_.insert(*out_id);
+  LOG(INFO) << "Irrigation system " << *out_id << " registered successfully";
+  return true;
+}
+
+bool InMemoryStorageEngine::ReplaceDailyIrrigationSchedules(
+    size_t irrigation_system_id,
+    const std::vector<DailyIrrigationSchedule> &schedules)
+{
+  std::unique_lock<std::shared_mutex> lock{registry_mutex_};
+
+  if (schedules.empty())
+  {
+    schedules_.erase(irrigation_system_id);
+    return true;
+  }
+
+  if (irrigation_system_ids_.count(irrigation_system_id) == 0)
+  {
+    LOG(ERROR) << "Failed to replace daily irrigation schedules. Unknown irrigation system "
+               << irrigation_system_id;
+    return false;
+  }
+
+  schedules_[irrigation_system_id] = schedules;
+  return true;
+}
+
+bool InMemoryStorageEngine::GetDailyIrrigationSchedules(
+    std::vector<DailyIrrigationSchedule> *out_schedules)
+{
+  assert(out_schedules);
+
+  std::shared_lock<std::shared_mutex> lock{registry_mutex_};
+  for (const auto &entry : schedules_)
+  {
+    out_schedules->insert(out_schedules->end(), entry.second.begin(), entry.second.end());
+  }
+  return true;
+}
+
+bool InMemoryStorageEngine::InsertPeripheral(const std::string &name, size_t *out_id)
+{
+  assert(out_id);
+
+  if (peripheral_ids_by_name_.count(name) > 0)
+  {
+    LOG(ERROR) << "Failed to insert peripheral. Name already taken: " << name;
+    return false;
+  }
+
+  *out_id = next_peripheral_id_++;
+  peripherals_.emplace(*out_id, name);
+  peripheral_ids_by_name_.emplace(name, *out_id);
+  return true;
+}
+
+InMemoryStorageEngine::SensorReadings *InMemoryStorageEngine::GetSensorReadings(
+    size_t sensor_id,
+    bool create)
+{
+  {
+    std::shared_lock<std::shared_mutex> lock{readings_mutex_};
+    auto it = readings_.find(sensor_id);
+    if (it != readings_.end())
+    {
+      return it->second.get();
+    }
+  }
+
+  if (!create)
+  {
+    return nullptr;
+  }
+
+  std::unique_lock<std::shared_mutex> lock{readings_mutex_};
+  std::unique_ptr<SensorReadings> &readings = readings_[sensor_id];
+  if (!readings)
+  {
+    readings = std::make_unique<SensorReadings>();
+  }
+  return readings.get();
+}
+
+} // namespace organicdump
@@ -0,0 +1,154 @@
+#ifndef ORGANICDUMP_SERVER_INMEMORYSTORAGEENGINE_H
+#define ORGANICDUMP_SERVER_INMEMORYSTORAGEENGINE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "StorageEngine.h"
+
+namespace organicdump
+{
+
+/**
+ * Keeps every table in process and loses it on exit. Registry tables are
+ * hash maps keyed the way the server looks them up, under one reader-writer
+ * lock. Readings are stored per sensor as parallel time, seq and value
+ * columns sorted by (time, seq), each sensor under its own lock, so
+ * concurrent batches for different sensors don't contend and a range read is
+ * a binary search and a copy.
+ *
+ * Enforces the same keys as the MySQL schema: peripheral names are unique,
+ * and ownership edges and schedules must refer to existing rows. Like every
+ * engine, it rejects readings of unregistered sensors, which here also keeps
+ * a bad sensor id from allocating storage.
+ */
+class InMemoryStorageEngine : public StorageEngine
+{
+public:
+  InMemoryStorageEngine();
+  virtual ~InMemoryStorageEngine();
+  bool OrphanRpiOwnedPeripheral(size_t peripheral_id) override;
+  bool AssignPeripheralToRpi(size_t rpi_id, size_t peripheral_id) override;
+  bool ContainsRpi(size_t id) override;
+  bool ContainsRpi(const std::string &name) override;
+  bool ContainsPeripheral(const std::string &name) override;
+  bool ContainsPeripheral(size_t id) override;
+  bool ContainsSoilMoistureSensor(size_t id) override;
+  bool ContainsIrrigationSystem(size_t id) override;
+  bool InsertRpi(
+      const std::string &name,
+      const std::string &location,
+      size_t *out_id) override;
+  bool InsertSoilMoistureSensor(
+      const std::string& name,
+      float floor,
+      float ceil,
+      size_t *out_id) override;
+  bool InsertSoilMoistureMeasurements(
+      const std::vector<SoilMoistureMeasurement> &measurements) override;
+  bool GetSoilMoistureReadings(
+      size_t sensor_id,
+      int64_t start_ms,
+      int64_t end_ms,
+      size_t max_readings,
+      std::vector<int64_t> *out_times,
+      std::vector<float> *out_values) override;
+
+  /**
+   * Rollups exist for readers of the MySQL tables. Nothing outside the
+   * process can read this engine, so it keeps none.
+   */
+  bool RefreshSoilMoistureRollups() override;
+  bool PruneSoilMoistureReadings(int64_t cutoff_ms) override;
+  bool EnsureSoilMoistureReadingPartitions() override;
+  bool UpdatePeripheralOwnership(
+      size_t peripheral_id,
+      size_t rpi_id) override;
+  bool InsertIrrigationSystem(
+      const std::string& name,
+      size_t *out_id) override;
+  bool ReplaceDailyIrrigationSchedules(
+      size_t irrigation_system_id,
+      const std::vector<DailyIrrigationSchedule> &schedules) override;
+  bool GetDailyIrrigationSchedules(
+      std::vector<DailyIrrigationSchedule> *out_schedules) override;
+
+private:
+  struct Rpi
+  {
+    std::string name;
+    std::string location;
+  };
+
+  struct SoilMoistureSensor
+  {
+    float floor;
+    float ceil;
+  };
+
+  struct SensorReadings
+  {
+    std::mutex mutex;
+
+    // Sorted by (time, seq), which is unique
+    std::vector<int64_t> times;
+    std::vector<uint32_t> seqs;
+    std::vector<float> values;
+  };
+
+private:
+  /** Must be called with |registry_mutex_| held exclusively. */
+  bool InsertPeripheral(const std::string &name, size_t *out_id);
+
+  /**
+   * Entries are never removed, so the result stays valid without
+   * |readings_mutex_| held. Only create entries for registered sensors.
+   */
+  SensorReadings *GetSensorReadings(size_t sensor_id, bool create);
+
+private:
+  InMemoryStorageEngine(const InMemoryStorageEngine &other) = delete;
+  InMemoryStorageEngine &operator=(const InMemoryStorageEngine &other) = delete;
+
+private:
+  // Guards every registry table and the schedules
+  mutable std::shared_mutex registry_mutex_;
+
+  // Next AUTO_INCREMENT values. Sensors and irrigation systems share the
+  // peripheral ids.
+  size_t next_rpi_id_;
+  size_t next_peripheral_id_;
+
+  std::unordered_map<size_t, Rpi> rpis_;
+
+  // Rpi names aren't unique, so this maps to the newest rpi of each name
+  std::unordered_map<std::string, size_t> rpi_ids_by_name_;
+
+  // peripheral id -> name, and back
+  std::unordered_map<size_t, std::string> peripherals_;
+  std::unordered_map<std::string, size_t> peripheral_ids_by_name_;
+
+  std::unordered_map<size_t, SoilMoistureSensor> soil_moisture_sensors_;
+  std::unordered_set<size_t> irrigation_system_ids_;
+
+  // peripheral id -> owning rpi id
+  std::unordered_map<size_t, size_t> peripheral_owners_;
+
+  // irrigation system id -> its schedules
+  std::unordered_map<size_t, std::vector<DailyIrrigationSchedule>> schedules_;
+
+  // Guards the map itself. Each sensor's columns have their own lock.
+  std::shared_mutex readings_mutex_;
+  std::unordered_map<size_t, std::unique_ptr<SensorReadings>> readings_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_INMEMORYSTORAGEENGINE_H
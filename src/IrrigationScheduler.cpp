@@ -0,0 +1,390 @@
+#include "IrrigationScheduler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "organic_dump.pb.h"
+
+#include "ClientDirectory.h"
+#include "CompletionQueue.h"
+#include "DbManager.h"
+#include "OrganicDumpProtoMessage.h"
+#include "ProtobufClient.h"
+
+namespace
+{
+using organicdump_proto::ClientType;
+using organicdump_proto::UnscheduledIrrigationRequest;
+
+constexpr int64_t NO_TIMER_MS = std::numeric_limits<int64_t>::max();
+constexpr int DAYS_PER_WEEK = 7;
+constexpr int64_t MS_PER_WEEK = int64_t{DAYS_PER_WEEK} * 24 * 60 * 60 * 1000;
+
+// Compact once at least this many stale timers make up half the heap
+constexpr size_t MIN_STALE_TIMERS_TO_COMPACT = 64;
+
+int64_t ToMs(organicdump::IrrigationScheduler::Clock::time_point time)
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      time.time_since_epoch()).count();
+}
+
+int64_t NowMs()
+{
+  return ToMs(organicdump::IrrigationScheduler::Clock::now());
+}
+
+/** Accepts "HHMM", "HMM" and "HH:MM". */
+bool ParseMilitaryTime(const std::string &text, int *out_minute_of_day)
+{
+  assert(out_minute_of_day);
+
+  int value = 0;
+  size_t digits = 0;
+  for (char c : text)
+  {
+    if (c == ':')
+    {
+      continue;
+    }
+
+    if (!std::isdigit(static_cast<unsigned char>(c)) || ++digits > 4)
+    {
+      return false;
+    }
+
+    value = value * 10 + (c - '0');
+  }
+
+  int hours = value / 100;
+  int minutes = value % 100;
+  if (digits < 3 || hours >= 24 || minutes >= 60)
+  {
+    return false;
+  }
+
+  *out_minute_of_day = hours * 60 + minutes;
+  return true;
+}
+
+/**
+ * First local time after |after_ms| that falls on |day_of_week| at
+ * |minute_of_day|. Goes through mktime() so that DST shifts are honoured.
+ */
+int64_t GetNextFireMs(int day_of_week, int minute_of_day, int64_t after_ms)
+{
+  time_t after = static_cast<time_t>(after_ms / 1000);
+  struct tm local;
+  localtime_r(&after, &local);
+
+  for (int days = 0; days <= DAYS_PER_WEEK; ++days)
+  {
+    struct tm candidate = local;
+    candidate.tm_mday += days;
+    candidate.tm_hour = minute_of_day / 60;
+    candidate.tm_min = minute_of_day % 60;
+    candidate.tm_sec = 0;
+    candidate.tm_isdst = -1;
+
+    time_t fire = mktime(&candidate);
+    if (fire == -1 || candidate.tm_wday != day_of_week)
+    {
+      continue;
+    }
+
+    int64_t fire_ms = static_cast<int64_t>(fire) * 1000;
+    if (fire_ms > after_ms)
+    {
+      return fire_ms;
+    }
+  }
+
+  return after_ms + MS_PER_WEEK;
+}
+
+} // namespace
+
+namespace organicdump
+{
+
+bool IrrigationScheduler::IsValid(const DailyIrrigationSchedule &schedule)
+{
+  int minute_of_day = 0;
+  return schedule.day_of_week_index < DAYS_PER_WEEK &&
+      ParseMilitaryTime(schedule.water_time_military, &minute_of_day);
+}
+
+IrrigationScheduler::IrrigationScheduler(std::shared_ptr<ClientDirectory> directory)
+  : directory_{std::move(directory)},
+    stale_timer_count_{0},
+    next_generation_{0}
+{
+  assert(directory_);
+}
+
+void IrrigationScheduler::Load(const std::vector<DailyIrrigationSchedule> &schedules)
+{
+  int64_t now_ms = NowMs();
+  int64_t previous_fire_ms;
+  int64_t next_fire_ms;
+  size_t loaded = 0;
+
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    previous_fire_ms = GetNextFireMsLocked();
+
+    for (const DailyIrrigationSchedule &schedule : schedules)
+    {
+      if (AddLocked(schedule, now_ms))
+      {
+        ++loaded;
+      }
+    }
+
+    next_fire_ms = GetNextFireMsLocked();
+  }
+
+  LOG(INFO) << "Loaded " << loaded << " daily irrigation schedules";
+  Wake(previous_fire_ms, next_fire_ms);
+}
+
+void IrrigationScheduler::Replace(
+    size_t irrigation_system_id,
+    const std::vector<DailyIrrigationSchedule> &schedules)
+{
+  int64_t now_ms = NowMs();
+  int64_t previous_fire_ms;
+  int64_t next_fire_ms;
+
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    previous_fire_ms = GetNextFireMsLocked();
+
+    // Orphans the system's existing timers
+    SystemTimers *system = GetSystemLocked(irrigation_system_id);
+    system->generation = next_generation_++;
+    stale_timer_count_ += system->live_timer_count;
+    system->live_timer_count = 0;
+
+    for (const DailyIrrigationSchedule &schedule : schedules)
+    {
+      assert(schedule.irrigation_system_id == irrigation_system_id);
+      AddLocked(schedule, now_ms);
+    }
+
+    CompactLocked();
+    next_fire_ms = GetNextFireMsLocked();
+  }
+
+  Wake(previous_fire_ms, next_fire_ms);
+}
+
+void IrrigationScheduler::SetWakeup(std::shared_ptr<CompletionQueue> completions)
+{
+  std::lock_guard<std::mutex> lock{mutex_};
+  wakeup_ = std::move(completions);
+}
+
+int IrrigationScheduler::GetTimeoutMs(Clock::time_point now) const
+{
+  int64_t next_fire_ms;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    next_fire_ms = GetNextFireMsLocked();
+  }
+
+  if (next_fire_ms == NO_TIMER_MS)
+  {
+    return -1;
+  }
+
+  int64_t remaining_ms = std::max<int64_t>(0, next_fire_ms - ToMs(now));
+  return static_cast<int>(std::min<int64_t>(
+      remaining_ms,
+      std::numeric_limits<int>::max()));
+}
+
+void IrrigationScheduler::RunDue(Clock::time_point now)
+{
+  int64_t now_ms = ToMs(now);
+  std::vector<Schedule> due;
+
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    while (!timers_.empty() && timers_.front().fire_ms <= now_ms)
+    {
+      std::pop_heap(timers_.begin(), timers_.end(), TimerLater{});
+      Timer timer = timers_.back();
+      timers_.pop_back();
+
+      if (IsStaleLocked(timer))
+      {
+        assert(stale_timer_count_ > 0);
+        --stale_timer_count_;
+        continue;
+      }
+
+      due.push_back(timer.schedule);
+
+      // Re-arm from the scheduled time rather than now so that a late
+      // wakeup doesn't fire the same slot twice.
+      timer.fire_ms = GetNextFireMs(
+          timer.schedule.day_of_week,
+          timer.schedule.minute_of_day,
+          std::max(timer.fire_ms, now_ms));
+      PushTimerLocked(timer);
+    }
+  }
+
+  for (const Schedule &schedule : due)
+  {
+    UnscheduledIrrigationRequest request;
+    request.set_irrigation_system_id(schedule.irrigation_system_id);
+    request.set_duration_ms(schedule.duration_ms);
+
+    LOG(INFO) << "Running scheduled irrigation:"
+              << " irrigation_system_id=" << schedule.irrigation_system_id
+              << ", water_duration_ms=" << schedule.duration_ms;
+
+    bool is_routed = directory_->Post(
+        ClientType::IRRIGATION_SYSTEM,
+        schedule.irrigation_system_id,
+        [request](ProtobufClient *device)
+        {
+          OrganicDumpProtoMessage command{request};
+          if (!device->Write(&command))
+          {
+            LOG(ERROR) << "Failed to queue scheduled irrigation for irrigation system "
+                       << request.irrigation_system_id();
+            device->RequestClose();
+            return;
+          }
+
+          // Nobody waits on a scheduled run, but its ack still takes a turn
+          device->ExpectAck(nullptr);
+        });
+
+    if (!is_routed)
+    {
+      LOG(ERROR) << "Skipping scheduled irrigation since irrigation system "
+                 << schedule.irrigation_system_id << " is not connected";
+    }
+  }
+}
+
+IrrigationScheduler::SystemTimers *IrrigationScheduler::GetSystemLocked(
+    size_t irrigation_system_id)
+{
+  auto it = systems_.find(irrigation_system_id);
+  if (it == systems_.end())
+  {
+    it = systems_.emplace(
+        irrigation_system_id,
+        SystemTimers{next_generation_++, 0}).first;
+  }
+
+  return &it->second;
+}
+
+bool IrrigationScheduler::IsStaleLocked(const Timer &timer)
+{
+  return timer.generation != GetSystemLocked(timer.schedule.irrigation_system_id)->generation;
+}
+
+bool IrrigationScheduler::AddLocked(
+    const DailyIrrigationSchedule &schedule,
+    int64_t now_ms)
+{
+  int minute_of_day = 0;
+  if (schedule.day_of_week_index >= DAYS_PER_WEEK ||
+      !ParseMilitaryTime(schedule.water_time_military, &minute_of_day))
+  {
+    LOG(ERROR) << "Ignoring malformed daily irrigation schedule:"
+               << " irrigation_system_id=" << schedule.irrigation_system_id
+               << ", day_of_week_index=" << schedule.day_of_week_index
+               << ", water_time_military=" << schedule.water_time_military;
+    return false;
+  }
+
+  Schedule entry{
+      schedule.irrigation_system_id,
+      static_cast<int>(schedule.day_of_week_index),
+      minute_of_day,
+      static_cast<uint32_t>(schedule.water_duration_ms)};
+
+  SystemTimers *system = GetSystemLocked(schedule.irrigation_system_id);
+  ++system->live_timer_count;
+
+  PushTimerLocked(Timer{
+      GetNextFireMs(entry.day_of_week, entry.minute_of_day, now_ms),
+      entry,
+      system->generation});
+  return true;
+}
+
+void IrrigationScheduler::PushTimerLocked(Timer timer)
+{
+  timers_.push_back(timer);
+  std::push_heap(timers_.begin(), timers_.end(), TimerLater{});
+}
+
+void IrrigationScheduler::CompactLocked()
+{
+  if (stale_timer_count_ < MIN_STALE_TIMERS_TO_COMPACT ||
+      stale_timer_count_ * 2 < timers_.size())
+  {
+    return;
+  }
+
+  timers_.erase(
+      std::remove_if(
+          timers_.begin(),
+          timers_.end(),
+          [this](const Timer &timer)
+          {
+            return IsStaleLocked(timer);
+          }),
+      timers_.end());
+  std::make_heap(timers_.begin(), timers_.end(), TimerLater{});
+  stale_timer_count_ = 0;
+}
+
+int64_t IrrigationScheduler::GetNextFireMsLocked() const
+{
+  return timers_.empty() ? NO_TIMER_MS : timers_.front().fire_ms;
+}
+
+void IrrigationScheduler::Wake(int64_t previous_fire_ms, int64_t next_fire_ms)
+{
+  if (next_fire_ms >= previous_fire_ms)
+  {
+    return;
+  }
+
+  std::shared_ptr<CompletionQueue> wakeup;
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    wakeup = wakeup_;
+  }
+
+  // Any completion makes the reactor recompute its wait timeout
+  if (wakeup)
+  {
+    wakeup->Post([]() {});
+  }
+}
+
+} // namespace organicdump
@@ -0,0 +1,126 @@
+#ifndef ORGANICDUMP_SERVER_IRRIGATIONSCHEDULER_H
+#define ORGANICDUMP_SERVER_IRRIGATIONSCHEDULER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "ClientDirectory.h"
+#include "CompletionQueue.h"
+#include "DbManager.h"
+
+namespace organicdump
+{
+
+/**
+ * Waters irrigation systems on their daily schedules. Every schedule has one
+ * timer in a min-heap keyed by its next fire time, so the reactor that runs
+ * the scheduler only wakes when a timer is due and each firing costs
+ * O(log n) however many schedules there are.
+ *
+ * Schedules name a day of the week (0 is Sunday) and a local "HHMM" time.
+ * Firing pushes an UnscheduledIrrigationRequest to the irrigation system
+ * through |directory|; systems that aren't connected miss that watering.
+ *
+ * Safe to call from any thread, but GetTimeoutMs() and RunDue() are meant
+ * for the one reactor whose CompletionQueue is passed to SetWakeup().
+ */
+class IrrigationScheduler
+{
+public:
+  // Schedules are wall-clock times of day
+  using Clock = std::chrono::system_clock;
+
+public:
+  /** Whether |schedule| names a real day of the week and time of day. */
+  static bool IsValid(const DailyIrrigationSchedule &schedule);
+
+public:
+  explicit IrrigationScheduler(std::shared_ptr<ClientDirectory> directory);
+
+  /** Adds |schedules|, e.g. everything stored in MySQL at startup. */
+  void Load(const std::vector<DailyIrrigationSchedule> &schedules);
+
+  /** Replaces every schedule of |irrigation_system_id| with |schedules|. */
+  void Replace(
+      size_t irrigation_system_id,
+      const std::vector<DailyIrrigationSchedule> &schedules);
+
+  /**
+   * Wakes the reactor that runs the scheduler when a new schedule is due
+   * sooner than the one it is waiting for.
+   */
+  void SetWakeup(std::shared_ptr<CompletionQueue> completions);
+
+  /** Milliseconds after |now| until the next timer is due, or -1 if none. */
+  int GetTimeoutMs(Clock::time_point now) const;
+
+  /** Fires every timer due by |now| and re-arms it for the following week. */
+  void RunDue(Clock::time_point now);
+
+private:
+  struct Schedule
+  {
+    size_t irrigation_system_id;
+    int day_of_week;
+    int minute_of_day;
+    uint32_t duration_ms;
+  };
+
+  struct Timer
+  {
+    int64_t fire_ms;
+    Schedule schedule;
+
+    // Timers of replaced schedules are skipped when they reach the top
+    uint64_t generation;
+  };
+
+  struct SystemTimers
+  {
+    uint64_t generation;
+    size_t live_timer_count;
+  };
+
+  /** Orders the heap so that the earliest timer is at the front. */
+  struct TimerLater
+  {
+    bool operator()(const Timer &lhs, const Timer &rhs) const
+    {
+      return lhs.fire_ms > rhs.fire_ms;
+    }
+  };
+
+private:
+  SystemTimers *GetSystemLocked(size_t irrigation_system_id);
+  bool IsStaleLocked(const Timer &timer);
+  bool AddLocked(const DailyIrrigationSchedule &schedule, int64_t now_ms);
+  void PushTimerLocked(Timer timer);
+  void CompactLocked();
+  int64_t GetNextFireMsLocked() const;
+  void Wake(int64_t previous_fire_ms, int64_t next_fire_ms);
+
+private:
+  IrrigationScheduler(const IrrigationScheduler &other) = delete;
+  IrrigationScheduler &operator=(const IrrigationScheduler &other) = delete;
+
+private:
+  std::shared_ptr<ClientDirectory> directory_;
+  mutable std::mutex mutex_;
+  std::shared_ptr<CompletionQueue> wakeup_;
+
+  // Min-heap on fire_ms
+  std::vector<Timer> timers_;
+  size_t stale_timer_count_;
+
+  std::unordered_map<size_t, SystemTimers> systems_;
+  uint64_t next_generation_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_IRRIGATIONSCHEDULER_H
@@ -0,0 +1,85 @@
+#include "IrrigationSystemClientHandler.h"
+
+#include <cassert>
+#include <memory>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "ClientStore.h"
+#include "IrrigationScheduler.h"
+#include "ProtobufClient.h"
+#include "OrganicDumpProtoMessage.h"
+
+namespace
+{
+using organicdump_proto::ClientType;
+using organicdump_proto::ErrorCode;
+using organicdump_proto::MessageType;
+} // namespace
+
+namespace organicdump
+{
+
+IrrigationSystemClientHandler::IrrigationSystemClientHandler(
+    std::shared_ptr<IrrigationScheduler> scheduler)
+  : scheduler_{std::move(scheduler)} {}
+
+IrrigationSystemClientHandler::~IrrigationSystemClientHandler() {}
+
+bool IrrigationSystemClientHandler::Handle(
+    const OrganicDumpProtoMessage &msg,
+    ProtobufClient *client,
+    ClientStore *clients)
+{
+  assert(client);
+  assert(clients);
+  assert(client->GetType() == ClientType::IRRIGATION_SYSTEM);
+
+  if (msg.type != MessageType::BASIC_RESPONSE)
+  {
+    LOG(ERROR) << "Received unexpected message from irrigation system: "
+               << MessageType_Name(msg.type);
+    return false;
+  }
+
+  if (msg.basic_response.code() != ErrorCode::OK)
+  {
+    LOG(ERROR) << "Irrigation system " << client->GetId() << " rejected command: "
+               << msg.basic_response.message();
+  }
+  else
+  {
+    LOG(INFO) << "Irrigation system " << client->GetId() << " acknowledged command";
+  }
+
+  ProtobufClient::AckHandler on_ack;
+  if (!client->TakeExpectedAck(&on_ack))
+  {
+    LOG(ERROR) << "Irrigation system " << client->GetId()
+               << " acknowledged a command that was never sent";
+    return true;
+  }
+
+  if (on_ack)
+  {
+    on_ack(msg.basic_response);
+  }
+
+  return true;
+}
+
+int IrrigationSystemClientHandler::GetPollTimeoutMs()
+{
+  return scheduler_ ? scheduler_->GetTimeoutMs(IrrigationScheduler::Clock::now()) : -1;
+}
+
+void IrrigationSystemClientHandler::Poll(ClientStore * /* clients */)
+{
+  if (scheduler_)
+  {
+    scheduler_->RunDue(IrrigationScheduler::Clock::now());
+  }
+}
+
+} // namespace organicdump
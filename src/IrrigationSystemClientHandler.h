@@ -0,0 +1,39 @@
+#ifndef ORGANICDUMP_SERVER_IRRIGATIONSYSTEMCLIENTHANDLER_H
+#define ORGANICDUMP_SERVER_IRRIGATIONSYSTEMCLIENTHANDLER_H
+
+#include <memory>
+
+#include "ClientHandler.h"
+#include "ClientStore.h"
+#include "IrrigationScheduler.h"
+#include "ProtobufClient.h"
+#include "OrganicDumpProtoMessage.h"
+
+namespace organicdump
+{
+
+/**
+ * Handles messages from irrigation systems. Commands reach them through the
+ * ClientDirectory; all they send back are acknowledgements, which are
+ * matched to commands in the order they were written. The handler of
+ * one reactor also runs the shared |scheduler|; the others get null.
+ */
+class IrrigationSystemClientHandler : public ClientHandler
+{
+public:
+  explicit IrrigationSystemClientHandler(std::shared_ptr<IrrigationScheduler> scheduler);
+  virtual ~IrrigationSystemClientHandler();
+  bool Handle(
+      const OrganicDumpProtoMessage &msg,
+      ProtobufClient *client,
+      ClientStore *clients) override;
+  int GetPollTimeoutMs() override;
+  void Poll(ClientStore *clients) override;
+
+private:
+  std::shared_ptr<IrrigationScheduler> scheduler_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_IRRIGATIONSYSTEMCLIENTHANDLER_H
@@ -0,0 +1,90 @@
+#include "MeasurementBatcher.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+namespace organicdump
+{
+
+MeasurementBatcher::MeasurementBatcher()
+  : MeasurementBatcher{1, std::chrono::milliseconds{0}} {}
+
+MeasurementBatcher::MeasurementBatcher(
+    size_t max_batch_size,
+    std::chrono::milliseconds max_delay)
+  : max_batch_size_{max_batch_size},
+    max_delay_{max_delay},
+    oldest_time_{},
+    senders_{},
+    measurements_{}
+{
+  assert(max_batch_size_ > 0);
+  senders_.reserve(max_batch_size_);
+  measurements_.reserve(max_batch_size_);
+}
+
+void MeasurementBatcher::Add(Sender sender, SoilMoistureMeasurement measurement)
+{
+  if (measurements_.empty())
+  {
+    oldest_time_ = Clock::now();
+  }
+
+  senders_.push_back(sender);
+  measurements_.push_back(measurement);
+}
+
+bool MeasurementBatcher::IsEmpty() const
+{
+  return measurements_.empty();
+}
+
+bool MeasurementBatcher::IsDue() const
+{
+  if (measurements_.empty())
+  {
+    return false;
+  }
+
+  return measurements_.size() >= max_batch_size_ ||
+         Clock::now() - oldest_time_ >= max_delay_;
+}
+
+int MeasurementBatcher::GetTimeoutMs() const
+{
+  if (measurements_.empty())
+  {
+    return -1;
+  }
+
+  if (measurements_.size() >= max_batch_size_)
+  {
+    return 0;
+  }
+
+  auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+      oldest_time_ + max_delay_ - Clock::now());
+
+  return static_cast<int>(std::max<int64_t>(0, remaining.count() + 1));
+}
+
+void MeasurementBatcher::Take(
+    std::vector<Sender> *out_senders,
+    std::vector<SoilMoistureMeasurement> *out_measurements)
+{
+  assert(out_senders);
+  assert(out_measurements);
+
+  out_senders->clear();
+  out_measurements->clear();
+  out_senders->swap(senders_);
+  out_measurements->swap(measurements_);
+
+  senders_.reserve(max_batch_size_);
+  measurements_.reserve(max_batch_size_);
+}
+
+} // namespace organicdump
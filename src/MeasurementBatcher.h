@@ -0,0 +1,65 @@
+#ifndef ORGANICDUMP_SERVER_MEASUREMENTBATCHER_H
+#define ORGANICDUMP_SERVER_MEASUREMENTBATCHER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "DbManager.h"
+
+namespace organicdump
+{
+
+/**
+ * Accumulates soil moisture measurements for group commit. A batch is due
+ * once it holds |max_batch_size| measurements or its oldest measurement has
+ * waited |max_delay|, whichever comes first.
+ */
+class MeasurementBatcher
+{
+public:
+  // Identifies the connection to acknowledge once the batch is durable
+  struct Sender
+  {
+    int fd;
+    uint64_t serial;
+
+    // From ProtobufClient::AddPendingReply()
+    uint64_t reply_slot;
+  };
+
+public:
+  MeasurementBatcher();
+  MeasurementBatcher(size_t max_batch_size, std::chrono::milliseconds max_delay);
+
+  void Add(Sender sender, SoilMoistureMeasurement measurement);
+  bool IsEmpty() const;
+  bool IsDue() const;
+
+  /**
+   * Milliseconds until the pending batch is due, or -1 if nothing is pending.
+   */
+  int GetTimeoutMs() const;
+
+  /**
+   * Moves the pending batch out. |out_senders|[i] sent |out_measurements|[i].
+   */
+  void Take(
+      std::vector<Sender> *out_senders,
+      std::vector<SoilMoistureMeasurement> *out_measurements);
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+private:
+  size_t max_batch_size_;
+  std::chrono::milliseconds max_delay_;
+  Clock::time_point oldest_time_;
+  std::vector<Sender> senders_;
+  std::vector<SoilMoistureMeasurement> measurements_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_MEASUREMENTBATCHER_H
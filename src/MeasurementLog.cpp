@@ -0,0 +1,822 @@
+#include "MeasurementLog.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "DbManager.h"
+
+namespace
+{
+constexpr size_t SEGMENT_BYTES = 4 * 1024 * 1024;
+constexpr size_t DRAIN_BATCH_SIZE = 1024;
+constexpr const char *SEGMENT_SUFFIX = ".wal";
+constexpr const char *CHECKPOINT_FILE = "checkpoint";
+constexpr const char *CHECKPOINT_TMP_FILE = "checkpoint.tmp";
+constexpr const char *QUARANTINE_FILE = "quarantine.csv";
+constexpr std::chrono::milliseconds MIN_DRAIN_BACKOFF{100};
+constexpr std::chrono::milliseconds MAX_DRAIN_BACKOFF{5000};
+
+// A batch that fails this many times in a row is bisected in search of the
+// records the sink rejects
+constexpr size_t DRAIN_ATTEMPTS_BEFORE_BISECT = 5;
+
+// Sink calls that may fail in a row while bisecting. Isolating one bad record
+// fails about twice per halving, so more than this looks like an outage.
+constexpr size_t MAX_BISECT_FAILURE_STREAK = 24;
+
+// Sensor ids are INT columns, so 32 bits hold them. |seq| took the upper half
+// of what was a 64-bit sensor id, so records written before it existed read
+// back with seq 0 on the little-endian hosts the server runs on.
+struct WalRecord
+{
+  uint64_t sequence;
+  uint32_t sensor_id;
+  uint32_t seq;
+  int64_t time_ms;
+  float value;
+
+  // CRC-32C of the preceding fields
+  uint32_t crc;
+};
+
+static_assert(sizeof(WalRecord) == 32, "WAL records must stay fixed-size");
+static_assert(offsetof(WalRecord, time_ms) == 16, "WAL records must keep their layout");
+constexpr size_t RECORDS_PER_SEGMENT = SEGMENT_BYTES / sizeof(WalRecord);
+
+uint32_t Crc32c(const uint8_t *data, size_t size)
+{
+  static const auto table = []()
+  {
+    std::vector<uint32_t> t(256);
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k)
+      {
+        c = (c & 1) ? (0x82F63B78 ^ (c >> 1)) : (c >> 1);
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < size; ++i)
+  {
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return crc ^ 0xFFFFFFFF;
+}
+
+uint32_t RecordCrc(const WalRecord &record)
+{
+  return Crc32c(
+      reinterpret_cast<const uint8_t *>(&record),
+      offsetof(WalRecord, crc));
+}
+
+std::string SegmentPath(const std::string &dir, uint64_t first_sequence)
+{
+  char name[32];
+  std::snprintf(
+      name,
+      sizeof(name),
+      "%020llu%s",
+      static_cast<unsigned long long>(first_sequence),
+      SEGMENT_SUFFIX);
+  return dir + "/" + name;
+}
+
+bool SyncDirectory(const std::string &dir)
+{
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    LOG(ERROR) << "Failed to open WAL directory " << dir << ": " << std::strerror(errno);
+    return false;
+  }
+
+  bool is_synced = fsync(fd) == 0;
+  if (!is_synced)
+  {
+    LOG(ERROR) << "Failed to fsync WAL directory " << dir << ": " << std::strerror(errno);
+  }
+
+  close(fd);
+  return is_synced;
+}
+
+} // namespace
+
+namespace organicdump
+{
+
+struct MeasurementLog::State
+{
+  struct Segment
+  {
+    uint64_t first_sequence;
+    uint64_t record_count;
+    std::string path;
+    int fd;
+    uint8_t *base;
+  };
+
+  struct DirtyRange
+  {
+    uint8_t *begin;
+    size_t size;
+  };
+
+  std::string dir;
+  Sink sink;
+
+  std::mutex mutex;
+
+  // Appenders wait here for a sync; the drainer waits on |drain_cv|
+  std::condition_variable durable_cv;
+  std::condition_variable drain_cv;
+
+  std::deque<Segment> segments;
+  std::vector<DirtyRange> dirty;
+  uint64_t next_sequence;
+  uint64_t durable_sequence;
+  uint64_t drained_sequence;
+  bool is_syncing;
+  bool is_stopping;
+
+  bool OpenSegment(uint64_t first_sequence, bool is_new, Segment *out_segment);
+  void CloseSegment(Segment *segment, bool unlink_file);
+  bool Rotate();
+  void MarkDirty(uint8_t *begin, size_t size);
+  bool ReadCheckpoint();
+  bool WriteCheckpoint(uint64_t sequence);
+
+  /**
+   * Drains |batch|, which the sink rejected as a whole, in ever smaller
+   * pieces and appends the records it rejects on their own to
+   * |out_rejected|. False if no piece could be drained, which is what an
+   * outage looks like, so nothing can be blamed on the records.
+   */
+  bool IsolateRejected(
+      const std::vector<SoilMoistureMeasurement> &batch,
+      std::vector<SoilMoistureMeasurement> *out_rejected);
+  bool DrainBisected(
+      const SoilMoistureMeasurement *begin,
+      const SoilMoistureMeasurement *end,
+      size_t *failure_streak,
+      bool *is_any_drained,
+      std::vector<SoilMoistureMeasurement> *out_rejected);
+
+  /** Appends |records| to QUARANTINE_FILE for an operator to inspect. */
+  bool WriteQuarantine(const std::vector<SoilMoistureMeasurement> &records);
+};
+
+bool MeasurementLog::State::OpenSegment(
+    uint64_t first_sequence,
+    bool is_new,
+    Segment *out_segment)
+{
+  assert(out_segment);
+
+  std::string path = SegmentPath(dir, first_sequence);
+  int flags = O_RDWR | O_CLOEXEC | (is_new ? O_CREAT | O_EXCL : 0);
+
+  int fd = open(path.c_str(), flags, 0644);
+  if (fd < 0)
+  {
+    LOG(ERROR) << "Failed to open WAL segment " << path << ": " << std::strerror(errno);
+    return false;
+  }
+
+  // New segments are zero-filled, which recovery reads as the end of the log
+  if (ftruncate(fd, SEGMENT_BYTES) != 0)
+  {
+    LOG(ERROR) << "Failed to size WAL segment " << path << ": " << std::strerror(errno);
+    close(fd);
+    return false;
+  }
+
+  void *base = mmap(nullptr, SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+  {
+    LOG(ERROR) << "Failed to map WAL segment " << path << ": " << std::strerror(errno);
+    close(fd);
+    return false;
+  }
+
+  if (is_new && !SyncDirectory(dir))
+  {
+    munmap(base, SEGMENT_BYTES);
+    close(fd);
+    return false;
+  }
+
+  *out_segment = Segment{
+      first_sequence,
+      0,
+      std::move(path),
+      fd,
+      static_cast<uint8_t *>(base)};
+  return true;
+}
+
+void MeasurementLog::State::CloseSegment(Segment *segment, bool unlink_file)
+{
+  assert(segment);
+
+  munmap(segment->base, SEGMENT_BYTES);
+  close(segment->fd);
+
+  if (unlink_file && unlink(segment->path.c_str()) != 0)
+  {
+    LOG(ERROR) << "Failed to delete WAL segment " << segment->path << ": "
+               << std::strerror(errno);
+  }
+}
+
+bool MeasurementLog::State::Rotate()
+{
+  Segment segment;
+  if (!OpenSegment(next_sequence, true, &segment))
+  {
+    return false;
+  }
+
+  segments.push_back(std::move(segment));
+  return true;
+}
+
+void MeasurementLog::State::MarkDirty(uint8_t *begin, size_t size)
+{
+  if (!dirty.empty() && dirty.back().begin + dirty.back().size == begin)
+  {
+    dirty.back().size += size;
+    return;
+  }
+
+  dirty.push_back(DirtyRange{begin, size});
+}
+
+bool MeasurementLog::State::ReadCheckpoint()
+{
+  std::ifstream checkpoint{dir + "/" + CHECKPOINT_FILE};
+  if (!checkpoint)
+  {
+    drained_sequence = 0;
+    return true;
+  }
+
+  if (!(checkpoint >> drained_sequence))
+  {
+    LOG(ERROR) << "Corrupt WAL checkpoint in " << dir;
+    return false;
+  }
+
+  return true;
+}
+
+bool MeasurementLog::State::WriteCheckpoint(uint64_t sequence)
+{
+  // Write-then-rename so that a crash leaves either the old or new checkpoint
+  std::string tmp_path = dir + "/" + CHECKPOINT_TMP_FILE;
+  std::string path = dir + "/" + CHECKPOINT_FILE;
+
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    LOG(ERROR) << "Failed to open " << tmp_path << ": " << std::strerror(errno);
+    return false;
+  }
+
+  std::string contents = std::to_string(sequence) + "\n";
+  bool is_written =
+      write(fd, contents.data(), contents.size()) == static_cast<ssize_t>(contents.size()) &&
+      fsync(fd) == 0;
+  close(fd);
+
+  if (!is_written || rename(tmp_path.c_str(), path.c_str()) != 0)
+  {
+    LOG(ERROR) << "Failed to write WAL checkpoint: " << std::strerror(errno);
+    return false;
+  }
+
+  return SyncDirectory(dir);
+}
+
+bool MeasurementLog::State::IsolateRejected(
+    const std::vector<SoilMoistureMeasurement> &batch,
+    std::vector<SoilMoistureMeasurement> *out_rejected)
+{
+  assert(!batch.empty());
+  assert(out_rejected);
+
+  size_t failure_streak = 0;
+  bool is_any_drained = false;
+  return DrainBisected(
+      batch.data(),
+      batch.data() + batch.size(),
+      &failure_streak,
+      &is_any_drained,
+      out_rejected) && is_any_drained;
+}
+
+bool MeasurementLog::State::DrainBisected(
+    const SoilMoistureMeasurement *begin,
+    const SoilMoistureMeasurement *end,
+    size_t *failure_streak,
+    bool *is_any_drained,
+    std::vector<SoilMoistureMeasurement> *out_rejected)
+{
+  assert(begin < end);
+  assert(failure_streak);
+  assert(is_any_drained);
+  assert(out_rejected);
+
+  // [begin, end) has already been rejected as a whole
+  if (end - begin == 1)
+  {
+    out_rejected->push_back(*begin);
+    return true;
+  }
+
+  const SoilMoistureMeasurement *middle = begin + (end - begin) / 2;
+  const SoilMoistureMeasurement *halves[][2] = {{begin, middle}, {middle, end}};
+
+  for (const auto &half : halves)
+  {
+    if (sink(std::vector<SoilMoistureMeasurement>(half[0], half[1])))
+    {
+      *failure_streak = 0;
+      *is_any_drained = true;
+      continue;
+    }
+
+    if (++*failure_streak > MAX_BISECT_FAILURE_STREAK ||
+        !DrainBisected(half[0], half[1], failure_streak, is_any_drained, out_rejected))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool MeasurementLog::State::WriteQuarantine(
+    const std::vector<SoilMoistureMeasurement> &records)
+{
+  // The whole batch drained once split, so the failure was transient
+  if (records.empty())
+  {
+    return true;
+  }
+
+  std::string path = dir + "/" + QUARANTINE_FILE;
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    LOG(ERROR) << "Failed to open " << path << ": " << std::strerror(errno);
+    return false;
+  }
+
+  // sensor_id,time_ms,seq,value per line
+  std::string contents;
+  for (const SoilMoistureMeasurement &record : records)
+  {
+    contents += std::to_string(record.sensor_id) + "," +
+        std::to_string(record.time_ms) + "," +
+        std::to_string(record.seq) + "," +
+        std::to_string(record.value) + "\n";
+  }
+
+  bool is_written =
+      write(fd, contents.data(), contents.size()) == static_cast<ssize_t>(contents.size()) &&
+      fsync(fd) == 0;
+  close(fd);
+
+  if (!is_written)
+  {
+    LOG(ERROR) << "Failed to write " << path << ": " << std::strerror(errno);
+    return false;
+  }
+
+  LOG(ERROR) << "Skipping " << records.size() << " logged measurement(s) the sink "
+             << "keeps rejecting. Appended them to " << path;
+  return SyncDirectory(dir);
+}
+
+bool MeasurementLog::Create(
+    std::string dir,
+    Sink sink,
+    MeasurementLog *out_log)
+{
+  assert(sink);
+  assert(out_log);
+
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+  {
+    LOG(ERROR) << "Failed to create WAL directory " << dir << ": " << std::strerror(errno);
+    return false;
+  }
+
+  auto state = std::make_unique<State>();
+  state->dir = std::move(dir);
+  state->sink = std::move(sink);
+  state->is_syncing = false;
+  state->is_stopping = false;
+
+  if (!state->ReadCheckpoint())
+  {
+    return false;
+  }
+
+  // Segment names are zero-padded, so lexical order is sequence order
+  std::vector<uint64_t> first_sequences;
+  DIR *listing = opendir(state->dir.c_str());
+  if (!listing)
+  {
+    LOG(ERROR) << "Failed to list WAL directory " << state->dir << ": "
+               << std::strerror(errno);
+    return false;
+  }
+
+  while (struct dirent *entry = readdir(listing))
+  {
+    std::string name = entry->d_name;
+    size_t suffix_size = std::strlen(SEGMENT_SUFFIX);
+    if (name.size() > suffix_size &&
+        name.compare(name.size() - suffix_size, suffix_size, SEGMENT_SUFFIX) == 0)
+    {
+      first_sequences.push_back(std::strtoull(name.c_str(), nullptr, 10));
+    }
+  }
+  closedir(listing);
+  std::sort(first_sequences.begin(), first_sequences.end());
+
+  // Recover each segment up to its first torn or unwritten record
+  for (uint64_t first_sequence : first_sequences)
+  {
+    State::Segment segment;
+    if (!state->OpenSegment(first_sequence, false, &segment))
+    {
+      return false;
+    }
+
+    while (segment.record_count < RECORDS_PER_SEGMENT)
+    {
+      WalRecord record;
+      std::memcpy(
+          &record,
+          segment.base + segment.record_count * sizeof(WalRecord),
+          sizeof(WalRecord));
+
+      if (record.sequence != first_sequence + segment.record_count ||
+          record.crc != RecordCrc(record))
+      {
+        break;
+      }
+
+      ++segment.record_count;
+    }
+
+    state->segments.push_back(std::move(segment));
+  }
+
+  // Drop segments that were drained before the last shutdown, keeping the
+  // newest for appends
+  while (state->segments.size() > 1)
+  {
+    State::Segment &front = state->segments.front();
+    if (front.first_sequence + front.record_count - 1 > state->drained_sequence)
+    {
+      break;
+    }
+
+    state->CloseSegment(&front, true);
+    state->segments.pop_front();
+  }
+
+  if (state->segments.empty())
+  {
+    State::Segment segment;
+    if (!state->OpenSegment(state->drained_sequence + 1, true, &segment))
+    {
+      return false;
+    }
+    state->segments.push_back(std::move(segment));
+  }
+
+  // Clear anything past the last valid record so that a torn write can never
+  // be mistaken for a record after new appends land in front of it
+  State::Segment &tail = state->segments.back();
+  size_t tail_offset = tail.record_count * sizeof(WalRecord);
+  std::memset(tail.base + tail_offset, 0, SEGMENT_BYTES - tail_offset);
+  if (msync(tail.base, SEGMENT_BYTES, MS_SYNC) != 0)
+  {
+    LOG(ERROR) << "Failed to sync WAL segment " << tail.path << ": " << std::strerror(errno);
+    return false;
+  }
+
+  state->next_sequence = tail.first_sequence + tail.record_count;
+  state->durable_sequence = state->next_sequence - 1;
+  state->drained_sequence = std::min(state->drained_sequence, state->durable_sequence);
+
+  LOG(INFO) << "Recovered measurement log in " << state->dir << ": "
+            << state->durable_sequence - state->drained_sequence
+            << " record(s) awaiting replay";
+
+  *out_log = MeasurementLog{std::move(state)};
+  out_log->drainer_ = std::thread{RunDrainer, out_log->state_.get()};
+  return true;
+}
+
+MeasurementLog::MeasurementLog() {}
+
+MeasurementLog::MeasurementLog(std::unique_ptr<State> state)
+  : state_{std::move(state)} {}
+
+MeasurementLog::~MeasurementLog()
+{
+  CloseResources();
+}
+
+MeasurementLog::MeasurementLog(MeasurementLog &&other)
+{
+  StealResources(&other);
+}
+
+MeasurementLog &MeasurementLog::operator=(MeasurementLog &&other)
+{
+  if (this != &other)
+  {
+    CloseResources();
+    StealResources(&other);
+  }
+  return *this;
+}
+
+bool MeasurementLog::Append(const std::vector<SoilMoistureMeasurement> &measurements)
+{
+  assert(state_);
+
+  State *state = state_.get();
+  std::unique_lock<std::mutex> lock{state->mutex};
+
+  for (const SoilMoistureMeasurement &measurement : measurements)
+  {
+    if (state->segments.back().record_count == RECORDS_PER_SEGMENT &&
+        !state->Rotate())
+    {
+      LOG(ERROR) << "Failed to rotate measurement log";
+      return false;
+    }
+
+    State::Segment *segment = &state->segments.back();
+
+    WalRecord record;
+    std::memset(&record, 0, sizeof(record));
+    record.sequence = state->next_sequence;
+    record.sensor_id = static_cast<uint32_t>(measurement.sensor_id);
+    record.seq = measurement.seq;
+    record.time_ms = measurement.time_ms;
+    record.value = measurement.value;
+    record.crc = RecordCrc(record);
+
+    uint8_t *dest = segment->base + segment->record_count * sizeof(WalRecord);
+    std::memcpy(dest, &record, sizeof(record));
+    state->MarkDirty(dest, sizeof(record));
+
+    ++segment->record_count;
+    ++state->next_sequence;
+  }
+
+  uint64_t target_sequence = state->next_sequence - 1;
+
+  // The first waiter becomes the leader and syncs everything written so far,
+  // including records appended by others while it waited for the lock.
+  while (state->durable_sequence < target_sequence)
+  {
+    if (state->is_syncing)
+    {
+      state->durable_cv.wait(lock);
+      continue;
+    }
+
+    state->is_syncing = true;
+    uint64_t sync_sequence = state->next_sequence - 1;
+    std::vector<State::DirtyRange> dirty;
+    dirty.swap(state->dirty);
+    lock.unlock();
+
+    static const uintptr_t page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+
+    bool is_synced = true;
+    for (const State::DirtyRange &range : dirty)
+    {
+      uintptr_t begin = reinterpret_cast<uintptr_t>(range.begin) & ~(page_size - 1);
+      uintptr_t end = reinterpret_cast<uintptr_t>(range.begin) + range.size;
+      if (msync(reinterpret_cast<void *>(begin), end - begin, MS_SYNC) != 0)
+      {
+        LOG(ERROR) << "Failed to sync measurement log: " << std::strerror(errno);
+        is_synced = false;
+        break;
+      }
+    }
+
+    lock.lock();
+    state->is_syncing = false;
+    state->durable_cv.notify_all();
+
+    if (!is_synced)
+    {
+      // Leave the ranges for the next leader to retry
+      state->dirty.insert(state->dirty.begin(), dirty.begin(), dirty.end());
+      return false;
+    }
+
+    state->durable_sequence = std::max(state->durable_sequence, sync_sequence);
+    state->drain_cv.notify_one();
+  }
+
+  return true;
+}
+
+void MeasurementLog::RunDrainer(State *state)
+{
+  assert(state);
+
+  std::chrono::milliseconds backoff = MIN_DRAIN_BACKOFF;
+  size_t failed_attempts = 0;
+  std::vector<SoilMoistureMeasurement> batch;
+  batch.reserve(DRAIN_BATCH_SIZE);
+
+  while (true)
+  {
+    uint64_t batch_last_sequence = 0;
+    batch.clear();
+
+    {
+      std::unique_lock<std::mutex> lock{state->mutex};
+      state->drain_cv.wait(lock, [state]() {
+        return state->is_stopping ||
+               state->durable_sequence > state->drained_sequence;
+      });
+
+      // Undrained records stay in the log and are replayed on restart
+      if (state->is_stopping)
+      {
+        return;
+      }
+
+      for (const State::Segment &segment : state->segments)
+      {
+        uint64_t last_sequence = segment.first_sequence + segment.record_count - 1;
+        uint64_t sequence = std::max(state->drained_sequence + 1, segment.first_sequence);
+
+        while (sequence <= last_sequence &&
+               sequence <= state->durable_sequence &&
+               batch.size() < DRAIN_BATCH_SIZE)
+        {
+          WalRecord record;
+          std::memcpy(
+              &record,
+              segment.base + (sequence - segment.first_sequence) * sizeof(WalRecord),
+              sizeof(WalRecord));
+
+          batch.push_back(SoilMoistureMeasurement{
+              static_cast<size_t>(record.sensor_id),
+              record.value,
+              record.time_ms,
+              record.seq});
+          batch_last_sequence = sequence;
+          ++sequence;
+        }
+      }
+
+      // Sequences lost to a torn segment tail are skipped
+      if (batch.empty())
+      {
+        state->drained_sequence = state->durable_sequence;
+        continue;
+      }
+    }
+
+    if (!state->sink(batch))
+    {
+      // A record the sink will never accept would otherwise stall the log
+      // forever. It is only blamed once other records of its batch drain,
+      // which proves the sink is up; records appended meanwhile join the
+      // batch, so even a batch of one bad record is eventually resolved.
+      std::vector<SoilMoistureMeasurement> rejected;
+      bool is_isolated =
+          ++failed_attempts % DRAIN_ATTEMPTS_BEFORE_BISECT == 0 &&
+          state->IsolateRejected(batch, &rejected) &&
+          state->WriteQuarantine(rejected);
+
+      if (!is_isolated)
+      {
+        LOG(ERROR) << "Failed to drain " << batch.size()
+                   << " logged measurement(s). Retrying in " << backoff.count() << "ms";
+
+        std::unique_lock<std::mutex> lock{state->mutex};
+        state->drain_cv.wait_for(lock, backoff, [state]() { return state->is_stopping; });
+        backoff = std::min(backoff * 2, MAX_DRAIN_BACKOFF);
+        continue;
+      }
+
+      for (const SoilMoistureMeasurement &record : rejected)
+      {
+        LOG(ERROR) << "Quarantined logged measurement the sink keeps rejecting: sensor_id="
+                   << record.sensor_id << ", time_ms=" << record.time_ms
+                   << ", seq=" << record.seq << ", value=" << record.value;
+      }
+    }
+
+    backoff = MIN_DRAIN_BACKOFF;
+    failed_attempts = 0;
+    state->WriteCheckpoint(batch_last_sequence);
+
+    std::vector<State::Segment> drained_segments;
+    {
+      std::lock_guard<std::mutex> lock{state->mutex};
+      state->drained_sequence = batch_last_sequence;
+
+      while (state->segments.size() > 1)
+      {
+        State::Segment &front = state->segments.front();
+        if (front.first_sequence + front.record_count - 1 > state->drained_sequence)
+        {
+          break;
+        }
+
+        drained_segments.push_back(std::move(front));
+        state->segments.pop_front();
+      }
+    }
+
+    for (State::Segment &segment : drained_segments)
+    {
+      state->CloseSegment(&segment, true);
+    }
+  }
+}
+
+void MeasurementLog::CloseResources()
+{
+  if (!state_)
+  {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock{state_->mutex};
+    state_->is_stopping = true;
+  }
+  state_->drain_cv.notify_all();
+
+  if (drainer_.joinable())
+  {
+    drainer_.join();
+  }
+
+  for (State::Segment &segment : state_->segments)
+  {
+    state_->CloseSegment(&segment, false);
+  }
+
+  state_.reset();
+}
+
+void MeasurementLog::StealResources(MeasurementLog *other)
+{
+  assert(other);
+  state_ = std::move(other->state_);
+  drainer_ = std::move(other->drainer_);
+}
+
+} // namespace organicdump
@@ -0,0 +1,76 @@
+#ifndef ORGANICDUMP_SERVER_MEASUREMENTLOG_H
+#define ORGANICDUMP_SERVER_MEASUREMENTLOG_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DbManager.h"
+
+namespace organicdump
+{
+
+/**
+ * Append-only, mmap-backed write-ahead log of soil moisture measurements.
+ *
+ * Append() returns once the measurements are on disk, so clients can be
+ * acknowledged at disk-append latency whether or not MySQL is keeping up.
+ * Concurrent appenders share one msync() (group commit). A background
+ * drainer replays durable records into |sink| in bulk, checkpoints its
+ * progress, and deletes segments once they are fully drained. Records that
+ * were durable but not drained when the process died are replayed on the
+ * next Create(); the sink must therefore tolerate replays.
+ *
+ * A batch the sink keeps rejecting is bisected until the rejected records
+ * are isolated. Those are appended to quarantine.csv in the log directory
+ * and skipped, so one bad record cannot stall the log.
+ *
+ * The log lives in fixed-size segment files named after the sequence number
+ * of their first record. Each record carries a CRC, so recovery stops at the
+ * first torn write.
+ */
+class MeasurementLog
+{
+public:
+  using Sink = std::function<bool(const std::vector<SoilMoistureMeasurement> &)>;
+
+public:
+  static bool Create(
+      std::string dir,
+      Sink sink,
+      MeasurementLog *out_log);
+
+public:
+  MeasurementLog();
+  ~MeasurementLog();
+  MeasurementLog(MeasurementLog &&other);
+  MeasurementLog &operator=(MeasurementLog &&other);
+
+  /** Blocks until |measurements| are durable. Safe to call from any thread. */
+  bool Append(const std::vector<SoilMoistureMeasurement> &measurements);
+
+private:
+  struct State;
+
+private:
+  MeasurementLog(std::unique_ptr<State> state);
+  static void RunDrainer(State *state);
+  void CloseResources();
+  void StealResources(MeasurementLog *other);
+
+private:
+  MeasurementLog(const MeasurementLog &other) = delete;
+  MeasurementLog &operator=(const MeasurementLog &other) = delete;
+
+private:
+  // Heap-allocated so that the drainer survives moves of the log
+  std::unique_ptr<State> state_;
+  std::thread drainer_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_MEASUREMENTLOG_H
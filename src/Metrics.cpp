@@ -0,0 +1,367 @@
+#include "Metrics.h"
+
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace
+{
+using organicdump::Counter;
+using organicdump::Gauge;
+using organicdump::LatencyHistogram;
+
+enum class MetricKind
+{
+  COUNTER,
+  GAUGE,
+  HISTOGRAM,
+};
+
+// One labelled instance of a metric. Only the member matching the family's
+// kind is set.
+struct Series
+{
+  std::unique_ptr<Counter> counter;
+  std::unique_ptr<Gauge> gauge;
+  std::unique_ptr<LatencyHistogram> histogram;
+};
+
+struct Family
+{
+  MetricKind kind;
+  std::string help;
+  std::string label;
+
+  // Label value -> series, ordered so that scrapes are stable
+  std::map<std::string, Series> series;
+};
+
+struct Registry
+{
+  std::mutex mutex;
+  std::map<std::string, Family> families;
+};
+
+Registry &GetRegistry()
+{
+  static Registry registry;
+  return registry;
+}
+
+Series *GetSeries(
+    MetricKind kind,
+    const std::string &name,
+    const std::string &help,
+    const std::string &label,
+    const std::string &label_value)
+{
+  Registry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock{registry.mutex};
+
+  auto it = registry.families.find(name);
+  if (it == registry.families.end())
+  {
+    it = registry.families.emplace(name, Family{kind, help, label, {}}).first;
+  }
+
+  Family *family = &it->second;
+  assert(family->kind == kind);
+  assert(family->label == label);
+
+  Series *series = &family->series[label_value];
+  switch (kind)
+  {
+    case MetricKind::COUNTER:
+      if (!series->counter)
+      {
+        series->counter = std::make_unique<Counter>();
+      }
+      break;
+    case MetricKind::GAUGE:
+      if (!series->gauge)
+      {
+        series->gauge = std::make_unique<Gauge>();
+      }
+      break;
+    case MetricKind::HISTOGRAM:
+      if (!series->histogram)
+      {
+        series->histogram = std::make_unique<LatencyHistogram>();
+      }
+      break;
+  }
+
+  return series;
+}
+
+const char *ToString(MetricKind kind)
+{
+  switch (kind)
+  {
+    case MetricKind::COUNTER:
+      return "counter";
+    case MetricKind::GAUGE:
+      return "gauge";
+    case MetricKind::HISTOGRAM:
+      return "histogram";
+  }
+  return "untyped";
+}
+
+std::string FormatSeconds(std::chrono::nanoseconds duration)
+{
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.9g", std::chrono::duration<double>{duration}.count());
+  return buffer;
+}
+
+std::string EscapeLabelValue(const std::string &value)
+{
+  std::string escaped;
+  escaped.reserve(value.size());
+  for (char c : value)
+  {
+    switch (c)
+    {
+      case '\\':
+        escaped += "\\\\";
+        break;
+      case '"':
+        escaped += "\\\"";
+        break;
+      case '\n':
+        escaped += "\\n";
+        break;
+      default:
+        escaped += c;
+        break;
+    }
+  }
+  return escaped;
+}
+
+/** Renders `{label="value",extra}`, or nothing when there are no labels. */
+std::string FormatLabels(
+    const Family &family,
+    const std::string &label_value,
+    const std::string &extra = "")
+{
+  std::string labels;
+  if (!family.label.empty())
+  {
+    labels = family.label + "=\"" + EscapeLabelValue(label_value) + "\"";
+  }
+
+  if (!extra.empty())
+  {
+    labels += labels.empty() ? extra : "," + extra;
+  }
+
+  return labels.empty() ? labels : "{" + labels + "}";
+}
+
+void RenderHistogram(
+    const std::string &name,
+    const Family &family,
+    const std::string &label_value,
+    const LatencyHistogram &histogram,
+    std::string *out)
+{
+  std::vector<uint64_t> counts;
+  std::chrono::nanoseconds sum{0};
+  histogram.Read(&counts, &sum);
+
+  // Prometheus buckets are cumulative
+  uint64_t total = 0;
+  for (size_t i = 0; i < LatencyHistogram::BOUNDED_BUCKET_COUNT; ++i)
+  {
+    total += counts[i];
+    *out += name + "_bucket" + FormatLabels(
+        family,
+        label_value,
+        "le=\"" + FormatSeconds(LatencyHistogram::GetUpperBound(i)) + "\"");
+    *out += " " + std::to_string(total) + "\n";
+  }
+
+  total += counts.back();
+  *out += name + "_bucket" + FormatLabels(family, label_value, "le=\"+Inf\"");
+  *out += " " + std::to_string(total) + "\n";
+  *out += name + "_sum" + FormatLabels(family, label_value) + " " + FormatSeconds(sum) + "\n";
+  *out += name + "_count" + FormatLabels(family, label_value) + " " + std::to_string(total) + "\n";
+}
+} // namespace
+
+namespace organicdump
+{
+
+void Counter::Increment(uint64_t delta)
+{
+  value_.fetch_add(delta, std::memory_order_relaxed);
+}
+
+uint64_t Counter::Get() const
+{
+  return value_.load(std::memory_order_relaxed);
+}
+
+void Gauge::Add(int64_t delta)
+{
+  value_.fetch_add(delta, std::memory_order_relaxed);
+}
+
+void Gauge::Set(int64_t value)
+{
+  value_.store(value, std::memory_order_relaxed);
+}
+
+int64_t Gauge::Get() const
+{
+  return value_.load(std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds LatencyHistogram::GetUpperBound(size_t index)
+{
+  assert(index < BOUNDED_BUCKET_COUNT);
+
+  if (index == 0)
+  {
+    return std::chrono::nanoseconds{int64_t{1} << MIN_EXPONENT};
+  }
+
+  size_t offset = index - 1;
+  int exponent = MIN_EXPONENT + static_cast<int>(offset / SUB_BUCKET_COUNT);
+  int64_t octave = int64_t{1} << exponent;
+  int64_t sub_bucket_width = octave >> SUB_BUCKET_BITS;
+  int64_t sub_bucket = static_cast<int64_t>(offset % SUB_BUCKET_COUNT);
+  return std::chrono::nanoseconds{octave + (sub_bucket + 1) * sub_bucket_width};
+}
+
+size_t LatencyHistogram::GetBucket(uint64_t latency_ns)
+{
+  if (latency_ns <= (uint64_t{1} << MIN_EXPONENT))
+  {
+    return 0;
+  }
+
+  // Bounds are inclusive, so bucket by the value just below
+  uint64_t value = latency_ns - 1;
+  int exponent = 63 - __builtin_clzll(value);
+  if (exponent >= MAX_EXPONENT)
+  {
+    return BOUNDED_BUCKET_COUNT;
+  }
+
+  size_t sub_bucket = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKET_COUNT - 1);
+  return 1 + (exponent - MIN_EXPONENT) * SUB_BUCKET_COUNT + sub_bucket;
+}
+
+void LatencyHistogram::Record(std::chrono::nanoseconds latency)
+{
+  uint64_t latency_ns = latency.count() > 0 ? static_cast<uint64_t>(latency.count()) : 0;
+  counts_[GetBucket(latency_ns)].fetch_add(1, std::memory_order_relaxed);
+  sum_ns_.fetch_add(latency_ns, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Read(
+    std::vector<uint64_t> *out_counts,
+    std::chrono::nanoseconds *out_sum) const
+{
+  assert(out_counts);
+  assert(out_sum);
+
+  out_counts->clear();
+  out_counts->reserve(counts_.size());
+  for (const std::atomic<uint64_t> &count : counts_)
+  {
+    out_counts->push_back(count.load(std::memory_order_relaxed));
+  }
+
+  *out_sum = std::chrono::nanoseconds{
+      static_cast<int64_t>(sum_ns_.load(std::memory_order_relaxed))};
+}
+
+LatencyTimer::LatencyTimer(LatencyHistogram *histogram)
+  : histogram_{histogram},
+    start_{std::chrono::steady_clock::now()}
+{
+  assert(histogram_);
+}
+
+LatencyTimer::~LatencyTimer()
+{
+  histogram_->Record(std::chrono::steady_clock::now() - start_);
+}
+
+Counter *Metrics::GetCounter(
+    const std::string &name,
+    const std::string &help,
+    const std::string &label,
+    const std::string &label_value)
+{
+  return GetSeries(MetricKind::COUNTER, name, help, label, label_value)->counter.get();
+}
+
+Gauge *Metrics::GetGauge(
+    const std::string &name,
+    const std::string &help,
+    const std::string &label,
+    const std::string &label_value)
+{
+  return GetSeries(MetricKind::GAUGE, name, help, label, label_value)->gauge.get();
+}
+
+LatencyHistogram *Metrics::GetHistogram(
+    const std::string &name,
+    const std::string &help,
+    const std::string &label,
+    const std::string &label_value)
+{
+  return GetSeries(MetricKind::HISTOGRAM, name, help, label, label_value)->histogram.get();
+}
+
+std::string Metrics::Render()
+{
+  Registry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock{registry.mutex};
+
+  std::string out;
+  for (const auto &family_entry : registry.families)
+  {
+    const std::string &name = family_entry.first;
+    const Family &family = family_entry.second;
+
+    out += "# HELP " + name + " " + family.help + "\n";
+    out += "# TYPE " + name + " " + ToString(family.kind) + "\n";
+
+    for (const auto &series_entry : family.series)
+    {
+      const std::string &label_value = series_entry.first;
+      const Series &series = series_entry.second;
+
+      switch (family.kind)
+      {
+        case MetricKind::COUNTER:
+          out += name + FormatLabels(family, label_value) + " "
+              + std::to_string(series.counter->Get()) + "\n";
+          break;
+        case MetricKind::GAUGE:
+          out += name + FormatLabels(family, label_value) + " "
+              + std::to_string(series.gauge->Get()) + "\n";
+          break;
+        case MetricKind::HISTOGRAM:
+          RenderHistogram(name, family, label_value, *series.histogram, &out);
+          break;
+      }
+    }
+  }
+
+  return out;
+}
+
+} // namespace organicdump
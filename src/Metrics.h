@@ -0,0 +1,131 @@
+#ifndef ORGANICDUMP_SERVER_METRICS_H
+#define ORGANICDUMP_SERVER_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace organicdump
+{
+
+/** Monotonic count. Safe to bump from any thread. */
+class Counter
+{
+public:
+  void Increment(uint64_t delta = 1);
+  uint64_t Get() const;
+
+private:
+  std::atomic<uint64_t> value_{0};
+};
+
+/** Level that moves both ways. Safe to update from any thread. */
+class Gauge
+{
+public:
+  void Add(int64_t delta);
+  void Set(int64_t value);
+  int64_t Get() const;
+
+private:
+  std::atomic<int64_t> value_{0};
+};
+
+/**
+ * Log-linear latency histogram in the style of HdrHistogram: every power of
+ * two from ~1us to ~69s is split into SUB_BUCKET_COUNT equal buckets, so a
+ * bucket is picked with a couple of bit operations and recording is two
+ * relaxed atomic adds. Bucket bounds are fixed, which lets Prometheus
+ * aggregate them across scrapes and processes.
+ *
+ * Eight buckets per power of two bound the error of an estimated quantile to
+ * 12.5%, at 209 bucket lines per series in a scrape.
+ */
+class LatencyHistogram
+{
+public:
+  static constexpr int MIN_EXPONENT = 10;
+  static constexpr int MAX_EXPONENT = 36;
+  static constexpr int SUB_BUCKET_BITS = 3;
+  static constexpr size_t SUB_BUCKET_COUNT = size_t{1} << SUB_BUCKET_BITS;
+
+  /** Buckets with a finite upper bound. One more catches everything above. */
+  static constexpr size_t BOUNDED_BUCKET_COUNT =
+      1 + (MAX_EXPONENT - MIN_EXPONENT) * SUB_BUCKET_COUNT;
+
+public:
+  /** Inclusive upper bound of bucket |index|. */
+  static std::chrono::nanoseconds GetUpperBound(size_t index);
+
+public:
+  void Record(std::chrono::nanoseconds latency);
+
+  /**
+   * Per-bucket counts, the last being the unbounded bucket, and the total of
+   * every recorded latency. Concurrent recordings may be partially visible.
+   */
+  void Read(std::vector<uint64_t> *out_counts, std::chrono::nanoseconds *out_sum) const;
+
+private:
+  static size_t GetBucket(uint64_t latency_ns);
+
+private:
+  std::array<std::atomic<uint64_t>, BOUNDED_BUCKET_COUNT + 1> counts_{};
+  std::atomic<uint64_t> sum_ns_{0};
+};
+
+/** Records the time from construction to destruction into a histogram. */
+class LatencyTimer
+{
+public:
+  explicit LatencyTimer(LatencyHistogram *histogram);
+  ~LatencyTimer();
+
+private:
+  LatencyTimer(const LatencyTimer &other) = delete;
+  LatencyTimer &operator=(const LatencyTimer &other) = delete;
+
+private:
+  LatencyHistogram *histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * Process-wide registry of metrics, rendered in the Prometheus text format.
+ *
+ * A metric is identified by its name and, optionally, the value of its one
+ * label; asking for the same metric twice returns the same object, which
+ * lives until the process exits. Lookups take a lock, so hot paths should
+ * look their metrics up once and keep the pointer.
+ */
+class Metrics
+{
+public:
+  static Counter *GetCounter(
+      const std::string &name,
+      const std::string &help,
+      const std::string &label = "",
+      const std::string &label_value = "");
+  static Gauge *GetGauge(
+      const std::string &name,
+      const std::string &help,
+      const std::string &label = "",
+      const std::string &label_value = "");
+
+  /** Latencies are exported in seconds; |name| should end in _seconds. */
+  static LatencyHistogram *GetHistogram(
+      const std::string &name,
+      const std::string &help,
+      const std::string &label = "",
+      const std::string &label_value = "");
+
+  static std::string Render();
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_METRICS_H
@@ -0,0 +1,303 @@
+#include "MetricsServer.h"
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "EventNotifier.h"
+#include "Metrics.h"
+
+namespace
+{
+constexpr int LISTEN_BACKLOG = 16;
+
+// Longest request head read; a scrape needs only its first line
+constexpr size_t MAX_REQUEST_SIZE = 4096;
+
+// A stalled scraper holds up the next one for at most this long
+constexpr time_t IO_TIMEOUT_SECONDS = 1;
+
+constexpr const char *METRICS_PATH = "/metrics";
+
+void SetIoTimeout(int fd)
+{
+  struct timeval timeout;
+  timeout.tv_sec = IO_TIMEOUT_SECONDS;
+  timeout.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+bool ReadRequestLine(int fd, std::string *out_line)
+{
+  std::string request;
+  char buffer[512];
+
+  while (request.find("\r\n") == std::string::npos)
+  {
+    if (request.size() >= MAX_REQUEST_SIZE)
+    {
+      return false;
+    }
+
+    ssize_t bytes_read = read(fd, buffer, sizeof(buffer));
+    if (bytes_read == -1 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if (bytes_read <= 0)
+    {
+      return false;
+    }
+
+    request.append(buffer, static_cast<size_t>(bytes_read));
+  }
+
+  *out_line = request.substr(0, request.find("\r\n"));
+  return true;
+}
+
+bool WriteAll(int fd, const std::string &data)
+{
+  size_t offset = 0;
+  while (offset < data.size())
+  {
+    ssize_t bytes_written = send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+    if (bytes_written == -1 && errno == EINTR)
+    {
+      continue;
+    }
+
+    if (bytes_written <= 0)
+    {
+      return false;
+    }
+
+    offset += static_cast<size_t>(bytes_written);
+  }
+  return true;
+}
+
+std::string MakeResponse(const char *status, const char *content_type, const std::string &body)
+{
+  return std::string{"HTTP/1.0 "} + status + "\r\n"
+      + "Content-Type: " + content_type + "\r\n"
+      + "Content-Length: " + std::to_string(body.size()) + "\r\n"
+      + "Connection: close\r\n"
+      + "\r\n"
+      + body;
+}
+} // namespace
+
+namespace organicdump
+{
+
+struct MetricsServer::State
+{
+  int listen_fd{-1};
+  EventNotifier stop_notifier;
+};
+
+bool MetricsServer::Create(int32_t port, MetricsServer *out_server)
+{
+  assert(out_server);
+
+  auto state = std::make_unique<State>();
+  if (!EventNotifier::Create(&state->stop_notifier))
+  {
+    LOG(ERROR) << "Failed to create metrics server stop notifier";
+    return false;
+  }
+
+  // Owns the socket from here on, so failures below close it
+  MetricsServer server{std::move(state)};
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+  {
+    LOG(ERROR) << "Failed to create metrics socket: " << strerror(errno);
+    return false;
+  }
+  server.state_->listen_fd = fd;
+
+  int enable = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1)
+  {
+    LOG(ERROR) << "Failed to set SO_REUSEADDR on metrics socket: " << strerror(errno);
+    return false;
+  }
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(static_cast<uint16_t>(port));
+
+  if (bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == -1)
+  {
+    LOG(ERROR) << "Failed to bind metrics port " << port << ": " << strerror(errno);
+    return false;
+  }
+
+  if (listen(fd, LISTEN_BACKLOG) == -1)
+  {
+    LOG(ERROR) << "Failed to listen on metrics port " << port << ": " << strerror(errno);
+    return false;
+  }
+
+  server.thread_ = std::thread{Run, server.state_.get()};
+  *out_server = std::move(server);
+  return true;
+}
+
+MetricsServer::MetricsServer() {}
+
+MetricsServer::MetricsServer(std::unique_ptr<State> state)
+  : state_{std::move(state)} {}
+
+MetricsServer::~MetricsServer()
+{
+  CloseResources();
+}
+
+MetricsServer::MetricsServer(MetricsServer &&other)
+{
+  StealResources(&other);
+}
+
+MetricsServer &MetricsServer::operator=(MetricsServer &&other)
+{
+  if (this != &other)
+  {
+    CloseResources();
+    StealResources(&other);
+  }
+  return *this;
+}
+
+void MetricsServer::Run(State *state)
+{
+  assert(state);
+
+  struct pollfd fds[2];
+  fds[0].fd = state->listen_fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = state->stop_notifier.GetFd();
+  fds[1].events = POLLIN;
+
+  while (true)
+  {
+    fds[0].revents = 0;
+    fds[1].revents = 0;
+
+    if (poll(fds, 2, -1) == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+
+      LOG(ERROR) << "Failed to poll metrics socket: " << strerror(errno);
+      return;
+    }
+
+    if (fds[1].revents)
+    {
+      return;
+    }
+
+    if (!(fds[0].revents & POLLIN))
+    {
+      continue;
+    }
+
+    int fd = accept4(state->listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd == -1)
+    {
+      LOG(ERROR) << "Failed to accept metrics connection: " << strerror(errno);
+      continue;
+    }
+
+    Serve(fd);
+    close(fd);
+  }
+}
+
+void MetricsServer::Serve(int fd)
+{
+  SetIoTimeout(fd);
+
+  std::string request_line;
+  if (!ReadRequestLine(fd, &request_line))
+  {
+    return;
+  }
+
+  // "GET /metrics HTTP/1.1", possibly with a query string
+  size_t path_begin = request_line.find(' ');
+  size_t path_end = request_line.find_first_of(" ?", path_begin + 1);
+  std::string method = request_line.substr(0, path_begin);
+  std::string path = (path_begin == std::string::npos)
+      ? ""
+      : request_line.substr(path_begin + 1, path_end - path_begin - 1);
+
+  std::string response;
+  if (method != "GET")
+  {
+    response = MakeResponse("405 Method Not Allowed", "text/plain", "Only GET is supported\n");
+  }
+  else if (path != METRICS_PATH)
+  {
+    response = MakeResponse("404 Not Found", "text/plain", "Metrics are served at /metrics\n");
+  }
+  else
+  {
+    response = MakeResponse("200 OK", "text/plain; version=0.0.4", Metrics::Render());
+  }
+
+  WriteAll(fd, response);
+}
+
+void MetricsServer::CloseResources()
+{
+  if (!state_)
+  {
+    return;
+  }
+
+  if (thread_.joinable())
+  {
+    state_->stop_notifier.Notify();
+    thread_.join();
+  }
+
+  if (state_->listen_fd != -1)
+  {
+    close(state_->listen_fd);
+  }
+
+  state_.reset();
+}
+
+void MetricsServer::StealResources(MetricsServer *other)
+{
+  assert(other);
+  state_ = std::move(other->state_);
+  thread_ = std::move(other->thread_);
+}
+
+} // namespace organicdump
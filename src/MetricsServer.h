@@ -0,0 +1,49 @@
+#ifndef ORGANICDUMP_SERVER_METRICSSERVER_H
+#define ORGANICDUMP_SERVER_METRICSSERVER_H
+
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+namespace organicdump
+{
+
+/**
+ * Serves Metrics::Render() as plaintext HTTP at /metrics for Prometheus to
+ * scrape. Listens on the loopback interface only and answers one request per
+ * connection on its own thread, well away from the reactors.
+ */
+class MetricsServer
+{
+public:
+  static bool Create(int32_t port, MetricsServer *out_server);
+
+public:
+  MetricsServer();
+  ~MetricsServer();
+  MetricsServer(MetricsServer &&other);
+  MetricsServer &operator=(MetricsServer &&other);
+
+private:
+  struct State;
+
+private:
+  MetricsServer(std::unique_ptr<State> state);
+  static void Run(State *state);
+  static void Serve(int fd);
+  void CloseResources();
+  void StealResources(MetricsServer *other);
+
+private:
+  MetricsServer(const MetricsServer &other) = delete;
+  MetricsServer &operator=(const MetricsServer &other) = delete;
+
+private:
+  // Heap-allocated so that the serving thread survives moves of the server
+  std::unique_ptr<State> state_;
+  std::thread thread_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_METRICSSERVER_H
@@ -0,0 +1,1212 @@
+#include "MySqlStorageEngine.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <mysqlx/xdevapi.h>
+#include <glog/logging.h>
+
+#include "CliConfig.h"
+#include "DbSessionPool.h"
+#include "RegistryCache.h"
+
+namespace {
+constexpr const char *RPIS_TABLE = "rpis";
+constexpr const char *PERIPHERALS_TABLE = "peripherals";
+constexpr const char *RPI_PERIPHERAL_EDGES_TABLE = "rpi_peripheral_edges";
+constexpr const char *SOIL_MOISTURE_SENSORS_TABLE = "soil_moisture_sensors";
+constexpr const char *SOIL_MOISTURE_MEASUREMENTS_TABLE = "soil_moisture_readings";
+constexpr const char *IRRIGATION_SYSTEMS_TABLE = "irrigation_systems";
+constexpr const char *DAILY_IRRIGATION_SCHEDULES_TABLE = "daily_irrigation_schedules";
+constexpr const char *STALE_ROLLUPS_TABLE = "soil_moisture_stale_rollups";
+constexpr const char *PRUNE_WATERMARK_TABLE = "soil_moisture_prune_watermark";
+
+// Column lists of the statements built by DbStatementCache::GetInsertSql()
+constexpr const char *RPI_COLUMNS = "name, time, location";
+constexpr const char *PERIPHERAL_COLUMNS = "name, time";
+constexpr const char *RPI_PERIPHERAL_EDGE_COLUMNS = "rpi_id, peripheral_id";
+constexpr const char *SOIL_MOISTURE_SENSOR_COLUMNS = "peripheral_id, ceiling, floor";
+constexpr const char *SOIL_MOISTURE_MEASUREMENT_COLUMNS = "sensor_id, time_ms, seq, reading";
+constexpr const char *STALE_ROLLUP_COLUMNS = "sensor_id, hour_ms";
+constexpr const char *IRRIGATION_SYSTEM_COLUMNS = "peripheral_id";
+constexpr const char *DAILY_IRRIGATION_SCHEDULE_COLUMNS =
+    "irrigation_system_id, day_of_week_index, irrigation_time_military, duration_ms";
+
+// X DevAPI inserts cannot express ON DUPLICATE KEY UPDATE, so readings are
+// upserted through SQL
+constexpr const char *UPSERT_READING_SUFFIX =
+    "ON DUPLICATE KEY UPDATE reading = VALUES(reading)";
+
+// Marking a bucket that is already stale changes nothing
+constexpr const char *MARK_STALE_ROLLUP_SUFFIX =
+    "ON DUPLICATE KEY UPDATE hour_ms = hour_ms";
+
+// Rows per readings upsert or schedules insert. Larger batches are split
+// into statements of this many in one transaction, which also bounds the
+// statement shapes each session caches.
+constexpr size_t MAX_ROWS_PER_INSERT = 256;
+
+// Catch-all partition of SOIL_MOISTURE_MEASUREMENTS_TABLE split to add months
+constexpr const char *FUTURE_PARTITION = "p_future";
+constexpr int PARTITION_MONTHS_AHEAD = 3;
+
+constexpr int64_t MINUTE_MS = 60 * 1000;
+constexpr int64_t HOUR_MS = 60 * MINUTE_MS;
+constexpr int64_t DAY_MS = 24 * HOUR_MS;
+
+// Rows deleted per statement when pruning a partially expired partition
+constexpr int PRUNE_CHUNK_ROWS = 10000;
+
+// Stale hours refreshed per call. The rest wait for the next call.
+constexpr size_t MAX_REFRESH_BUCKETS = 10000;
+
+// Each rollup level is rebuilt from the level below it. Parameters are
+// (sensor_id, start_ms, end_ms), aligned to the level's bucket width.
+// Minutes before the prune watermark keep their stored 1-minute rollups.
+constexpr const char *REFRESH_ROLLUPS_1M_SQL =
+    "INSERT INTO soil_moisture_rollups_1m "
+    "(sensor_id, bucket_ms, min_reading, max_reading, mean_reading, reading_count) "
+    "SELECT sensor_id, time_ms - MOD(time_ms, 60000), "
+    "       MIN(reading), MAX(reading), AVG(reading), COUNT(*) "
+    "FROM soil_moisture_readings "
+    "WHERE sensor_id = ? AND time_ms >= ? AND time_ms < ? "
+    "AND time_ms >= (SELECT pruned_before_ms FROM soil_moisture_prune_watermark) "
+    "GROUP BY sensor_id, time_ms - MOD(time_ms, 60000) "
+    "ON DUPLICATE KEY UPDATE min_reading = VALUES(min_reading), "
+    "  max_reading = VALUES(max_reading), mean_reading = VALUES(mean_reading), "
+    "  reading_count = VALUES(reading_count)";
+
+constexpr const char *REFRESH_ROLLUPS_1H_SQL =
+    "INSERT INTO soil_moisture_rollups_1h "
+    "(sensor_id, bucket_ms, min_reading, max_reading, mean_reading, reading_count) "
+    "SELECT sensor_id, bucket_ms - MOD(bucket_ms, 3600000), "
+    "       MIN(min_reading), MAX(max_reading), "
+    "       SUM(mean_reading * reading_count) / SUM(reading_count), SUM(reading_count) "
+    "FROM soil_moisture_rollups_1m "
+    "WHERE sensor_id = ? AND bucket_ms >= ? AND bucket_ms < ? "
+    "GROUP BY sensor_id, bucket_ms - MOD(bucket_ms, 3600000) "
+    "ON DUPLICATE KEY UPDATE min_reading = VALUES(min_reading), "
+    "  max_reading = VALUES(max_reading), mean_reading = VALUES(mean_reading), "
+    "  reading_count = VALUES(reading_count)";
+
+constexpr const char *REFRESH_ROLLUPS_1D_SQL =
+    "INSERT INTO soil_moisture_rollups_1d "
+    "(sensor_id, bucket_ms, min_reading, max_reading, mean_reading, reading_count) "
+    "SELECT sensor_id, bucket_ms - MOD(bucket_ms, 86400000), "
+    "       MIN(min_reading), MAX(max_reading), "
+    "       SUM(mean_reading * reading_count) / SUM(reading_count), SUM(reading_count) "
+    "FROM soil_moisture_rollups_1h "
+    "WHERE sensor_id = ? AND bucket_ms >= ? AND bucket_ms < ? "
+    "GROUP BY sensor_id, bucket_ms - MOD(bucket_ms, 86400000) "
+    "ON DUPLICATE KEY UPDATE min_reading = VALUES(min_reading), "
+    "  max_reading = VALUES(max_reading), mean_reading = VALUES(mean_reading), "
+    "  reading_count = VALUES(reading_count)";
+
+std::string MakeTimestamp(std::time_t t) {
+  std::tm tm;
+  localtime_r(&t, &tm);
+
+  std::ostringstream oss;
+  oss << std::put_time(&tm, "%Y-%m-%d %H-%M-%S");
+  return oss.str();
+}
+
+std::string MakeTimestamp() {
+  return MakeTimestamp(std::time(nullptr));
+}
+
+bool LoadRegistry(
+    organicdump::DbSessionPool *pool,
+    organicdump::RegistryCache *registry)
+{
+  assert(pool);
+  assert(registry);
+
+  organicdump::DbSessionLease lease;
+  if (!pool->Checkout(&lease))
+  {
+    return false;
+  }
+
+  try
+  {
+    mysqlx::Schema *db = lease.GetSchema();
+
+    for (mysqlx::Row row : db->getTable(RPIS_TABLE).select("id", "name").execute().fetchAll())
+    {
+      registry->AddRpi(row[0].get<uint64_t>(), row[1].get<std::string>());
+    }
+
+    for (mysqlx::Row row : db->getTable(PERIPHERALS_TABLE).select("id", "name").execute().fetchAll())
+    {
+      registry->AddPeripheral(row[0].get<uint64_t>(), row[1].get<std::string>());
+    }
+
+    for (mysqlx::Row row : db->getTable(SOIL_MOISTURE_SENSORS_TABLE).select("peripheral_id").execute().fetchAll())
+    {
+      registry->AddSoilMoistureSensor(row[0].get<uint64_t>());
+    }
+
+    for (mysqlx::Row row : db->getTable(IRRIGATION_SYSTEMS_TABLE).select("peripheral_id").execute().fetchAll())
+    {
+      registry->AddIrrigationSystem(row[0].get<uint64_t>());
+    }
+
+    for (mysqlx::Row row : db->getTable(RPI_PERIPHERAL_EDGES_TABLE)
+            .select("peripheral_id", "rpi_id").execute().fetchAll())
+    {
+      registry->SetPeripheralOwner(row[0].get<uint64_t>(), row[1].get<uint64_t>());
+    }
+
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to load registry. Error: " << e;
+    lease.MarkSuspect();
+    return false;
+  }
+}
+
+int64_t FloorToBucket(int64_t time_ms, int64_t bucket_ms)
+{
+  return time_ms - (time_ms % bucket_ms);
+}
+
+mysqlx::SqlStatement MakeInsert(
+    organicdump::DbSessionLease *lease,
+    const char *table_name,
+    const char *columns,
+    size_t row_count = 1,
+    const char *suffix = "")
+{
+  assert(lease);
+  return lease->GetSession()->sql(
+      lease->GetStatements()->GetInsertSql(table_name, columns, row_count, suffix));
+}
+
+void Rollback(organicdump::DbSessionLease *lease)
+{
+  assert(lease);
+
+  try
+  {
+    lease->GetSession()->rollback();
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to roll back transaction. Error: " << e;
+    lease->MarkSuspect();
+  }
+}
+} // namespace
+
+namespace organicdump
+{
+
+bool MySqlStorageEngine::Create(const CliConfig &config, MySqlStorageEngine *out_engine) {
+  assert(out_engine);
+
+  DbSessionPool pool;
+  if (!DbSessionPool::Create(
+        config.GetDbUrl(),
+        config.GetDbName(),
+        config.GetDbPoolMinSessions(),
+        config.GetDbPoolMaxSessions(),
+        config.GetDbIdlePingInterval(),
+        config.GetDbCheckoutTimeout(),
+        &pool))
+  {
+    LOG(ERROR) << "Failed to create db session pool";
+    return false;
+  }
+
+  if (!EnsureMeasurementPartitions(&pool))
+  {
+    LOG(ERROR) << "Failed to prepare soil moisture reading partitions";
+    return false;
+  }
+
+  auto registry = std::make_unique<RegistryCache>();
+  if (!LoadRegistry(&pool, registry.get()))
+  {
+    LOG(ERROR) << "Failed to warm registry cache";
+    return false;
+  }
+
+  *out_engine = MySqlStorageEngine{std::move(pool), std::move(registry)};
+  return true;
+}
+
+MySqlStorageEngine::MySqlStorageEngine() : is_initialized_{false} {}
+
+MySqlStorageEngine::MySqlStorageEngine(
+    DbSessionPool pool,
+    std::unique_ptr<RegistryCache> registry)
+    : is_initialized_{true},
+      pool_{std::move(pool)},
+      registry_{std::move(registry)} {}
+
+MySqlStorageEngine::~MySqlStorageEngine()
+{
+  CloseResources();
+}
+
+MySqlStorageEngine::MySqlStorageEngine(MySqlStorageEngine &&other)
+{
+  StealResources(&other);
+}
+
+MySqlStorageEngine &MySqlStorageEngine::operator=(MySqlStorageEngine &&other)
+{
+  if (this != &other)
+  {
+    CloseResources();
+    StealResources(&other);
+  }
+  return *this;
+}
+
+bool MySqlStorageEngine::OrphanRpiOwnedPeripheral(size_t peripheral_id)
+{
+  if (!registry_->IsPeripheralOwned(peripheral_id))
+  {
+    // Expected when a peripheral is assigned for the first time
+    LOG(INFO) << "Peripheral " << peripheral_id << " not owned by any rpi. Nothing to orphan";
+    return false;
+  }
+
+  DbSessionLease lease;
+  if (!pool_.Checkout(&lease))
+  {
+    return false;
+  }
+
+  try
+  {
+    const mysqlx::Result result = lease.GetStatements()
+        ->GetRemove(RPI_PERIPHERAL_EDGES_TABLE, "peripheral_id = :id")
+        ->bind("id", peripheral_id)
+        .execute();
+
+    registry_->RemovePeripheralOwner(peripheral_id);
+
+    if (result.getAffectedItemsCount() == 0)
+    {
+      LOG(ERROR) << "Peripheral " << peripheral_id
+                 << " owned according to the registry cache but not in the database";
+      return false;
+    }
+
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to remove record from " << RPI_PERIPHERAL_EDGES_TABLE
+               << ". Error: " << e;
+    lease.MarkSuspect();
+    return false;
+  }
+}
+
+bool MySqlStorageEngine::AssignPeripheralToRpi(size_t rpi_id, size_t peripheral_id)
+{
+  DbSessionLease lease;
+  if (!pool_.Checkout(&lease))
+  {
+    return false;
+  }
+
+  try
+  {
+    const mysqlx::SqlResult result =
+        MakeInsert(&lease, RPI_PERIPHERAL_EDGES_TABLE, RPI_PERIPHERAL_EDGE_COLUMNS)
+            .bind(static_cast<uint64_t>(rpi_id), static_cast<uint64_t>(peripheral_id))
+            .execute();
+
+    if (result.getAffectedItemsCount() == 0)
+    {
+      LOG(ERROR) << "Failed to insert rpi-peripheral edge";
+      return false;
+    }
+
+    registry_->SetPeripheralOwner(peripheral_id, rpi_id);
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to insert into " << RPI_PERIPHERAL_EDGES_TABLE
+               << ". Error: " << e;
+    lease.MarkSuspect();
+    return false;
+  }
+}
+
+bool MySqlStorageEngine::ContainsRpi(size_t id)
+{
+  return registry_->ContainsRpi(id);
+}
+
+bool MySqlStorageEngine::ContainsRpi(const std::string &name)
+{
+  return registry_->ContainsRpi(name);
+}
+
+bool MySqlStorageEngine::ContainsPeripheral(const std::string &name)
+{
+  return registry_->ContainsPeripheral(name);
+}
+
+bool MySqlStorageEngine::ContainsPeripheral(size_t id)
+{
+  return registry_->ContainsPeripheral(id);
+}
+
+bool MySqlStorageEngine::ContainsSoilMoistureSensor(size_t id)
+{
+  return registry_->ContainsSoilMoistureSensor(id);
+}
+
+bool MySqlStorageEngine::ContainsIrrigationSystem(size_t id) {
+  return registry_->ContainsIrrigationSystem(id);
+}
+
+bool MySqlStorageEngine::InsertPeripheral(
+    DbSessionLease *lease,
+    const std::string &name,
+    size_t *out_id)
+{
+  assert(lease);
+  assert(out_id);
+
+  const mysqlx::SqlResult result = MakeInsert(lease, PERIPHERALS_TABLE, PERIPHERAL_COLUMNS)
+      .bind(name, MakeTimestamp())
+      .execute();
+
+  if (result.getAffectedItemsCount() == 0)
+  {
+    LOG(ERROR) << "Failed to insert peripheral";
+    return false;
+  }
+
+  *out_id = result.getAutoIncrementValue();
+  return true;
+}
+
+bool MySqlStorageEngine::DeletePeripheralOwnership(
+    DbSessionLease *lease,
+    size_t peripheral_id)
+{
+  assert(lease);
+
+  try
+  {
+    const mysqlx::Result result = lease->GetStatements()
+      ->GetRemove(RPI_PERIPHERAL_EDGES_TABLE, "peripheral_id = :id")
+      ->bind("id", peripheral_id)
+      .execute();
+
+    LOG(INFO) << "Removed " << result.getAffectedItemsCount()
+              << " from " << RPI_PERIPHERAL_EDGES_TABLE;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to remove record from " << RPI_PERIPHERAL_EDGES_TABLE
+               << ". Error: " << e;
+    lease->MarkSuspect();
+    return false;
+  }
+
+  return true;
+}
+
+bool MySqlStorageEngine::InsertPeripheralOwnership(
+    DbSessionLease *lease,
+    size_t peripheral_id,
+    size_t rpi_id)
+{
+  assert(lease);
+
+  try
+  {
+    const mysqlx::SqlResult result =
+        MakeInsert(lease, RPI_PERIPHERAL_EDGES_TABLE, RPI_PERIPHERAL_EDGE_COLUMNS)
+            .bind(static_cast<uint64_t>(rpi_id), static_cast<uint64_t>(peripheral_id))
+            .execute();
+
+    LOG(INFO) << "Inserted " << result.getAffectedItemsCount() << " rows into "
+              << RPI_PERIPHERAL_EDGES_TABLE;
+
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to insert record into " << RPI_PERIPHERAL_EDGES_TABLE
+               << ". Error: " << e;
+    lease->MarkSuspect();
+    return false;
+  }
+}
+
+bool MySqlStorageEngine::InsertSoilMoistureSensor(
+    const std::string& name,
+    float floor,
+    float ceil,
+    size_t *out_id)
+{
+  LOG(INFO) << "Registering soil moisture sensor w/database, {name="
+            << name << ", floor=" << floor << ", ceil=" << ceil << "}";
+
+  DbSessionLease lease;
+  if (!pool_.Checkout(&lease))
+  {
+    return false;
+  }
+
+  try
+  {
+    lease.GetSession()->startTransaction();
+
+    if (!InsertPeripheral(&lease, name, out_id))
+    {
+      LOG(ERROR) << "Failed to insert peripheral record";
+      goto error;
+    }
+
+    const mysqlx::SqlResult result =
+        MakeInsert(&lease, SOIL_MOISTURE_SENSORS_TABLE, SOIL_MOISTURE_SENSOR_COLUMNS)
+            .bind(static_cast<uint64_t>(*out_id), ceil, floor)
+            .execute();
+
+    if (result.getAffectedItemsCount() == 0)
+    {
+      LOG(ERROR) << "Failed to insert soil moisture sensor record";
+      goto error;
+    }
+
+    LOG(INFO) << "Soil moisture sensor registered successfully";
+    lease.GetSession()->commit();
+    registry_->AddPeripheral(*out_id, name);
+    registry_->AddSoilMoistureSensor(*out_id);
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << e;
+    lease.MarkSuspect();
+    goto error;
+  }
+
+error:
+    LOG(ERROR) << "Transaction failure when inserting soil moisture sensor. Rolling back...";
+    Rollback(&lease);
+    return false;
+}
+
+bool MySqlStorageEngine::UpdatePeripheralOwnership(size_t peripheral_id, size_t rpi_id) {
+  // Check peripheral exists
+  if (!ContainsPeripheral(peripheral_id)) {
+    LOG(ERROR) << "Could not find peripheral w/id: " << peripheral_id;
+    return false;
+  }
+
+  // Check RPI exists
+  if (!ContainsRpi(rpi_id)) {
+    LOG(ERROR) << "Could not find rpi w/id: " << rpi_id;
+    return false;
+  }
+
+  DbSessionLease lease;
+  if (!pool_.Checkout(&lease))
+  {
+    return false;
+  }
+
+  try
+  {
+    lease.GetSession()->startTransaction();
+
+    // Try to ownership record
+    if (!DeletePeripheralOwnership(&lease, peripheral_id))
+    {
+      LOG(ERROR) << "Failed to delete peripheral ownership record. Id: "
+                 << peripheral_id;
+      goto error;
+    }
+
+    // Insert new ownership record
+    if (!InsertPeripheralOwnership(&lease, peripheral_id, rpi_id))
+    {
+      LOG(ERROR) << "Failed to insert peripheral ownership record"
+                 << ". Peripheral ID: " << peripheral_id
+                 << ". RPI ID: " << rpi_id;
+      goto error;
+    }
+
+    LOG(INFO) << "Peripheral ownership updated successfully!";
+    lease.GetSession()->commit();
+    registry_->SetPeripheralOwner(peripheral_id, rpi_id);
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << e;
+    lease.MarkSuspect();
+    goto error;
+  }
+
+error:
+  LOG(ERROR) << "Transaction failure when updating peripheral paranetage. Rolling back...";
+  Rollback(&lease);
+  return false;
+}
+
+bool MySqlStorageEngine::InsertSoilMoistureMeasurements(
+    const std::vector<SoilMoistureMeasurement> &measurements)
+{
+  assert(!measurements.empty());
+
+  // Partitioned tables can't carry the foreign key that would check this
+  for (const SoilMoistureMeasurement &measurement : measurements)
+  {
+    if (!registry_->ContainsSoilMoistureSensor(measurement.sensor_id))
+    {
+      LOG(ERROR) << "Failed to insert soil moisture measurements. Unknown sensor "
+                 << measurement.sensor_id;
+      return false;
+    }
+  }
+
+  DbSessionLease lease;
+  if (!pool_.Checkout(&lease))
+  {
+    return false;
+  }
+
+  // The hours whose rollups the batch makes stale are marked in the same
+  // transaction, so a crash cannot lose them. Sorted, so that concurrent
+  // batches lock them in one order.
+  std::set<std::pair<uint64_t, int64_t>> stale_hours;
+  for (const SoilMoistureMeasurement &measurement : measurements)
+  {
+    stale_hours.emplace(
+        static_cast<uint64_t>(measurement.sensor_id),
+        FloorToBucket(measurement.time_ms, HOUR_MS));
+  }
+
+  try
+  {
+    lease.GetSession()->startTransaction();
+
+    // Marked before the readings are written, in the order RefreshSoilMoistureRollups()
+    // locks them, so the two cannot deadlock
+    auto stale_begin = stale_hours.begin();
+    while (stale_begin != stale_hours.end())
+    {
+      size_t row_count = std::min<size_t>(
+          MAX_ROWS_PER_INSERT,
+          static_cast<size_t>(std::distance(stale_begin, stale_hours.end())));
+      mysqlx::SqlStatement mark = MakeInsert(
+          &lease,
+          STALE_ROLLUPS_TABLE,
+          STALE_ROLLUP_COLUMNS,
+          row_count,
+          MARK_STALE_ROLLUP_SUFFIX);
+
+      for (size_t i = 0; i < row_count; ++i, ++stale_begin)
+      {
+        mark.bind(stale_begin->first, stale_begin->second);
+      }
+
+      mark.execute();
+    }
+
+    for (size_t begin = 0; begin < measurements.size(); begin += MAX_ROWS_PER_INSERT)
+    {
+      size_t end = std::min(measurements.size(), begin + MAX_ROWS_PER_INSERT);
+      mysqlx::SqlStatement insert = MakeInsert(
+          &lease,
+          SOIL_MOISTURE_MEASUREMENTS_TABLE,
+          SOIL_MOISTURE_MEASUREMENT_COLUMNS,
+          end - begin,
+          UPSERT_READING_SUFFIX);
+
+      for (size_t i = begin; i < end; ++i)
+      {
+        insert.bind(
+            static_cast<uint64_t>(measurements[i].sensor_id),
+            measurements[i].time_ms,
+            static_cast<uint64_t>(measurements[i].seq),
+            measurements[i].value);
+      }
+
+      insert.execute();
+    }
+
+    lease.GetSession()->commit();
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to batch insert into " << SOIL_MOISTURE_MEASUREMENTS_TABLE
+               << ". Error: " << e;
+    lease.MarkSuspect();
+    Rollback(&lease);
+    return false;
+  }
+
+  return true;
+}
+
+bool MySqlStorageEngine::GetSoilMoistureReadings(
+    size_t sensor_id,
+    int64_t start_ms,
+    int64_t end_ms,
+    size_t max_readings,
+    std::vector<int64_t> *out_times,
+    std::vector<float> *out_values)
+{
+  assert(out_times);
+  assert(out_values);
+
+  DbSessionLease lease;
+  if (!pool_.Checkout(&lease))
+  {
+    return false;
+  }
+
+  try
+  {
+    // Newest first so that LIMIT keeps the most recent readings
+    mysqlx::SqlResult result = lease.GetSession()
+        ->sql(std::string{"SELECT time_ms, reading FROM "} +
+              SOIL_MOISTURE_MEASUREMENTS_TABLE +
+              " WHERE sensor_id = ? AND time_ms >= ? AND time_ms < ?"
+              " ORDER BY time_ms DESC, seq DESC LIMIT ?")
+        .bind(
+            static_cast<uint64_t>(sensor_id),
+            start_ms,
+            end_ms,
+            static_cast<uint64_t>(max_readings))
+        .execute();
+
+    size_t count = static_cast<size_t>(result.count());
+    size_t offset = out_times->size();
+    out_times->resize(offset + count);
+    out_values->resize(offset + count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+      mysqlx::Row row = result.fetchOne();
+      size_t index = offset + count - 1 - i;
+      (*out_times)[index] = row[0].get<int64_t>();
+      (*out_values)[index] = row[1].get<float>();
+    }
+
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to read from " << SOIL_MOISTURE_MEASUREMENTS_TABLE
+               << ". Error: " << e;
+    lease.MarkSuspect();
+    return false;
+  }
+}
+
+bool MySqlStorageEngine::RefreshSoilMoistureRollups()
+{
+  DbSessionLease lease;
+  if (!pool_.Checkout(&lease))
+  {
+    return false;
+  }
+
+  std::vector<std::pair<uint64_t, int64_t>> stale_hours;
+
+  try
+  {
+    mysqlx::SqlResult result = lease.GetSession()
+        ->sql(std::string{"SELECT sensor_id, hour_ms FROM "} + STALE_ROLLUPS_TABLE +
+              " ORDER BY sensor_id, hour_ms LIMIT ?")
+        .bind(static_cast<uint64_t>(MAX_REFRESH_BUCKETS))
+        .execute();
+
+    for (mysqlx::Row row : result.fetchAll())
+    {
+      stale_hours.emplace_back(row[0].get<uint64_t>(), row[1].get<int64_t>());
+    }
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to read " << STALE_ROLLUPS_TABLE << ". Error: " << e;
+    lease.MarkSuspect();
+    return false;
+  }
+
+  for (const std::pair<uint64_t, int64_t> &stale_hour : stale_hours)
+  {
+    uint64_t sensor_id = stale_hour.first;
+    int64_t hour_ms = stale_hour.second;
+    int64_t day_ms = FloorToBucket(hour_ms, DAY_MS);
+
+    try
+    {
+      mysqlx::Session *session = lease.GetSession();
+      session->startTransaction();
+
+      // Deleting the mark first locks it, so a batch that lands in this hour
+      // meanwhile waits and marks it again once the rebuild commits
+      session->sql(std::string{"DELETE FROM "} + STALE_ROLLUPS_TABLE +
+                   " WHERE sensor_id = ? AND hour_ms = ?")
+          .bind(sensor_id, hour_ms)
+          .execute();
+
+      session->sql(REFRESH_ROLLUPS_1M_SQL)
+          .bind(sensor_id, hour_ms, hour_ms + HOUR_MS)
+          .execute();
+
+      session->sql(REFRESH_ROLLUPS_1H_SQL)
+          .bind(sensor_id, hour_ms, hour_ms + HOUR_MS)
+          .execute();
+
+      session->sql(REFRESH_ROLLUPS_1D_SQL)
+          .bind(sensor_id, day_ms, day_ms + DAY_MS)
+          .execute();
+
+      session->commit();
+    }
+    catch (const mysqlx::Error &e)
+    {
+      LOG(ERROR) << "Failed to refresh soil moisture rollups of sensor "
+                 << sensor_id << " at " << hour_ms << ". Error: " << e;
+      lease.MarkSuspect();
+      Rollback(&lease);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool MySqlStorageEngine::PruneSoilMoistureReadings(int64_t cutoff_ms)
+{
+  DbSessionLease lease;
+  if (!pool_.Checkout(&lease))
+  {
+    return false;
+  }
+
+  // Whole hours only, so no minute is left partly pruned
+  cutoff_ms = FloorToBucket(cutoff_ms, HOUR_MS);
+
+  try
+  {
+    mysqlx::Session *session = lease.GetSession();
+
+    // Readings are only pruned once their rollups are current
+    mysqlx::Row oldest_stale = session
+        ->sql(std::string{"SELECT MIN(hour_ms) FROM "} + STALE_ROLLUPS_TABLE)
+        .execute()
+        .fetchOne();
+
+    if (!oldest_stale[0].isNull() && oldest_stale[0].get<int64_t>() < cutoff_ms)
+    {
+      cutoff_ms = oldest_stale[0].get<int64_t>();
+      LOG(INFO) << "Pruning only readings older than " << cutoff_ms
+                << ", where the oldest stale rollups start";
+    }
+
+    // Committed before anything is deleted, so a refresh never rebuilds a
+    // minute from what the prune has left of it
+    session->sql(std::string{"UPDATE "} + PRUNE_WATERMARK_TABLE +
+                 " SET pruned_before_ms = GREATEST(pruned_before_ms, ?)")
+        .bind(cutoff_ms)
+        .execute();
+
+    // A partition holds rows below its bound, so it has fully expired once
+    // the bound is at or before the cutoff. The catch-all never expires.
+    mysqlx::SqlResult partitions = session
+        ->sql("SELECT PARTITION_NAME, PARTITION_DESCRIPTION "
+              "FROM INFORMATION_SCHEMA.PARTITIONS "
+              "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = ? "
+              "AND PARTITION_NAME IS NOT NULL "
+              "ORDER BY PARTITION_ORDINAL_POSITION")
+        .bind(SOIL_MOISTURE_MEASUREMENTS_TABLE)
+        .execute();
+
+    std::vector<std::string> expired;
+    for (mysqlx::Row row : partitions.fetchAll())
+    {
+      std::string name = row[0].get<std::string>();
+      std::string bound = row[1].get<std::string>();
+
+      if (name == FUTURE_PARTITION || std::stoll(bound) > cutoff_ms)
+      {
+        break;
+      }
+
+      expired.push_back(std::move(name));
+    }
+
+    for (const std::string &name : expired)
+    {
+      session->sql(std::string{"ALTER TABLE "} + SOIL_MOISTURE_MEASUREMENTS_TABLE +
+                   " DROP PARTITION " + name).execute();
+
+      LOG(INFO) << "Dropped expired partition " << name << " of "
+                << SOIL_MOISTURE_MEASUREMENTS_TABLE;
+    }
+
+    // Trim the rest in chunks to keep each transaction short
+    std::string delete_statement = std::string{"DELETE FROM "} +
+        SOIL_MOISTURE_MEASUREMENTS_TABLE + " WHERE time_ms < ? LIMIT " +
+        std::to_string(PRUNE_CHUNK_ROWS);
+
+    uint64_t deleted = 0;
+    while (true)
+    {
+      mysqlx::SqlResult result = session->sql(delete_statement)
+          .bind(cutoff_ms)
+          .execute();
+
+      uint64_t count = result.getAffectedItemsCount();
+      deleted += count;
+      if (count < static_cast<uint64_t>(PRUNE_CHUNK_ROWS))
+      {
+        break;
+      }
+    }
+
+    LOG(INFO) << "Pruned " << expired.size() << " partition(s) and " << deleted
+              << " row(s) older than " << cutoff_ms << " from "
+              << SOIL_MOISTURE_MEASUREMENTS_TABLE;
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to prune " << SOIL_MOISTURE_MEASUREMENTS_TABLE
+               << ". Error: " << e;
+    lease.MarkSuspect();
+    return false;
+  }
+}
+
+bool MySqlStorageEngine::EnsureSoilMoistureReadingPartitions()
+{
+  return EnsureMeasurementPartitions(&pool_);
+}
+
+bool MySqlStorageEngine::EnsureMeasurementPartitions(DbSessionPool *pool)
+{
+  assert(pool);
+
+  DbSessionLease lease;
+  if (!pool->Checkout(&lease))
+  {
+    return false;
+  }
+
+  try
+  {
+    std::unordered_set<std::string> partitions;
+    mysqlx::SqlResult result = lease.GetSession()
+        ->sql("SELECT PARTITION_NAME FROM INFORMATION_SCHEMA.PARTITIONS "
+              "WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = ? "
+              "AND PARTITION_NAME IS NOT NULL")
+        .bind(SOIL_MOISTURE_MEASUREMENTS_TABLE)
+        .execute();
+
+    for (mysqlx::Row row : result.fetchAll())
+    {
+      partitions.insert(row[0].get<std::string>());
+    }
+
+    if (partitions.count(FUTURE_PARTITION) == 0)
+    {
+      LOG(ERROR) << SOIL_MOISTURE_MEASUREMENTS_TABLE << " has no "
+                 << FUTURE_PARTITION << " partition. Run "
+                 << "migrate-soil-moisture-readings.sql first.";
+      return false;
+    }
+
+    std::time_t now = std::time(nullptr);
+    std::tm month;
+    gmtime_r(&now, &month);
+    month.tm_mday = 1;
+    month.tm_hour = 0;
+    month.tm_min = 0;
+    month.tm_sec = 0;
+
+    // Split p_future so that this month and the next few each get their own
+    // partition. Months are visited in ascending order, as RANGE requires.
+    for (int i = 0; i <= PARTITION_MONTHS_AHEAD; ++i)
+    {
+      char name[16];
+      std::strftime(name, sizeof(name), "p%Y%m", &month);
+
+      ++month.tm_mon;
+      std::tm next_month = month;
+      int64_t end_ms = static_cast<int64_t>(timegm(&next_month)) * 1000;
+      month = next_month;
+
+      if (partitions.count(name) > 0)
+      {
+        continue;
+      }
+
+      std::ostringstream alter;
+      alter << "ALTER TABLE " << SOIL_MOISTURE_MEASUREMENTS_TABLE
+            << " REORGANIZE PARTITION " << FUTURE_PARTITION << " INTO ("
+            << "PARTITION " << name << " VALUES LESS THAN (" << end_ms << "), "
+            << "PARTITION " << FUTURE_PARTITION << " VALUES LESS THAN MAXVALUE)";
+      lease.GetSession()->sql(alter.str()).execute();
+
+      LOG(INFO) << "Added partition " << name << " to "
+                << SOIL_MOISTURE_MEASUREMENTS_TABLE;
+    }
+
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to add partitions to " << SOIL_MOISTURE_MEASUREMENTS_TABLE
+               << ". Error: " << e;
+    lease.MarkSuspect();
+    return false;
+  }
+}
+
+bool MySqlStorageEngine::InsertRpi(
+    const std::string &name,
+    const std::string &location,
+    size_t *out_id)
+{
+  DbSessionLease lease;
+  if (!pool_.Checkout(&lease))
+  {
+    return false;
+  }
+
+  try
+  {
+    assert(out_id);
+    const mysqlx::SqlResult result = MakeInsert(&lease, RPIS_TABLE, RPI_COLUMNS)
+        .bind(name, MakeTimestamp(), location)
+        .execute();
+
+    if (result.getAffectedItemsCount() == 0)
+    {
+      LOG(ERROR) << "Failed to insert peripheral";
+      return false;
+    }
+
+    *out_id = result.getAutoIncrementValue();
+    registry_->AddRpi(*out_id, name);
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to insert into " << RPIS_TABLE << ". Error: " << e;
+    lease.MarkSuspect();
+    return false;
+  }
+}
+
+bool MySqlStorageEngine::InsertIrrigationSystem(
+    const std::string& name,
+    size_t *out_id)
+{
+  assert(out_id);
+
+  LOG(INFO) << "Registering irrigation system w/database: name="
+            << name;
+  DbSessionLease lease;
+  if (!pool_.Checkout(&lease))
+  {
+    return false;
+  }
+
+  try
+  {
+    lease.GetSession()->startTransaction();
+
+    if (!InsertPeripheral(&lease, name, out_id))
+    {
+      LOG(ERROR) << "Failed to insert peripheral record";
+      goto error;
+    }
+
+    const mysqlx::SqlResult result =
+        MakeInsert(&lease, IRRIGATION_SYSTEMS_TABLE, IRRIGATION_SYSTEM_COLUMNS)
+            .bind(static_cast<uint64_t>(*out_id))
+            .execute();
+
+    if (result.getAffectedItemsCount() == 0)
+    {
+      LOG(ERROR) << "Failed to insert irrigation systems record";
+      goto error;
+    }
+
+    LOG(INFO) << "Irrigation system " << *out_id << " registered successfully";
+    lease.GetSession()->commit();
+    registry_->AddPeripheral(*out_id, name);
+    registry_->AddIrrigationSystem(*out_id);
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << e;
+    lease.MarkSuspect();
+    goto error;
+  }
+
+error:
+    LOG(ERROR) << "Transaction failure when inserting irrigation system. Rolling back...";
+    Rollback(&lease);
+    return false;
+}
+
+bool MySqlStorageEngine::ReplaceDailyIrrigationSchedules(
+    size_t irrigation_system_id,
+    const std::vector<DailyIrrigationSchedule> &schedules)
+{
+  LOG(INFO) << "Replacing daily irrigation schedules:"
+            << " irrigation_system_id=" << irrigation_system_id
+            << " schedule_count=" << schedules.size();
+
+  DbSessionLease lease;
+  if (!pool_.Checkout(&lease))
+  {
+    return false;
+  }
+
+  try
+  {
+    lease.GetSession()->startTransaction();
+
+    lease.GetSession()
+        ->sql(std::string{"DELETE FROM "} + DAILY_IRRIGATION_SCHEDULES_TABLE +
+              " WHERE irrigation_system_id = ?")
+        .bind(static_cast<uint64_t>(irrigation_system_id))
+        .execute();
+
+    for (size_t begin = 0; begin < schedules.size(); begin += MAX_ROWS_PER_INSERT)
+    {
+      size_t end = std::min(schedules.size(), begin + MAX_ROWS_PER_INSERT);
+      mysqlx::SqlStatement insert = MakeInsert(
+          &lease,
+          DAILY_IRRIGATION_SCHEDULES_TABLE,
+          DAILY_IRRIGATION_SCHEDULE_COLUMNS,
+          end - begin);
+
+      for (size_t i = begin; i < end; ++i)
+      {
+        assert(schedules[i].irrigation_system_id == irrigation_system_id);
+        insert.bind(
+            static_cast<uint64_t>(irrigation_system_id),
+            static_cast<uint64_t>(schedules[i].day_of_week_index),
+            schedules[i].water_time_military,
+            static_cast<uint64_t>(schedules[i].water_duration_ms));
+      }
+
+      if (insert.execute().getAffectedItemsCount() != end - begin)
+      {
+        LOG(ERROR) << "Failed to insert every daily irrigation schedule. irrigation_system_id="
+                   << irrigation_system_id;
+        goto error;
+      }
+    }
+
+    lease.GetSession()->commit();
+    LOG(INFO) << "Daily irrigation schedules of irrigation system " << irrigation_system_id
+              << " replaced successfully";
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << e;
+    lease.MarkSuspect();
+    goto error;
+  }
+
+error:
+    LOG(ERROR) << "Transaction failure when replacing daily irrigation "
+               << "schedules. Rolling back...";
+    Rollback(&lease);
+    return false;
+}
+
+bool MySqlStorageEngine::GetDailyIrrigationSchedules(
+    std::vector<DailyIrrigationSchedule> *out_schedules)
+{
+  assert(out_schedules);
+
+  DbSessionLease lease;
+  if (!pool_.Checkout(&lease))
+  {
+    return false;
+  }
+
+  try
+  {
+    mysqlx::RowResult result = lease.GetStatements()
+        ->GetTable(DAILY_IRRIGATION_SCHEDULES_TABLE)
+        ->select(
+            "irrigation_system_id",
+            "day_of_week_index",
+            "irrigation_time_military",
+            "duration_ms")
+        .execute();
+
+    for (mysqlx::Row row : result.fetchAll())
+    {
+      out_schedules->push_back(DailyIrrigationSchedule{
+          static_cast<size_t>(row[0].get<uint64_t>()),
+          static_cast<size_t>(row[1].get<uint64_t>()),
+          row[2].get<std::string>(),
+          static_cast<size_t>(row[3].get<uint64_t>())});
+    }
+
+    return true;
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Failed to read from " << DAILY_IRRIGATION_SCHEDULES_TABLE
+               << ". Error: " << e;
+    lease.MarkSuspect();
+    return false;
+  }
+}
+
+void MySqlStorageEngine::CloseResources()
+{
+  if (!is_initialized_)
+  {
+    return;
+  }
+
+  is_initialized_ = false;
+  pool_ = DbSessionPool{};
+  registry_.reset();
+}
+
+void MySqlStorageEngine::StealResources(MySqlStorageEngine *other)
+{
+  assert(other);
+  is_initialized_ = other->is_initialized_;
+  other->is_initialized_ = false;
+  pool_ = std::move(other->pool_);
+  registry_ = std::move(other->registry_);
+}
+
+} // namespace organicdump
@@ -0,0 +1,128 @@
+#ifndef ORGANICDUMP_SERVER_MYSQLSTORAGEENGINE_H
+#define ORGANICDUMP_SERVER_MYSQLSTORAGEENGINE_H
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <mysqlx/xdevapi.h>
+
+#include "CliConfig.h"
+#include "DbSessionPool.h"
+#include "RegistryCache.h"
+#include "StorageEngine.h"
+
+namespace organicdump
+{
+
+/**
+ * Every call checks a session out of the pool for its own duration, so one
+ * engine may be shared by concurrent threads. Existence checks are served
+ * from a RegistryCache; only writes reach MySQL. The cache also stands in
+ * for the foreign key the partitioned readings table can't have, rejecting
+ * readings of unregistered sensors. Each batch of readings
+ * marks the (sensor, hour) buckets it touches in soil_moisture_stale_rollups
+ * in its own transaction, so stale rollups survive a crash until
+ * RefreshSoilMoistureRollups() rebuilds them. Pruning drops whole monthly
+ * partitions where possible.
+ */
+class MySqlStorageEngine : public StorageEngine
+{
+public:
+  static bool Create(const CliConfig &config, MySqlStorageEngine *out_engine);
+
+public:
+  MySqlStorageEngine();
+  MySqlStorageEngine(
+      DbSessionPool pool,
+      std::unique_ptr<RegistryCache> registry);
+  virtual ~MySqlStorageEngine();
+  MySqlStorageEngine(MySqlStorageEngine &&other);
+  MySqlStorageEngine &operator=(MySqlStorageEngine &&other);
+  bool OrphanRpiOwnedPeripheral(size_t peripheral_id) override;
+  bool AssignPeripheralToRpi(size_t rpi_id, size_t peripheral_id) override;
+  bool ContainsRpi(size_t id) override;
+  bool ContainsRpi(const std::string &name) override;
+  bool ContainsPeripheral(const std::string &name) override;
+  bool ContainsPeripheral(size_t id) override;
+  bool ContainsSoilMoistureSensor(size_t id) override;
+  bool ContainsIrrigationSystem(size_t id) override;
+  bool InsertRpi(
+      const std::string &name,
+      const std::string &location,
+      size_t *out_id) override;
+  bool InsertSoilMoistureSensor(
+      const std::string& name,
+      float floor,
+      float ceil,
+      size_t *out_id) override;
+
+  /** Inserts all |measurements| with a single multi-row INSERT. */
+  bool InsertSoilMoistureMeasurements(
+      const std::vector<SoilMoistureMeasurement> &measurements) override;
+  bool GetSoilMoistureReadings(
+      size_t sensor_id,
+      int64_t start_ms,
+      int64_t end_ms,
+      size_t max_readings,
+      std::vector<int64_t> *out_times,
+      std::vector<float> *out_values) override;
+
+  /**
+   * Recomputes the 1-minute, 1-hour and 1-day rollup buckets of each stale
+   * hour, one hour per transaction. Buckets are rebuilt from their source
+   * rows rather than adjusted, so replayed readings are not counted twice.
+   * Hours that fail stay stale for the next call.
+   */
+  bool RefreshSoilMoistureRollups() override;
+
+  /**
+   * Never prunes readings of an hour whose rollups are still stale. The
+   * watermark in soil_moisture_prune_watermark is raised before anything is
+   * deleted.
+   */
+  bool PruneSoilMoistureReadings(int64_t cutoff_ms) override;
+
+  /** Splits the next few months out of the catch-all partition. */
+  bool EnsureSoilMoistureReadingPartitions() override;
+  bool UpdatePeripheralOwnership(
+      size_t peripheral_id,
+      size_t rpi_id) override;
+  bool InsertIrrigationSystem(
+      const std::string& name,
+      size_t *out_id) override;
+  bool ReplaceDailyIrrigationSchedules(
+      size_t irrigation_system_id,
+      const std::vector<DailyIrrigationSchedule> &schedules) override;
+  bool GetDailyIrrigationSchedules(
+      std::vector<DailyIrrigationSchedule> *out_schedules) override;
+
+private:
+  static bool EnsureMeasurementPartitions(DbSessionPool *pool);
+  void CloseResources();
+  void StealResources(MySqlStorageEngine *other);
+  bool InsertPeripheral(
+      DbSessionLease *lease,
+      const std::string &name,
+      size_t *out_id);
+  bool DeletePeripheralOwnership(DbSessionLease *lease, size_t peripheral_id);
+  bool InsertPeripheralOwnership(
+      DbSessionLease *lease,
+      size_t peripheral_id,
+      size_t rpi_id);
+
+private:
+  MySqlStorageEngine(const MySqlStorageEngine &other) = delete;
+  MySqlStorageEngine &operator=(const MySqlStorageEngine &other) = delete;
+
+private:
+  bool is_initialized_;
+  DbSessionPool pool_;
+  std::unique_ptr<RegistryCache> registry_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_MYSQLSTORAGEENGINE_H
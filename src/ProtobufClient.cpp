@@ -1,66 +1,366 @@
 #include "ProtobufClient.h"
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
 #include <utility>
 
+#include <glog/logging.h>
+
 #include "organic_dump.pb.h"
 
-#include "Fd.h"
+#include "Metrics.h"
 #include "OrganicDumpProtoMessage.h"
+#include "ProtobufFraming.h"
+#include "TlsStream.h"
 
 namespace
 {
+using organicdump::LatencyHistogram;
+using organicdump::Metrics;
 using organicdump_proto::ClientType;
-using network::TlsConnection;
+
+// Enough for a full TLS record per SSL_read()
+constexpr size_t READ_CHUNK_SIZE = 16 * 1024;
+
+LatencyHistogram *GetTlsLatency(const char *op)
+{
+  return Metrics::GetHistogram(
+      "organicdump_tls_seconds",
+      "Time per wakeup spent draining a client's TLS reads or flushing its TLS writes",
+      "op",
+      op);
+}
 } // namespace
 
 namespace organicdump
 {
 
-ProtobufClient::ProtobufClient(TlsConnection cxn)
-  : cxn_{std::move(cxn)},
+ProtobufClient::ProtobufClient(
+    TlsStream stream,
+    uint64_t serial,
+    std::vector<int> *flush_queue)
+  : stream_{std::move(stream)},
+    serial_{serial},
+    flush_queue_{flush_queue},
+    frame_state_{FrameState::READING_HEADER},
+    pending_header_{},
+    recv_buffer_{},
+    recv_begin_{0},
+    send_buffer_{},
+    send_begin_{0},
+    is_read_paused_{false},
+    is_close_requested_{false},
+    first_pending_reply_{0},
+    pending_replies_{},
+    expected_acks_{},
+    connected_at_{std::chrono::steady_clock::now()},
+    last_active_{connected_at_},
     type_{ClientType::UNKNOWN},
     id_{} {}
 
-bool ProtobufClient::Read(OrganicDumpProtoMessage *out_msg, bool *out_cxn_closed)
+bool ProtobufClient::ReadMessages(
+    std::vector<OrganicDumpProtoMessage> *out_msgs,
+    bool *out_cxn_closed)
+{
+  bool is_drained = false;
+  return ReadMessages(SIZE_MAX, out_msgs, out_cxn_closed, &is_drained);
+}
+
+bool ProtobufClient::ReadMessages(
+    size_t max_msgs,
+    std::vector<OrganicDumpProtoMessage> *out_msgs,
+    bool *out_cxn_closed,
+    bool *out_is_drained)
 {
-  assert(out_msg);
+  assert(max_msgs > 0);
+  assert(out_msgs);
+  assert(out_cxn_closed);
+  assert(out_is_drained);
+
+  static LatencyHistogram *latency = GetTlsLatency("read");
+  LatencyTimer timer{latency};
+
+  *out_cxn_closed = false;
+  *out_is_drained = false;
+
+  // Size |out_msgs| may grow to, saturated for the uncapped overload
+  size_t limit = out_msgs->size() + std::min(max_msgs, SIZE_MAX - out_msgs->size());
+
+  // Frames left over by a previous call that stopped early come first
+  if (!ParseFrames(limit, out_msgs))
+  {
+    return false;
+  }
 
-  if (!ReadTlsProtobufMessage(
-        &cxn_,
-        out_msg,
-        out_cxn_closed))
+  while (out_msgs->size() < limit)
   {
-    if (out_cxn_closed)
+    // Reclaim consumed bytes before growing the buffer
+    if (recv_begin_ > 0 && recv_begin_ >= recv_buffer_.size() / 2)
     {
-      return true;
+      recv_buffer_.erase(recv_buffer_.begin(), recv_buffer_.begin() + recv_begin_);
+      recv_begin_ = 0;
     }
 
-    LOG(ERROR) << "Failed to read TLS protobuf message";
-    return false;
+    size_t offset = recv_buffer_.size();
+    recv_buffer_.resize(offset + READ_CHUNK_SIZE);
+
+    size_t bytes_read = 0;
+    TlsIoStatus status = stream_.Read(
+        recv_buffer_.data() + offset,
+        READ_CHUNK_SIZE,
+        &bytes_read);
+
+    recv_buffer_.resize(offset + bytes_read);
+
+    switch (status)
+    {
+      case TlsIoStatus::COMPLETE:
+        if (!ParseFrames(limit, out_msgs))
+        {
+          return false;
+        }
+        continue;
+      case TlsIoStatus::WANT_READ:
+      case TlsIoStatus::WANT_WRITE:
+        *out_is_drained = true;
+        return true;
+      case TlsIoStatus::CLOSED:
+        *out_cxn_closed = true;
+        *out_is_drained = true;
+        return true;
+      default:
+        LOG(ERROR) << "Failed to read from TLS stream";
+        return false;
+    }
   }
 
   return true;
 }
 
-bool ProtobufClient::Write(OrganicDumpProtoMessage *msg, bool *out_cxn_closed)
+bool ProtobufClient::Write(OrganicDumpProtoMessage *msg)
 {
   assert(msg);
 
-  if (!SendTlsProtobufMessage(
-        &cxn_,
-        msg,
-        out_cxn_closed))
+  // Reclaim flushed bytes so a slow but steady reader doesn't grow the buffer
+  if (send_begin_ > 0 && send_begin_ >= send_buffer_.size() / 2)
+  {
+    send_buffer_.erase(0, send_begin_);
+    send_begin_ = 0;
+  }
+
+  bool was_idle = GetPendingWriteBytes() == 0;
+
+  if (!EncodeFrame(*msg, &send_buffer_))
+  {
+    LOG(ERROR) << "Failed to encode TLS protobuf message";
+    return false;
+  }
+
+  if (was_idle && flush_queue_)
+  {
+    flush_queue_->push_back(GetFd());
+  }
+
+  return true;
+}
+
+bool ProtobufClient::Flush(bool *out_cxn_closed)
+{
+  assert(out_cxn_closed);
+
+  static LatencyHistogram *latency = GetTlsLatency("write");
+  LatencyTimer timer{latency};
+
+  *out_cxn_closed = false;
+
+  while (send_begin_ < send_buffer_.size())
+  {
+    size_t bytes_written = 0;
+    TlsIoStatus status = stream_.Write(
+        reinterpret_cast<const uint8_t *>(send_buffer_.data()) + send_begin_,
+        send_buffer_.size() - send_begin_,
+        &bytes_written);
+
+    switch (status)
+    {
+      case TlsIoStatus::COMPLETE:
+        send_begin_ += bytes_written;
+        break;
+      case TlsIoStatus::WANT_READ:
+      case TlsIoStatus::WANT_WRITE:
+        return true;
+      case TlsIoStatus::CLOSED:
+        *out_cxn_closed = true;
+        return false;
+      default:
+        LOG(ERROR) << "Failed to write TLS protobuf messages";
+        return false;
+    }
+  }
+
+  send_buffer_.clear();
+  send_begin_ = 0;
+  return true;
+}
+
+size_t ProtobufClient::GetPendingWriteBytes() const
+{
+  return send_buffer_.size() - send_begin_;
+}
+
+bool ProtobufClient::IsReadPaused() const
+{
+  return is_read_paused_;
+}
+
+void ProtobufClient::SetReadPaused(bool paused)
+{
+  is_read_paused_ = paused;
+}
+
+bool ProtobufClient::ParseFrames(size_t limit, std::vector<OrganicDumpProtoMessage> *out_msgs)
+{
+  while (out_msgs->size() < limit)
+  {
+    size_t available = recv_buffer_.size() - recv_begin_;
+    const uint8_t *data = recv_buffer_.data() + recv_begin_;
+
+    if (frame_state_ == FrameState::READING_HEADER)
+    {
+      if (available < FRAME_HEADER_SIZE)
+      {
+        return true;
+      }
+
+      memcpy(&pending_header_, data, FRAME_HEADER_SIZE);
+      recv_begin_ += FRAME_HEADER_SIZE;
+
+      if (pending_header_.size > MAX_FRAME_BODY_SIZE)
+      {
+        LOG(ERROR) << "TLS protobuf message body too large: " << pending_header_.size;
+        return false;
+      }
+
+      frame_state_ = FrameState::READING_BODY;
+      continue;
+    }
+
+    if (available < pending_header_.size)
+    {
+      return true;
+    }
+
+    OrganicDumpProtoMessage msg;
+    if (!DecodeFrameBody(pending_header_.type, data, pending_header_.size, &msg))
+    {
+      LOG(ERROR) << "Failed to decode TLS protobuf message";
+      return false;
+    }
+
+    recv_begin_ += pending_header_.size;
+    frame_state_ = FrameState::READING_HEADER;
+    out_msgs->push_back(std::move(msg));
+  }
+
+  return true;
+}
+
+void ProtobufClient::RequestClose()
+{
+  if (is_close_requested_)
+  {
+    return;
+  }
+
+  is_close_requested_ = true;
+  if (flush_queue_)
+  {
+    flush_queue_->push_back(GetFd());
+  }
+}
+
+bool ProtobufClient::IsCloseRequested() const
+{
+  return is_close_requested_;
+}
+
+uint64_t ProtobufClient::AddPendingReply()
+{
+  pending_replies_.emplace_back();
+  return first_pending_reply_ + pending_replies_.size() - 1;
+}
+
+void ProtobufClient::CompletePendingReply(uint64_t slot, ReplySender send)
+{
+  assert(send);
+  assert(slot >= first_pending_reply_);
+  assert(slot - first_pending_reply_ < pending_replies_.size());
+
+  ReplySender &pending = pending_replies_[slot - first_pending_reply_];
+  assert(!pending);
+  pending = std::move(send);
+
+  while (!pending_replies_.empty() && pending_replies_.front())
+  {
+    ReplySender ready = std::move(pending_replies_.front());
+    pending_replies_.pop_front();
+    ++first_pending_reply_;
+    ready(this);
+  }
+}
+
+bool ProtobufClient::HasPendingReplies() const
+{
+  return !pending_replies_.empty();
+}
+
+void ProtobufClient::ExpectAck(AckHandler on_ack)
+{
+  expected_acks_.push_back(std::move(on_ack));
+}
+
+bool ProtobufClient::TakeExpectedAck(AckHandler *out_on_ack)
+{
+  assert(out_on_ack);
+
+  if (expected_acks_.empty())
   {
-    LOG(ERROR) << "Failed to write TLS protobuf message";
     return false;
   }
 
+  *out_on_ack = std::move(expected_acks_.front());
+  expected_acks_.pop_front();
   return true;
 }
 
-const network::Fd &ProtobufClient::GetFd() const
+void ProtobufClient::MarkActive(std::chrono::steady_clock::time_point now)
+{
+  last_active_ = now;
+}
+
+std::chrono::steady_clock::time_point ProtobufClient::GetLastActive() const
+{
+  return last_active_;
+}
+
+std::chrono::steady_clock::time_point ProtobufClient::GetConnectedAt() const
+{
+  return connected_at_;
+}
+
+int ProtobufClient::GetFd() const
+{
+  return stream_.GetFd();
+}
+
+uint64_t ProtobufClient::GetSerial() const
 {
-  return cxn_.GetFd();
+  return serial_;
 }
 
 const organicdump_proto::ClientType &ProtobufClient::GetType() const
@@ -1,32 +1,161 @@
 #ifndef ORGANICDUMP_SERVER_PROTOBUFCLIENT_H
 #define ORGANICDUMP_SERVER_PROTOBUFCLIENT_H
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
 #include "organic_dump.pb.h"
 
-#include "Fd.h"
 #include "OrganicDumpProtoMessage.h"
-#include "TlsConnection.h"
+#include "ProtobufFraming.h"
+#include "TlsStream.h"
 
 namespace organicdump
 {
 
+/**
+ * A connected peer speaking framed protobuf over a non-blocking TLS stream.
+ *
+ * Reads are incremental: whatever SSL_read() returns is appended to a
+ * per-connection receive buffer and complete frames are peeled off the
+ * front, so a peer that sends half a frame never blocks the reactor.
+ *
+ * Writes are queued: Write() only appends the encoded frame to an outbound
+ * buffer and Flush() pushes as much of it as the socket accepts, so several
+ * small responses go out in a single SSL_write().
+ */
 class ProtobufClient
 {
 public:
-  ProtobufClient(network::TlsConnection cxn);
+  using ReplySender = std::function<void(ProtobufClient *client)>;
+  using AckHandler = std::function<void(const organicdump_proto::BasicResponse &resp)>;
+
+public:
+  /**
+   * |serial| uniquely identifies the connection within its Server, unlike the
+   * fd which is recycled. When a write makes the outbound queue non-empty the
+   * fd is appended to |flush_queue| so the owner knows to flush it.
+   */
   ProtobufClient(
-      network::TlsConnection cxn,
-      organicdump_proto::ClientType type);
-  bool Read(OrganicDumpProtoMessage *out_msg, bool *out_cxn_closed=nullptr);
-  bool Write(OrganicDumpProtoMessage *msg, bool *out_cxn_closed=nullptr);
-  const network::Fd &GetFd() const;
+      TlsStream stream,
+      uint64_t serial,
+      std::vector<int> *flush_queue);
+
+  /**
+   * Reads until the stream reports WANT_READ, i.e. until both OpenSSL's
+   * buffered records (SSL_pending) and the socket are drained, and appends
+   * every complete message to |out_msgs|. Sets |out_cxn_closed| when the
+   * peer closed the connection; messages read before the close are still
+   * returned.
+   */
+  bool ReadMessages(
+      std::vector<OrganicDumpProtoMessage> *out_msgs,
+      bool *out_cxn_closed);
+
+  /**
+   * Like ReadMessages(), but stops once |max_msgs| messages have been
+   * appended, leaving the rest buffered for the next call. Sets
+   * |out_is_drained| unless it stopped early, in which case the owner must
+   * call again without waiting for another readiness edge.
+   */
+  bool ReadMessages(
+      size_t max_msgs,
+      std::vector<OrganicDumpProtoMessage> *out_msgs,
+      bool *out_cxn_closed,
+      bool *out_is_drained);
+  bool Write(OrganicDumpProtoMessage *msg);
+
+  /**
+   * Writes queued frames until the queue is empty or the socket would block.
+   */
+  bool Flush(bool *out_cxn_closed);
+  size_t GetPendingWriteBytes() const;
+  bool IsReadPaused() const;
+  void SetReadPaused(bool paused);
+
+  /**
+   * Asks the owner to disconnect the client once its queued writes have
+   * been flushed, for decisions made outside the read path.
+   */
+  void RequestClose();
+  bool IsCloseRequested() const;
+
+  /**
+   * Reserves a slot for a response that is still being produced off the
+   * reactor thread. Completed slots are sent in the order they were
+   * reserved, whichever finishes first, so a slow response is never
+   * overtaken. A response may be written inline only when no slot is
+   * outstanding.
+   */
+  uint64_t AddPendingReply();
+  void CompletePendingReply(uint64_t slot, ReplySender send);
+  bool HasPendingReplies() const;
+
+  /**
+   * Devices acknowledge commands in the order they were written. Call after
+   * writing a command to queue the handler for its ack, which may be empty
+   * when nothing waits on it.
+   */
+  void ExpectAck(AckHandler on_ack);
+
+  /** False if no command is awaiting an ack. */
+  bool TakeExpectedAck(AckHandler *out_on_ack);
+
+  /**
+   * Time the peer last sent a message, which the owner uses to reap dead
+   * connections. Starts out as the time the client was created.
+   */
+  void MarkActive(std::chrono::steady_clock::time_point now);
+  std::chrono::steady_clock::time_point GetLastActive() const;
+  std::chrono::steady_clock::time_point GetConnectedAt() const;
+  int GetFd() const;
+  uint64_t GetSerial() const;
   const organicdump_proto::ClientType &GetType() const;
   size_t GetId() const;
   bool IsDifferentiated() const;
   void Differentiate(organicdump_proto::ClientType type, size_t id);
 
 private:
-  network::TlsConnection cxn_;
+  enum class FrameState
+  {
+    READING_HEADER,
+    READING_BODY,
+  };
+
+private:
+  /** Parses buffered frames until |out_msgs| holds |limit| messages. */
+  bool ParseFrames(size_t limit, std::vector<OrganicDumpProtoMessage> *out_msgs);
+
+private:
+  TlsStream stream_;
+  uint64_t serial_;
+  std::vector<int> *flush_queue_;
+  FrameState frame_state_;
+  FrameHeader pending_header_;
+
+  // Bytes in [recv_begin_, recv_buffer_.size()) have been read but not yet
+  // consumed as part of a frame.
+  std::vector<uint8_t> recv_buffer_;
+  size_t recv_begin_;
+
+  // Bytes in [send_begin_, send_buffer_.size()) are queued for the peer
+  std::string send_buffer_;
+  size_t send_begin_;
+  bool is_read_paused_;
+  bool is_close_requested_;
+
+  // Slot |first_pending_reply_| is at the front. Empty senders are still
+  // being produced.
+  uint64_t first_pending_reply_;
+  std::deque<ReplySender> pending_replies_;
+  std::deque<AckHandler> expected_acks_;
+  std::chrono::steady_clock::time_point connected_at_;
+  std::chrono::steady_clock::time_point last_active_;
   organicdump_proto::ClientType type_;
   size_t id_;
 };
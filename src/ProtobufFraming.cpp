@@ -0,0 +1,138 @@
+#include "ProtobufFraming.h"
+
+#include <cassert>
+#include <cstring>
+#include <string>
+
+#include <glog/logging.h>
+#include <google/protobuf/message_lite.h>
+
+#include "organic_dump.pb.h"
+
+#include "OrganicDumpProtoMessage.h"
+
+namespace
+{
+using google::protobuf::MessageLite;
+using organicdump::OrganicDumpProtoMessage;
+using organicdump_proto::MessageType;
+
+// Shared by the const and mutable accessors below
+template <typename Payload, typename Message>
+Payload *SelectPayload(MessageType type, Message *msg)
+{
+  switch (type)
+  {
+    case MessageType::HELLO:
+      return &msg->hello;
+    case MessageType::BASIC_RESPONSE:
+      return &msg->basic_response;
+    case MessageType::REGISTER_RPI:
+      return &msg->register_rpi;
+    case MessageType::REGISTER_SOIL_MOISTURE_SENSOR:
+      return &msg->register_soil_moisture_sensor;
+    case MessageType::UPDATE_PERIPHERAL_OWNERSHIP:
+      return &msg->update_peripheral_ownership;
+    case MessageType::SEND_SOIL_MOISTURE_MEASUREMENT:
+      return &msg->send_soil_moisture_measurement;
+    case MessageType::SEND_SOIL_MOISTURE_MEASUREMENTS:
+      return &msg->send_soil_moisture_measurements;
+    case MessageType::REGISTER_IRRIGATION_SYSTEM:
+      return &msg->register_irrigation_system;
+    case MessageType::SET_IRRIGATION_SCHEDULE:
+      return &msg->set_irrigation_schedule;
+    case MessageType::UNSCHEDULED_IRRIGATION_REQUEST:
+      return &msg->unscheduled_irrigation_request;
+    case MessageType::GET_SOIL_MOISTURE_HISTORY:
+      return &msg->get_soil_moisture_history;
+    case MessageType::SOIL_MOISTURE_HISTORY:
+      return &msg->soil_moisture_history;
+    case MessageType::HEARTBEAT:
+      return &msg->heartbeat;
+    default:
+      return nullptr;
+  }
+}
+
+const MessageLite *GetPayload(const OrganicDumpProtoMessage &msg)
+{
+  return SelectPayload<const MessageLite>(msg.type, &msg);
+}
+
+MessageLite *GetMutablePayload(MessageType type, OrganicDumpProtoMessage *msg)
+{
+  return SelectPayload<MessageLite>(type, msg);
+}
+
+} // namespace
+
+namespace organicdump
+{
+
+bool EncodeFrame(const OrganicDumpProtoMessage &msg, std::string *out_buffer)
+{
+  assert(out_buffer);
+
+  const MessageLite *payload = GetPayload(msg);
+  if (!payload)
+  {
+    LOG(ERROR) << "Cannot encode message w/type " << ToString(msg.type);
+    return false;
+  }
+
+  size_t body_size = payload->ByteSizeLong();
+
+  FrameHeader header;
+  memset(&header, 0, sizeof(header));
+  header.type = static_cast<uint8_t>(msg.type);
+  header.size = body_size;
+
+  size_t offset = out_buffer->size();
+  out_buffer->resize(offset + FRAME_HEADER_SIZE + body_size);
+
+  uint8_t *frame = reinterpret_cast<uint8_t *>(&(*out_buffer)[offset]);
+  memcpy(frame, &header, FRAME_HEADER_SIZE);
+
+  if (!payload->SerializeToArray(frame + FRAME_HEADER_SIZE, static_cast<int>(body_size)))
+  {
+    LOG(ERROR) << "Failed to serialize message w/type " << ToString(msg.type);
+    out_buffer->resize(offset);
+    return false;
+  }
+
+  return true;
+}
+
+bool DecodeFrameBody(
+    uint8_t type,
+    const uint8_t *body,
+    size_t size,
+    OrganicDumpProtoMessage *out_msg)
+{
+  assert(out_msg);
+
+  if (!organicdump_proto::MessageType_IsValid(type))
+  {
+    LOG(ERROR) << "Received frame w/invalid message type: " << static_cast<int>(type);
+    return false;
+  }
+
+  MessageType message_type = static_cast<MessageType>(type);
+  MessageLite *payload = GetMutablePayload(message_type, out_msg);
+  if (!payload)
+  {
+    LOG(ERROR) << "Received frame w/unsupported message type: " << ToString(message_type);
+    return false;
+  }
+
+  if (!payload->ParseFromArray(body, static_cast<int>(size)))
+  {
+    LOG(ERROR) << "Failed to parse " << ToString(message_type) << " frame body";
+    return false;
+  }
+
+  out_msg->type = message_type;
+  return true;
+}
+
+} // namespace organicdump
@@ -0,0 +1,42 @@
+#ifndef ORGANICDUMP_SERVER_PROTOBUFFRAMING_H
+#define ORGANICDUMP_SERVER_PROTOBUFFRAMING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "OrganicDumpProtoMessage.h"
+#include "TlsUtilities.h"
+
+namespace organicdump
+{
+
+/**
+ * Frames on the wire are the raw network::ProtobufMessageHeader followed by
+ * |header.size| bytes of serialized protobuf, exactly as written by
+ * SendTlsProtobufMessage() in organic-dump-network.
+ */
+using FrameHeader = network::ProtobufMessageHeader;
+constexpr size_t FRAME_HEADER_SIZE = sizeof(FrameHeader);
+
+// Upper bound on a frame body. Larger headers are treated as corrupt rather
+// than trusted with an allocation.
+constexpr size_t MAX_FRAME_BODY_SIZE = 1 << 20;
+
+/**
+ * Appends the framed encoding of |msg| to |out_buffer|.
+ */
+bool EncodeFrame(const OrganicDumpProtoMessage &msg, std::string *out_buffer);
+
+/**
+ * Parses a frame body of |size| bytes into the payload selected by |type|.
+ */
+bool DecodeFrameBody(
+    uint8_t type,
+    const uint8_t *body,
+    size_t size,
+    OrganicDumpProtoMessage *out_msg);
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_PROTOBUFFRAMING_H
@@ -0,0 +1,230 @@
+#include "ReactorPool.h"
+
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+#include "AcceptRateLimiter.h"
+#include "ClientDirectory.h"
+#include "DbExecutor.h"
+#include "DbManager.h"
+#include "IrrigationScheduler.h"
+#include "MeasurementLog.h"
+#include "RollupEngine.h"
+#include "SensorHistoryCache.h"
+#include "Server.h"
+#include "TlsContext.h"
+
+namespace
+{
+// Source addresses whose accept rate is tracked at once
+constexpr size_t MAX_RATE_LIMITED_SOURCES = 64 * 1024;
+} // namespace
+
+namespace organicdump
+{
+
+bool ReactorPool::Create(const CliConfig &config, ReactorPool *out_pool)
+{
+  assert(out_pool);
+
+  size_t thread_count = config.GetReactorThreads();
+  assert(thread_count > 0);
+
+  auto tls_context = std::make_shared<TlsContext>();
+  if (!TlsContext::Create(
+        config.GetCertFile(),
+        config.GetKeyFile(),
+        config.GetCaFile(),
+        tls_context.get()))
+  {
+    LOG(ERROR) << "Failed to create TLS context";
+    return false;
+  }
+
+  auto db = std::make_shared<DbManager>();
+  if (!DbManager::Create(config, db.get()))
+  {
+    LOG(ERROR) << "Failed to create DbManager";
+    return false;
+  }
+
+  RollupEngine rollup_engine;
+  if (!RollupEngine::Create(
+        db,
+        config.GetRollupInterval(),
+        config.GetRawRetention(),
+        &rollup_engine))
+  {
+    LOG(ERROR) << "Failed to create rollup engine";
+    return false;
+  }
+
+  std::shared_ptr<MeasurementLog> measurement_log;
+  if (!config.GetMeasurementWalDir().empty())
+  {
+    measurement_log = std::make_shared<MeasurementLog>();
+    if (!MeasurementLog::Create(
+          config.GetMeasurementWalDir(),
+          [db](const std::vector<SoilMoistureMeasurement> &measurements) {
+            return db->InsertSoilMoistureMeasurements(measurements);
+          },
+          measurement_log.get()))
+    {
+      LOG(ERROR) << "Failed to create measurement log";
+      return false;
+    }
+  }
+
+  auto history = std::make_shared<SensorHistoryCache>(
+      config.GetHistoryReadingsPerSensor());
+
+  // Lets a reactor route to clients that another reactor accepted
+  auto directory = std::make_shared<ClientDirectory>();
+
+  std::vector<DailyIrrigationSchedule> schedules;
+  if (!db->GetDailyIrrigationSchedules(&schedules))
+  {
+    LOG(ERROR) << "Failed to load daily irrigation schedules";
+    return false;
+  }
+
+  auto scheduler = std::make_shared<IrrigationScheduler>(directory);
+  scheduler->Load(schedules);
+
+  auto db_executor = std::make_shared<DbExecutor>();
+  if (!DbExecutor::Create(
+        config.GetDbThreads(),
+        std::move(db),
+        db_executor.get()))
+  {
+    LOG(ERROR) << "Failed to create db executor";
+    return false;
+  }
+
+  // Shared so that spreading connections across reactors doesn't multiply
+  // a peer's accept rate
+  auto accept_limiter = std::make_shared<AcceptRateLimiter>(
+      config.GetAcceptRatePerIp(),
+      static_cast<double>(config.GetAcceptBurstPerIp()),
+      MAX_RATE_LIMITED_SOURCES);
+
+  bool reuse_port = thread_count > 1;
+
+  std::vector<std::unique_ptr<Server>> servers;
+  servers.reserve(thread_count);
+
+  for (size_t i = 0; i < thread_count; ++i)
+  {
+    auto server = std::make_unique<Server>();
+    if (!Server::Create(
+          config,
+          reuse_port,
+          tls_context,
+          db_executor,
+          measurement_log,
+          history,
+          directory,
+          scheduler,
+          accept_limiter,
+          i == 0,
+          server.get()))
+    {
+      LOG(ERROR) << "Failed to create reactor " << i;
+      return false;
+    }
+
+    servers.push_back(std::move(server));
+  }
+
+  LOG(INFO) << "Created " << thread_count << " reactor(s) on port "
+            << config.GetPort();
+
+  *out_pool = ReactorPool{
+      std::move(db_executor),
+      std::move(measurement_log),
+      std::move(rollup_engine),
+      std::move(servers)};
+  return true;
+}
+
+ReactorPool::ReactorPool() {}
+
+ReactorPool::ReactorPool(
+    std::shared_ptr<DbExecutor> db_executor,
+    std::shared_ptr<MeasurementLog> measurement_log,
+    RollupEngine rollup_engine,
+    std::vector<std::unique_ptr<Server>> servers)
+  : db_executor_{std::move(db_executor)},
+    measurement_log_{std::move(measurement_log)},
+    rollup_engine_{std::move(rollup_engine)},
+    servers_{std::move(servers)} {}
+
+ReactorPool::ReactorPool(ReactorPool &&other)
+{
+  StealResources(&other);
+}
+
+ReactorPool &ReactorPool::operator=(ReactorPool &&other)
+{
+  if (this != &other)
+  {
+    StealResources(&other);
+  }
+  return *this;
+}
+
+ReactorPool::~ReactorPool() {}
+
+bool ReactorPool::Run()
+{
+  if (servers_.size() == 1)
+  {
+    return servers_.front()->Run();
+  }
+
+  std::atomic<bool> failed{false};
+  std::vector<std::thread> threads;
+  threads.reserve(servers_.size());
+
+  for (size_t i = 0; i < servers_.size(); ++i)
+  {
+    threads.emplace_back([this, i, &failed]() {
+      if (servers_[i]->Run())
+      {
+        return;
+      }
+
+      LOG(ERROR) << "Reactor " << i << " failed. Stopping remaining reactors...";
+      failed = true;
+
+      for (const auto &server : servers_)
+      {
+        server->Stop();
+      }
+    });
+  }
+
+  for (auto &thread : threads)
+  {
+    thread.join();
+  }
+
+  return !failed;
+}
+
+void ReactorPool::StealResources(ReactorPool *other)
+{
+  assert(other);
+  servers_ = std::move(other->servers_);
+  rollup_engine_ = std::move(other->rollup_engine_);
+  measurement_log_ = std::move(other->measurement_log_);
+  db_executor_ = std::move(other->db_executor_);
+}
+
+} // namespace organicdump
@@ -0,0 +1,65 @@
+#ifndef ORGANICDUMP_SERVER_REACTORPOOL_H
+#define ORGANICDUMP_SERVER_REACTORPOOL_H
+
+#include <memory>
+#include <vector>
+
+#include "CliConfig.h"
+#include "DbExecutor.h"
+#include "MeasurementLog.h"
+#include "RollupEngine.h"
+#include "Server.h"
+
+namespace organicdump
+{
+
+/**
+ * Runs one Server per thread. Each Server owns a SO_REUSEPORT listener on the
+ * shared port, so the kernel shards accepted connections across threads and
+ * every connection (and its handlers) stays confined to a single thread.
+ * Database work from all reactors runs on a shared DbExecutor, and
+ * measurements optionally land in a shared MeasurementLog first.
+ */
+class ReactorPool
+{
+public:
+  static bool Create(const CliConfig &config, ReactorPool *out_pool);
+
+public:
+  ReactorPool();
+  ReactorPool(
+      std::shared_ptr<DbExecutor> db_executor,
+      std::shared_ptr<MeasurementLog> measurement_log,
+      RollupEngine rollup_engine,
+      std::vector<std::unique_ptr<Server>> servers);
+  ReactorPool(ReactorPool &&other);
+  ReactorPool &operator=(ReactorPool &&other);
+  ~ReactorPool();
+
+  /**
+   * Blocks until every reactor returns. If one reactor fails, the others are
+   * stopped and false is returned.
+   */
+  bool Run();
+
+private:
+  void StealResources(ReactorPool *other);
+
+private:
+  ReactorPool(const ReactorPool &other) = delete;
+  ReactorPool &operator=(const ReactorPool &other) = delete;
+
+private:
+  // Shared by every reactor. Declared first so that it outlives the servers
+  // that submit work to it.
+  std::shared_ptr<DbExecutor> db_executor_;
+
+  // Null unless --measurement_wal_dir is set
+  std::shared_ptr<MeasurementLog> measurement_log_;
+  RollupEngine rollup_engine_;
+  std::vector<std::unique_ptr<Server>> servers_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_REACTORPOOL_H
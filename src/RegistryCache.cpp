@@ -0,0 +1,92 @@
+#include "RegistryCache.h"
+
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+
+namespace organicdump
+{
+
+RegistryCache::RegistryCache() {}
+
+void RegistryCache::AddRpi(size_t id, const std::string &name)
+{
+  std::unique_lock<std::shared_mutex> lock{mutex_};
+  rpi_ids_.insert(id);
+  rpi_names_.insert(name);
+}
+
+bool RegistryCache::ContainsRpi(size_t id) const
+{
+  std::shared_lock<std::shared_mutex> lock{mutex_};
+  return rpi_ids_.count(id) > 0;
+}
+
+bool RegistryCache::ContainsRpi(const std::string &name) const
+{
+  std::shared_lock<std::shared_mutex> lock{mutex_};
+  return rpi_names_.count(name) > 0;
+}
+
+void RegistryCache::AddPeripheral(size_t id, const std::string &name)
+{
+  std::unique_lock<std::shared_mutex> lock{mutex_};
+  peripheral_ids_.insert(id);
+  peripheral_names_.insert(name);
+}
+
+bool RegistryCache::ContainsPeripheral(size_t id) const
+{
+  std::shared_lock<std::shared_mutex> lock{mutex_};
+  return peripheral_ids_.count(id) > 0;
+}
+
+bool RegistryCache::ContainsPeripheral(const std::string &name) const
+{
+  std::shared_lock<std::shared_mutex> lock{mutex_};
+  return peripheral_names_.count(name) > 0;
+}
+
+void RegistryCache::AddSoilMoistureSensor(size_t peripheral_id)
+{
+  std::unique_lock<std::shared_mutex> lock{mutex_};
+  soil_moisture_sensor_ids_.insert(peripheral_id);
+}
+
+bool RegistryCache::ContainsSoilMoistureSensor(size_t peripheral_id) const
+{
+  std::shared_lock<std::shared_mutex> lock{mutex_};
+  return soil_moisture_sensor_ids_.count(peripheral_id) > 0;
+}
+
+void RegistryCache::AddIrrigationSystem(size_t peripheral_id)
+{
+  std::unique_lock<std::shared_mutex> lock{mutex_};
+  irrigation_system_ids_.insert(peripheral_id);
+}
+
+bool RegistryCache::ContainsIrrigationSystem(size_t peripheral_id) const
+{
+  std::shared_lock<std::shared_mutex> lock{mutex_};
+  return irrigation_system_ids_.count(peripheral_id) > 0;
+}
+
+void RegistryCache::SetPeripheralOwner(size_t peripheral_id, size_t rpi_id)
+{
+  std::unique_lock<std::shared_mutex> lock{mutex_};
+  peripheral_owners_[peripheral_id] = rpi_id;
+}
+
+void RegistryCache::RemovePeripheralOwner(size_t peripheral_id)
+{
+  std::unique_lock<std::shared_mutex> lock{mutex_};
+  peripheral_owners_.erase(peripheral_id);
+}
+
+bool RegistryCache::IsPeripheralOwned(size_t peripheral_id) const
+{
+  std::shared_lock<std::shared_mutex> lock{mutex_};
+  return peripheral_owners_.count(peripheral_id) > 0;
+}
+
+} // namespace organicdump
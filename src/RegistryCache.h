@@ -0,0 +1,63 @@
+#ifndef ORGANICDUMP_SERVER_REGISTRYCACHE_H
+#define ORGANICDUMP_SERVER_REGISTRYCACHE_H
+
+#include <cstddef>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace organicdump
+{
+
+/**
+ * In-memory copy of the rpi/peripheral registry and the rpi ownership edges.
+ * MySqlStorageEngine and SqliteStorageEngine warm it at startup and writes through to it after
+ * each committed change, so existence checks never reach MySQL. This assumes the
+ * server is the only writer of those tables.
+ *
+ * Lookups take a shared lock and may run concurrently from any thread.
+ */
+class RegistryCache
+{
+public:
+  RegistryCache();
+
+  void AddRpi(size_t id, const std::string &name);
+  bool ContainsRpi(size_t id) const;
+  bool ContainsRpi(const std::string &name) const;
+
+  void AddPeripheral(size_t id, const std::string &name);
+  bool ContainsPeripheral(size_t id) const;
+  bool ContainsPeripheral(const std::string &name) const;
+
+  void AddSoilMoistureSensor(size_t peripheral_id);
+  bool ContainsSoilMoistureSensor(size_t peripheral_id) const;
+
+  void AddIrrigationSystem(size_t peripheral_id);
+  bool ContainsIrrigationSystem(size_t peripheral_id) const;
+
+  void SetPeripheralOwner(size_t peripheral_id, size_t rpi_id);
+  void RemovePeripheralOwner(size_t peripheral_id);
+  bool IsPeripheralOwned(size_t peripheral_id) const;
+
+private:
+  RegistryCache(const RegistryCache &other) = delete;
+  RegistryCache &operator=(const RegistryCache &other) = delete;
+
+private:
+  mutable std::shared_mutex mutex_;
+  std::unordered_set<size_t> rpi_ids_;
+  std::unordered_set<std::string> rpi_names_;
+  std::unordered_set<size_t> peripheral_ids_;
+  std::unordered_set<std::string> peripheral_names_;
+  std::unordered_set<size_t> soil_moisture_sensor_ids_;
+  std::unordered_set<size_t> irrigation_system_ids_;
+
+  // peripheral id -> owning rpi id
+  std::unordered_map<size_t, size_t> peripheral_owners_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_REGISTRYCACHE_H
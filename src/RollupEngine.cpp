@@ -0,0 +1,182 @@
+#include "RollupEngine.h"
+
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include <glog/logging.h>
+
+#include "DbManager.h"
+
+namespace
+{
+// Retention is measured in days, so pruning more often gains little
+constexpr std::chrono::minutes PRUNE_INTERVAL{60};
+
+// Partitions are added months ahead, so an hourly check keeps a server that
+// runs for months from writing everything into the catch-all partition
+constexpr std::chrono::minutes PARTITION_CHECK_INTERVAL{60};
+
+int64_t NowMs()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+} // namespace
+
+namespace organicdump
+{
+
+struct RollupEngine::State
+{
+  std::shared_ptr<DbManager> db;
+  std::chrono::milliseconds refresh_interval;
+  std::chrono::hours raw_retention;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool is_stopping;
+};
+
+bool RollupEngine::Create(
+    std::shared_ptr<DbManager> db,
+    std::chrono::milliseconds refresh_interval,
+    std::chrono::hours raw_retention,
+    RollupEngine *out_engine)
+{
+  assert(db);
+  assert(refresh_interval.count() > 0);
+  assert(out_engine);
+
+  auto state = std::make_unique<State>();
+  state->db = std::move(db);
+  state->refresh_interval = refresh_interval;
+  state->raw_retention = raw_retention;
+  state->is_stopping = false;
+
+  *out_engine = RollupEngine{std::move(state)};
+  out_engine->thread_ = std::thread{Run, out_engine->state_.get()};
+
+  LOG(INFO) << "Started rollup engine";
+  return true;
+}
+
+RollupEngine::RollupEngine() {}
+
+RollupEngine::RollupEngine(std::unique_ptr<State> state)
+  : state_{std::move(state)} {}
+
+RollupEngine::~RollupEngine()
+{
+  CloseResources();
+}
+
+RollupEngine::RollupEngine(RollupEngine &&other)
+{
+  StealResources(&other);
+}
+
+RollupEngine &RollupEngine::operator=(RollupEngine &&other)
+{
+  if (this != &other)
+  {
+    CloseResources();
+    StealResources(&other);
+  }
+  return *this;
+}
+
+void RollupEngine::Run(State *state)
+{
+  assert(state);
+
+  // Prune once at startup, then every PRUNE_INTERVAL. Partitions were
+  // already prepared when the storage engine was created.
+  auto next_prune = std::chrono::steady_clock::now();
+  auto next_partition_check = next_prune + PARTITION_CHECK_INTERVAL;
+
+  while (true)
+  {
+    bool is_stopping;
+    {
+      std::unique_lock<std::mutex> lock{state->mutex};
+      is_stopping = state->cv.wait_for(
+          lock,
+          state->refresh_interval,
+          [state]() { return state->is_stopping; });
+    }
+
+    bool is_refreshed = state->db->RefreshSoilMoistureRollups();
+    if (!is_refreshed)
+    {
+      LOG(ERROR) << "Failed to refresh soil moisture rollups. Retrying next interval";
+    }
+
+    // Stale hours are stored, so stopping loses none of them. Refreshing
+    // first just leaves the rollups current for the next start.
+    if (is_stopping)
+    {
+      return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now >= next_partition_check)
+    {
+      next_partition_check = now + PARTITION_CHECK_INTERVAL;
+
+      if (!state->db->EnsureSoilMoistureReadingPartitions())
+      {
+        LOG(ERROR) << "Failed to add soil moisture reading partitions";
+      }
+    }
+
+    // Rows are pruned only once their rollups are stored, so a failed
+    // refresh postpones the prune until one succeeds
+    if (state->raw_retention.count() > 0 && now >= next_prune && is_refreshed)
+    {
+      next_prune = now + PRUNE_INTERVAL;
+
+      int64_t cutoff_ms = GetRawRetentionCutoffMs(NowMs(), state->raw_retention);
+
+      if (!state->db->PruneSoilMoistureReadings(cutoff_ms))
+      {
+        LOG(ERROR) << "Failed to prune soil moisture readings";
+      }
+    }
+  }
+}
+
+void RollupEngine::CloseResources()
+{
+  if (!state_)
+  {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock{state_->mutex};
+    state_->is_stopping = true;
+  }
+  state_->cv.notify_all();
+
+  if (thread_.joinable())
+  {
+    thread_.join();
+  }
+
+  state_.reset();
+}
+
+void RollupEngine::StealResources(RollupEngine *other)
+{
+  assert(other);
+  state_ = std::move(other->state_);
+  thread_ = std::move(other->thread_);
+}
+
+} // namespace organicdump
@@ -0,0 +1,58 @@
+#ifndef ORGANICDUMP_SERVER_ROLLUPENGINE_H
+#define ORGANICDUMP_SERVER_ROLLUPENGINE_H
+
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "DbManager.h"
+
+namespace organicdump
+{
+
+/**
+ * Background thread that keeps the soil moisture rollup tables current and
+ * enforces raw reading retention. Every |refresh_interval| it folds newly
+ * committed readings into the rollups. When |raw_retention| is nonzero it
+ * also prunes raw readings older than that after a successful refresh, and
+ * the engine spares any hour still marked stale, so rows are only pruned
+ * once their rollups are stored. Hourly, it also adds the partitions that
+ * upcoming readings will land in.
+ */
+class RollupEngine
+{
+public:
+  static bool Create(
+      std::shared_ptr<DbManager> db,
+      std::chrono::milliseconds refresh_interval,
+      std::chrono::hours raw_retention,
+      RollupEngine *out_engine);
+
+public:
+  RollupEngine();
+  ~RollupEngine();
+  RollupEngine(RollupEngine &&other);
+  RollupEngine &operator=(RollupEngine &&other);
+
+private:
+  struct State;
+
+private:
+  RollupEngine(std::unique_ptr<State> state);
+  static void Run(State *state);
+  void CloseResources();
+  void StealResources(RollupEngine *other);
+
+private:
+  RollupEngine(const RollupEngine &other) = delete;
+  RollupEngine &operator=(const RollupEngine &other) = delete;
+
+private:
+  // Heap-allocated so that the thread survives moves of the engine
+  std::unique_ptr<State> state_;
+  std::thread thread_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_ROLLUPENGINE_H
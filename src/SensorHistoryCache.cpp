@@ -0,0 +1,240 @@
+#include "SensorHistoryCache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include "DbManager.h"
+
+namespace
+{
+int64_t NowMs()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+} // namespace
+
+namespace organicdump
+{
+
+SensorHistoryCache::SensorHistoryCache(size_t capacity_per_sensor)
+  : capacity_{capacity_per_sensor},
+    created_ms_{NowMs()}
+{
+  assert(capacity_ > 0);
+}
+
+void SensorHistoryCache::Add(const std::vector<SoilMoistureMeasurement> &measurements)
+{
+  for (const SoilMoistureMeasurement &measurement : measurements)
+  {
+    Ring *ring = FindOrCreateRing(measurement.sensor_id);
+    std::lock_guard<std::mutex> lock{ring->mutex};
+    Insert(measurement, ring);
+  }
+}
+
+void SensorHistoryCache::Insert(const SoilMoistureMeasurement &measurement, Ring *ring)
+{
+  assert(ring);
+
+  // Readings older than the coverage are for MySQL to serve
+  if (measurement.time_ms < ring->covered_since_ms)
+  {
+    return;
+  }
+
+  // Readings almost always arrive in order, so search back from the newest
+  size_t position = ring->size;
+  while (position > 0)
+  {
+    size_t index = (ring->head + position - 1) % capacity_;
+    if (ring->times[index] < measurement.time_ms ||
+        (ring->times[index] == measurement.time_ms && ring->seqs[index] <= measurement.seq))
+    {
+      break;
+    }
+    --position;
+  }
+
+  // A resent reading replaces the one it repeats, as in storage
+  if (position > 0)
+  {
+    size_t index = (ring->head + position - 1) % capacity_;
+    if (ring->times[index] == measurement.time_ms && ring->seqs[index] == measurement.seq)
+    {
+      ring->values[index] = measurement.value;
+      return;
+    }
+  }
+
+  bool is_full = ring->size == capacity_;
+  if (is_full)
+  {
+    // Older than every reading held, so keeping it would leave a gap
+    if (position == 0)
+    {
+      ring->covered_since_ms = ring->times[ring->head];
+      return;
+    }
+
+    // The oldest reading makes room
+    ring->head = (ring->head + 1) % capacity_;
+    --ring->size;
+    --position;
+  }
+
+  // Shift the readings newer than |position| up by one
+  for (size_t i = ring->size; i > position; --i)
+  {
+    size_t to = (ring->head + i) % capacity_;
+    size_t from = (ring->head + i - 1) % capacity_;
+    ring->times[to] = ring->times[from];
+    ring->seqs[to] = ring->seqs[from];
+    ring->values[to] = ring->values[from];
+  }
+
+  size_t index = (ring->head + position) % capacity_;
+  ring->times[index] = measurement.time_ms;
+  ring->seqs[index] = measurement.seq;
+  ring->values[index] = measurement.value;
+  ++ring->size;
+
+  // Coverage starts at the oldest reading that is still held
+  if (is_full)
+  {
+    ring->covered_since_ms = ring->times[ring->head];
+  }
+}
+
+int64_t SensorHistoryCache::Read(
+    size_t sensor_id,
+    int64_t since_ms,
+    size_t max_readings,
+    std::vector<int64_t> *out_times,
+    std::vector<float> *out_values) const
+{
+  assert(out_times);
+  assert(out_values);
+
+  Ring *ring = FindRing(sensor_id);
+  if (!ring)
+  {
+    return created_ms_;
+  }
+
+  std::lock_guard<std::mutex> lock{ring->mutex};
+
+  // Walk back from the newest reading to find where the window starts
+  size_t count = 0;
+  while (count < ring->size && count < max_readings)
+  {
+    size_t index = (ring->head + ring->size - 1 - count) % capacity_;
+    if (ring->times[index] < since_ms)
+    {
+      break;
+    }
+    ++count;
+  }
+
+  size_t offset = out_times->size();
+  out_times->resize(offset + count);
+  out_values->resize(offset + count);
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    size_t index = (ring->head + ring->size - count + i) % capacity_;
+    (*out_times)[offset + i] = ring->times[index];
+    (*out_values)[offset + i] = ring->values[index];
+  }
+
+  return ring->covered_since_ms;
+}
+
+void SensorHistoryCache::Backfill(
+    size_t sensor_id,
+    int64_t read_covered_since_ms,
+    int64_t covered_since_ms,
+    const std::vector<int64_t> &times,
+    const std::vector<float> &values)
+{
+  assert(times.size() == values.size());
+
+  // Queries for sensors that have never reported must not grow the map
+  Ring *ring = times.empty() ? FindRing(sensor_id) : FindOrCreateRing(sensor_id);
+  if (!ring)
+  {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock{ring->mutex};
+
+  if (ring->covered_since_ms != read_covered_since_ms)
+  {
+    return;
+  }
+
+  // Keep the newest readings that fit; dropping any shrinks the coverage
+  size_t count = std::min(capacity_ - ring->size, times.size());
+  size_t first = times.size() - count;
+
+  ring->head = (ring->head + capacity_ - count) % capacity_;
+  for (size_t i = 0; i < count; ++i)
+  {
+    size_t index = (ring->head + i) % capacity_;
+    ring->times[index] = times[first + i];
+    ring->seqs[index] = 0;
+    ring->values[index] = values[first + i];
+  }
+  ring->size += count;
+
+  if (first == 0)
+  {
+    ring->covered_since_ms = covered_since_ms;
+  }
+  else if (count > 0)
+  {
+    ring->covered_since_ms = times[first];
+  }
+}
+
+SensorHistoryCache::Ring *SensorHistoryCache::FindRing(size_t sensor_id) const
+{
+  std::shared_lock<std::shared_mutex> lock{mutex_};
+
+  auto it = rings_.find(sensor_id);
+  return (it == rings_.end()) ? nullptr : it->second.get();
+}
+
+SensorHistoryCache::Ring *SensorHistoryCache::FindOrCreateRing(size_t sensor_id)
+{
+  Ring *ring = FindRing(sensor_id);
+  if (ring)
+  {
+    return ring;
+  }
+
+  std::unique_lock<std::shared_mutex> lock{mutex_};
+
+  std::unique_ptr<Ring> &slot = rings_[sensor_id];
+  if (!slot)
+  {
+    slot = std::make_unique<Ring>();
+    slot->times.resize(capacity_);
+    slot->seqs.resize(capacity_);
+    slot->values.resize(capacity_);
+    slot->head = 0;
+    slot->size = 0;
+    slot->covered_since_ms = created_ms_;
+  }
+
+  return slot.get();
+}
+
+} // namespace organicdump
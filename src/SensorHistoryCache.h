@@ -0,0 +1,110 @@
+#ifndef ORGANICDUMP_SERVER_SENSORHISTORYCACHE_H
+#define ORGANICDUMP_SERVER_SENSORHISTORYCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "DbManager.h"
+
+namespace organicdump
+{
+
+/**
+ * The most recent soil moisture readings of each sensor, kept in fixed-size
+ * rings so that recent-history queries never reach MySQL. Each ring stores
+ * timestamps and values in separate arrays, so a time-window scan only
+ * touches the timestamps.
+ *
+ * A ring holds every reading committed since the cache was created, until it
+ * wraps; after that it holds the newest |capacity_per_sensor|. Read() reports
+ * how far back that coverage goes so callers know which older range to fetch
+ * from MySQL, and Backfill() lets them keep what they fetched.
+ *
+ * Readings usually arrive in time order and are appended. Client-timestamped
+ * readings can arrive late, so those are inserted in order, replace a reading
+ * with the same (time_ms, seq), or are left to MySQL when they are older than
+ * the ring's coverage. Backfilled readings are held with seq 0, which only
+ * matters if one sensor mixes client and server timestamps.
+ *
+ * Safe to call from any thread.
+ */
+class SensorHistoryCache
+{
+public:
+  explicit SensorHistoryCache(size_t capacity_per_sensor);
+
+  /**
+   * Records committed readings. The first reading of a sensor allocates its
+   * ring, which is never freed, so only readings of registered sensors may
+   * be passed.
+   */
+  void Add(const std::vector<SoilMoistureMeasurement> &measurements);
+
+  /**
+   * Appends the newest readings of |sensor_id| taken at or after |since_ms|,
+   * at most |max_readings| of them, oldest first. Returns the time from which
+   * the cache holds every reading of the sensor; anything older must be read
+   * from MySQL.
+   */
+  int64_t Read(
+      size_t sensor_id,
+      int64_t since_ms,
+      size_t max_readings,
+      std::vector<int64_t> *out_times,
+      std::vector<float> *out_values) const;
+
+  /**
+   * Prepends readings fetched from MySQL, oldest first, that cover every
+   * reading of |sensor_id| from |covered_since_ms| up to the coverage Read()
+   * returned as |read_covered_since_ms|. Ignored if the ring has changed
+   * coverage since; readings that do not fit are dropped, oldest first.
+   */
+  void Backfill(
+      size_t sensor_id,
+      int64_t read_covered_since_ms,
+      int64_t covered_since_ms,
+      const std::vector<int64_t> &times,
+      const std::vector<float> &values);
+
+private:
+  struct Ring
+  {
+    std::mutex mutex;
+    // Sorted by (time, seq) from |head|
+    std::vector<int64_t> times;
+    std::vector<uint32_t> seqs;
+    std::vector<float> values;
+
+    // Index of the oldest reading
+    size_t head;
+    size_t size;
+    int64_t covered_since_ms;
+  };
+
+private:
+  /** Must be called with the ring's lock held. */
+  void Insert(const SoilMoistureMeasurement &measurement, Ring *ring);
+  Ring *FindRing(size_t sensor_id) const;
+  Ring *FindOrCreateRing(size_t sensor_id);
+
+private:
+  SensorHistoryCache(const SensorHistoryCache &other) = delete;
+  SensorHistoryCache &operator=(const SensorHistoryCache &other) = delete;
+
+private:
+  size_t capacity_;
+  int64_t created_ms_;
+
+  // Guards the map only; each ring has its own lock
+  mutable std::shared_mutex mutex_;
+  std::unordered_map<size_t, std::unique_ptr<Ring>> rings_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_SENSORHISTORYCACHE_H
@@ -1,72 +1,234 @@
 #include "Server.h"
 
-#include <sys/select.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <cstdint>
+#include <utility>
+#include <vector>
 
 #include <glog/logging.h>
 
+#include "AcceptRateLimiter.h"
 #include "ClientHandler.h"
+#include "CompletionQueue.h"
 #include "ControlClientHandler.h"
-#include "NetworkUtilities.h"
-#include "TlsConnection.h"
-#include "TlsServer.h"
-#include "TlsServerFactory.h"
+#include "DbExecutor.h"
+#include "EventNotifier.h"
+#include "HotLog.h"
+#include "IrrigationSystemClientHandler.h"
+#include "Metrics.h"
+#include "TlsContext.h"
+#include "TlsListener.h"
+#include "TimingWheel.h"
+#include "TlsStream.h"
 #include "UndifferentiatedClientHandler.h"
 
 namespace {
-using network::TlsConnection;
-using network::TlsServer;
-using network::TlsServerFactory;
+using organicdump::Counter;
+using organicdump::LatencyHistogram;
+using organicdump::Metrics;
 using organicdump_proto::ClientType;
 using organicdump_proto::MessageType;
 
+// Upper bound on events returned by a single epoll_wait() call. Extra ready
+// fds are simply reported on the next wakeup.
+constexpr size_t MAX_EPOLL_EVENTS = 256;
+
+// Connections accepted per listener wakeup. The listener is level-triggered,
+// so a backlog longer than this is picked up on the next wakeup without
+// starving established clients.
+constexpr size_t MAX_ACCEPTS_PER_WAKEUP = 64;
+
+// Client sockets are edge-triggered: handshakes and reads are always driven
+// until OpenSSL reports WANT_READ/WANT_WRITE, or, for reads past the
+// per-wakeup cap, resumed from |readable_fds_|, so no readiness edge is lost.
+constexpr uint32_t HANDSHAKE_EVENTS = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+constexpr uint32_t CLIENT_EVENTS = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+// Messages read from one client between checks of its outbound queue, and
+// per wakeup. A client that keeps its socket full is revisited on the next
+// loop, so it can't hold up the reactor's other clients.
+constexpr size_t MAX_MESSAGES_PER_READ = 16;
+constexpr size_t MAX_MESSAGES_PER_WAKEUP = 64;
+
+// Idle deadlines are tracked to the nearest tick. 512 slots of 250ms span two
+// minutes, so the default idle timeout is reached in one revolution.
+constexpr std::chrono::milliseconds IDLE_WHEEL_TICK{250};
+constexpr size_t IDLE_WHEEL_SLOTS = 512;
+
+// How long the listener is ignored after accept() runs out of file
+// descriptors. The listener is level-triggered, so without a pause the
+// reactor would spin on the connection it can't accept.
+constexpr std::chrono::milliseconds FD_EXHAUSTED_ACCEPT_PAUSE{100};
+
+// Per-connection errors are logged at most once per this interval per call
+// site, so that a flood of bad connections can't flood the logs
+constexpr int64_t ERROR_LOG_INTERVAL_MS = 1000;
+
+Counter *GetReapedCount(const char *reason)
+{
+  return Metrics::GetCounter(
+      "organicdump_reaped_connections_total",
+      "Connections closed for going silent (idle) or never sending HELLO (no_hello)",
+      "reason",
+      reason);
+}
+
+Counter *GetRejectedCount(const char *reason)
+{
+  return Metrics::GetCounter(
+      "organicdump_rejected_connections_total",
+      "Connections reset on accept since too many were pending (over_cap) or "
+      "their source exceeded its accept rate (rate_limited)",
+      "reason",
+      reason);
+}
+
+Counter *GetAcceptedCount()
+{
+  return Metrics::GetCounter(
+      "organicdump_accepted_connections_total",
+      "Connections admitted on accept");
+}
+
+LatencyHistogram *GetHandshakeLatency()
+{
+  return Metrics::GetHistogram(
+      "organicdump_handshake_seconds",
+      "Time from accepting a connection to completing its TLS handshake");
+}
+
 } // namespace
 
 namespace organicdump
 {
 
 bool Server::Create(
-  int32_t port,
-  std::string cert_file,
-  std::string key_file,
-  std::string ca_file,
+  const CliConfig &config,
+  bool reuse_port,
+  std::shared_ptr<TlsContext> tls_context,
+  std::shared_ptr<DbExecutor> db_executor,
+  std::shared_ptr<MeasurementLog> measurement_log,
+  std::shared_ptr<SensorHistoryCache> history,
+  std::shared_ptr<ClientDirectory> directory,
+  std::shared_ptr<IrrigationScheduler> scheduler,
+  std::shared_ptr<AcceptRateLimiter> accept_limiter,
+  bool runs_scheduler,
   Server *out_server)
 {
-  TlsServer tls_server;
-  TlsServerFactory server_factory;
-  if (!server_factory.Create(
-        port,
-        cert_file,
-        key_file,
-        ca_file,
-        network::WaitPolicy::BLOCKING,
-        &tls_server))
-  {
-    LOG(ERROR) << "Failed to create server factory";
+  assert(accept_limiter);
+
+  TlsListener listener;
+  if (!TlsListener::Create(
+        config.GetPort(),
+        reuse_port,
+        std::move(tls_context),
+        &listener))
+  {
+    LOG(ERROR) << "Failed to create TLS listener";
+    return false;
+  }
+
+  EpollReactor reactor;
+  if (!EpollReactor::Create(MAX_EPOLL_EVENTS, &reactor))
+  {
+    LOG(ERROR) << "Failed to create epoll reactor";
+    return false;
+  }
+
+  if (!reactor.Add(listener.GetFd(), EPOLLIN))
+  {
+    LOG(ERROR) << "Failed to register listening socket with epoll reactor";
+    return false;
+  }
+
+  EventNotifier stop_notifier;
+  if (!EventNotifier::Create(&stop_notifier))
+  {
+    LOG(ERROR) << "Failed to create stop notifier";
+    return false;
+  }
+
+  if (!reactor.Add(stop_notifier.GetFd(), EPOLLIN))
+  {
+    LOG(ERROR) << "Failed to register stop notifier with epoll reactor";
+    return false;
+  }
+
+  EventNotifier completion_notifier;
+  if (!EventNotifier::Create(&completion_notifier))
+  {
+    LOG(ERROR) << "Failed to create completion notifier";
+    return false;
+  }
+
+  if (!reactor.Add(completion_notifier.GetFd(), EPOLLIN))
+  {
+    LOG(ERROR) << "Failed to register completion notifier with epoll reactor";
     return false;
   }
 
+  auto completions = std::make_shared<CompletionQueue>(std::move(completion_notifier));
+
   ControlClientHandler control_handler;
-  if (!ControlClientHandler::Create(&control_handler))
+  if (!ControlClientHandler::Create(
+        std::move(db_executor),
+        completions,
+        std::move(measurement_log),
+        std::move(history),
+        directory,
+        scheduler,
+        config.GetMeasurementBatchSize(),
+        config.GetMeasurementFlushDelay(),
+        config.GetRawRetention(),
+        &control_handler))
   {
     LOG(ERROR) << "Failed to create control client handler";
     return false;
   }
 
+  ClientStore clients{directory, completions};
+
   std::unordered_map<organicdump_proto::ClientType,
                      std::unique_ptr<ClientHandler>> handlers;
   handlers[ClientType::CONTROL] =
       std::make_unique<ControlClientHandler>(std::move(control_handler));
 
+  if (runs_scheduler)
+  {
+    scheduler->SetWakeup(completions);
+  }
+
+  handlers[ClientType::IRRIGATION_SYSTEM] =
+      std::make_unique<IrrigationSystemClientHandler>(
+          runs_scheduler ? scheduler : nullptr);
+
   handlers[ClientType::UNKNOWN] =
       std::make_unique<UndifferentiatedClientHandler>();
 
-  *out_server = Server{std::move(tls_server), std::move(handlers)};
+  *out_server = Server{
+      std::move(listener),
+      std::move(reactor),
+      std::move(stop_notifier),
+      std::move(completions),
+      std::move(clients),
+      config.GetHandshakeTimeout(),
+      config.GetIdleTimeout(),
+      config.GetHelloTimeout(),
+      config.GetMaxPendingConnections(),
+      std::move(accept_limiter),
+      config.GetWriteHighWaterBytes(),
+      config.GetWriteKickBytes(),
+      std::move(handlers)};
   return true;
 }
 
@@ -84,14 +246,64 @@ Server &Server::operator=(Server &&other)
   return *this;
 }
 
-Server::Server() {}
+Server::Server()
+  : listener_paused_{false},
+    listener_resume_at_{},
+    next_connection_serial_{0},
+    idle_timeout_{0},
+    hello_timeout_{0},
+    idle_wheel_{IDLE_WHEEL_TICK, IDLE_WHEEL_SLOTS},
+    accepted_count_{GetAcceptedCount()},
+    handshake_latency_{GetHandshakeLatency()},
+    reaped_idle_count_{GetReapedCount("idle")},
+    reaped_undifferentiated_count_{GetReapedCount("no_hello")},
+    max_pending_connections_{0},
+    rejected_over_cap_count_{GetRejectedCount("over_cap")},
+    rejected_rate_limited_count_{GetRejectedCount("rate_limited")},
+    write_high_water_bytes_{0},
+    write_kick_bytes_{0} {}
 
 Server::Server(
-    TlsServer tls_server,
+    TlsListener listener,
+    EpollReactor reactor,
+    EventNotifier stop_notifier,
+    std::shared_ptr<CompletionQueue> completions,
+    ClientStore clients,
+    std::chrono::milliseconds handshake_timeout,
+    std::chrono::milliseconds idle_timeout,
+    std::chrono::milliseconds hello_timeout,
+    size_t max_pending_connections,
+    std::shared_ptr<AcceptRateLimiter> accept_limiter,
+    size_t write_high_water_bytes,
+    size_t write_kick_bytes,
     std::unordered_map<organicdump_proto::ClientType,
                        std::unique_ptr<ClientHandler>> handlers)
-  : tls_server_{std::move(tls_server)},
-    fd_to_client_map_{},
+  : listener_{std::move(listener)},
+    listener_paused_{false},
+    listener_resume_at_{},
+    reactor_{std::move(reactor)},
+    stop_notifier_{std::move(stop_notifier)},
+    completions_{std::move(completions)},
+    handshake_timeout_{handshake_timeout},
+    next_connection_serial_{0},
+    fd_to_handshake_map_{},
+    handshake_deadlines_{},
+    idle_timeout_{idle_timeout},
+    hello_timeout_{hello_timeout},
+    idle_wheel_{IDLE_WHEEL_TICK, IDLE_WHEEL_SLOTS},
+    accepted_count_{GetAcceptedCount()},
+    handshake_latency_{GetHandshakeLatency()},
+    reaped_idle_count_{GetReapedCount("idle")},
+    reaped_undifferentiated_count_{GetReapedCount("no_hello")},
+    max_pending_connections_{max_pending_connections},
+    accept_limiter_{std::move(accept_limiter)},
+    rejected_over_cap_count_{GetRejectedCount("over_cap")},
+    rejected_rate_limited_count_{GetRejectedCount("rate_limited")},
+    write_high_water_bytes_{write_high_water_bytes},
+    write_kick_bytes_{write_kick_bytes},
+    clients_{std::move(clients)},
+    flush_queue_{},
+    readable_fds_{},
     handlers_{std::move(handlers)}
 {}
 
@@ -103,136 +315,719 @@ bool Server::Run()
 
   while (true)
   {
-     fd_set read_fds;
-     FD_ZERO(&read_fds);
+    size_t ready_count = 0;
+    if (!reactor_.Wait(GetWaitTimeoutMs(), &ready_count))
+    {
+      LOG(ERROR) << "Failed to wait for socket events";
+      KickAllClients();
+      return false;
+    }
 
-     int max_fd = tls_server_.GetFd().Get();
-     FD_SET(max_fd, &read_fds);
+    bool stop = false;
+    if (!ProcessReadySockets(ready_count, &stop))
+    {
+      LOG(ERROR) << "Failed to process ready sockets";
+      KickAllClients();
+      return false;
+    }
 
-     for (auto &entry : fd_to_client_map_)
-     {
+    if (stop)
+    {
+      LOG(INFO) << "Stopping organic dump server...";
+      KickAllClients();
+      return true;
+    }
 
-       if (entry.first > max_fd)
-       {
-         max_fd = entry.first;
-       }
+    ResumeListener();
+    ExpireHandshakes();
+    ReapIdleClients();
+    PollHandlers();
+    ReadReadableClients();
+    FlushQueuedClients();
+  }
 
-       FD_SET(entry.first, &read_fds);
-     }
+  return true;
+}
 
-     LOG(INFO) << "Entering select()...";
+void Server::Stop() const
+{
+  stop_notifier_.Notify();
+}
 
-     int result = select(
-         max_fd + 1,
-         &read_fds,
-         nullptr,
-         nullptr,
-         nullptr);
+void Server::KickAllClients()
+{
+  LOG(ERROR) << "Kicking all clients and removing handlers";
 
-     switch (result)
-     {
-       case -1:
-         LOG(ERROR) << "Failed during select(): " << strerror(errno);
-         KickAllClients();
-         return false;
+  for (const auto &entry : fd_to_handshake_map_)
+  {
+    reactor_.Remove(entry.first);
+  }
+
+  for (int fd : clients_.GetFds())
+  {
+    reactor_.Remove(fd);
+  }
 
-      case 0:
-         LOG(INFO) << "Select timeout expired";
-         break;
+  fd_to_handshake_map_.clear();
+  handshake_deadlines_.clear();
+  clients_.RemoveAll();
+  flush_queue_.clear();
+  readable_fds_.clear();
+  handlers_.clear();
+}
+
+void Server::KickClient(int fd)
+{
+  assert(clients_.Contains(fd));
+
+  // Deregister before the connection closes its socket so that a recycled fd
+  // never inherits a stale registration.
+  reactor_.Remove(fd);
+  clients_.Remove(fd);
+}
 
-      default:
-         if (!ProcessReadableSockets(&read_fds, max_fd))
-         {
-           LOG(ERROR) << "Failed to process readable sockets";
-           KickAllClients();
-           return false;
-         }
+bool Server::ProcessReadySockets(size_t ready_count, bool *out_stop)
+{
+  assert(out_stop);
+
+  int listener_fd = listener_.GetFd();
+
+  for (size_t i = 0; i < ready_count; ++i)
+  {
+    const struct epoll_event &event = reactor_.GetReadyEvent(i);
+
+    if (event.data.fd == listener_fd)
+    {
+      if (event.events & (EPOLLERR | EPOLLHUP))
+      {
+        LOG(ERROR) << "Error condition on listening socket";
+        return false;
+      }
+
+      AcceptNewClients();
+      continue;
+    }
 
-         LOG(INFO) << "Processed all readable sockets successfully";
-         break;
-     }
+    if (event.data.fd == stop_notifier_.GetFd())
+    {
+      stop_notifier_.Drain();
+      *out_stop = true;
+      continue;
+    }
+
+    if (event.data.fd == completions_->GetFd())
+    {
+      completions_->RunAll();
+      continue;
+    }
+
+    if (fd_to_handshake_map_.count(event.data.fd) == 1)
+    {
+      ContinueHandshake(event.data.fd, event.events);
+      continue;
+    }
+
+    ProcessClient(event.data.fd, event.events);
   }
 
   return true;
 }
 
-void Server::KickAllClients()
+void Server::AcceptNewClients()
 {
-  LOG(ERROR) << "Kicking all clients and removing handlers";
-  fd_to_client_map_.clear();
-  handlers_.clear();
+  for (size_t i = 0; i < MAX_ACCEPTS_PER_WAKEUP; ++i)
+  {
+    TlsStream stream;
+    bool would_block = false;
+    bool rejected = false;
+    bool fds_exhausted = false;
+    if (!listener_.Accept(
+          [this](const struct sockaddr_in &peer) { return AdmitConnection(peer); },
+          &stream,
+          &would_block,
+          &rejected,
+          &fds_exhausted))
+    {
+      if (rejected)
+      {
+        continue;
+      }
+
+      if (fds_exhausted)
+      {
+        PauseListener();
+        return;
+      }
+
+      if (!would_block)
+      {
+        HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+            << "Failed to accept new connection";
+      }
+      return;
+    }
+
+    int fd = stream.GetFd();
+    assert(fd_to_handshake_map_.count(fd) == 0);
+    assert(!clients_.Contains(fd));
+
+    if (!reactor_.Add(fd, HANDSHAKE_EVENTS))
+    {
+      HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+          << "Failed to register new connection with epoll reactor";
+      continue;
+    }
+
+    Clock::time_point now = Clock::now();
+    uint64_t serial = next_connection_serial_++;
+    fd_to_handshake_map_.emplace(fd, PendingHandshake{std::move(stream), serial, now});
+    handshake_deadlines_.push_back(
+        HandshakeDeadline{now + handshake_timeout_, fd, serial});
+    accepted_count_->Increment();
+
+    // Registration reports the socket as writable straight away, which kicks
+    // off the handshake on the next wakeup.
+  }
+}
+
+void Server::PauseListener()
+{
+  if (listener_paused_)
+  {
+    return;
+  }
+
+  // Watching no events keeps the registration without reporting readiness
+  if (!reactor_.Modify(listener_.GetFd(), 0))
+  {
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Failed to pause listening socket";
+    return;
+  }
+
+  listener_paused_ = true;
+  listener_resume_at_ = Clock::now() + FD_EXHAUSTED_ACCEPT_PAUSE;
+  HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+      << "Out of file descriptors. Pausing accepts for "
+      << FD_EXHAUSTED_ACCEPT_PAUSE.count() << "ms";
+}
+
+void Server::ResumeListener()
+{
+  if (!listener_paused_ || Clock::now() < listener_resume_at_)
+  {
+    return;
+  }
+
+  if (!reactor_.Modify(listener_.GetFd(), EPOLLIN))
+  {
+    // Try again after another pause rather than on every wakeup
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Failed to resume listening socket";
+    listener_resume_at_ = Clock::now() + FD_EXHAUSTED_ACCEPT_PAUSE;
+    return;
+  }
+
+  listener_paused_ = false;
+}
+
+bool Server::AdmitConnection(const struct sockaddr_in &peer)
+{
+  size_t pending = fd_to_handshake_map_.size() + clients_.GetUndifferentiatedCount();
+  if (pending >= max_pending_connections_)
+  {
+    rejected_over_cap_count_->Increment();
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Resetting new connection since " << pending
+        << " connections are already pending. Rejected so far: " << rejected_over_cap_count_->Get();
+    return false;
+  }
+
+  if (!accept_limiter_->Admit(peer.sin_addr.s_addr, Clock::now()))
+  {
+    rejected_rate_limited_count_->Increment();
+
+    char address[INET_ADDRSTRLEN] = {};
+    inet_ntop(AF_INET, &peer.sin_addr, address, sizeof(address));
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Resetting new connection from " << address
+        << " since it exceeded its accept rate. Rejected so far: "
+        << rejected_rate_limited_count_->Get();
+    return false;
+  }
+
+  return true;
+}
+
+void Server::ContinueHandshake(int fd, uint32_t events)
+{
+  assert(fd_to_handshake_map_.count(fd) == 1);
+
+  if (events & EPOLLERR)
+  {
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Socket error during TLS handshake on fd " << fd;
+    DropHandshake(fd);
+    return;
+  }
+
+  TlsStream *stream = &fd_to_handshake_map_.at(fd).stream;
+  TlsIoStatus status = stream->Handshake();
+
+  switch (status)
+  {
+    case TlsIoStatus::WANT_READ:
+    case TlsIoStatus::WANT_WRITE:
+      return;
+    case TlsIoStatus::COMPLETE:
+      break;
+    default:
+      HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+          << "TLS handshake failed on fd " << fd << ": " << ToString(status);
+      DropHandshake(fd);
+      return;
+  }
+
+  if (!reactor_.Modify(fd, CLIENT_EVENTS))
+  {
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Failed to promote handshaken connection on fd " << fd;
+    DropHandshake(fd);
+    return;
+  }
+
+  HOT_LOG(INFO) << "Accepted new connection. Creating undifferented protobuf client";
+  PendingHandshake *handshake = &fd_to_handshake_map_.at(fd);
+  handshake_latency_->Record(Clock::now() - handshake->accepted_at);
+  uint64_t serial = handshake->serial;
+  ProtobufClient *client = clients_.Add(
+      fd,
+      ProtobufClient{
+          std::move(handshake->stream),
+          serial,
+          &flush_queue_});
+  fd_to_handshake_map_.erase(fd);
+  idle_wheel_.Schedule(GetReapDeadline(*client), TimingWheel::Entry{fd, serial});
+
+  // The peer may have pipelined its first request behind the handshake. That
+  // edge was consumed while handshaking, so read now rather than wait.
+  ProcessClient(fd, EPOLLIN);
+}
+
+void Server::DropHandshake(int fd)
+{
+  assert(fd_to_handshake_map_.count(fd) == 1);
+
+  reactor_.Remove(fd);
+  fd_to_handshake_map_.erase(fd);
+}
+
+void Server::ExpireHandshakes()
+{
+  Clock::time_point now = Clock::now();
+
+  while (!handshake_deadlines_.empty() &&
+         handshake_deadlines_.front().deadline <= now)
+  {
+    const HandshakeDeadline &entry = handshake_deadlines_.front();
+
+    auto it = fd_to_handshake_map_.find(entry.fd);
+    if (it != fd_to_handshake_map_.end() && it->second.serial == entry.serial)
+    {
+      HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+          << "TLS handshake timed out on fd " << entry.fd;
+      DropHandshake(entry.fd);
+    }
+
+    handshake_deadlines_.pop_front();
+  }
 }
 
-bool Server::ProcessReadableSockets(fd_set *readable_fds, int max_fd)
+void Server::ReapIdleClients()
 {
-  assert(readable_fds);
+  Clock::time_point now = Clock::now();
+
+  std::vector<TimingWheel::Entry> expired;
+  idle_wheel_.Advance(now, &expired);
+
+  for (const TimingWheel::Entry &entry : expired)
+  {
+    ProtobufClient *client = clients_.FindClient(entry.fd, entry.serial);
+    if (!client)
+    {
+      continue;
+    }
 
-  // First, check whether it's a new connection
-  if (FD_ISSET(tls_server_.GetFd().Get(), readable_fds)) {
-    TlsConnection cxn;
-    if (!tls_server_.Accept(&cxn)) {
-        LOG(ERROR) << "Failed to accept new connection";
+    Clock::time_point deadline = GetReapDeadline(*client);
+    if (deadline > now)
+    {
+      idle_wheel_.Schedule(deadline, entry);
+      continue;
+    }
+
+    if (client->IsDifferentiated())
+    {
+      reaped_idle_count_->Increment();
+      HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+          << "Reaping " << ToString(client->GetType()) << " client on fd " << entry.fd
+          << " after " << idle_timeout_.count() << "ms of silence";
     }
     else
     {
-        LOG(INFO) << "Accepted new connection. Creating undifferented protobuf client";
-        assert(fd_to_client_map_.count(cxn.GetFd().Get()) == 0);
-        fd_to_client_map_.emplace(cxn.GetFd().Get(), std::move(cxn));
+      reaped_undifferentiated_count_->Increment();
+      HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+          << "Reaping client on fd " << entry.fd << " that sent no HELLO";
+    }
+
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Reaped so far: " << reaped_idle_count_->Get() << " idle, "
+        << reaped_undifferentiated_count_->Get() << " undifferentiated";
+    KickClient(entry.fd);
+  }
+}
+
+Server::Clock::time_point Server::GetReapDeadline(const ProtobufClient &client) const
+{
+  Clock::time_point deadline = client.GetLastActive() + idle_timeout_;
+  if (!client.IsDifferentiated())
+  {
+    deadline = std::min(deadline, client.GetConnectedAt() + hello_timeout_);
+  }
+
+  return deadline;
+}
+
+void Server::ReplyToHeartbeat(
+    const organicdump_proto::Heartbeat &heartbeat,
+    ProtobufClient *client)
+{
+  assert(client);
+
+  // Echo the peer's timestamp so that it can measure round trips too
+  OrganicDumpProtoMessage reply{heartbeat};
+  if (!client->Write(&reply))
+  {
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Failed to queue heartbeat reply";
+  }
+}
+
+void Server::PollHandlers()
+{
+  for (auto &entry : handlers_)
+  {
+    entry.second->Poll(&clients_);
+  }
+}
+
+void Server::ReadReadableClients()
+{
+  std::vector<int> fds;
+  fds.swap(readable_fds_);
+
+  for (int fd : fds)
+  {
+    // Skip clients kicked since they were left readable
+    if (clients_.Contains(fd))
+    {
+      ReadFromClient(fd);
+    }
+  }
+}
+
+void Server::FlushQueuedClients()
+{
+  std::vector<int> fds;
+  fds.swap(flush_queue_);
+
+  for (int fd : fds)
+  {
+    // Skip clients kicked after queueing a write
+    if (clients_.Contains(fd))
+    {
+      FlushClient(fd);
+    }
+  }
+}
+
+int Server::GetWaitTimeoutMs()
+{
+  // Discard deadlines of handshakes that already completed or failed so that
+  // they don't cause spurious wakeups.
+  while (!handshake_deadlines_.empty())
+  {
+    const HandshakeDeadline &entry = handshake_deadlines_.front();
+    auto it = fd_to_handshake_map_.find(entry.fd);
+    if (it != fd_to_handshake_map_.end() && it->second.serial == entry.serial)
+    {
+      break;
     }
+    handshake_deadlines_.pop_front();
+  }
+
+  // Clients left readable are served again without waiting
+  if (!readable_fds_.empty())
+  {
+    return 0;
   }
 
-  // Finally, process read events for existing clients
-  for (size_t fd = 0; fd <= max_fd; ++fd) {
-    if (FD_ISSET(fd, readable_fds) && fd != tls_server_.GetFd().Get()) {
-      LOG(INFO) << "Socket fd " << fd << " is readable";
+  int timeout_ms = idle_wheel_.GetTimeoutMs(Clock::now());
 
-      if (fd_to_client_map_.count(fd) == 0) {
-        LOG(INFO) << "Fd " << fd << " marked as readable but client not found. "
+  if (listener_paused_)
+  {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        listener_resume_at_ - Clock::now());
+    int resume_timeout_ms = static_cast<int>(std::max<int64_t>(0, remaining.count() + 1));
+    if (timeout_ms < 0 || resume_timeout_ms < timeout_ms)
+    {
+      timeout_ms = resume_timeout_ms;
+    }
+  }
+
+  if (!handshake_deadlines_.empty())
+  {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        handshake_deadlines_.front().deadline - Clock::now());
+
+    // Round up so that the wait doesn't return just before the deadline
+    int handshake_timeout_ms = static_cast<int>(std::max<int64_t>(0, remaining.count() + 1));
+    if (timeout_ms < 0 || handshake_timeout_ms < timeout_ms)
+    {
+      timeout_ms = handshake_timeout_ms;
+    }
+  }
+
+  for (auto &entry : handlers_)
+  {
+    int handler_timeout_ms = entry.second->GetPollTimeoutMs();
+    if (handler_timeout_ms >= 0 &&
+        (timeout_ms < 0 || handler_timeout_ms < timeout_ms))
+    {
+      timeout_ms = handler_timeout_ms;
+    }
+  }
+
+  return timeout_ms;
+}
+
+void Server::ProcessClient(int fd, uint32_t events)
+{
+  if (!clients_.Contains(fd))
+  {
+    HOT_LOG(INFO) << "Fd " << fd << " marked as ready but client not found. "
                   << "Assume it was kicked in previous operation.";
-        continue;
-      }
+    return;
+  }
 
-      LOG(INFO) << "Found client for socket fd " << fd;
-
-      // Read and handle message
-      ProtobufClient *client = &fd_to_client_map_.at(fd);
-      OrganicDumpProtoMessage msg;
-      bool cxn_closed = false;
-
-      if (!client->Read(&msg, &cxn_closed)) {
-        if (cxn_closed) {
-          LOG(ERROR) << "Connection closed by peer";
-        }
-        else
-        {
-          LOG(ERROR) << "Failed to read protobuf message. Kicking connection.";
-        }
-        client = nullptr;
-        fd_to_client_map_.erase(fd);
-        continue;
-      }
+  if (events & EPOLLERR)
+  {
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Socket error on fd " << fd << ". Kicking client.";
+    KickClient(fd);
+    return;
+  }
 
-      LOG(INFO) << ToString(msg.type) << " protobuf message read successfully from "
-                << ToString(client->GetType()) << " client";
+  // Writability first: draining the queue may lift a read pause
+  if ((events & EPOLLOUT) && !FlushClient(fd))
+  {
+    return;
+  }
 
-      if (handlers_.count(client->GetType()) == 0)
-      {
-        LOG(ERROR) << "No handler for client type: " << ToString(client->GetType())
-                   << ". Ignoring message...";
-        return true;
-      }
+  if (events & EPOLLIN)
+  {
+    // Responses are flushed once the whole wakeup has been processed, so a
+    // batch of pipelined requests is answered in as few SSL_write() calls as
+    // the socket allows.
+    ReadFromClient(fd);
+  }
+}
 
-      // Client is already differentiated. Pass to relevant handler
-      assert(handlers_.count(client->GetType()) == 1);
+bool Server::ReadFromClient(int fd)
+{
+  assert(clients_.Contains(fd));
 
-      ClientHandler *handler = handlers_.at(client->GetType()).get();
-      if (!handler->Handle(msg, client, &fd_to_client_map_)) {
-        LOG(ERROR) << "Failed to handle protobuf message. Kicking client.";
-        fd_to_client_map_.erase(fd);
-      }
+  ProtobufClient *client = clients_.GetClient(fd);
+  if (client->IsCloseRequested())
+  {
+    return true;
+  }
 
-      LOG(INFO) << "Protobuf message handled successfully";
+  if (client->IsReadPaused())
+  {
+    // Input stays queued in the socket; FlushClient() resumes reading once
+    // the peer catches up.
+    return true;
+  }
+
+  HOT_LOG(INFO) << "Socket fd " << fd << " is readable";
+
+  // Read in rounds, checking the outbound queue between them, until the peer
+  // is drained or the wakeup's share is used up. Hang-ups surface as a
+  // closed read once the buffered data is consumed.
+  std::vector<OrganicDumpProtoMessage> msgs;
+  size_t budget = MAX_MESSAGES_PER_WAKEUP;
+
+  while (true)
+  {
+    bool cxn_closed = false;
+    bool is_drained = false;
+    msgs.clear();
+
+    if (!client->ReadMessages(
+          std::min(budget, MAX_MESSAGES_PER_READ),
+          &msgs,
+          &cxn_closed,
+          &is_drained))
+    {
+      HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+          << "Failed to read protobuf message. Kicking connection.";
+      KickClient(fd);
+      return false;
     }
+
+    if (!HandleMessages(fd, msgs))
+    {
+      return false;
+    }
+
+    if (cxn_closed)
+    {
+      HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+          << "Connection closed by peer";
+      KickClient(fd);
+      return false;
+    }
+
+    if (is_drained || client->IsCloseRequested())
+    {
+      return true;
+    }
+
+    // The rest stays buffered; FlushClient() resumes reading once the peer
+    // catches up
+    if (client->GetPendingWriteBytes() >= write_high_water_bytes_)
+    {
+      HOT_LOG(INFO) << "Pausing reads from fd " << fd << ": "
+                    << client->GetPendingWriteBytes() << " bytes queued";
+      client->SetReadPaused(true);
+      return true;
+    }
+
+    budget -= msgs.size();
+    if (budget == 0)
+    {
+      readable_fds_.push_back(fd);
+      return true;
+    }
+  }
+}
+
+bool Server::HandleMessages(int fd, const std::vector<OrganicDumpProtoMessage> &msgs)
+{
+  ProtobufClient *client = clients_.GetClient(fd);
+
+  if (!msgs.empty())
+  {
+    client->MarkActive(Clock::now());
+  }
+
+  for (const OrganicDumpProtoMessage &msg : msgs)
+  {
+    HOT_LOG(INFO) << ToString(msg.type) << " protobuf message read successfully from "
+                  << ToString(client->GetType()) << " client";
+
+    // Heartbeats only keep the connection alive, whatever the client type
+    if (msg.type == MessageType::HEARTBEAT)
+    {
+      ReplyToHeartbeat(msg.heartbeat, client);
+      continue;
+    }
+
+    // Look the handler up per message: a HELLO earlier in the batch may have
+    // differentiated the client.
+    if (handlers_.count(client->GetType()) == 0)
+    {
+      HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+          << "No handler for client type: " << ToString(client->GetType())
+          << ". Ignoring message...";
+      continue;
+    }
+
+    assert(handlers_.count(client->GetType()) == 1);
+
+    ClientHandler *handler = handlers_.at(client->GetType()).get();
+    if (!handler->Handle(msg, client, &clients_)) {
+      HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+          << "Failed to handle protobuf message. Kicking client.";
+      KickClient(fd);
+      return false;
+    }
+
+    HOT_LOG(INFO) << "Protobuf message handled successfully";
+  }
+
+  return true;
+}
+
+bool Server::FlushClient(int fd)
+{
+  assert(clients_.Contains(fd));
+
+  ProtobufClient *client = clients_.GetClient(fd);
+  bool cxn_closed = false;
+
+  if (!client->Flush(&cxn_closed))
+  {
+    if (cxn_closed)
+    {
+      HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+          << "Connection closed by peer";
+    }
+    else
+    {
+      HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+          << "Failed to flush outbound queue. Kicking client.";
+    }
+    KickClient(fd);
+    return false;
+  }
+
+  // Close once the final response has drained; until then EPOLLOUT brings us
+  // back here.
+  if (client->IsCloseRequested() && client->GetPendingWriteBytes() == 0)
+  {
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Closing client on fd " << fd << " at handler's request";
+    KickClient(fd);
+    return false;
+  }
+
+  size_t pending = client->GetPendingWriteBytes();
+
+  if (pending >= write_kick_bytes_)
+  {
+    HOT_LOG_EVERY_MS(ERROR, ERROR_LOG_INTERVAL_MS)
+        << "Client on fd " << fd << " has " << pending
+        << " unsent bytes queued. Kicking slow consumer.";
+    KickClient(fd);
+    return false;
+  }
+
+  if (!client->IsReadPaused() && pending >= write_high_water_bytes_)
+  {
+    HOT_LOG(INFO) << "Pausing reads from fd " << fd << ": " << pending
+                  << " bytes queued";
+    client->SetReadPaused(true);
+    return true;
+  }
+
+  if (client->IsReadPaused() && pending < write_high_water_bytes_ / 2)
+  {
+    HOT_LOG(INFO) << "Resuming reads from fd " << fd;
+    client->SetReadPaused(false);
+
+    // Edge-triggered: input that arrived while paused won't raise a new edge
+    return ReadFromClient(fd) && FlushClient(fd);
   }
 
   return true;
@@ -242,8 +1037,32 @@ void Server::StealResources(Server *other)
 {
     assert(other);
 
-    tls_server_ = std::move(other->tls_server_);
-    fd_to_client_map_ = std::move(other->fd_to_client_map_);
+    listener_ = std::move(other->listener_);
+    listener_paused_ = other->listener_paused_;
+    listener_resume_at_ = other->listener_resume_at_;
+    reactor_ = std::move(other->reactor_);
+    stop_notifier_ = std::move(other->stop_notifier_);
+    completions_ = std::move(other->completions_);
+    handshake_timeout_ = other->handshake_timeout_;
+    next_connection_serial_ = other->next_connection_serial_;
+    fd_to_handshake_map_ = std::move(other->fd_to_handshake_map_);
+    handshake_deadlines_ = std::move(other->handshake_deadlines_);
+    idle_timeout_ = other->idle_timeout_;
+    idle_wheel_ = std::move(other->idle_wheel_);
+    accepted_count_ = other->accepted_count_;
+    handshake_latency_ = other->handshake_latency_;
+    reaped_idle_count_ = other->reaped_idle_count_;
+    reaped_undifferentiated_count_ = other->reaped_undifferentiated_count_;
+    hello_timeout_ = other->hello_timeout_;
+    max_pending_connections_ = other->max_pending_connections_;
+    accept_limiter_ = std::move(other->accept_limiter_);
+    rejected_over_cap_count_ = other->rejected_over_cap_count_;
+    rejected_rate_limited_count_ = other->rejected_rate_limited_count_;
+    write_high_water_bytes_ = other->write_high_water_bytes_;
+    write_kick_bytes_ = other->write_kick_bytes_;
+    flush_queue_ = std::move(other->flush_queue_);
+    readable_fds_ = std::move(other->readable_fds_);
+    clients_ = std::move(other->clients_);
     handlers_ = std::move(other->handlers_);
 }
 
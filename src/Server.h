@@ -1,31 +1,74 @@
 #ifndef ORGANICDUMP_SERVER_SERVER_H
 #define ORGANICDUMP_SERVER_SERVER_H
 
+#include <netinet/in.h>
+
+#include <chrono>
 #include <cstdint>
+#include <deque>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "AcceptRateLimiter.h"
+#include "CliConfig.h"
+#include "ClientDirectory.h"
 #include "ClientHandler.h"
+#include "ClientStore.h"
+#include "CompletionQueue.h"
+#include "DbExecutor.h"
+#include "EpollReactor.h"
+#include "EventNotifier.h"
+#include "IrrigationScheduler.h"
+#include "MeasurementLog.h"
+#include "Metrics.h"
 #include "ProtobufClient.h"
-#include "TlsServer.h"
+#include "SensorHistoryCache.h"
+#include "TimingWheel.h"
+#include "TlsContext.h"
+#include "TlsListener.h"
 
 namespace organicdump
 {
 
+/**
+ * A single reactor: one listener, one epoll instance and the clients it
+ * accepted. All state is confined to the thread that calls Run().
+ * Exactly one reactor is created with |runs_scheduler| and fires the
+ * shared irrigation |scheduler|'s timers.
+ */
 class Server
 {
 public:
   static bool Create(
-      int32_t port,
-      std::string cert_file,
-      std::string key_file,
-      std::string ca_file,
+      const CliConfig &config,
+      bool reuse_port,
+      std::shared_ptr<TlsContext> tls_context,
+      std::shared_ptr<DbExecutor> db_executor,
+      std::shared_ptr<MeasurementLog> measurement_log,
+      std::shared_ptr<SensorHistoryCache> history,
+      std::shared_ptr<ClientDirectory> directory,
+      std::shared_ptr<IrrigationScheduler> scheduler,
+      std::shared_ptr<AcceptRateLimiter> accept_limiter,
+      bool runs_scheduler,
       Server *out_server);
 
 public:
   Server();
   Server(
-      network::TlsServer tls_server,
+      TlsListener listener,
+      EpollReactor reactor,
+      EventNotifier stop_notifier,
+      std::shared_ptr<CompletionQueue> completions,
+      ClientStore clients,
+      std::chrono::milliseconds handshake_timeout,
+      std::chrono::milliseconds idle_timeout,
+      std::chrono::milliseconds hello_timeout,
+      size_t max_pending_connections,
+      std::shared_ptr<AcceptRateLimiter> accept_limiter,
+      size_t write_high_water_bytes,
+      size_t write_kick_bytes,
       std::unordered_map<organicdump_proto::ClientType,
                          std::unique_ptr<ClientHandler>> handlers);
   Server(Server &&other);
@@ -33,9 +76,55 @@ public:
   ~Server();
   bool Run();
 
+  /**
+   * Asks Run() to return. Safe to call from any thread.
+   */
+  void Stop() const;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  // Accepted socket whose TLS handshake is still in flight
+  struct PendingHandshake
+  {
+    TlsStream stream;
+    uint64_t serial;
+    Clock::time_point accepted_at;
+  };
+
+  struct HandshakeDeadline
+  {
+    Clock::time_point deadline;
+    int fd;
+    uint64_t serial;
+  };
+
 private:
   void KickAllClients();
-  bool ProcessReadableSockets(fd_set *readable_fds, int max_fd);
+  void KickClient(int fd);
+  bool ProcessReadySockets(size_t ready_count, bool *out_stop);
+  void AcceptNewClients();
+  void PauseListener();
+  void ResumeListener();
+  bool AdmitConnection(const struct sockaddr_in &peer);
+  void ContinueHandshake(int fd, uint32_t events);
+  void DropHandshake(int fd);
+  void ExpireHandshakes();
+  void ReapIdleClients();
+  Clock::time_point GetReapDeadline(const ProtobufClient &client) const;
+  void ReplyToHeartbeat(
+      const organicdump_proto::Heartbeat &heartbeat,
+      ProtobufClient *client);
+  void PollHandlers();
+  void FlushQueuedClients();
+  int GetWaitTimeoutMs();
+  void ProcessClient(int fd, uint32_t events);
+  bool ReadFromClient(int fd);
+
+  /** False if a message made the client be kicked. */
+  bool HandleMessages(int fd, const std::vector<OrganicDumpProtoMessage> &msgs);
+  void ReadReadableClients();
+  bool FlushClient(int fd);
   void StealResources(Server *other);
 
 private:
@@ -43,8 +132,61 @@ private:
   Server &operator=(const Server &other) = delete;
 
 private:
-  network::TlsServer tls_server_;
-  std::unordered_map<int, ProtobufClient> fd_to_client_map_;
+  TlsListener listener_;
+
+  // Set while the listener is deregistered from readiness after running out
+  // of file descriptors
+  bool listener_paused_;
+  Clock::time_point listener_resume_at_;
+  EpollReactor reactor_;
+  EventNotifier stop_notifier_;
+
+  // Results posted back by db workers for clients owned by this reactor
+  std::shared_ptr<CompletionQueue> completions_;
+  std::chrono::milliseconds handshake_timeout_;
+  uint64_t next_connection_serial_;
+  std::unordered_map<int, PendingHandshake> fd_to_handshake_map_;
+
+  // Ordered by deadline since every handshake gets the same timeout. Entries
+  // for handshakes that already finished are skipped lazily.
+  std::deque<HandshakeDeadline> handshake_deadlines_;
+
+  // Every client has an entry due once it has been silent for
+  // |idle_timeout_| or, before HELLO, once |hello_timeout_| has passed since
+  // it connected. Entries of clients that spoke since are pushed back.
+  std::chrono::milliseconds idle_timeout_;
+  std::chrono::milliseconds hello_timeout_;
+  TimingWheel idle_wheel_;
+
+  // Process-wide metrics, shared with the other reactors
+  Counter *accepted_count_;
+  LatencyHistogram *handshake_latency_;
+  Counter *reaped_idle_count_;
+  Counter *reaped_undifferentiated_count_;
+
+  // Admission control, applied right after accept() and before any TLS work.
+  // Pending connections are those handshaking or awaiting HELLO.
+  size_t max_pending_connections_;
+
+  // Shared with every reactor
+  std::shared_ptr<AcceptRateLimiter> accept_limiter_;
+  Counter *rejected_over_cap_count_;
+  Counter *rejected_rate_limited_count_;
+
+  // Outbound backpressure. Reads from a client pause once its queue passes
+  // the high-water mark and resume when it drains below half of it; a client
+  // whose queue reaches the kick threshold is disconnected.
+  size_t write_high_water_bytes_;
+  size_t write_kick_bytes_;
+  ClientStore clients_;
+
+  // Fds of clients whose outbound queue became non-empty since the last flush
+  std::vector<int> flush_queue_;
+
+  // Fds of clients that used up their share of a wakeup with input still
+  // unread. Edge-triggered epoll won't report them again, so Run() reads
+  // them on its next loop without waiting.
+  std::vector<int> readable_fds_;
   std::unordered_map<organicdump_proto::ClientType,
                      std::unique_ptr<ClientHandler>> handlers_;
 };
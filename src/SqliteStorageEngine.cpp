@@ -0,0 +1,1298 @@
+#include "SqliteStorageEngine.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+#include <sqlite3.h>
+
+#include "RegistryCache.h"
+
+namespace
+{
+using organicdump::DailyIrrigationSchedule;
+using organicdump::RegistryCache;
+
+// How long a statement waits for a lock held by another process, e.g. the
+// sqlite3 shell, before giving up
+constexpr int BUSY_TIMEOUT_MS = 5000;
+
+constexpr int64_t MINUTE_MS = 60 * 1000;
+constexpr int64_t HOUR_MS = 60 * MINUTE_MS;
+constexpr int64_t DAY_MS = 24 * HOUR_MS;
+
+// Mirrors create-tables.sql. Readings and rollups are clustered by
+// (sensor_id, time) so that range reads and deletes touch adjacent pages.
+constexpr const char *SCHEMA_SQL =
+    "CREATE TABLE IF NOT EXISTS rpis ("
+    "  id INTEGER PRIMARY KEY,"
+    "  name TEXT NOT NULL,"
+    "  time TEXT NOT NULL,"
+    "  location TEXT NOT NULL);"
+    "CREATE TABLE IF NOT EXISTS peripherals ("
+    "  id INTEGER PRIMARY KEY,"
+    "  name TEXT NOT NULL UNIQUE,"
+    "  time TEXT NOT NULL);"
+    "CREATE TABLE IF NOT EXISTS rpi_peripheral_edges ("
+    "  peripheral_id INTEGER PRIMARY KEY REFERENCES peripherals(id),"
+    "  rpi_id INTEGER NOT NULL REFERENCES rpis(id));"
+    "CREATE TABLE IF NOT EXISTS soil_moisture_sensors ("
+    "  peripheral_id INTEGER PRIMARY KEY REFERENCES peripherals(id),"
+    "  ceiling REAL NOT NULL,"
+    "  floor REAL NOT NULL);"
+    "CREATE TABLE IF NOT EXISTS soil_moisture_readings ("
+    "  sensor_id INTEGER NOT NULL,"
+    "  time_ms INTEGER NOT NULL,"
+    "  seq INTEGER NOT NULL DEFAULT 0,"
+    "  reading REAL NOT NULL,"
+    "  PRIMARY KEY(sensor_id, time_ms, seq)) WITHOUT ROWID;"
+    "CREATE TABLE IF NOT EXISTS soil_moisture_rollups_1m ("
+    "  sensor_id INTEGER NOT NULL,"
+    "  bucket_ms INTEGER NOT NULL,"
+    "  min_reading REAL NOT NULL,"
+    "  max_reading REAL NOT NULL,"
+    "  mean_reading REAL NOT NULL,"
+    "  reading_count INTEGER NOT NULL,"
+    "  PRIMARY KEY(sensor_id, bucket_ms)) WITHOUT ROWID;"
+    "CREATE TABLE IF NOT EXISTS soil_moisture_rollups_1h ("
+    "  sensor_id INTEGER NOT NULL,"
+    "  bucket_ms INTEGER NOT NULL,"
+    "  min_reading REAL NOT NULL,"
+    "  max_reading REAL NOT NULL,"
+    "  mean_reading REAL NOT NULL,"
+    "  reading_count INTEGER NOT NULL,"
+    "  PRIMARY KEY(sensor_id, bucket_ms)) WITHOUT ROWID;"
+    "CREATE TABLE IF NOT EXISTS soil_moisture_rollups_1d ("
+    "  sensor_id INTEGER NOT NULL,"
+    "  bucket_ms INTEGER NOT NULL,"
+    "  min_reading REAL NOT NULL,"
+    "  max_reading REAL NOT NULL,"
+    "  mean_reading REAL NOT NULL,"
+    "  reading_count INTEGER NOT NULL,"
+    "  PRIMARY KEY(sensor_id, bucket_ms)) WITHOUT ROWID;"
+    "CREATE TABLE IF NOT EXISTS soil_moisture_stale_rollups ("
+    "  sensor_id INTEGER NOT NULL,"
+    "  hour_ms INTEGER NOT NULL,"
+    "  PRIMARY KEY(sensor_id, hour_ms)) WITHOUT ROWID;"
+    "CREATE TABLE IF NOT EXISTS soil_moisture_prune_watermark ("
+    "  id INTEGER PRIMARY KEY CHECK (id = 0),"
+    "  pruned_before_ms INTEGER NOT NULL);"
+    "INSERT OR IGNORE INTO soil_moisture_prune_watermark (id, pruned_before_ms) "
+    "  SELECT 0, COALESCE(MIN(time_ms) - MIN(time_ms) % 3600000 + 3600000, 0) "
+    "  FROM soil_moisture_readings;"
+    "CREATE TABLE IF NOT EXISTS irrigation_systems ("
+    "  peripheral_id INTEGER PRIMARY KEY REFERENCES peripherals(id));"
+    "CREATE TABLE IF NOT EXISTS daily_irrigation_schedules ("
+    "  id INTEGER PRIMARY KEY,"
+    "  day_of_week_index INTEGER NOT NULL,"
+    "  irrigation_time_military TEXT NOT NULL,"
+    "  duration_ms INTEGER NOT NULL,"
+    "  irrigation_system_id INTEGER NOT NULL REFERENCES irrigation_systems(peripheral_id));"
+    "CREATE INDEX IF NOT EXISTS daily_irrigation_schedules_by_system "
+    "  ON daily_irrigation_schedules(irrigation_system_id);";
+
+// FULL syncs the log on every commit. Readings are acknowledged once they
+// commit, so a power cut must not take back a commit.
+constexpr const char *WAL_SQL = "PRAGMA journal_mode=WAL";
+constexpr const char *WRITER_PRAGMAS_SQL =
+    "PRAGMA synchronous=FULL;"
+    "PRAGMA foreign_keys=ON;";
+
+constexpr const char *BEGIN_SQL = "BEGIN IMMEDIATE";
+constexpr const char *COMMIT_SQL = "COMMIT";
+constexpr const char *ROLLBACK_SQL = "ROLLBACK";
+
+constexpr const char *INSERT_RPI_SQL =
+    "INSERT INTO rpis (name, time, location) VALUES (?, ?, ?)";
+constexpr const char *INSERT_PERIPHERAL_SQL =
+    "INSERT INTO peripherals (name, time) VALUES (?, ?)";
+constexpr const char *INSERT_SOIL_MOISTURE_SENSOR_SQL =
+    "INSERT INTO soil_moisture_sensors (peripheral_id, ceiling, floor) VALUES (?, ?, ?)";
+constexpr const char *INSERT_IRRIGATION_SYSTEM_SQL =
+    "INSERT INTO irrigation_systems (peripheral_id) VALUES (?)";
+constexpr const char *INSERT_EDGE_SQL =
+    "INSERT INTO rpi_peripheral_edges (rpi_id, peripheral_id) VALUES (?, ?)";
+constexpr const char *REPLACE_EDGE_SQL =
+    "INSERT OR REPLACE INTO rpi_peripheral_edges (rpi_id, peripheral_id) VALUES (?, ?)";
+constexpr const char *DELETE_EDGE_SQL =
+    "DELETE FROM rpi_peripheral_edges WHERE peripheral_id = ?";
+constexpr const char *UPSERT_READING_SQL =
+    "INSERT OR REPLACE INTO soil_moisture_readings (sensor_id, time_ms, seq, reading) "
+    "VALUES (?, ?, ?, ?)";
+
+// Marked in the transaction that writes the readings of the hour
+constexpr const char *MARK_STALE_ROLLUP_SQL =
+    "INSERT OR IGNORE INTO soil_moisture_stale_rollups (sensor_id, hour_ms) VALUES (?, ?)";
+constexpr const char *SELECT_STALE_ROLLUPS_SQL =
+    "SELECT sensor_id, hour_ms FROM soil_moisture_stale_rollups LIMIT ?";
+constexpr const char *DELETE_STALE_ROLLUP_SQL =
+    "DELETE FROM soil_moisture_stale_rollups WHERE sensor_id = ? AND hour_ms = ?";
+constexpr const char *SELECT_OLDEST_STALE_ROLLUP_SQL =
+    "SELECT MIN(hour_ms) FROM soil_moisture_stale_rollups";
+
+// Raised before each prune deletes anything, so a refresh never rebuilds a
+// minute from what a prune has left of it
+constexpr const char *RAISE_PRUNE_WATERMARK_SQL =
+    "UPDATE soil_moisture_prune_watermark SET pruned_before_ms = MAX(pruned_before_ms, ?)";
+
+// Stale hours refreshed per call. The rest wait for the next call.
+constexpr int64_t MAX_REFRESH_BUCKETS = 10000;
+
+// Newest first so that LIMIT keeps the most recent readings
+constexpr const char *SELECT_READINGS_SQL =
+    "SELECT time_ms, reading FROM soil_moisture_readings "
+    "WHERE sensor_id = ? AND time_ms >= ? AND time_ms < ? "
+    "ORDER BY time_ms DESC, seq DESC LIMIT ?";
+
+// Walks the distinct sensors with one primary key seek each
+constexpr const char *SELECT_NEXT_READING_SENSOR_SQL =
+    "SELECT MIN(sensor_id) FROM soil_moisture_readings WHERE sensor_id > ?";
+
+// Rows deleted per transaction when pruning, so that writes aren't held up
+// behind a sensor with a large backlog of expired readings
+constexpr int PRUNE_CHUNK_ROWS = 10000;
+
+// SQLite has no DELETE ... LIMIT by default, so a chunk runs up to the time
+// of the sensor's |PRUNE_CHUNK_ROWS|th oldest expired reading. Parameters
+// are (sensor_id, cutoff_ms, PRUNE_CHUNK_ROWS - 1).
+constexpr const char *PRUNE_READINGS_SQL =
+    "DELETE FROM soil_moisture_readings WHERE sensor_id = ?1 AND time_ms < ?2 "
+    "AND time_ms <= COALESCE("
+    "  (SELECT time_ms FROM soil_moisture_readings WHERE sensor_id = ?1 AND time_ms < ?2 "
+    "   ORDER BY time_ms LIMIT 1 OFFSET ?3), ?2)";
+
+constexpr const char *DELETE_SCHEDULES_SQL =
+    "DELETE FROM daily_irrigation_schedules WHERE irrigation_system_id = ?";
+constexpr const char *INSERT_SCHEDULE_SQL =
+    "INSERT INTO daily_irrigation_schedules "
+    "(irrigation_system_id, day_of_week_index, irrigation_time_military, duration_ms) "
+    "VALUES (?, ?, ?, ?)";
+constexpr const char *SELECT_SCHEDULES_SQL =
+    "SELECT irrigation_system_id, day_of_week_index, irrigation_time_military, duration_ms "
+    "FROM daily_irrigation_schedules";
+
+// Each rollup level is rebuilt from the level below it. Parameters are
+// (sensor_id, start_ms, end_ms), aligned to the level's bucket width.
+// Minutes before the prune watermark keep their stored 1-minute rollups.
+constexpr const char *REFRESH_ROLLUPS_1M_SQL =
+    "INSERT OR REPLACE INTO soil_moisture_rollups_1m "
+    "(sensor_id, bucket_ms, min_reading, max_reading, mean_reading, reading_count) "
+    "SELECT sensor_id, time_ms - time_ms % 60000, "
+    "       MIN(reading), MAX(reading), AVG(reading), COUNT(*) "
+    "FROM soil_moisture_readings "
+    "WHERE sensor_id = ? AND time_ms >= ? AND time_ms < ? "
+    "AND time_ms >= (SELECT pruned_before_ms FROM soil_moisture_prune_watermark) "
+    "GROUP BY time_ms - time_ms % 60000";
+
+constexpr const char *REFRESH_ROLLUPS_1H_SQL =
+    "INSERT OR REPLACE INTO soil_moisture_rollups_1h "
+    "(sensor_id, bucket_ms, min_reading, max_reading, mean_reading, reading_count) "
+    "SELECT sensor_id, bucket_ms - bucket_ms % 3600000, "
+    "       MIN(min_reading), MAX(max_reading), "
+    "       SUM(mean_reading * reading_count) / SUM(reading_count), SUM(reading_count) "
+    "FROM soil_moisture_rollups_1m "
+    "WHERE sensor_id = ? AND bucket_ms >= ? AND bucket_ms < ? "
+    "GROUP BY bucket_ms - bucket_ms % 3600000";
+
+constexpr const char *REFRESH_ROLLUPS_1D_SQL =
+    "INSERT OR REPLACE INTO soil_moisture_rollups_1d "
+    "(sensor_id, bucket_ms, min_reading, max_reading, mean_reading, reading_count) "
+    "SELECT sensor_id, bucket_ms - bucket_ms % 86400000, "
+    "       MIN(min_reading), MAX(max_reading), "
+    "       SUM(mean_reading * reading_count) / SUM(reading_count), SUM(reading_count) "
+    "FROM soil_moisture_rollups_1h "
+    "WHERE sensor_id = ? AND bucket_ms >= ? AND bucket_ms < ? "
+    "GROUP BY bucket_ms - bucket_ms % 86400000";
+
+constexpr const char *SELECT_RPIS_SQL = "SELECT id, name FROM rpis";
+constexpr const char *SELECT_PERIPHERALS_SQL = "SELECT id, name FROM peripherals";
+constexpr const char *SELECT_SOIL_MOISTURE_SENSORS_SQL =
+    "SELECT peripheral_id FROM soil_moisture_sensors";
+constexpr const char *SELECT_IRRIGATION_SYSTEMS_SQL =
+    "SELECT peripheral_id FROM irrigation_systems";
+constexpr const char *SELECT_EDGES_SQL =
+    "SELECT peripheral_id, rpi_id FROM rpi_peripheral_edges";
+
+/**
+ * A connection and the statements prepared on it. Only one thread may use it
+ * at a time, under |mutex|.
+ */
+struct Connection
+{
+  sqlite3 *db{nullptr};
+  std::mutex mutex;
+
+  // SQL text -> statement prepared from it
+  std::unordered_map<std::string, sqlite3_stmt *> statements;
+};
+
+/** Resets a cached statement on scope exit so that it is ready for reuse. */
+class StatementLease
+{
+public:
+  explicit StatementLease(sqlite3_stmt *statement) : statement_{statement}
+  {
+    assert(statement_);
+  }
+
+  ~StatementLease()
+  {
+    sqlite3_reset(statement_);
+  }
+
+private:
+  StatementLease(const StatementLease &other) = delete;
+  StatementLease &operator=(const StatementLease &other) = delete;
+
+private:
+  sqlite3_stmt *statement_;
+};
+
+std::string MakeTimestamp()
+{
+  std::time_t t = std::time(nullptr);
+  std::tm tm;
+  localtime_r(&t, &tm);
+
+  std::ostringstream oss;
+  oss << std::put_time(&tm, "%Y-%m-%d %H-%M-%S");
+  return oss.str();
+}
+
+int64_t FloorToBucket(int64_t time_ms, int64_t bucket_ms)
+{
+  return time_ms - (time_ms % bucket_ms);
+}
+
+sqlite3_int64 ToSqlite(size_t value)
+{
+  return static_cast<sqlite3_int64>(value);
+}
+
+bool OpenConnection(const std::string &path, int flags, Connection *connection)
+{
+  assert(connection);
+
+  // Each connection is used by one thread at a time, so SQLite's own
+  // per-connection mutex would only add overhead
+  int rc = sqlite3_open_v2(path.c_str(), &connection->db, flags | SQLITE_OPEN_NOMUTEX, nullptr);
+  if (rc != SQLITE_OK)
+  {
+    LOG(ERROR) << "Failed to open sqlite database " << path << ": "
+               << (connection->db ? sqlite3_errmsg(connection->db) : sqlite3_errstr(rc));
+    return false;
+  }
+
+  sqlite3_busy_timeout(connection->db, BUSY_TIMEOUT_MS);
+  return true;
+}
+
+void CloseConnection(Connection *connection)
+{
+  assert(connection);
+
+  for (auto &entry : connection->statements)
+  {
+    sqlite3_finalize(entry.second);
+  }
+  connection->statements.clear();
+
+  if (connection->db)
+  {
+    sqlite3_close(connection->db);
+    connection->db = nullptr;
+  }
+}
+
+/** Runs |sql|, which may hold several statements, discarding any rows. */
+bool ExecuteScript(Connection *connection, const char *sql)
+{
+  assert(connection);
+
+  char *error = nullptr;
+  if (sqlite3_exec(connection->db, sql, nullptr, nullptr, &error) != SQLITE_OK)
+  {
+    LOG(ERROR) << "Failed to execute sqlite script: " << (error ? error : "unknown error");
+    sqlite3_free(error);
+    return false;
+  }
+  return true;
+}
+
+/** Returns the statement prepared from |sql|, preparing it on first use. */
+sqlite3_stmt *GetStatement(Connection *connection, const char *sql)
+{
+  assert(connection);
+
+  auto it = connection->statements.find(sql);
+  if (it != connection->statements.end())
+  {
+    return it->second;
+  }
+
+  sqlite3_stmt *statement = nullptr;
+  if (sqlite3_prepare_v3(
+        connection->db,
+        sql,
+        -1,
+        SQLITE_PREPARE_PERSISTENT,
+        &statement,
+        nullptr) != SQLITE_OK)
+  {
+    LOG(ERROR) << "Failed to prepare \"" << sql << "\": " << sqlite3_errmsg(connection->db);
+    return nullptr;
+  }
+
+  connection->statements.emplace(sql, statement);
+  return statement;
+}
+
+/** Steps |statement| through its rows, passing it to |on_row| at each. */
+template <typename OnRow>
+bool ForEachRow(Connection *connection, sqlite3_stmt *statement, OnRow on_row)
+{
+  assert(connection);
+  assert(statement);
+
+  int rc;
+  while ((rc = sqlite3_step(statement)) == SQLITE_ROW)
+  {
+    on_row(statement);
+  }
+
+  if (rc != SQLITE_DONE)
+  {
+    LOG(ERROR) << "Failed to execute \"" << sqlite3_sql(statement) << "\": "
+               << sqlite3_errmsg(connection->db);
+    return false;
+  }
+  return true;
+}
+
+/** Steps |statement| to completion, discarding any rows. */
+bool StepToDone(Connection *connection, sqlite3_stmt *statement)
+{
+  return ForEachRow(connection, statement, [](sqlite3_stmt * /* row */) {});
+}
+
+/** Runs a statement that takes no parameters, e.g. BEGIN or COMMIT. */
+bool Execute(Connection *connection, const char *sql)
+{
+  sqlite3_stmt *statement = GetStatement(connection, sql);
+  if (!statement)
+  {
+    return false;
+  }
+
+  StatementLease lease{statement};
+  return StepToDone(connection, statement);
+}
+
+void Rollback(Connection *connection)
+{
+  assert(connection);
+
+  // A failed COMMIT may already have ended the transaction
+  if (!sqlite3_get_autocommit(connection->db) && !Execute(connection, ROLLBACK_SQL))
+  {
+    LOG(ERROR) << "Failed to roll back sqlite transaction";
+  }
+}
+
+bool Commit(Connection *connection)
+{
+  if (!Execute(connection, COMMIT_SQL))
+  {
+    Rollback(connection);
+    return false;
+  }
+  return true;
+}
+
+bool EnableWal(Connection *connection)
+{
+  assert(connection);
+
+  sqlite3_stmt *statement = GetStatement(connection, WAL_SQL);
+  if (!statement)
+  {
+    return false;
+  }
+
+  StatementLease lease{statement};
+  if (sqlite3_step(statement) != SQLITE_ROW)
+  {
+    LOG(ERROR) << "Failed to enable WAL mode: " << sqlite3_errmsg(connection->db);
+    return false;
+  }
+
+  // Some filesystems can't host a WAL, in which case the mode is unchanged
+  std::string mode = reinterpret_cast<const char *>(sqlite3_column_text(statement, 0));
+  if (mode != "wal")
+  {
+    LOG(ERROR) << "Failed to enable WAL mode. Journal mode is " << mode;
+    return false;
+  }
+
+  return true;
+}
+
+/** Must be called inside a transaction on the writer. */
+bool InsertPeripheral(Connection *writer, const std::string &name, size_t *out_id)
+{
+  assert(writer);
+  assert(out_id);
+
+  sqlite3_stmt *insert = GetStatement(writer, INSERT_PERIPHERAL_SQL);
+  if (!insert)
+  {
+    return false;
+  }
+
+  std::string timestamp = MakeTimestamp();
+  StatementLease lease{insert};
+  sqlite3_bind_text(insert, 1, name.c_str(), static_cast<int>(name.size()), SQLITE_STATIC);
+  sqlite3_bind_text(insert, 2, timestamp.c_str(), static_cast<int>(timestamp.size()), SQLITE_STATIC);
+
+  if (!StepToDone(writer, insert))
+  {
+    LOG(ERROR) << "Failed to insert peripheral";
+    return false;
+  }
+
+  *out_id = static_cast<size_t>(sqlite3_last_insert_rowid(writer->db));
+  return true;
+}
+
+/** Binds (sensor_id, start_ms, end_ms) and runs one rollup refresh. */
+bool RefreshRollupLevel(
+    Connection *writer,
+    const char *sql,
+    size_t sensor_id,
+    int64_t start_ms,
+    int64_t end_ms)
+{
+  sqlite3_stmt *refresh = GetStatement(writer, sql);
+  if (!refresh)
+  {
+    return false;
+  }
+
+  StatementLease lease{refresh};
+  sqlite3_bind_int64(refresh, 1, ToSqlite(sensor_id));
+  sqlite3_bind_int64(refresh, 2, start_ms);
+  sqlite3_bind_int64(refresh, 3, end_ms);
+  return StepToDone(writer, refresh);
+}
+
+bool LoadRegistry(Connection *reader, RegistryCache *registry)
+{
+  assert(reader);
+  assert(registry);
+
+  sqlite3_stmt *rpis = GetStatement(reader, SELECT_RPIS_SQL);
+  sqlite3_stmt *peripherals = GetStatement(reader, SELECT_PERIPHERALS_SQL);
+  sqlite3_stmt *sensors = GetStatement(reader, SELECT_SOIL_MOISTURE_SENSORS_SQL);
+  sqlite3_stmt *irrigation_systems = GetStatement(reader, SELECT_IRRIGATION_SYSTEMS_SQL);
+  sqlite3_stmt *edges = GetStatement(reader, SELECT_EDGES_SQL);
+  if (!rpis || !peripherals || !sensors || !irrigation_systems || !edges)
+  {
+    return false;
+  }
+
+  StatementLease rpis_lease{rpis};
+  StatementLease peripherals_lease{peripherals};
+  StatementLease sensors_lease{sensors};
+  StatementLease irrigation_systems_lease{irrigation_systems};
+  StatementLease edges_lease{edges};
+
+  return ForEachRow(reader, rpis, [registry](sqlite3_stmt *row)
+      {
+        registry->AddRpi(
+            static_cast<size_t>(sqlite3_column_int64(row, 0)),
+            reinterpret_cast<const char *>(sqlite3_column_text(row, 1)));
+      }) &&
+      ForEachRow(reader, peripherals, [registry](sqlite3_stmt *row)
+      {
+        registry->AddPeripheral(
+            static_cast<size_t>(sqlite3_column_int64(row, 0)),
+            reinterpret_cast<const char *>(sqlite3_column_text(row, 1)));
+      }) &&
+      ForEachRow(reader, sensors, [registry](sqlite3_stmt *row)
+      {
+        registry->AddSoilMoistureSensor(static_cast<size_t>(sqlite3_column_int64(row, 0)));
+      }) &&
+      ForEachRow(reader, irrigation_systems, [registry](sqlite3_stmt *row)
+      {
+        registry->AddIrrigationSystem(static_cast<size_t>(sqlite3_column_int64(row, 0)));
+      }) &&
+      ForEachRow(reader, edges, [registry](sqlite3_stmt *row)
+      {
+        registry->SetPeripheralOwner(
+            static_cast<size_t>(sqlite3_column_int64(row, 0)),
+            static_cast<size_t>(sqlite3_column_int64(row, 1)));
+      });
+}
+
+/**
+ * Rebuilds every rollup level of the stale hour in one transaction and
+ * clears its mark.
+ */
+bool RefreshRollups(Connection *writer, size_t sensor_id, int64_t hour_ms)
+{
+  sqlite3_stmt *unmark = GetStatement(writer, DELETE_STALE_ROLLUP_SQL);
+  if (!unmark || !Execute(writer, BEGIN_SQL))
+  {
+    return false;
+  }
+
+  int64_t day_ms = FloorToBucket(hour_ms, DAY_MS);
+  StatementLease lease{unmark};
+  sqlite3_bind_int64(unmark, 1, ToSqlite(sensor_id));
+  sqlite3_bind_int64(unmark, 2, hour_ms);
+
+  if (!StepToDone(writer, unmark) ||
+      !RefreshRollupLevel(
+          writer, REFRESH_ROLLUPS_1M_SQL, sensor_id, hour_ms, hour_ms + HOUR_MS) ||
+      !RefreshRollupLevel(
+          writer, REFRESH_ROLLUPS_1H_SQL, sensor_id, hour_ms, hour_ms + HOUR_MS) ||
+      !RefreshRollupLevel(
+          writer, REFRESH_ROLLUPS_1D_SQL, sensor_id, day_ms, day_ms + DAY_MS))
+  {
+    Rollback(writer);
+    return false;
+  }
+
+  return Commit(writer);
+}
+} // namespace
+
+namespace organicdump
+{
+
+struct SqliteStorageEngine::State
+{
+  ~State()
+  {
+    CloseConnection(&reader);
+    CloseConnection(&writer);
+  }
+
+  Connection writer;
+
+  // Read-only. In WAL mode it sees the last commit without waiting for the
+  // writer.
+  Connection reader;
+
+  RegistryCache registry;
+};
+
+bool SqliteStorageEngine::Create(const std::string &path, SqliteStorageEngine *out_engine)
+{
+  assert(out_engine);
+
+  auto state = std::make_unique<State>();
+  if (!OpenConnection(path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, &state->writer))
+  {
+    return false;
+  }
+
+  if (!EnableWal(&state->writer) ||
+      !ExecuteScript(&state->writer, WRITER_PRAGMAS_SQL) ||
+      !ExecuteScript(&state->writer, SCHEMA_SQL))
+  {
+    LOG(ERROR) << "Failed to prepare sqlite database " << path;
+    return false;
+  }
+
+  if (!OpenConnection(path, SQLITE_OPEN_READONLY, &state->reader))
+  {
+    return false;
+  }
+
+  if (!LoadRegistry(&state->reader, &state->registry))
+  {
+    LOG(ERROR) << "Failed to warm registry cache";
+    return false;
+  }
+
+  LOG(INFO) << "Opened sqlite database " << path;
+  *out_engine = SqliteStorageEngine{std::move(state)};
+  return true;
+}
+
+SqliteStorageEngine::SqliteStorageEngine() {}
+
+SqliteStorageEngine::SqliteStorageEngine(std::unique_ptr<State> state)
+  : state_{std::move(state)} {}
+
+SqliteStorageEngine::~SqliteStorageEngine()
+{
+  CloseResources();
+}
+
+SqliteStorageEngine::SqliteStorageEngine(SqliteStorageEngine &&other)
+{
+  StealResources(&other);
+}
+
+SqliteStorageEngine &SqliteStorageEngine::operator=(SqliteStorageEngine &&other)
+{
+  if (this != &other)
+  {
+    CloseResources();
+    StealResources(&other);
+  }
+  return *this;
+}
+
+bool SqliteStorageEngine::OrphanRpiOwnedPeripheral(size_t peripheral_id)
+{
+  if (!state_->registry.IsPeripheralOwned(peripheral_id))
+  {
+    // Expected when a peripheral is assigned for the first time
+    LOG(INFO) << "Peripheral " << peripheral_id << " not owned by any rpi. Nothing to orphan";
+    return false;
+  }
+
+  Connection *writer = &state_->writer;
+  std::lock_guard<std::mutex> lock{writer->mutex};
+
+  sqlite3_stmt *remove = GetStatement(writer, DELETE_EDGE_SQL);
+  if (!remove)
+  {
+    return false;
+  }
+
+  StatementLease lease{remove};
+  sqlite3_bind_int64(remove, 1, ToSqlite(peripheral_id));
+  if (!StepToDone(writer, remove))
+  {
+    return false;
+  }
+
+  state_->registry.RemovePeripheralOwner(peripheral_id);
+
+  if (sqlite3_changes(writer->db) == 0)
+  {
+    LOG(ERROR) << "Peripheral " << peripheral_id
+               << " owned according to the registry cache but not in the database";
+    return false;
+  }
+
+  return true;
+}
+
+bool SqliteStorageEngine::AssignPeripheralToRpi(size_t rpi_id, size_t peripheral_id)
+{
+  Connection *writer = &state_->writer;
+  std::lock_guard<std::mutex> lock{writer->mutex};
+
+  sqlite3_stmt *insert = GetStatement(writer, INSERT_EDGE_SQL);
+  if (!insert)
+  {
+    return false;
+  }
+
+  StatementLease lease{insert};
+  sqlite3_bind_int64(insert, 1, ToSqlite(rpi_id));
+  sqlite3_bind_int64(insert, 2, ToSqlite(peripheral_id));
+  if (!StepToDone(writer, insert))
+  {
+    LOG(ERROR) << "Failed to insert rpi-peripheral edge";
+    return false;
+  }
+
+  state_->registry.SetPeripheralOwner(peripheral_id, rpi_id);
+  return true;
+}
+
+bool SqliteStorageEngine::ContainsRpi(size_t id)
+{
+  return state_->registry.ContainsRpi(id);
+}
+
+bool SqliteStorageEngine::ContainsRpi(const std::string &name)
+{
+  return state_->registry.ContainsRpi(name);
+}
+
+bool SqliteStorageEngine::ContainsPeripheral(const std::string &name)
+{
+  return state_->registry.ContainsPeripheral(name);
+}
+
+bool SqliteStorageEngine::ContainsPeripheral(size_t id)
+{
+  return state_->registry.ContainsPeripheral(id);
+}
+
+bool SqliteStorageEngine::ContainsSoilMoistureSensor(size_t id)
+{
+  return state_->registry.ContainsSoilMoistureSensor(id);
+}
+
+bool SqliteStorageEngine::ContainsIrrigationSystem(size_t id)
+{
+  return state_->registry.ContainsIrrigationSystem(id);
+}
+
+bool SqliteStorageEngine::InsertRpi(
+    const std::string &name,
+    const std::string &location,
+    size_t *out_id)
+{
+  assert(out_id);
+
+  Connection *writer = &state_->writer;
+  std::lock_guard<std::mutex> lock{writer->mutex};
+
+  sqlite3_stmt *insert = GetStatement(writer, INSERT_RPI_SQL);
+  if (!insert)
+  {
+    return false;
+  }
+
+  std::string timestamp = MakeTimestamp();
+  StatementLease lease{insert};
+  sqlite3_bind_text(insert, 1, name.c_str(), static_cast<int>(name.size()), SQLITE_STATIC);
+  sqlite3_bind_text(insert, 2, timestamp.c_str(), static_cast<int>(timestamp.size()), SQLITE_STATIC);
+  sqlite3_bind_text(insert, 3, location.c_str(), static_cast<int>(location.size()), SQLITE_STATIC);
+
+  if (!StepToDone(writer, insert))
+  {
+    LOG(ERROR) << "Failed to insert rpi";
+    return false;
+  }
+
+  *out_id = static_cast<size_t>(sqlite3_last_insert_rowid(writer->db));
+  state_->registry.AddRpi(*out_id, name);
+  return true;
+}
+
+bool SqliteStorageEngine::InsertSoilMoistureSensor(
+    const std::string& name,
+    float floor,
+    float ceil,
+    size_t *out_id)
+{
+  assert(out_id);
+
+  LOG(INFO) << "Registering soil moisture sensor w/database, {name="
+            << name << ", floor=" << floor << ", ceil=" << ceil << "}";
+
+  Connection *writer = &state_->writer;
+  std::lock_guard<std::mutex> lock{writer->mutex};
+
+  sqlite3_stmt *insert = GetStatement(writer, INSERT_SOIL_MOISTURE_SENSOR_SQL);
+  if (!insert || !Execute(writer, BEGIN_SQL))
+  {
+    return false;
+  }
+
+  if (!InsertPeripheral(writer, name, out_id))
+  {
+    Rollback(writer);
+    return false;
+  }
+
+  {
+    StatementLease lease{insert};
+    sqlite3_bind_int64(insert, 1, ToSqlite(*out_id));
+    sqlite3_bind_double(insert, 2, ceil);
+    sqlite3_bind_double(insert, 3, floor);
+
+    if (!StepToDone(writer, insert))
+    {
+      LOG(ERROR) << "Failed to insert soil moisture sensor record";
+      Rollback(writer);
+      return false;
+    }
+  }
+
+  if (!Commit(writer))
+  {
+    return false;
+  }
+
+  LOG(INFO) << "Soil moisture sensor registered successfully";
+  state_->registry.AddPeripheral(*out_id, name);
+  state_->registry.AddSoilMoistureSensor(*out_id);
+  return true;
+}
+
+bool SqliteStorageEngine::InsertSoilMoistureMeasurements(
+    const std::vector<SoilMoistureMeasurement> &measurements)
+{
+  // The readings table has no foreign key, like the partitioned MySQL one
+  for (const SoilMoistureMeasurement &measurement : measurements)
+  {
+    if (!state_->registry.ContainsSoilMoistureSensor(measurement.sensor_id))
+    {
+      LOG(ERROR) << "Failed to insert soil moisture measurements. Unknown sensor "
+                 << measurement.sensor_id;
+      return false;
+    }
+  }
+
+  Connection *writer = &state_->writer;
+  {
+    std::lock_guard<std::mutex> lock{writer->mutex};
+
+    sqlite3_stmt *mark = GetStatement(writer, MARK_STALE_ROLLUP_SQL);
+    sqlite3_stmt *upsert = GetStatement(writer, UPSERT_READING_SQL);
+    if (!mark || !upsert || !Execute(writer, BEGIN_SQL))
+    {
+      return false;
+    }
+
+    // The hours whose rollups the batch makes stale are marked in the same
+    // transaction, so a crash cannot lose them
+    std::set<std::pair<size_t, int64_t>> stale_hours;
+    for (const SoilMoistureMeasurement &measurement : measurements)
+    {
+      stale_hours.emplace(measurement.sensor_id, FloorToBucket(measurement.time_ms, HOUR_MS));
+    }
+
+    for (const std::pair<size_t, int64_t> &stale_hour : stale_hours)
+    {
+      StatementLease lease{mark};
+      sqlite3_bind_int64(mark, 1, ToSqlite(stale_hour.first));
+      sqlite3_bind_int64(mark, 2, stale_hour.second);
+
+      if (!StepToDone(writer, mark))
+      {
+        Rollback(writer);
+        return false;
+      }
+    }
+
+    for (const SoilMoistureMeasurement &measurement : measurements)
+    {
+      StatementLease lease{upsert};
+      sqlite3_bind_int64(upsert, 1, ToSqlite(measurement.sensor_id));
+      sqlite3_bind_int64(upsert, 2, measurement.time_ms);
+      sqlite3_bind_int64(upsert, 3, measurement.seq);
+      sqlite3_bind_double(upsert, 4, measurement.value);
+
+      if (!StepToDone(writer, upsert))
+      {
+        Rollback(writer);
+        return false;
+      }
+    }
+
+    if (!Commit(writer))
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool SqliteStorageEngine::GetSoilMoistureReadings(
+    size_t sensor_id,
+    int64_t start_ms,
+    int64_t end_ms,
+    size_t max_readings,
+    std::vector<int64_t> *out_times,
+    std::vector<float> *out_values)
+{
+  assert(out_times);
+  assert(out_values);
+
+  Connection *reader = &state_->reader;
+  std::lock_guard<std::mutex> lock{reader->mutex};
+
+  sqlite3_stmt *select = GetStatement(reader, SELECT_READINGS_SQL);
+  if (!select)
+  {
+    return false;
+  }
+
+  StatementLease lease{select};
+  sqlite3_bind_int64(select, 1, ToSqlite(sensor_id));
+  sqlite3_bind_int64(select, 2, start_ms);
+  sqlite3_bind_int64(select, 3, end_ms);
+  sqlite3_bind_int64(
+      select,
+      4,
+      ToSqlite(std::min<size_t>(max_readings, std::numeric_limits<sqlite3_int64>::max())));
+
+  size_t offset = out_times->size();
+  bool is_read = ForEachRow(reader, select, [out_times, out_values](sqlite3_stmt *row)
+      {
+        out_times->push_back(sqlite3_column_int64(row, 0));
+        out_values->push_back(static_cast<float>(sqlite3_column_double(row, 1)));
+      });
+
+  if (!is_read)
+  {
+    out_times->resize(offset);
+    out_values->resize(offset);
+    return false;
+  }
+
+  std::reverse(out_times->begin() + offset, out_times->end());
+  std::reverse(out_values->begin() + offset, out_values->end());
+  return true;
+}
+
+bool SqliteStorageEngine::RefreshSoilMoistureRollups()
+{
+  Connection *writer = &state_->writer;
+  std::vector<std::pair<size_t, int64_t>> stale_hours;
+
+  {
+    std::lock_guard<std::mutex> lock{writer->mutex};
+
+    sqlite3_stmt *select = GetStatement(writer, SELECT_STALE_ROLLUPS_SQL);
+    if (!select)
+    {
+      return false;
+    }
+
+    StatementLease lease{select};
+    sqlite3_bind_int64(select, 1, MAX_REFRESH_BUCKETS);
+    if (!ForEachRow(writer, select, [&stale_hours](sqlite3_stmt *row)
+        {
+          stale_hours.emplace_back(
+              static_cast<size_t>(sqlite3_column_int64(row, 0)),
+              sqlite3_column_int64(row, 1));
+        }))
+    {
+      return false;
+    }
+  }
+
+  // One hour per transaction, so writes of new readings carry on in between
+  for (const std::pair<size_t, int64_t> &stale_hour : stale_hours)
+  {
+    std::lock_guard<std::mutex> lock{writer->mutex};
+
+    if (!RefreshRollups(writer, stale_hour.first, stale_hour.second))
+    {
+      LOG(ERROR) << "Failed to refresh soil moisture rollups of sensor "
+                 << stale_hour.first << " at " << stale_hour.second;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool SqliteStorageEngine::EnsureSoilMoistureReadingPartitions()
+{
+  return true;
+}
+
+bool SqliteStorageEngine::PruneSoilMoistureReadings(int64_t cutoff_ms)
+{
+  Connection *reader = &state_->reader;
+  Connection *writer = &state_->writer;
+  sqlite3_int64 sensor_id = -1;
+  int64_t deleted = 0;
+
+  // Whole hours only, so no minute is left partly pruned
+  cutoff_ms = FloorToBucket(cutoff_ms, HOUR_MS);
+
+  // Readings are only pruned once their rollups are current
+  {
+    std::lock_guard<std::mutex> lock{reader->mutex};
+
+    sqlite3_stmt *oldest_stale = GetStatement(reader, SELECT_OLDEST_STALE_ROLLUP_SQL);
+    if (!oldest_stale)
+    {
+      return false;
+    }
+
+    StatementLease lease{oldest_stale};
+    if (sqlite3_step(oldest_stale) != SQLITE_ROW)
+    {
+      LOG(ERROR) << "Failed to find stale rollups: " << sqlite3_errmsg(reader->db);
+      return false;
+    }
+
+    if (sqlite3_column_type(oldest_stale, 0) != SQLITE_NULL &&
+        sqlite3_column_int64(oldest_stale, 0) < cutoff_ms)
+    {
+      cutoff_ms = sqlite3_column_int64(oldest_stale, 0);
+      LOG(INFO) << "Pruning only readings older than " << cutoff_ms
+                << ", where the oldest stale rollups start";
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock{writer->mutex};
+
+    sqlite3_stmt *raise = GetStatement(writer, RAISE_PRUNE_WATERMARK_SQL);
+    if (!raise)
+    {
+      return false;
+    }
+
+    StatementLease lease{raise};
+    sqlite3_bind_int64(raise, 1, cutoff_ms);
+    if (!StepToDone(writer, raise))
+    {
+      LOG(ERROR) << "Failed to raise the soil moisture prune watermark";
+      return false;
+    }
+  }
+
+  while (true)
+  {
+    // Find the next sensor on the reader, so writes carry on meanwhile
+    {
+      std::lock_guard<std::mutex> lock{reader->mutex};
+
+      sqlite3_stmt *next = GetStatement(reader, SELECT_NEXT_READING_SENSOR_SQL);
+      if (!next)
+      {
+        return false;
+      }
+
+      StatementLease lease{next};
+      sqlite3_bind_int64(next, 1, sensor_id);
+      if (sqlite3_step(next) != SQLITE_ROW)
+      {
+        LOG(ERROR) << "Failed to find sensors to prune: " << sqlite3_errmsg(reader->db);
+        return false;
+      }
+
+      if (sqlite3_column_type(next, 0) == SQLITE_NULL)
+      {
+        break;
+      }
+      sensor_id = sqlite3_column_int64(next, 0);
+    }
+
+    // Each chunk is its own transaction, and writes get the writer between
+    // chunks
+    int chunk_deleted = PRUNE_CHUNK_ROWS;
+    while (chunk_deleted >= PRUNE_CHUNK_ROWS)
+    {
+      std::lock_guard<std::mutex> lock{writer->mutex};
+
+      sqlite3_stmt *prune = GetStatement(writer, PRUNE_READINGS_SQL);
+      if (!prune)
+      {
+        return false;
+      }
+
+      StatementLease lease{prune};
+      sqlite3_bind_int64(prune, 1, sensor_id);
+      sqlite3_bind_int64(prune, 2, cutoff_ms);
+      sqlite3_bind_int(prune, 3, PRUNE_CHUNK_ROWS - 1);
+      if (!StepToDone(writer, prune))
+      {
+        LOG(ERROR) << "Failed to prune soil moisture readings of sensor " << sensor_id;
+        return false;
+      }
+
+      chunk_deleted = sqlite3_changes(writer->db);
+      deleted += chunk_deleted;
+    }
+  }
+
+  LOG(INFO) << "Pruned " << deleted << " soil moisture reading(s) older than " << cutoff_ms;
+  return true;
+}
+
+bool SqliteStorageEngine::UpdatePeripheralOwnership(size_t peripheral_id, size_t rpi_id)
+{
+  if (!ContainsPeripheral(peripheral_id))
+  {
+    LOG(ERROR) << "Could not find peripheral w/id: " << peripheral_id;
+    return false;
+  }
+
+  if (!ContainsRpi(rpi_id))
+  {
+    LOG(ERROR) << "Could not find rpi w/id: " << rpi_id;
+    return false;
+  }
+
+  Connection *writer = &state_->writer;
+  std::lock_guard<std::mutex> lock{writer->mutex};
+
+  // The edge is keyed by peripheral, so replacing it moves the peripheral in
+  // one statement
+  sqlite3_stmt *replace = GetStatement(writer, REPLACE_EDGE_SQL);
+  if (!replace)
+  {
+    return false;
+  }
+
+  StatementLease lease{replace};
+  sqlite3_bind_int64(replace, 1, ToSqlite(rpi_id));
+  sqlite3_bind_int64(replace, 2, ToSqlite(peripheral_id));
+  if (!StepToDone(writer, replace))
+  {
+    LOG(ERROR) << "Failed to update ownership of peripheral " << peripheral_id;
+    return false;
+  }
+
+  state_->registry.SetPeripheralOwner(peripheral_id, rpi_id);
+  return true;
+}
+
+bool SqliteStorageEngine::InsertIrrigationSystem(
+    const std::string& name,
+    size_t *out_id)
+{
+  assert(out_id);
+
+  LOG(INFO) << "Registering irrigation system w/database: name=" << name;
+
+  Connection *writer = &state_->writer;
+  std::lock_guard<std::mutex> lock{writer->mutex};
+
+  sqlite3_stmt *insert = GetStatement(writer, INSERT_IRRIGATION_SYSTEM_SQL);
+  if (!insert || !Execute(writer, BEGIN_SQL))
+  {
+    return false;
+  }
+
+  if (!InsertPeripheral(writer, name, out_id))
+  {
+    Rollback(writer);
+    return false;
+  }
+
+  {
+    StatementLease lease{insert};
+    sqlite3_bind_int64(insert, 1, ToSqlite(*out_id));
+
+    if (!StepToDone(writer, insert))
+    {
+      LOG(ERROR) << "Failed to insert irrigation systems record";
+      Rollback(writer);
+      return false;
+    }
+  }
+
+  if (!Commit(writer))
+  {
+    return false;
+  }
+
+  LOG(INFO) << "Irrigation system " << *out_id << " registered successfully";
+  state_->registry.AddPeripheral(*out_id, name);
+  state_->registry.AddIrrigationSystem(*out_id);
+  return true;
+}
+
+bool SqliteStorageEngine::ReplaceDailyIrrigationSchedules(
+    size_t irrigation_system_id,
+    const std::vector<DailyIrrigationSchedule> &schedules)
+{
+  LOG(INFO) << "Replacing daily irrigation schedules:"
+            << " irrigation_system_id=" << irrigation_system_id
+            << " schedule_count=" << schedules.size();
+
+  Connection *writer = &state_->writer;
+  std::lock_guard<std::mutex> lock{writer->mutex};
+
+  sqlite3_stmt *remove = GetStatement(writer, DELETE_SCHEDULES_SQL);
+  sqlite3_stmt *insert = GetStatement(writer, INSERT_SCHEDULE_SQL);
+  if (!remove || !insert || !Execute(writer, BEGIN_SQL))
+  {
+    return false;
+  }
+
+  {
+    StatementLease lease{remove};
+    sqlite3_bind_int64(remove, 1, ToSqlite(irrigation_system_id));
+
+    if (!StepToDone(writer, remove))
+    {
+      Rollback(writer);
+      return false;
+    }
+  }
+
+  for (const DailyIrrigationSchedule &schedule : schedules)
+  {
+    assert(schedule.irrigation_system_id == irrigation_system_id);
+
+    StatementLease lease{insert};
+    sqlite3_bind_int64(insert, 1, ToSqlite(irrigation_system_id));
+    sqlite3_bind_int64(insert, 2, ToSqlite(schedule.day_of_week_index));
+    sqlite3_bind_text(
+        insert,
+        3,
+        schedule.water_time_military.c_str(),
+        static_cast<int>(schedule.water_time_military.size()),
+        SQLITE_STATIC);
+    sqlite3_bind_int64(insert, 4, ToSqlite(schedule.water_duration_ms));
+
+    if (!StepToDone(writer, insert))
+    {
+      LOG(ERROR) << "Failed to insert every daily irrigation schedule. irrigation_system_id="
+                 << irrigation_system_id;
+      Rollback(writer);
+      return false;
+    }
+  }
+
+  if (!Commit(writer))
+  {
+    return false;
+  }
+
+  LOG(INFO) << "Daily irrigation schedules of irrigation system " << irrigation_system_id
+            << " replaced successfully";
+  return true;
+}
+
+bool SqliteStorageEngine::GetDailyIrrigationSchedules(
+    std::vector<DailyIrrigationSchedule> *out_schedules)
+{
+  assert(out_schedules);
+
+  Connection *reader = &state_->reader;
+  std::lock_guard<std::mutex> lock{reader->mutex};
+
+  sqlite3_stmt *select = GetStatement(reader, SELECT_SCHEDULES_SQL);
+  if (!select)
+  {
+    return false;
+  }
+
+  StatementLease lease{select};
+  return ForEachRow(reader, select, [out_schedules](sqlite3_stmt *row)
+      {
+        out_schedules->push_back(DailyIrrigationSchedule{
+            static_cast<size_t>(sqlite3_column_int64(row, 0)),
+            static_cast<size_t>(sqlite3_column_int64(row, 1)),
+            reinterpret_cast<const char *>(sqlite3_column_text(row, 2)),
+            static_cast<size_t>(sqlite3_column_int64(row, 3))});
+      });
+}
+
+void SqliteStorageEngine::CloseResources()
+{
+  state_.reset();
+}
+
+void SqliteStorageEngine::StealResources(SqliteStorageEngine *other)
+{
+  assert(other);
+  state_ = std::move(other->state_);
+}
+
+} // namespace organicdump
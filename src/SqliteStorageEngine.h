@@ -0,0 +1,108 @@
+#ifndef ORGANICDUMP_SERVER_SQLITESTORAGEENGINE_H
+#define ORGANICDUMP_SERVER_SQLITESTORAGEENGINE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "StorageEngine.h"
+
+namespace organicdump
+{
+
+/**
+ * Keeps every table in one local SQLite file, for sites too small to run
+ * MySQL beside the server. The schema mirrors the MySQL one and is created
+ * on first use.
+ *
+ * The file is in WAL mode with one connection for writes and one for reads,
+ * each used by one thread at a time, so reads never wait behind a write.
+ * Every operation commits in a single transaction through statements
+ * prepared once and reused. Every commit is synced (synchronous=FULL), so
+ * a reading that was acknowledged survives a power cut.
+ *
+ * Like MySqlStorageEngine, existence checks, including the sensor check on
+ * every reading, are served from a RegistryCache, and the hours whose
+ * rollups new readings make stale are marked in soil_moisture_stale_rollups
+ * in the same transaction as the readings.
+ */
+class SqliteStorageEngine : public StorageEngine
+{
+public:
+  static bool Create(const std::string &path, SqliteStorageEngine *out_engine);
+
+public:
+  SqliteStorageEngine();
+  virtual ~SqliteStorageEngine();
+  SqliteStorageEngine(SqliteStorageEngine &&other);
+  SqliteStorageEngine &operator=(SqliteStorageEngine &&other);
+  bool OrphanRpiOwnedPeripheral(size_t peripheral_id) override;
+  bool AssignPeripheralToRpi(size_t rpi_id, size_t peripheral_id) override;
+  bool ContainsRpi(size_t id) override;
+  bool ContainsRpi(const std::string &name) override;
+  bool ContainsPeripheral(const std::string &name) override;
+  bool ContainsPeripheral(size_t id) override;
+  bool ContainsSoilMoistureSensor(size_t id) override;
+  bool ContainsIrrigationSystem(size_t id) override;
+  bool InsertRpi(
+      const std::string &name,
+      const std::string &location,
+      size_t *out_id) override;
+  bool InsertSoilMoistureSensor(
+      const std::string& name,
+      float floor,
+      float ceil,
+      size_t *out_id) override;
+  bool InsertSoilMoistureMeasurements(
+      const std::vector<SoilMoistureMeasurement> &measurements) override;
+  bool GetSoilMoistureReadings(
+      size_t sensor_id,
+      int64_t start_ms,
+      int64_t end_ms,
+      size_t max_readings,
+      std::vector<int64_t> *out_times,
+      std::vector<float> *out_values) override;
+  bool RefreshSoilMoistureRollups() override;
+
+  /**
+   * Deletes each sensor's expired readings in short transactions of at most
+   * a chunk each, sparing any hour whose rollups are still stale. The
+   * watermark in soil_moisture_prune_watermark is raised before the first.
+   */
+  bool PruneSoilMoistureReadings(int64_t cutoff_ms) override;
+
+  /** SQLite has no partitions, so there is nothing to prepare. */
+  bool EnsureSoilMoistureReadingPartitions() override;
+  bool UpdatePeripheralOwnership(
+      size_t peripheral_id,
+      size_t rpi_id) override;
+  bool InsertIrrigationSystem(
+      const std::string& name,
+      size_t *out_id) override;
+  bool ReplaceDailyIrrigationSchedules(
+      size_t irrigation_system_id,
+      const std::vector<DailyIrrigationSchedule> &schedules) override;
+  bool GetDailyIrrigationSchedules(
+      std::vector<DailyIrrigationSchedule> *out_schedules) override;
+
+private:
+  struct State;
+
+private:
+  SqliteStorageEngine(std::unique_ptr<State> state);
+  void CloseResources();
+  void StealResources(SqliteStorageEngine *other);
+
+private:
+  SqliteStorageEngine(const SqliteStorageEngine &other) = delete;
+  SqliteStorageEngine &operator=(const SqliteStorageEngine &other) = delete;
+
+private:
+  // Heap-allocated so that the connection locks survive moves of the engine
+  std::unique_ptr<State> state_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_SQLITESTORAGEENGINE_H
@@ -0,0 +1,159 @@
+#ifndef ORGANICDUMP_SERVER_STORAGEENGINE_H
+#define ORGANICDUMP_SERVER_STORAGEENGINE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace organicdump
+{
+
+struct SoilMoistureMeasurement
+{
+  size_t sensor_id;
+  float value;
+
+  // UTC epoch milliseconds
+  int64_t time_ms;
+
+  // Tells apart readings of one sensor stamped in the same millisecond. Zero
+  // for readings the client timestamped, which its timestamps identify: a
+  // resent reading overwrites itself and a later value at the same client
+  // time replaces the earlier one. Readings stamped on receipt take
+  // NextSoilMoistureReadingSeq() so that none of them overwrites another.
+  uint32_t seq = 0;
+};
+
+/** Never zero, which is left to client-timestamped readings. */
+inline uint32_t NextSoilMoistureReadingSeq()
+{
+  static std::atomic<uint32_t> next{1};
+  uint32_t seq = next.fetch_add(1, std::memory_order_relaxed);
+  return seq != 0 ? seq : next.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * The time before which raw readings may already be pruned under
+ * |raw_retention|, or INT64_MIN when it is zero and they are kept forever.
+ * It falls on an hour and only moves forward, so a reading at or after it
+ * lands in an hour whose raw readings are all still stored.
+ */
+inline int64_t GetRawRetentionCutoffMs(int64_t now_ms, std::chrono::hours raw_retention)
+{
+  constexpr int64_t HOUR_MS = 60 * 60 * 1000;
+  if (raw_retention.count() <= 0)
+  {
+    return INT64_MIN;
+  }
+
+  int64_t cutoff_ms = now_ms - raw_retention.count() * HOUR_MS;
+  return cutoff_ms - ((cutoff_ms % HOUR_MS) + HOUR_MS) % HOUR_MS;
+}
+
+struct DailyIrrigationSchedule
+{
+  size_t irrigation_system_id;
+  size_t day_of_week_index;
+  std::string water_time_military;
+  size_t water_duration_ms;
+};
+
+/**
+ * Where DbManager keeps the registry, readings and schedules. Engines are
+ * shared by every database worker thread, so every call must be safe to make
+ * concurrently. Contains*() lookups are served from memory by every engine,
+ * so they may also be made from a reactor thread.
+ */
+class StorageEngine
+{
+public:
+  virtual ~StorageEngine() {}
+
+  /**
+   * Removes the peripheral's ownership edge. False if it had none, which is
+   * the normal case before a peripheral's first assignment.
+   */
+  virtual bool OrphanRpiOwnedPeripheral(size_t peripheral_id) = 0;
+  virtual bool AssignPeripheralToRpi(size_t rpi_id, size_t peripheral_id) = 0;
+  virtual bool ContainsRpi(size_t id) = 0;
+  virtual bool ContainsRpi(const std::string &name) = 0;
+  virtual bool ContainsPeripheral(const std::string &name) = 0;
+  virtual bool ContainsPeripheral(size_t id) = 0;
+  virtual bool ContainsSoilMoistureSensor(size_t id) = 0;
+  virtual bool ContainsIrrigationSystem(size_t id) = 0;
+  virtual bool InsertRpi(
+      const std::string &name,
+      const std::string &location,
+      size_t *out_id) = 0;
+  virtual bool InsertSoilMoistureSensor(
+      const std::string& name,
+      float floor,
+      float ceil,
+      size_t *out_id) = 0;
+
+  /**
+   * Readings are keyed by (sensor_id, time_ms, seq) and a replayed reading
+   * overwrites the stored one, so retrying a batch is harmless. Every reading
+   * must name a registered soil moisture sensor, and a batch that doesn't is
+   * rejected whole. The readings tables have no foreign key to enforce it, so
+   * each engine checks its registry.
+   */
+  virtual bool InsertSoilMoistureMeasurements(
+      const std::vector<SoilMoistureMeasurement> &measurements) = 0;
+
+  /**
+   * Reads the newest readings of |sensor_id| in [start_ms, end_ms), at most
+   * |max_readings| of them, and appends them oldest first.
+   */
+  virtual bool GetSoilMoistureReadings(
+      size_t sensor_id,
+      int64_t start_ms,
+      int64_t end_ms,
+      size_t max_readings,
+      std::vector<int64_t> *out_times,
+      std::vector<float> *out_values) = 0;
+
+  /**
+   * Folds readings inserted since the last call into the rollups. Minutes
+   * before the prune watermark keep their stored 1-minute rollups, since
+   * their raw readings may be gone, and only the coarser levels are rebuilt
+   * from them.
+   */
+  virtual bool RefreshSoilMoistureRollups() = 0;
+
+  /**
+   * Deletes raw readings older than |cutoff_ms| rounded down to the hour, so
+   * that no hour is left partly pruned, and first raises the prune watermark
+   * to that hour. Rollups are kept.
+   */
+  virtual bool PruneSoilMoistureReadings(int64_t cutoff_ms) = 0;
+
+  /**
+   * Adds the partitions that upcoming readings will land in, for engines
+   * that partition them. Called at startup and periodically after.
+   */
+  virtual bool EnsureSoilMoistureReadingPartitions() = 0;
+  virtual bool UpdatePeripheralOwnership(
+      size_t peripheral_id,
+      size_t rpi_id) = 0;
+  virtual bool InsertIrrigationSystem(
+      const std::string& name,
+      size_t *out_id) = 0;
+
+  /**
+   * Replaces every daily schedule of |irrigation_system_id| with |schedules|
+   * atomically, so a failure leaves the previous set untouched.
+   */
+  virtual bool ReplaceDailyIrrigationSchedules(
+      size_t irrigation_system_id,
+      const std::vector<DailyIrrigationSchedule> &schedules) = 0;
+  virtual bool GetDailyIrrigationSchedules(
+      std::vector<DailyIrrigationSchedule> *out_schedules) = 0;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_STORAGEENGINE_H
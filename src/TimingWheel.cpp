@@ -0,0 +1,117 @@
+#include "TimingWheel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace organicdump
+{
+
+TimingWheel::TimingWheel() : TimingWheel{std::chrono::milliseconds{1}, 1} {}
+
+TimingWheel::TimingWheel(std::chrono::milliseconds tick, size_t slot_count)
+  : tick_{tick},
+    slots_(slot_count),
+    next_tick_{0},
+    size_{0}
+{
+  assert(tick_.count() > 0);
+  assert(!slots_.empty());
+
+  next_tick_ = ToTick(Clock::now());
+}
+
+void TimingWheel::Schedule(Clock::time_point deadline, Entry entry)
+{
+  // Round up so that an entry never fires before its deadline, and never
+  // land in a slot that has already been visited.
+  int64_t deadline_tick = std::max(ToTick(deadline) + 1, next_tick_);
+
+  Slot &slot = slots_[static_cast<size_t>(deadline_tick) % slots_.size()];
+  slot.entries.push_back(entry);
+  slot.deadline_ticks.push_back(deadline_tick);
+  ++size_;
+}
+
+void TimingWheel::Advance(Clock::time_point now, std::vector<Entry> *out_expired)
+{
+  assert(out_expired);
+
+  int64_t now_tick = ToTick(now);
+  if (now_tick < next_tick_)
+  {
+    return;
+  }
+
+  // After a long stall every slot is visited once rather than once per tick
+  int64_t last_tick = std::min<int64_t>(
+      now_tick,
+      next_tick_ + static_cast<int64_t>(slots_.size()) - 1);
+
+  for (int64_t tick = next_tick_; tick <= last_tick; ++tick)
+  {
+    Slot &slot = slots_[static_cast<size_t>(tick) % slots_.size()];
+
+    size_t kept = 0;
+    for (size_t i = 0; i < slot.entries.size(); ++i)
+    {
+      if (slot.deadline_ticks[i] <= now_tick)
+      {
+        out_expired->push_back(slot.entries[i]);
+        continue;
+      }
+
+      slot.entries[kept] = slot.entries[i];
+      slot.deadline_ticks[kept] = slot.deadline_ticks[i];
+      ++kept;
+    }
+
+    size_ -= slot.entries.size() - kept;
+    slot.entries.resize(kept);
+    slot.deadline_ticks.resize(kept);
+  }
+
+  next_tick_ = now_tick + 1;
+}
+
+int TimingWheel::GetTimeoutMs(Clock::time_point now) const
+{
+  if (size_ == 0)
+  {
+    return -1;
+  }
+
+  // Occupied slots bound the wakeup from below; an entry a full revolution
+  // away just costs an extra wakeup.
+  int64_t due_tick = next_tick_ + static_cast<int64_t>(slots_.size()) - 1;
+  for (int64_t tick = next_tick_; tick < due_tick; ++tick)
+  {
+    if (!slots_[static_cast<size_t>(tick) % slots_.size()].entries.empty())
+    {
+      due_tick = tick;
+      break;
+    }
+  }
+
+  auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::time_point{tick_ * due_tick} - now);
+  return static_cast<int>(std::min<int64_t>(
+      std::max<int64_t>(0, remaining.count()),
+      std::numeric_limits<int>::max()));
+}
+
+size_t TimingWheel::GetSize() const
+{
+  return size_;
+}
+
+int64_t TimingWheel::ToTick(Clock::time_point time) const
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      time.time_since_epoch()).count() / tick_.count();
+}
+
+} // namespace organicdump
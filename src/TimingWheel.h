@@ -0,0 +1,69 @@
+#ifndef ORGANICDUMP_SERVER_TIMINGWHEEL_H
+#define ORGANICDUMP_SERVER_TIMINGWHEEL_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace organicdump
+{
+
+/**
+ * Hashed timing wheel of connection deadlines. A deadline lands in the slot
+ * of its tick modulo the slot count, so scheduling is O(1) and each tick
+ * only visits the entries hashed to it. Deadlines further out than one
+ * revolution simply survive the visits that come before them.
+ *
+ * Entries are never cancelled: the owner checks an expired entry against
+ * the live connection (by serial) and either drops it or schedules a new
+ * deadline, which keeps activity on the hot path to a timestamp update.
+ *
+ * Confined to the reactor's thread.
+ */
+class TimingWheel
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry
+  {
+    int fd;
+    uint64_t serial;
+  };
+
+public:
+  TimingWheel();
+  TimingWheel(std::chrono::milliseconds tick, size_t slot_count);
+
+  void Schedule(Clock::time_point deadline, Entry entry);
+
+  /** Removes every entry due at or before |now| and appends it to |out_expired|. */
+  void Advance(Clock::time_point now, std::vector<Entry> *out_expired);
+
+  /** Milliseconds until the next occupied slot is due, or -1 if there are none. */
+  int GetTimeoutMs(Clock::time_point now) const;
+  size_t GetSize() const;
+
+private:
+  struct Slot
+  {
+    std::vector<Entry> entries;
+    std::vector<int64_t> deadline_ticks;
+  };
+
+private:
+  int64_t ToTick(Clock::time_point time) const;
+
+private:
+  std::chrono::milliseconds tick_;
+  std::vector<Slot> slots_;
+
+  // First tick whose slot has not been visited yet
+  int64_t next_tick_;
+  size_t size_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_TIMINGWHEEL_H
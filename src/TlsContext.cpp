@@ -0,0 +1,158 @@
+#include "TlsContext.h"
+
+#include <cassert>
+#include <utility>
+
+#include <glog/logging.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+namespace organicdump
+{
+
+void LogSslErrors(const char *what)
+{
+  LOG(ERROR) << what;
+
+  unsigned long error;
+  while ((error = ERR_get_error()) != 0)
+  {
+    char buffer[256];
+    ERR_error_string_n(error, buffer, sizeof(buffer));
+    LOG(ERROR) << "  " << buffer;
+  }
+}
+
+bool TlsContext::Create(
+    const std::string &cert_file,
+    const std::string &key_file,
+    const std::string &ca_file,
+    TlsContext *out_context)
+{
+  return CreateWithMethod(TLS_server_method(), cert_file, key_file, ca_file, out_context);
+}
+
+bool TlsContext::CreateClient(
+    const std::string &cert_file,
+    const std::string &key_file,
+    const std::string &ca_file,
+    TlsContext *out_context)
+{
+  return CreateWithMethod(TLS_client_method(), cert_file, key_file, ca_file, out_context);
+}
+
+bool TlsContext::CreateWithMethod(
+    const SSL_METHOD *method,
+    const std::string &cert_file,
+    const std::string &key_file,
+    const std::string &ca_file,
+    TlsContext *out_context)
+{
+  assert(method);
+  assert(out_context);
+
+  SSL_CTX *ctx = SSL_CTX_new(method);
+  if (!ctx)
+  {
+    LogSslErrors("Failed to create SSL_CTX");
+    return false;
+  }
+
+  // Move semantics keep the context alive if creation fails part way through
+  TlsContext context{ctx};
+
+  if (SSL_CTX_use_certificate_file(ctx, cert_file.c_str(), SSL_FILETYPE_PEM) != 1)
+  {
+    LogSslErrors("Failed to load certificate file");
+    return false;
+  }
+
+  if (SSL_CTX_use_PrivateKey_file(ctx, key_file.c_str(), SSL_FILETYPE_PEM) != 1)
+  {
+    LogSslErrors("Failed to load private key file");
+    return false;
+  }
+
+  if (SSL_CTX_check_private_key(ctx) != 1)
+  {
+    LogSslErrors("Private key does not match certificate");
+    return false;
+  }
+
+  if (SSL_CTX_load_verify_locations(ctx, ca_file.c_str(), nullptr) != 1)
+  {
+    LogSslErrors("Failed to load CA file");
+    return false;
+  }
+
+  SSL_CTX_set_verify(
+      ctx,
+      SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
+      nullptr);
+
+  // Outbound queues are flushed incrementally from a buffer that may grow
+  // (and move) between retries of the same SSL_write().
+  SSL_CTX_set_mode(
+      ctx,
+      SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+  *out_context = std::move(context);
+  return true;
+}
+
+TlsContext::TlsContext() : is_initialized_{false}, ctx_{nullptr} {}
+
+TlsContext::TlsContext(SSL_CTX *ctx)
+  : is_initialized_{true},
+    ctx_{ctx} {}
+
+TlsContext::TlsContext(TlsContext &&other)
+  : is_initialized_{false},
+    ctx_{nullptr}
+{
+  StealResources(&other);
+}
+
+TlsContext &TlsContext::operator=(TlsContext &&other)
+{
+  if (this != &other)
+  {
+    CloseResources();
+    StealResources(&other);
+  }
+  return *this;
+}
+
+TlsContext::~TlsContext()
+{
+  CloseResources();
+}
+
+SSL_CTX *TlsContext::Get() const
+{
+  assert(is_initialized_);
+  return ctx_;
+}
+
+void TlsContext::CloseResources()
+{
+  if (!is_initialized_)
+  {
+    return;
+  }
+
+  is_initialized_ = false;
+  SSL_CTX_free(ctx_);
+  ctx_ = nullptr;
+}
+
+void TlsContext::StealResources(TlsContext *other)
+{
+  assert(other);
+  is_initialized_ = other->is_initialized_;
+  other->is_initialized_ = false;
+  ctx_ = other->ctx_;
+  other->ctx_ = nullptr;
+}
+
+} // namespace organicdump
@@ -0,0 +1,67 @@
+#ifndef ORGANICDUMP_SERVER_TLSCONTEXT_H
+#define ORGANICDUMP_SERVER_TLSCONTEXT_H
+
+#include <string>
+
+#include <openssl/ssl.h>
+
+namespace organicdump
+{
+
+/**
+ * Logs |what| followed by, and clears, the calling thread's OpenSSL error queue.
+ */
+void LogSslErrors(const char *what);
+
+/**
+ * Owns an SSL_CTX. Peers must present a certificate signed by the configured
+ * CA. A single context is shared by every reactor thread; OpenSSL allows
+ * concurrent SSL_new() calls against one SSL_CTX.
+ */
+class TlsContext
+{
+public:
+  static bool Create(
+      const std::string &cert_file,
+      const std::string &key_file,
+      const std::string &ca_file,
+      TlsContext *out_context);
+
+  /** Context for connecting to the server, as the load generator does. */
+  static bool CreateClient(
+      const std::string &cert_file,
+      const std::string &key_file,
+      const std::string &ca_file,
+      TlsContext *out_context);
+
+public:
+  TlsContext();
+  TlsContext(SSL_CTX *ctx);
+  TlsContext(TlsContext &&other);
+  TlsContext &operator=(TlsContext &&other);
+  ~TlsContext();
+
+  SSL_CTX *Get() const;
+
+private:
+  static bool CreateWithMethod(
+      const SSL_METHOD *method,
+      const std::string &cert_file,
+      const std::string &key_file,
+      const std::string &ca_file,
+      TlsContext *out_context);
+  void CloseResources();
+  void StealResources(TlsContext *other);
+
+private:
+  TlsContext(const TlsContext &other) = delete;
+  TlsContext &operator=(const TlsContext &other) = delete;
+
+private:
+  bool is_initialized_;
+  SSL_CTX *ctx_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_TLSCONTEXT_H
@@ -0,0 +1,213 @@
+#include "TlsListener.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#include <glog/logging.h>
+#include <openssl/ssl.h>
+
+namespace
+{
+constexpr int LISTEN_BACKLOG = SOMAXCONN;
+} // namespace
+
+namespace organicdump
+{
+
+bool TlsListener::Create(
+    int32_t port,
+    bool reuse_port,
+    std::shared_ptr<TlsContext> context,
+    TlsListener *out_listener)
+{
+  assert(context);
+  assert(out_listener);
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+  {
+    LOG(ERROR) << "Failed to create listening socket: " << strerror(errno);
+    return false;
+  }
+
+  TlsListener listener{fd, std::move(context)};
+
+  int enable = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1)
+  {
+    LOG(ERROR) << "Failed to set SO_REUSEADDR: " << strerror(errno);
+    return false;
+  }
+
+  if (reuse_port &&
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1)
+  {
+    LOG(ERROR) << "Failed to set SO_REUSEPORT: " << strerror(errno);
+    return false;
+  }
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(static_cast<uint16_t>(port));
+
+  if (bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) == -1)
+  {
+    LOG(ERROR) << "Failed to bind port " << port << ": " << strerror(errno);
+    return false;
+  }
+
+  if (listen(fd, LISTEN_BACKLOG) == -1)
+  {
+    LOG(ERROR) << "Failed to listen on port " << port << ": " << strerror(errno);
+    return false;
+  }
+
+  *out_listener = std::move(listener);
+  return true;
+}
+
+TlsListener::TlsListener() : is_initialized_{false}, fd_{-1} {}
+
+TlsListener::TlsListener(int fd, std::shared_ptr<TlsContext> context)
+  : is_initialized_{true},
+    fd_{fd},
+    context_{std::move(context)} {}
+
+TlsListener::TlsListener(TlsListener &&other)
+  : is_initialized_{false},
+    fd_{-1}
+{
+  StealResources(&other);
+}
+
+TlsListener &TlsListener::operator=(TlsListener &&other)
+{
+  if (this != &other)
+  {
+    CloseResources();
+    StealResources(&other);
+  }
+  return *this;
+}
+
+TlsListener::~TlsListener()
+{
+  CloseResources();
+}
+
+int TlsListener::GetFd() const
+{
+  return fd_;
+}
+
+bool TlsListener::Accept(
+    const AdmissionCheck &admit,
+    TlsStream *out_stream,
+    bool *out_would_block,
+    bool *out_rejected,
+    bool *out_fds_exhausted)
+{
+  assert(is_initialized_);
+  assert(out_stream);
+  assert(out_would_block);
+  assert(out_rejected);
+  assert(out_fds_exhausted);
+
+  *out_would_block = false;
+  *out_rejected = false;
+  *out_fds_exhausted = false;
+
+  struct sockaddr_in peer;
+  socklen_t peer_size = sizeof(peer);
+  memset(&peer, 0, sizeof(peer));
+
+  int fd = accept4(
+      fd_,
+      reinterpret_cast<struct sockaddr *>(&peer),
+      &peer_size,
+      SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd == -1)
+  {
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+      *out_would_block = true;
+      return false;
+    }
+
+    if (errno == EMFILE || errno == ENFILE)
+    {
+      *out_fds_exhausted = true;
+      return false;
+    }
+
+    LOG(ERROR) << "Failed to accept connection: " << strerror(errno);
+    return false;
+  }
+
+  if (admit && !admit(peer))
+  {
+    // Reset rather than close gracefully so that shedding load doesn't
+    // leave sockets in TIME_WAIT.
+    struct linger reset{1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    close(fd);
+    *out_rejected = true;
+    return false;
+  }
+
+  SSL *ssl = SSL_new(context_->Get());
+  if (!ssl)
+  {
+    LogSslErrors("Failed to create SSL session");
+    close(fd);
+    return false;
+  }
+
+  // The stream now owns both the socket and the session
+  TlsStream stream{fd, ssl};
+
+  if (SSL_set_fd(ssl, fd) != 1)
+  {
+    LogSslErrors("Failed to attach socket to SSL session");
+    return false;
+  }
+
+  SSL_set_accept_state(ssl);
+
+  *out_stream = std::move(stream);
+  return true;
+}
+
+void TlsListener::CloseResources()
+{
+  if (!is_initialized_)
+  {
+    return;
+  }
+
+  is_initialized_ = false;
+  close(fd_);
+  fd_ = -1;
+  context_.reset();
+}
+
+void TlsListener::StealResources(TlsListener *other)
+{
+  assert(other);
+  is_initialized_ = other->is_initialized_;
+  other->is_initialized_ = false;
+  fd_ = other->fd_;
+  other->fd_ = -1;
+  context_ = std::move(other->context_);
+}
+
+} // namespace organicdump
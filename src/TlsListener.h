@@ -0,0 +1,81 @@
+#ifndef ORGANICDUMP_SERVER_TLSLISTENER_H
+#define ORGANICDUMP_SERVER_TLSLISTENER_H
+
+#include <netinet/in.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "TlsContext.h"
+#include "TlsStream.h"
+
+namespace organicdump
+{
+
+/**
+ * Non-blocking listening TCP socket that hands out TLS streams. With
+ * |reuse_port| set, several listeners (one per reactor thread) may bind the
+ * same port and the kernel load-balances incoming connections between them.
+ */
+class TlsListener
+{
+public:
+  /**
+   * Decides from the peer's address alone whether a freshly accepted socket
+   * is worth a TLS session.
+   */
+  using AdmissionCheck = std::function<bool(const struct sockaddr_in &peer)>;
+
+public:
+  static bool Create(
+      int32_t port,
+      bool reuse_port,
+      std::shared_ptr<TlsContext> context,
+      TlsListener *out_listener);
+
+public:
+  TlsListener();
+  TlsListener(int fd, std::shared_ptr<TlsContext> context);
+  TlsListener(TlsListener &&other);
+  TlsListener &operator=(TlsListener &&other);
+  ~TlsListener();
+
+  int GetFd() const;
+
+  /**
+   * Accepts a connection without running the TLS handshake. The returned
+   * stream is non-blocking; drive it with TlsStream::Handshake(). Sets
+   * |out_would_block| when the accept queue is empty.
+   *
+   * Sets |out_fds_exhausted| when the process or system has run out of file
+   * descriptors. The connection stays queued and the listener stays readable,
+   * so callers should stop accepting for a while rather than retry at once.
+   *
+   * Connections that fail |admit| are reset before any TLS state is
+   * allocated and reported through |out_rejected|.
+   */
+  bool Accept(
+      const AdmissionCheck &admit,
+      TlsStream *out_stream,
+      bool *out_would_block,
+      bool *out_rejected,
+      bool *out_fds_exhausted);
+
+private:
+  void CloseResources();
+  void StealResources(TlsListener *other);
+
+private:
+  TlsListener(const TlsListener &other) = delete;
+  TlsListener &operator=(const TlsListener &other) = delete;
+
+private:
+  bool is_initialized_;
+  int fd_;
+  std::shared_ptr<TlsContext> context_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_TLSLISTENER_H
@@ -0,0 +1,173 @@
+#include "TlsStream.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <utility>
+
+#include <glog/logging.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "TlsContext.h"
+
+namespace organicdump
+{
+
+const char *ToString(TlsIoStatus status)
+{
+  switch (status)
+  {
+    case TlsIoStatus::COMPLETE:
+      return "COMPLETE";
+    case TlsIoStatus::WANT_READ:
+      return "WANT_READ";
+    case TlsIoStatus::WANT_WRITE:
+      return "WANT_WRITE";
+    case TlsIoStatus::CLOSED:
+      return "CLOSED";
+    case TlsIoStatus::FAILURE:
+      return "FAILURE";
+    default:
+      return "<UNKNOWN>";
+  }
+}
+
+TlsStream::TlsStream() : is_initialized_{false}, fd_{-1}, ssl_{nullptr} {}
+
+TlsStream::TlsStream(int fd, SSL *ssl)
+  : is_initialized_{true},
+    fd_{fd},
+    ssl_{ssl} {}
+
+TlsStream::TlsStream(TlsStream &&other)
+  : is_initialized_{false},
+    fd_{-1},
+    ssl_{nullptr}
+{
+  StealResources(&other);
+}
+
+TlsStream &TlsStream::operator=(TlsStream &&other)
+{
+  if (this != &other)
+  {
+    CloseResources();
+    StealResources(&other);
+  }
+  return *this;
+}
+
+TlsStream::~TlsStream()
+{
+  CloseResources();
+}
+
+int TlsStream::GetFd() const
+{
+  return fd_;
+}
+
+TlsIoStatus TlsStream::Handshake()
+{
+  assert(is_initialized_);
+
+  int result = SSL_do_handshake(ssl_);
+  if (result == 1)
+  {
+    return TlsIoStatus::COMPLETE;
+  }
+
+  return ToStatus(result);
+}
+
+TlsIoStatus TlsStream::Read(uint8_t *buffer, size_t size, size_t *out_read)
+{
+  assert(is_initialized_);
+  assert(buffer);
+  assert(out_read);
+
+  *out_read = 0;
+  int result = SSL_read(ssl_, buffer, static_cast<int>(std::min<size_t>(size, INT_MAX)));
+  if (result > 0)
+  {
+    *out_read = static_cast<size_t>(result);
+    return TlsIoStatus::COMPLETE;
+  }
+
+  return ToStatus(result);
+}
+
+TlsIoStatus TlsStream::Write(const uint8_t *buffer, size_t size, size_t *out_written)
+{
+  assert(is_initialized_);
+  assert(buffer);
+  assert(out_written);
+
+  *out_written = 0;
+  int result = SSL_write(ssl_, buffer, static_cast<int>(std::min<size_t>(size, INT_MAX)));
+  if (result > 0)
+  {
+    *out_written = static_cast<size_t>(result);
+    return TlsIoStatus::COMPLETE;
+  }
+
+  return ToStatus(result);
+}
+
+TlsIoStatus TlsStream::ToStatus(int result)
+{
+  int error = SSL_get_error(ssl_, result);
+  switch (error)
+  {
+    case SSL_ERROR_WANT_READ:
+      return TlsIoStatus::WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+      return TlsIoStatus::WANT_WRITE;
+    case SSL_ERROR_ZERO_RETURN:
+      return TlsIoStatus::CLOSED;
+    case SSL_ERROR_SYSCALL:
+      if (errno == 0 || errno == ECONNRESET || errno == EPIPE)
+      {
+        ERR_clear_error();
+        return TlsIoStatus::CLOSED;
+      }
+      LOG(ERROR) << "TLS syscall failure on fd " << fd_ << ": " << strerror(errno);
+      ERR_clear_error();
+      return TlsIoStatus::FAILURE;
+    default:
+      LogSslErrors("TLS failure");
+      return TlsIoStatus::FAILURE;
+  }
+}
+
+void TlsStream::CloseResources()
+{
+  if (!is_initialized_)
+  {
+    return;
+  }
+
+  is_initialized_ = false;
+  SSL_free(ssl_);
+  ssl_ = nullptr;
+  close(fd_);
+  fd_ = -1;
+}
+
+void TlsStream::StealResources(TlsStream *other)
+{
+  assert(other);
+  is_initialized_ = other->is_initialized_;
+  other->is_initialized_ = false;
+  fd_ = other->fd_;
+  other->fd_ = -1;
+  ssl_ = other->ssl_;
+  other->ssl_ = nullptr;
+}
+
+} // namespace organicdump
@@ -0,0 +1,64 @@
+#ifndef ORGANICDUMP_SERVER_TLSSTREAM_H
+#define ORGANICDUMP_SERVER_TLSSTREAM_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <openssl/ssl.h>
+
+namespace organicdump
+{
+
+enum class TlsIoStatus
+{
+  COMPLETE,
+  WANT_READ,
+  WANT_WRITE,
+  CLOSED,
+  FAILURE,
+};
+
+const char *ToString(TlsIoStatus status);
+
+/**
+ * A connected socket and the SSL session running over it. Owns both and
+ * releases them together.
+ */
+class TlsStream
+{
+public:
+  TlsStream();
+  TlsStream(int fd, SSL *ssl);
+  TlsStream(TlsStream &&other);
+  TlsStream &operator=(TlsStream &&other);
+  ~TlsStream();
+
+  int GetFd() const;
+
+  /**
+   * Advances the handshake as far as the socket allows, as whichever side
+   * the SSL session was set up for. Returns WANT_READ/WANT_WRITE until the
+   * handshake completes.
+   */
+  TlsIoStatus Handshake();
+  TlsIoStatus Read(uint8_t *buffer, size_t size, size_t *out_read);
+  TlsIoStatus Write(const uint8_t *buffer, size_t size, size_t *out_written);
+
+private:
+  TlsIoStatus ToStatus(int result);
+  void CloseResources();
+  void StealResources(TlsStream *other);
+
+private:
+  TlsStream(const TlsStream &other) = delete;
+  TlsStream &operator=(const TlsStream &other) = delete;
+
+private:
+  bool is_initialized_;
+  int fd_;
+  SSL *ssl_;
+};
+
+} // namespace organicdump
+
+#endif // ORGANICDUMP_SERVER_TLSSTREAM_H
@@ -1,8 +1,9 @@
 #include "UndifferentiatedClientHandler.h"
 
 #include <memory>
-#include <unordered_map>
 
+#include "ClientStore.h"
+#include "HotLog.h"
 #include "ProtobufClient.h"
 #include "OrganicDumpProtoMessage.h"
 
@@ -21,7 +22,7 @@ UndifferentiatedClientHandler::~UndifferentiatedClientHandler() {}
 bool UndifferentiatedClientHandler::Handle(
     const OrganicDumpProtoMessage &msg,
     ProtobufClient *client,
-    std::unordered_map<int, ProtobufClient> *clients)
+    ClientStore *clients)
 {
   assert(client);
   assert(clients);
@@ -35,10 +36,10 @@ bool UndifferentiatedClientHandler::Handle(
 
   const Hello &hello = msg.hello;
 
-  LOG(INFO) << "Received Hello from client w/type: " << ToString(hello.type())
-            << " and ID: " << hello.client_id();
+  HOT_LOG(INFO) << "Received Hello from client w/type: " << ToString(hello.type())
+                << " and ID: " << hello.client_id();
 
-  client->Differentiate(hello.type(), hello.client_id());
+  clients->Differentiate(client, hello.type(), hello.client_id());
   return true;
 }
 
@@ -2,9 +2,9 @@
 #define ORGANICDUMP_SERVER_UNDIFFERENTIATEDCLIENTHANDLER_H
 
 #include <memory>
-#include <unordered_map>
 
 #include "ClientHandler.h"
+#include "ClientStore.h"
 #include "ProtobufClient.h"
 #include "OrganicDumpProtoMessage.h"
 
@@ -18,7 +18,7 @@ public:
   bool Handle(
       const OrganicDumpProtoMessage &msg,
       ProtobufClient *client,
-      std::unordered_map<int, ProtobufClient> *clients);
+      ClientStore *clients);
 };
 
 } // namespace organicdump
@@ -1,19 +1,27 @@
+#include <signal.h>
+#include <sys/resource.h>
+
 #include <cassert>
 #include <cstdlib>
 #include <iostream>
 #include <memory>
+#include <string>
 #include <utility>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
 #include "CliConfig.h"
-#include "Server.h"
+#include "HotLog.h"
+#include "MetricsServer.h"
+#include "ReactorPool.h"
 
 namespace
 {
 using organicdump::CliConfig;
-using organicdump::Server;
+using organicdump::HotLog;
+using organicdump::MetricsServer;
+using organicdump::ReactorPool;
 
 void InitLibraries(const char *app_name)
 {
@@ -22,7 +30,31 @@ void InitLibraries(const char *app_name)
   SSL_library_init();
   OpenSSL_add_all_algorithms();
   SSL_load_error_strings();
-  ERR_load_BIO_strings();
+
+  // OpenSSL writes through plain write(), so a client that disconnects while
+  // a response is queued must surface as a failed write, not kill the server
+  signal(SIGPIPE, SIG_IGN);
+}
+
+void RaiseFdLimit()
+{
+  // Every connected RPi holds a socket open, so lift the soft fd limit to the
+  // hard limit rather than stalling at the usual default of 1024.
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+  {
+    LOG(ERROR) << "Failed to query RLIMIT_NOFILE";
+    return;
+  }
+
+  limit.rlim_cur = limit.rlim_max;
+  if (setrlimit(RLIMIT_NOFILE, &limit) != 0)
+  {
+    LOG(ERROR) << "Failed to raise RLIMIT_NOFILE to " << limit.rlim_max;
+    return;
+  }
+
+  LOG(INFO) << "Fd limit: " << limit.rlim_cur;
 }
 
 } // anonymous namespace
@@ -37,27 +69,53 @@ int main(int argc, char **argv)
   }
 
   InitLibraries(argv[0]);
+  HotLog::Start();
+  RaiseFdLimit();
 
   LOG(INFO) << "Port: " << config.GetPort();
   LOG(INFO) << "Cert: " << config.GetCertFile();
   LOG(INFO) << "Key: " << config.GetKeyFile();
   LOG(INFO) << "Ca: " << config.GetCaFile();
+  LOG(INFO) << "Reactor threads: " << config.GetReactorThreads();
+  LOG(INFO) << "Handshake timeout (ms): " << config.GetHandshakeTimeout().count();
+  LOG(INFO) << "Idle timeout (ms): " << config.GetIdleTimeout().count();
+  LOG(INFO) << "HELLO timeout (ms): " << config.GetHelloTimeout().count();
+  LOG(INFO) << "Max pending connections per reactor: " << config.GetMaxPendingConnections();
+  LOG(INFO) << "Accept rate per IP (/s): " << config.GetAcceptRatePerIp()
+            << ", burst: " << config.GetAcceptBurstPerIp();
+  LOG(INFO) << "Db: " << config.GetDbUrl() << "/" << config.GetDbName();
+  LOG(INFO) << "Db threads: " << config.GetDbThreads();
+  LOG(INFO) << "Db sessions: " << config.GetDbPoolMinSessions() << "-"
+            << config.GetDbPoolMaxSessions();
+  LOG(INFO) << "Measurement log: "
+            << (config.GetMeasurementWalDir().empty() ? "disabled" : config.GetMeasurementWalDir());
+  LOG(INFO) << "History readings per sensor: " << config.GetHistoryReadingsPerSensor();
+  LOG(INFO) << "Rollup interval (ms): " << config.GetRollupInterval().count();
+  LOG(INFO) << "Raw retention (days): " << config.GetRawRetention().count() / 24;
+  LOG(INFO) << "Metrics port: "
+            << (config.GetMetricsPort() == 0 ? "disabled" : std::to_string(config.GetMetricsPort()));
+
+  MetricsServer metrics_server;
+  if (config.GetMetricsPort() != 0 &&
+      !MetricsServer::Create(config.GetMetricsPort(), &metrics_server)) {
+    LOG(ERROR) << "Failed to start metrics server";
+    HotLog::Stop();
+    return EXIT_FAILURE;
+  }
 
-  Server server;
-  if (!Server::Create(
-        config.GetPort(),
-        config.GetCertFile(),
-        config.GetKeyFile(),
-        config.GetCaFile(),
-        &server)) {
+  ReactorPool server;
+  if (!ReactorPool::Create(config, &server)) {
     LOG(ERROR) << "Failed to initialize organic dump server";
+    HotLog::Stop();
     return EXIT_FAILURE;
   }
 
   if (!server.Run()) {
     LOG(ERROR) << "Failed to run organic dump server";
+    HotLog::Stop();
     return EXIT_FAILURE;
   }
 
+  HotLog::Stop();
   return EXIT_SUCCESS;
 }
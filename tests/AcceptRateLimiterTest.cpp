@@ -0,0 +1,94 @@
+#include "AcceptRateLimiter.h"
+
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace
+{
+using organicdump::AcceptRateLimiter;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+TEST(AcceptRateLimiterTest, AdmitsABurstThenTheRate)
+{
+  AcceptRateLimiter limiter{10, 20, 16};
+  AcceptRateLimiter::Clock::time_point now = AcceptRateLimiter::Clock::now();
+
+  int admitted = 0;
+  for (int i = 0; i < 30; ++i)
+  {
+    admitted += limiter.Admit(1, now);
+  }
+  EXPECT_EQ(admitted, 20);
+
+  // One token refills every 100ms
+  EXPECT_FALSE(limiter.Admit(1, now + milliseconds{50}));
+  EXPECT_TRUE(limiter.Admit(1, now + milliseconds{150}));
+
+  // Other addresses have buckets of their own
+  EXPECT_TRUE(limiter.Admit(2, now));
+}
+
+TEST(AcceptRateLimiterTest, RefusesNewAddressesWhileTheTableIsFull)
+{
+  AcceptRateLimiter limiter{10, 20, 2};
+  AcceptRateLimiter::Clock::time_point now = AcceptRateLimiter::Clock::now();
+
+  EXPECT_TRUE(limiter.Admit(1, now));
+  EXPECT_TRUE(limiter.Admit(2, now));
+  EXPECT_FALSE(limiter.Admit(3, now));
+  EXPECT_FALSE(limiter.Admit(3, now + milliseconds{50}));
+
+  // Refilled buckets are forgotten, which makes room again
+  EXPECT_TRUE(limiter.Admit(3, now + seconds{5}));
+}
+
+TEST(AcceptRateLimiterTest, AdmitsEverythingWithoutARate)
+{
+  AcceptRateLimiter limiter;
+  AcceptRateLimiter::Clock::time_point now = AcceptRateLimiter::Clock::now();
+
+  for (uint32_t address = 0; address < 100; ++address)
+  {
+    EXPECT_TRUE(limiter.Admit(address, now));
+    EXPECT_TRUE(limiter.Admit(address, now));
+  }
+}
+
+TEST(AcceptRateLimiterTest, SharesBucketsAcrossThreads)
+{
+  constexpr int THREAD_COUNT = 4;
+  constexpr int ATTEMPTS_PER_THREAD = 100;
+
+  AcceptRateLimiter limiter{1, 50, 16};
+  AcceptRateLimiter::Clock::time_point now = AcceptRateLimiter::Clock::now();
+
+  std::vector<int> admitted(THREAD_COUNT, 0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREAD_COUNT; ++t)
+  {
+    threads.emplace_back([&limiter, &admitted, now, t]()
+    {
+      for (int i = 0; i < ATTEMPTS_PER_THREAD; ++i)
+      {
+        admitted[t] += limiter.Admit(1, now);
+      }
+    });
+  }
+
+  int total = 0;
+  for (int t = 0; t < THREAD_COUNT; ++t)
+  {
+    threads[t].join();
+    total += admitted[t];
+  }
+
+  // However the attempts are spread, the address gets one burst
+  EXPECT_EQ(total, 50);
+}
+
+} // namespace
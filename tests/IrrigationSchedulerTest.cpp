@@ -0,0 +1,320 @@
+#include "IrrigationScheduler.h"
+
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "ClientDirectory.h"
+#include "ClientStore.h"
+#include "CompletionQueue.h"
+#include "DbManager.h"
+#include "EventNotifier.h"
+#include "OrganicDumpProtoMessage.h"
+#include "ProtobufClient.h"
+#include "ProtobufFraming.h"
+#include "TlsStream.h"
+
+namespace
+{
+using organicdump::ClientDirectory;
+using organicdump::ClientStore;
+using organicdump::CompletionQueue;
+using organicdump::DailyIrrigationSchedule;
+using organicdump::EncodeFrame;
+using organicdump::EventNotifier;
+using organicdump::IrrigationScheduler;
+using organicdump::OrganicDumpProtoMessage;
+using organicdump::ProtobufClient;
+using organicdump::TlsStream;
+using organicdump_proto::ClientType;
+using organicdump_proto::UnscheduledIrrigationRequest;
+using Clock = IrrigationScheduler::Clock;
+
+constexpr int64_t MINUTE_MS = 60 * 1000;
+constexpr int64_t WEEK_MS = 7 * 24 * 60 * MINUTE_MS;
+
+// Slack for the time that passes between computing an expectation and
+// reading the timeout
+constexpr int64_t SLACK_MS = 5000;
+
+int64_t NowMs()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/** The schedule of |irrigation_system_id| for the local minute holding |time_ms|. */
+DailyIrrigationSchedule MakeScheduleAt(size_t irrigation_system_id, int64_t time_ms)
+{
+  time_t time = static_cast<time_t>(time_ms / 1000);
+  struct tm local;
+  localtime_r(&time, &local);
+
+  char military[8];
+  std::snprintf(military, sizeof(military), "%02d%02d", local.tm_hour, local.tm_min);
+  return DailyIrrigationSchedule{
+      irrigation_system_id,
+      static_cast<size_t>(local.tm_wday),
+      military,
+      1000};
+}
+
+Clock::time_point AtMs(int64_t time_ms)
+{
+  return Clock::time_point{std::chrono::milliseconds{time_ms}};
+}
+
+/** Start of the minute after the one holding |time_ms|. */
+int64_t GetNextMinuteMs(int64_t time_ms)
+{
+  return time_ms - time_ms % MINUTE_MS + MINUTE_MS;
+}
+
+bool IsReadable(int fd)
+{
+  struct pollfd entry{fd, POLLIN, 0};
+  return poll(&entry, 1, 0) == 1;
+}
+
+class IrrigationSchedulerTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    const char *tz = getenv("TZ");
+    had_tz_ = tz != nullptr;
+    tz_ = had_tz_ ? tz : "";
+
+    // Keeps DST shifts out of the expected times
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    directory_ = std::make_shared<ClientDirectory>();
+    completions_ = MakeWakeup();
+    clients_ = std::make_unique<ClientStore>(directory_, completions_);
+    scheduler_ = std::make_unique<IrrigationScheduler>(directory_);
+  }
+
+  void TearDown() override
+  {
+    scheduler_.reset();
+    clients_.reset();
+
+    if (had_tz_)
+    {
+      setenv("TZ", tz_.c_str(), 1);
+    }
+    else
+    {
+      unsetenv("TZ");
+    }
+
+    tzset();
+  }
+
+  /**
+   * Adds a connected irrigation system to |clients_|, which publishes it to
+   * the scheduler's directory. The socket is never read or written, since
+   * queued commands stay in the client's outbound buffer until flushed.
+   */
+  ProtobufClient *ConnectIrrigationSystem(size_t irrigation_system_id)
+  {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    EXPECT_GE(fd, 0);
+
+    ProtobufClient *client = clients_->Add(
+        fd,
+        ProtobufClient{TlsStream{fd, nullptr}, next_serial_++, &flush_queue_});
+    clients_->Differentiate(client, ClientType::IRRIGATION_SYSTEM, irrigation_system_id);
+    return client;
+  }
+
+  static size_t GetFrameSize(size_t irrigation_system_id, uint32_t duration_ms)
+  {
+    UnscheduledIrrigationRequest request;
+    request.set_irrigation_system_id(irrigation_system_id);
+    request.set_duration_ms(duration_ms);
+
+    std::string frame;
+    EXPECT_TRUE(EncodeFrame(OrganicDumpProtoMessage{request}, &frame));
+    return frame.size();
+  }
+
+  std::shared_ptr<CompletionQueue> MakeWakeup()
+  {
+    EventNotifier notifier;
+    EXPECT_TRUE(EventNotifier::Create(&notifier));
+    return std::make_shared<CompletionQueue>(std::move(notifier));
+  }
+
+protected:
+  bool had_tz_;
+  std::string tz_;
+
+  std::shared_ptr<ClientDirectory> directory_;
+
+  // The reactor that holds the irrigation systems
+  std::shared_ptr<CompletionQueue> completions_;
+  std::vector<int> flush_queue_;
+  std::unique_ptr<ClientStore> clients_;
+  uint64_t next_serial_{1};
+
+  std::unique_ptr<IrrigationScheduler> scheduler_;
+};
+
+TEST_F(IrrigationSchedulerTest, ValidatesDayAndTime)
+{
+  EXPECT_TRUE(IrrigationScheduler::IsValid({1, 0, "0630", 1000}));
+  EXPECT_TRUE(IrrigationScheduler::IsValid({1, 6, "2359", 1000}));
+  EXPECT_TRUE(IrrigationScheduler::IsValid({1, 3, "630", 1000}));
+  EXPECT_TRUE(IrrigationScheduler::IsValid({1, 3, "06:30", 1000}));
+  EXPECT_FALSE(IrrigationScheduler::IsValid({1, 7, "0630", 1000}));
+  EXPECT_FALSE(IrrigationScheduler::IsValid({1, 0, "2400", 1000}));
+  EXPECT_FALSE(IrrigationScheduler::IsValid({1, 0, "0660", 1000}));
+  EXPECT_FALSE(IrrigationScheduler::IsValid({1, 0, "06", 1000}));
+  EXPECT_FALSE(IrrigationScheduler::IsValid({1, 0, "06h30", 1000}));
+}
+
+TEST_F(IrrigationSchedulerTest, HasNoTimeoutWithoutSchedules)
+{
+  EXPECT_EQ(scheduler_->GetTimeoutMs(Clock::now()), -1);
+
+  scheduler_->Load({{1, 7, "0630", 1000}, {1, 0, "abcd", 1000}});
+  EXPECT_EQ(scheduler_->GetTimeoutMs(Clock::now()), -1);
+}
+
+TEST_F(IrrigationSchedulerTest, TimesOutAtNextScheduledMinute)
+{
+  int64_t now_ms = NowMs();
+  int64_t fire_ms = now_ms + 5 * MINUTE_MS;
+  fire_ms -= fire_ms % MINUTE_MS;
+
+  scheduler_->Load({MakeScheduleAt(1, fire_ms)});
+
+  int timeout_ms = scheduler_->GetTimeoutMs(Clock::now());
+  EXPECT_LE(timeout_ms, fire_ms - now_ms);
+  EXPECT_GE(timeout_ms, fire_ms - now_ms - SLACK_MS);
+}
+
+TEST_F(IrrigationSchedulerTest, SchedulesMissedTodayForNextWeek)
+{
+  int64_t now_ms = NowMs();
+  int64_t missed_ms = now_ms - 2 * MINUTE_MS;
+  missed_ms -= missed_ms % MINUTE_MS;
+
+  scheduler_->Load({MakeScheduleAt(1, missed_ms)});
+
+  int timeout_ms = scheduler_->GetTimeoutMs(Clock::now());
+  EXPECT_LE(timeout_ms, missed_ms + WEEK_MS - now_ms);
+  EXPECT_GE(timeout_ms, missed_ms + WEEK_MS - now_ms - SLACK_MS);
+}
+
+TEST_F(IrrigationSchedulerTest, ReplacingWithSoonerScheduleLowersTimeout)
+{
+  int64_t now_ms = NowMs();
+  scheduler_->Load({MakeScheduleAt(1, now_ms + 3 * 24 * 60 * MINUTE_MS)});
+  int far_timeout_ms = scheduler_->GetTimeoutMs(Clock::now());
+
+  scheduler_->Replace(1, {MakeScheduleAt(1, now_ms + 10 * MINUTE_MS)});
+  int near_timeout_ms = scheduler_->GetTimeoutMs(Clock::now());
+
+  EXPECT_LT(near_timeout_ms, far_timeout_ms);
+  EXPECT_LE(near_timeout_ms, 10 * MINUTE_MS);
+}
+
+TEST_F(IrrigationSchedulerTest, WakesReactorOnlyWhenATimerIsDueSooner)
+{
+  std::shared_ptr<CompletionQueue> wakeup = MakeWakeup();
+  scheduler_->SetWakeup(wakeup);
+
+  int64_t now_ms = NowMs();
+  scheduler_->Load({MakeScheduleAt(1, now_ms + 60 * MINUTE_MS)});
+  EXPECT_TRUE(IsReadable(wakeup->GetFd()));
+  wakeup->RunAll();
+
+  scheduler_->Load({MakeScheduleAt(2, now_ms + 120 * MINUTE_MS)});
+  EXPECT_FALSE(IsReadable(wakeup->GetFd()));
+
+  scheduler_->Load({MakeScheduleAt(3, now_ms + 30 * MINUTE_MS)});
+  EXPECT_TRUE(IsReadable(wakeup->GetFd()));
+}
+
+TEST_F(IrrigationSchedulerTest, RunDueLeavesTimersThatAreNotDue)
+{
+  int64_t now_ms = NowMs();
+  scheduler_->Load({MakeScheduleAt(1, now_ms + 10 * MINUTE_MS)});
+  int timeout_ms = scheduler_->GetTimeoutMs(Clock::now());
+
+  scheduler_->RunDue(Clock::now());
+
+  EXPECT_GT(scheduler_->GetTimeoutMs(Clock::now()), 0);
+  EXPECT_LE(scheduler_->GetTimeoutMs(Clock::now()), timeout_ms);
+}
+
+TEST_F(IrrigationSchedulerTest, RunDueFiresDueTimerAndRearmsItForNextWeek)
+{
+  int64_t fire_ms = GetNextMinuteMs(NowMs());
+  scheduler_->Load({MakeScheduleAt(1, fire_ms)});
+  ProtobufClient *device = ConnectIrrigationSystem(1);
+
+  // Runs at the scheduled minute, as the reactor would once it wakes
+  scheduler_->RunDue(AtMs(fire_ms));
+  ASSERT_TRUE(IsReadable(completions_->GetFd()));
+  completions_->RunAll();
+
+  EXPECT_EQ(device->GetPendingWriteBytes(), GetFrameSize(1, 1000));
+  EXPECT_EQ(flush_queue_, std::vector<int>{device->GetFd()});
+  ProtobufClient::AckHandler on_ack;
+  EXPECT_TRUE(device->TakeExpectedAck(&on_ack));
+  EXPECT_FALSE(on_ack);
+
+  EXPECT_EQ(scheduler_->GetTimeoutMs(AtMs(fire_ms)), WEEK_MS);
+
+  // A late second wakeup in the same minute doesn't water again
+  scheduler_->RunDue(AtMs(fire_ms + 1000));
+  EXPECT_FALSE(IsReadable(completions_->GetFd()));
+  EXPECT_EQ(scheduler_->GetTimeoutMs(AtMs(fire_ms)), WEEK_MS);
+}
+
+TEST_F(IrrigationSchedulerTest, RunDueSkipsTimersOfReplacedSchedules)
+{
+  int64_t replaced_ms = GetNextMinuteMs(NowMs());
+  int64_t fire_ms = replaced_ms + 10 * MINUTE_MS;
+  scheduler_->Load({MakeScheduleAt(1, replaced_ms)});
+  scheduler_->Replace(1, {MakeScheduleAt(1, fire_ms)});
+  ProtobufClient *device = ConnectIrrigationSystem(1);
+
+  scheduler_->RunDue(AtMs(replaced_ms));
+  EXPECT_FALSE(IsReadable(completions_->GetFd()));
+  EXPECT_EQ(scheduler_->GetTimeoutMs(AtMs(replaced_ms)), fire_ms - replaced_ms);
+
+  scheduler_->RunDue(AtMs(fire_ms));
+  ASSERT_TRUE(IsReadable(completions_->GetFd()));
+  completions_->RunAll();
+  EXPECT_EQ(device->GetPendingWriteBytes(), GetFrameSize(1, 1000));
+  EXPECT_EQ(scheduler_->GetTimeoutMs(AtMs(fire_ms)), WEEK_MS);
+}
+
+TEST_F(IrrigationSchedulerTest, RunDueSkipsSystemsThatAreNotConnected)
+{
+  int64_t fire_ms = GetNextMinuteMs(NowMs());
+  scheduler_->Load({MakeScheduleAt(1, fire_ms)});
+
+  scheduler_->RunDue(AtMs(fire_ms));
+
+  EXPECT_FALSE(IsReadable(completions_->GetFd()));
+  EXPECT_EQ(scheduler_->GetTimeoutMs(AtMs(fire_ms)), WEEK_MS);
+}
+
+} // namespace
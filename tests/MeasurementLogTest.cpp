@@ -0,0 +1,256 @@
+#include "MeasurementLog.h"
+
+#include <stdlib.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "StorageEngine.h"
+
+namespace
+{
+using organicdump::MeasurementLog;
+using organicdump::SoilMoistureMeasurement;
+
+// Long enough for the drainer to back off through the attempts that precede
+// a bisection
+constexpr std::chrono::seconds DRAIN_TIMEOUT{30};
+
+/**
+ * Stands in for the database. Stores what it accepts and rejects whole
+ * batches while |is_down| or while they hold a reading of |rejected_sensor_id|.
+ */
+class FakeSink
+{
+public:
+  MeasurementLog::Sink GetSink()
+  {
+    return [this](const std::vector<SoilMoistureMeasurement> &measurements)
+    {
+      return Store(measurements);
+    };
+  }
+
+  void SetDown(bool is_down)
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    is_down_ = is_down;
+  }
+
+  void SetRejectedSensor(size_t sensor_id)
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    rejected_sensor_id_ = sensor_id;
+  }
+
+  /** False if fewer than |count| readings were stored before the timeout. */
+  bool WaitForStored(size_t count)
+  {
+    std::unique_lock<std::mutex> lock{mutex_};
+    return stored_cv_.wait_for(lock, DRAIN_TIMEOUT, [this, count]()
+    {
+      return stored_.size() >= count;
+    });
+  }
+
+  std::vector<SoilMoistureMeasurement> GetStored()
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return stored_;
+  }
+
+private:
+  bool Store(const std::vector<SoilMoistureMeasurement> &measurements)
+  {
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (is_down_)
+    {
+      return false;
+    }
+
+    for (const SoilMoistureMeasurement &measurement : measurements)
+    {
+      if (measurement.sensor_id == rejected_sensor_id_)
+      {
+        return false;
+      }
+    }
+
+    stored_.insert(stored_.end(), measurements.begin(), measurements.end());
+    stored_cv_.notify_all();
+    return true;
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable stored_cv_;
+  bool is_down_{false};
+  size_t rejected_sensor_id_{0};
+  std::vector<SoilMoistureMeasurement> stored_;
+};
+
+class MeasurementLogTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    std::string dir_template = ::testing::TempDir() + "measurement_log_test.XXXXXX";
+    ASSERT_NE(mkdtemp(&dir_template[0]), nullptr);
+    root_dir_ = dir_template;
+    log_dir_ = root_dir_ + "/wal";
+  }
+
+  void TearDown() override
+  {
+    std::filesystem::remove_all(root_dir_);
+  }
+
+  /**
+   * Lines of quarantine.csv, once it has at least |count| of them or the
+   * drain timeout has passed.
+   */
+  std::vector<std::string> WaitForQuarantine(size_t count) const
+  {
+    auto deadline = std::chrono::steady_clock::now() + DRAIN_TIMEOUT;
+    while (true)
+    {
+      std::vector<std::string> lines;
+      std::ifstream file{log_dir_ + "/quarantine.csv"};
+      for (std::string line; std::getline(file, line);)
+      {
+        lines.push_back(line);
+      }
+
+      if (lines.size() >= count || std::chrono::steady_clock::now() >= deadline)
+      {
+        return lines;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+  }
+
+protected:
+  std::string root_dir_;
+  std::string log_dir_;
+};
+
+TEST_F(MeasurementLogTest, DrainsAppendedMeasurementsIntoSink)
+{
+  FakeSink sink;
+  MeasurementLog log;
+  ASSERT_TRUE(MeasurementLog::Create(log_dir_, sink.GetSink(), &log));
+
+  ASSERT_TRUE(log.Append({{1, 0.5f, 1000, 7}, {2, 0.25f, 2000, 0}}));
+  ASSERT_TRUE(sink.WaitForStored(2));
+
+  std::vector<SoilMoistureMeasurement> stored = sink.GetStored();
+  ASSERT_EQ(stored.size(), 2u);
+  EXPECT_EQ(stored[0].sensor_id, 1u);
+  EXPECT_EQ(stored[0].value, 0.5f);
+  EXPECT_EQ(stored[0].time_ms, 1000);
+  EXPECT_EQ(stored[0].seq, 7u);
+  EXPECT_EQ(stored[1].sensor_id, 2u);
+  EXPECT_EQ(stored[1].time_ms, 2000);
+}
+
+TEST_F(MeasurementLogTest, ReplaysUndrainedRecordsAfterRestart)
+{
+  {
+    FakeSink down_sink;
+    down_sink.SetDown(true);
+
+    MeasurementLog log;
+    ASSERT_TRUE(MeasurementLog::Create(log_dir_, down_sink.GetSink(), &log));
+    for (int64_t i = 0; i < 100; ++i)
+    {
+      ASSERT_TRUE(log.Append({{1, 1.0f, i, 0}}));
+    }
+  }
+
+  FakeSink sink;
+  MeasurementLog log;
+  ASSERT_TRUE(MeasurementLog::Create(log_dir_, sink.GetSink(), &log));
+  ASSERT_TRUE(sink.WaitForStored(100));
+
+  std::vector<SoilMoistureMeasurement> stored = sink.GetStored();
+  ASSERT_EQ(stored.size(), 100u);
+  for (size_t i = 0; i < stored.size(); ++i)
+  {
+    EXPECT_EQ(stored[i].time_ms, static_cast<int64_t>(i));
+  }
+}
+
+TEST_F(MeasurementLogTest, GroupsConcurrentAppends)
+{
+  constexpr int THREAD_COUNT = 4;
+  constexpr int APPENDS_PER_THREAD = 1000;
+
+  FakeSink sink;
+  MeasurementLog log;
+  ASSERT_TRUE(MeasurementLog::Create(log_dir_, sink.GetSink(), &log));
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREAD_COUNT; ++t)
+  {
+    threads.emplace_back([&log, t]()
+    {
+      for (int i = 0; i < APPENDS_PER_THREAD; ++i)
+      {
+        EXPECT_TRUE(log.Append({{static_cast<size_t>(t + 1), 1.0f, i, 0}}));
+      }
+    });
+  }
+
+  for (std::thread &thread : threads)
+  {
+    thread.join();
+  }
+
+  ASSERT_TRUE(sink.WaitForStored(THREAD_COUNT * APPENDS_PER_THREAD));
+  EXPECT_EQ(sink.GetStored().size(), static_cast<size_t>(THREAD_COUNT * APPENDS_PER_THREAD));
+}
+
+TEST_F(MeasurementLogTest, QuarantinesRecordsTheSinkKeepsRejecting)
+{
+  constexpr size_t BAD_SENSOR_ID = 666;
+
+  FakeSink sink;
+  sink.SetRejectedSensor(BAD_SENSOR_ID);
+
+  MeasurementLog log;
+  ASSERT_TRUE(MeasurementLog::Create(log_dir_, sink.GetSink(), &log));
+
+  std::vector<SoilMoistureMeasurement> measurements;
+  for (int64_t i = 0; i < 1000; ++i)
+  {
+    bool is_bad = i == 300 || i == 301 || i == 777;
+    measurements.push_back({is_bad ? BAD_SENSOR_ID : 1, 1.0f, i, 0});
+  }
+  ASSERT_TRUE(log.Append(measurements));
+
+  ASSERT_TRUE(sink.WaitForStored(997));
+  for (const SoilMoistureMeasurement &measurement : sink.GetStored())
+  {
+    EXPECT_NE(measurement.sensor_id, BAD_SENSOR_ID);
+  }
+
+  // Rejected records are quarantined once the bisection has drained the rest
+  std::vector<std::string> quarantined = WaitForQuarantine(3);
+  ASSERT_EQ(quarantined.size(), 3u);
+  EXPECT_EQ(quarantined[0].rfind("666,300,", 0), 0u);
+  EXPECT_EQ(quarantined[1].rfind("666,301,", 0), 0u);
+  EXPECT_EQ(quarantined[2].rfind("666,777,", 0), 0u);
+}
+
+} // namespace
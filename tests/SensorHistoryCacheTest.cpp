@@ -0,0 +1,142 @@
+#include "SensorHistoryCache.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "StorageEngine.h"
+
+namespace
+{
+using organicdump::SensorHistoryCache;
+
+constexpr size_t CAPACITY = 4;
+
+int64_t NowMs()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+class SensorHistoryCacheTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    // Readings after the cache's creation, which it covers from the start
+    base_ms_ = NowMs() + 1000;
+  }
+
+  /** Reads up to CAPACITY readings of sensor 1 and returns the coverage. */
+  int64_t ReadAll(int64_t since_ms = 0)
+  {
+    times_.clear();
+    values_.clear();
+    return cache_.Read(1, since_ms, CAPACITY, &times_, &values_);
+  }
+
+  int64_t At(int64_t offset_ms) const
+  {
+    return base_ms_ + offset_ms;
+  }
+
+protected:
+  SensorHistoryCache cache_{CAPACITY};
+  int64_t base_ms_;
+  std::vector<int64_t> times_;
+  std::vector<float> values_;
+};
+
+TEST_F(SensorHistoryCacheTest, ReadsReadingsInTimeOrder)
+{
+  cache_.Add({{1, 1.0f, At(10)}, {1, 3.0f, At(30)}, {1, 2.0f, At(20)}, {2, 5.0f, At(15)}});
+
+  int64_t covered_since_ms = ReadAll();
+  EXPECT_EQ(times_, (std::vector<int64_t>{At(10), At(20), At(30)}));
+  EXPECT_EQ(values_, (std::vector<float>{1.0f, 2.0f, 3.0f}));
+  EXPECT_LT(covered_since_ms, base_ms_);
+
+  ReadAll(At(20));
+  EXPECT_EQ(times_, (std::vector<int64_t>{At(20), At(30)}));
+
+  times_.clear();
+  values_.clear();
+  cache_.Read(1, 0, 1, &times_, &values_);
+  EXPECT_EQ(times_, (std::vector<int64_t>{At(30)}));
+}
+
+TEST_F(SensorHistoryCacheTest, ReplacesReadingsWithTheSameTimeAndSeq)
+{
+  cache_.Add({{1, 1.0f, At(10)}, {1, 2.0f, At(20)}, {1, 3.0f, At(30)}});
+  cache_.Add({{1, 9.0f, At(20)}});
+  ReadAll();
+  EXPECT_EQ(times_, (std::vector<int64_t>{At(10), At(20), At(30)}));
+  EXPECT_EQ(values_, (std::vector<float>{1.0f, 9.0f, 3.0f}));
+
+  cache_.Add({{1, 5.0f, At(20), 7}});
+  ReadAll();
+  EXPECT_EQ(times_, (std::vector<int64_t>{At(10), At(20), At(20), At(30)}));
+  EXPECT_EQ(values_, (std::vector<float>{1.0f, 9.0f, 5.0f, 3.0f}));
+}
+
+TEST_F(SensorHistoryCacheTest, EvictsOldestReadingsWhenFull)
+{
+  cache_.Add({{1, 1.0f, At(10)}, {1, 2.0f, At(20)}, {1, 3.0f, At(30)}, {1, 4.0f, At(40)}});
+
+  // A late reading in the middle pushes out the oldest
+  cache_.Add({{1, 5.0f, At(25)}});
+  EXPECT_EQ(ReadAll(), At(20));
+  EXPECT_EQ(times_, (std::vector<int64_t>{At(20), At(25), At(30), At(40)}));
+
+  // One older than the coverage is left to the database
+  cache_.Add({{1, 6.0f, At(5)}});
+  EXPECT_EQ(ReadAll(), At(20));
+  EXPECT_EQ(times_, (std::vector<int64_t>{At(20), At(25), At(30), At(40)}));
+
+  for (int64_t i = 0; i < 10; ++i)
+  {
+    cache_.Add({{1, 1.0f, At(100 + i)}});
+  }
+  EXPECT_EQ(ReadAll(), At(106));
+  EXPECT_EQ(times_, (std::vector<int64_t>{At(106), At(107), At(108), At(109)}));
+}
+
+TEST_F(SensorHistoryCacheTest, BackfillsOlderReadings)
+{
+  int64_t created_ms = ReadAll();
+  EXPECT_TRUE(times_.empty());
+
+  cache_.Add({{1, 3.0f, At(30)}});
+  ASSERT_EQ(ReadAll(), created_ms);
+
+  cache_.Backfill(
+      1, created_ms, created_ms - 1000, {created_ms - 900, created_ms - 800}, {1.0f, 2.0f});
+  EXPECT_EQ(ReadAll(0), created_ms - 1000);
+  EXPECT_EQ(times_, (std::vector<int64_t>{created_ms - 900, created_ms - 800, At(30)}));
+  EXPECT_EQ(values_, (std::vector<float>{1.0f, 2.0f, 3.0f}));
+
+  // A fetch based on coverage that has since changed is ignored
+  cache_.Backfill(1, created_ms, created_ms - 5000, {created_ms - 4000}, {0.0f});
+  EXPECT_EQ(ReadAll(0), created_ms - 1000);
+  EXPECT_EQ(times_.size(), 3u);
+}
+
+TEST_F(SensorHistoryCacheTest, KeepsNewestBackfilledReadingsThatFit)
+{
+  int64_t created_ms = ReadAll();
+  cache_.Add({{1, 4.0f, At(40)}, {1, 5.0f, At(50)}});
+
+  cache_.Backfill(
+      1,
+      created_ms,
+      created_ms - 1000,
+      {created_ms - 900, created_ms - 800, created_ms - 700},
+      {1.0f, 2.0f, 3.0f});
+
+  EXPECT_EQ(ReadAll(0), created_ms - 800);
+  EXPECT_EQ(times_, (std::vector<int64_t>{created_ms - 800, created_ms - 700, At(40), At(50)}));
+}
+
+} // namespace
@@ -0,0 +1,593 @@
+#include "StorageEngine.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <sqlite3.h>
+
+#include "InMemoryStorageEngine.h"
+#include "SqliteStorageEngine.h"
+
+namespace
+{
+using organicdump::DailyIrrigationSchedule;
+using organicdump::InMemoryStorageEngine;
+using organicdump::SoilMoistureMeasurement;
+using organicdump::SqliteStorageEngine;
+using organicdump::StorageEngine;
+
+constexpr int64_t HOUR_MS = 60 * 60 * 1000;
+
+/** A fresh directory under the test temp dir, removed with everything in it. */
+class TempDirectory
+{
+public:
+  TempDirectory()
+  {
+    std::string dir_template = ::testing::TempDir() + "storage_engine_test.XXXXXX";
+    if (mkdtemp(&dir_template[0]))
+    {
+      path_ = dir_template;
+    }
+  }
+
+  ~TempDirectory()
+  {
+    if (!path_.empty())
+    {
+      std::filesystem::remove_all(path_);
+    }
+  }
+
+  /** Empty if the directory couldn't be created. */
+  const std::string &GetPath() const
+  {
+    return path_;
+  }
+
+private:
+  TempDirectory(const TempDirectory &other) = delete;
+  TempDirectory &operator=(const TempDirectory &other) = delete;
+
+private:
+  std::string path_;
+};
+
+class InMemoryEngineFactory
+{
+public:
+  std::unique_ptr<StorageEngine> Create()
+  {
+    return std::make_unique<InMemoryStorageEngine>();
+  }
+};
+
+class SqliteEngineFactory
+{
+public:
+  std::unique_ptr<StorageEngine> Create()
+  {
+    auto engine = std::make_unique<SqliteStorageEngine>();
+    if (dir_.GetPath().empty() ||
+        !SqliteStorageEngine::Create(dir_.GetPath() + "/organicdump.db", engine.get()))
+    {
+      return nullptr;
+    }
+
+    return engine;
+  }
+
+private:
+  TempDirectory dir_;
+};
+
+/**
+ * Runs against every engine, so that DbManager sees the same behaviour
+ * whichever one the server is configured with.
+ */
+template <typename Factory>
+class StorageEngineTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    engine_ = factory_.Create();
+    ASSERT_NE(engine_, nullptr);
+  }
+
+  /** Registers sensors until one has |sensor_id|, which must be unused. */
+  void RegisterSensorsThrough(size_t sensor_id)
+  {
+    size_t id = 0;
+    while (id < sensor_id)
+    {
+      ASSERT_TRUE(engine_->InsertSoilMoistureSensor(
+          "sensor-" + std::to_string(id + 1), 0.0f, 1.0f, &id));
+    }
+    ASSERT_EQ(id, sensor_id);
+  }
+
+  void ReadAll(
+      size_t sensor_id,
+      std::vector<int64_t> *out_times,
+      std::vector<float> *out_values)
+  {
+    ASSERT_TRUE(engine_->GetSoilMoistureReadings(
+        sensor_id, INT64_MIN, INT64_MAX, SIZE_MAX, out_times, out_values));
+  }
+
+protected:
+  Factory factory_;
+  std::unique_ptr<StorageEngine> engine_;
+};
+
+using EngineFactories = ::testing::Types<InMemoryEngineFactory, SqliteEngineFactory>;
+TYPED_TEST_SUITE(StorageEngineTest, EngineFactories);
+
+TYPED_TEST(StorageEngineTest, RegistersRpisAndPeripherals)
+{
+  StorageEngine *engine = this->engine_.get();
+
+  size_t rpi_id = 0;
+  ASSERT_TRUE(engine->InsertRpi("rpi", "greenhouse", &rpi_id));
+  EXPECT_EQ(rpi_id, 1u);
+  EXPECT_TRUE(engine->ContainsRpi(rpi_id));
+  EXPECT_TRUE(engine->ContainsRpi("rpi"));
+  EXPECT_FALSE(engine->ContainsRpi(rpi_id + 1));
+  EXPECT_FALSE(engine->ContainsRpi("other"));
+
+  size_t sensor_id = 0;
+  ASSERT_TRUE(engine->InsertSoilMoistureSensor("sensor", 0.1f, 0.9f, &sensor_id));
+  EXPECT_EQ(sensor_id, 1u);
+
+  // Sensors and irrigation systems share peripheral ids and names
+  size_t irrigation_system_id = 0;
+  EXPECT_FALSE(engine->InsertIrrigationSystem("sensor", &irrigation_system_id));
+  ASSERT_TRUE(engine->InsertIrrigationSystem("valve", &irrigation_system_id));
+  EXPECT_EQ(irrigation_system_id, 2u);
+
+  EXPECT_TRUE(engine->ContainsPeripheral(sensor_id));
+  EXPECT_TRUE(engine->ContainsPeripheral("sensor"));
+  EXPECT_TRUE(engine->ContainsPeripheral(irrigation_system_id));
+  EXPECT_TRUE(engine->ContainsPeripheral("valve"));
+  EXPECT_FALSE(engine->ContainsPeripheral("missing"));
+  EXPECT_TRUE(engine->ContainsIrrigationSystem(irrigation_system_id));
+  EXPECT_FALSE(engine->ContainsIrrigationSystem(sensor_id));
+}
+
+TYPED_TEST(StorageEngineTest, TracksPeripheralOwnership)
+{
+  StorageEngine *engine = this->engine_.get();
+
+  size_t rpi_id = 0;
+  size_t sensor_id = 0;
+  ASSERT_TRUE(engine->InsertRpi("rpi", "greenhouse", &rpi_id));
+  ASSERT_TRUE(engine->InsertSoilMoistureSensor("sensor", 0.0f, 1.0f, &sensor_id));
+
+  EXPECT_FALSE(engine->OrphanRpiOwnedPeripheral(sensor_id));
+  EXPECT_TRUE(engine->AssignPeripheralToRpi(rpi_id, sensor_id));
+  EXPECT_FALSE(engine->AssignPeripheralToRpi(rpi_id, sensor_id));
+  EXPECT_FALSE(engine->AssignPeripheralToRpi(rpi_id + 1, sensor_id));
+  EXPECT_TRUE(engine->OrphanRpiOwnedPeripheral(sensor_id));
+
+  EXPECT_TRUE(engine->UpdatePeripheralOwnership(sensor_id, rpi_id));
+  EXPECT_TRUE(engine->UpdatePeripheralOwnership(sensor_id, rpi_id));
+}
+
+TYPED_TEST(StorageEngineTest, ReplacesDailyIrrigationSchedules)
+{
+  StorageEngine *engine = this->engine_.get();
+
+  size_t sensor_id = 0;
+  size_t irrigation_system_id = 0;
+  ASSERT_TRUE(engine->InsertSoilMoistureSensor("sensor", 0.0f, 1.0f, &sensor_id));
+  ASSERT_TRUE(engine->InsertIrrigationSystem("valve", &irrigation_system_id));
+
+  EXPECT_FALSE(engine->ReplaceDailyIrrigationSchedules(
+      sensor_id, {{sensor_id, 0, "0630", 5000}}));
+
+  ASSERT_TRUE(engine->ReplaceDailyIrrigationSchedules(
+      irrigation_system_id,
+      {{irrigation_system_id, 1, "0700", 2000},
+       {irrigation_system_id, 0, "0630", 5000}}));
+
+  std::vector<DailyIrrigationSchedule> schedules;
+  ASSERT_TRUE(engine->GetDailyIrrigationSchedules(&schedules));
+  ASSERT_EQ(schedules.size(), 2u);
+  std::sort(
+      schedules.begin(),
+      schedules.end(),
+      [](const DailyIrrigationSchedule &lhs, const DailyIrrigationSchedule &rhs)
+      {
+        return lhs.day_of_week_index < rhs.day_of_week_index;
+      });
+  EXPECT_EQ(schedules[0].irrigation_system_id, irrigation_system_id);
+  EXPECT_EQ(schedules[0].day_of_week_index, 0u);
+  EXPECT_EQ(schedules[0].water_time_military, "0630");
+  EXPECT_EQ(schedules[0].water_duration_ms, 5000u);
+  EXPECT_EQ(schedules[1].day_of_week_index, 1u);
+  EXPECT_EQ(schedules[1].water_time_military, "0700");
+
+  ASSERT_TRUE(engine->ReplaceDailyIrrigationSchedules(irrigation_system_id, {}));
+  schedules.clear();
+  ASSERT_TRUE(engine->GetDailyIrrigationSchedules(&schedules));
+  EXPECT_TRUE(schedules.empty());
+}
+
+TYPED_TEST(StorageEngineTest, ReadsNewestReadingsInRangeOldestFirst)
+{
+  this->RegisterSensorsThrough(2);
+  StorageEngine *engine = this->engine_.get();
+
+  ASSERT_TRUE(engine->InsertSoilMoistureMeasurements(
+      {{1, 0.1f, 10}, {1, 0.2f, 30}, {2, 0.5f, 5}, {1, 0.3f, 20}}));
+
+  std::vector<int64_t> times;
+  std::vector<float> values;
+  ASSERT_TRUE(engine->GetSoilMoistureReadings(1, 0, 100, 10, &times, &values));
+  EXPECT_EQ(times, (std::vector<int64_t>{10, 20, 30}));
+  EXPECT_EQ(values, (std::vector<float>{0.1f, 0.3f, 0.2f}));
+
+  times.clear();
+  values.clear();
+  ASSERT_TRUE(engine->GetSoilMoistureReadings(1, 0, 100, 2, &times, &values));
+  EXPECT_EQ(times, (std::vector<int64_t>{20, 30}));
+
+  // The end of the range is exclusive
+  times.clear();
+  values.clear();
+  ASSERT_TRUE(engine->GetSoilMoistureReadings(1, 10, 30, 10, &times, &values));
+  EXPECT_EQ(times, (std::vector<int64_t>{10, 20}));
+
+  times.clear();
+  values.clear();
+  ASSERT_TRUE(engine->GetSoilMoistureReadings(2, 0, 100, 10, &times, &values));
+  EXPECT_EQ(times, (std::vector<int64_t>{5}));
+}
+
+TYPED_TEST(StorageEngineTest, KeysReadingsByTimeAndSeq)
+{
+  this->RegisterSensorsThrough(1);
+  StorageEngine *engine = this->engine_.get();
+
+  // A replay of (time, seq) overwrites, a new seq at the same time doesn't
+  ASSERT_TRUE(engine->InsertSoilMoistureMeasurements(
+      {{1, 0.1f, 10, 2}, {1, 0.2f, 10, 1}, {1, 0.3f, 10, 0}}));
+  ASSERT_TRUE(engine->InsertSoilMoistureMeasurements({{1, 0.4f, 10, 2}}));
+
+  std::vector<int64_t> times;
+  std::vector<float> values;
+  this->ReadAll(1, &times, &values);
+  EXPECT_EQ(times, (std::vector<int64_t>{10, 10, 10}));
+  EXPECT_EQ(values, (std::vector<float>{0.3f, 0.2f, 0.4f}));
+}
+
+TYPED_TEST(StorageEngineTest, PrunesReadingsOlderThanCutoff)
+{
+  this->RegisterSensorsThrough(2);
+  StorageEngine *engine = this->engine_.get();
+
+  ASSERT_TRUE(engine->InsertSoilMoistureMeasurements(
+      {{1, 0.1f, 10}, {1, 0.2f, 2 * HOUR_MS}, {1, 0.3f, 2 * HOUR_MS + 30}, {2, 0.5f, 5}}));
+
+  // Engines that keep rollups may spare readings not yet folded into them
+  ASSERT_TRUE(engine->RefreshSoilMoistureRollups());
+  ASSERT_TRUE(engine->PruneSoilMoistureReadings(2 * HOUR_MS + 20));
+
+  // The cutoff is rounded down to the hour
+  std::vector<int64_t> times;
+  std::vector<float> values;
+  this->ReadAll(1, &times, &values);
+  EXPECT_EQ(times, (std::vector<int64_t>{2 * HOUR_MS, 2 * HOUR_MS + 30}));
+
+  times.clear();
+  values.clear();
+  this->ReadAll(2, &times, &values);
+  EXPECT_TRUE(times.empty());
+}
+
+TYPED_TEST(StorageEngineTest, StoresConcurrentBatches)
+{
+  constexpr size_t SENSOR_COUNT = 4;
+  constexpr int THREAD_COUNT = 4;
+  constexpr int BATCHES_PER_THREAD = 200;
+
+  this->RegisterSensorsThrough(SENSOR_COUNT);
+  StorageEngine *engine = this->engine_.get();
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREAD_COUNT; ++t)
+  {
+    threads.emplace_back([engine, t]()
+    {
+      for (int i = 0; i < BATCHES_PER_THREAD; ++i)
+      {
+        std::vector<SoilMoistureMeasurement> batch;
+        for (size_t sensor_id = 1; sensor_id <= SENSOR_COUNT; ++sensor_id)
+        {
+          batch.push_back({sensor_id, 1.0f, t * BATCHES_PER_THREAD + i});
+        }
+        EXPECT_TRUE(engine->InsertSoilMoistureMeasurements(batch));
+
+        std::vector<int64_t> times;
+        std::vector<float> values;
+        EXPECT_TRUE(engine->GetSoilMoistureReadings(
+            1 + i % SENSOR_COUNT, 0, INT64_MAX, 50, &times, &values));
+      }
+    });
+  }
+
+  for (std::thread &thread : threads)
+  {
+    thread.join();
+  }
+
+  for (size_t sensor_id = 1; sensor_id <= SENSOR_COUNT; ++sensor_id)
+  {
+    std::vector<int64_t> times;
+    std::vector<float> values;
+    this->ReadAll(sensor_id, &times, &values);
+    EXPECT_EQ(times.size(), static_cast<size_t>(THREAD_COUNT * BATCHES_PER_THREAD));
+    EXPECT_TRUE(std::is_sorted(times.begin(), times.end()));
+  }
+}
+
+TEST(RawRetentionCutoffTest, FallsOnTheHourBeforeRetention)
+{
+  using organicdump::GetRawRetentionCutoffMs;
+
+  constexpr int64_t DAY_MS = 24 * HOUR_MS;
+  int64_t now_ms = 100 * DAY_MS + 5 * HOUR_MS + 123;
+
+  // Readings from the start of the hour that retention reaches into are kept
+  EXPECT_EQ(GetRawRetentionCutoffMs(now_ms, std::chrono::hours{48}), 98 * DAY_MS + 5 * HOUR_MS);
+  EXPECT_EQ(GetRawRetentionCutoffMs(98 * DAY_MS, std::chrono::hours{48}), 96 * DAY_MS);
+  EXPECT_EQ(GetRawRetentionCutoffMs(HOUR_MS / 2, std::chrono::hours{1}), -HOUR_MS);
+
+  // Zero keeps every reading
+  EXPECT_EQ(GetRawRetentionCutoffMs(now_ms, std::chrono::hours{0}), INT64_MIN);
+
+  // The cutoff never moves back, so no reading lands in a pruned hour
+  int64_t previous_ms = INT64_MIN;
+  for (int64_t ms = now_ms; ms < now_ms + 3 * HOUR_MS; ms += 7 * 60 * 1000)
+  {
+    int64_t cutoff_ms = GetRawRetentionCutoffMs(ms, std::chrono::hours{24});
+    EXPECT_GE(cutoff_ms, previous_ms);
+    EXPECT_LE(cutoff_ms, ms - DAY_MS);
+    previous_ms = cutoff_ms;
+  }
+}
+
+TYPED_TEST(StorageEngineTest, RejectsBatchesWithUnregisteredSensors)
+{
+  StorageEngine *engine = this->engine_.get();
+
+  size_t sensor_id = 0;
+  size_t irrigation_system_id = 0;
+  ASSERT_TRUE(engine->InsertSoilMoistureSensor("sensor", 0.0f, 1.0f, &sensor_id));
+  ASSERT_TRUE(engine->InsertIrrigationSystem("valve", &irrigation_system_id));
+  EXPECT_TRUE(engine->ContainsSoilMoistureSensor(sensor_id));
+  EXPECT_FALSE(engine->ContainsSoilMoistureSensor(irrigation_system_id));
+
+  // Nothing of a rejected batch is stored
+  EXPECT_FALSE(engine->InsertSoilMoistureMeasurements(
+      {{sensor_id, 0.1f, 10}, {sensor_id + 100, 0.2f, 20}}));
+  EXPECT_FALSE(engine->InsertSoilMoistureMeasurements({{irrigation_system_id, 0.1f, 10}}));
+
+  std::vector<int64_t> times;
+  std::vector<float> values;
+  this->ReadAll(sensor_id, &times, &values);
+  EXPECT_TRUE(times.empty());
+}
+
+class SqliteStorageEngineTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    ASSERT_FALSE(dir_.GetPath().empty());
+    path_ = dir_.GetPath() + "/organicdump.db";
+  }
+
+  void Open(SqliteStorageEngine *out_engine)
+  {
+    ASSERT_TRUE(SqliteStorageEngine::Create(path_, out_engine));
+  }
+
+  /** Registers sensors in |engine| until one has |sensor_id|. */
+  void RegisterSensorsThrough(SqliteStorageEngine *engine, size_t sensor_id)
+  {
+    size_t id = 0;
+    while (id < sensor_id)
+    {
+      ASSERT_TRUE(engine->InsertSoilMoistureSensor(
+          "sensor-" + std::to_string(id + 1), 0.0f, 1.0f, &id));
+    }
+    ASSERT_EQ(id, sensor_id);
+  }
+
+  /** Runs |sql|, which selects one integer, on a connection of its own. */
+  int64_t SelectCount(const std::string &sql)
+  {
+    sqlite3 *db = nullptr;
+    sqlite3_stmt *statement = nullptr;
+    int64_t count = -1;
+    if (sqlite3_open(path_.c_str(), &db) == SQLITE_OK &&
+        sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr) == SQLITE_OK &&
+        sqlite3_step(statement) == SQLITE_ROW)
+    {
+      count = sqlite3_column_int64(statement, 0);
+    }
+
+    sqlite3_finalize(statement);
+    sqlite3_close(db);
+    return count;
+  }
+
+protected:
+  TempDirectory dir_;
+  std::string path_;
+};
+
+TEST_F(SqliteStorageEngineTest, KeepsEverythingAcrossReopen)
+{
+  size_t irrigation_system_id = 0;
+  {
+    SqliteStorageEngine engine;
+    Open(&engine);
+
+    size_t rpi_id = 0;
+    size_t sensor_id = 0;
+    ASSERT_TRUE(engine.InsertRpi("rpi", "greenhouse", &rpi_id));
+    ASSERT_TRUE(engine.InsertSoilMoistureSensor("sensor", 0.0f, 1.0f, &sensor_id));
+    ASSERT_TRUE(engine.InsertIrrigationSystem("valve", &irrigation_system_id));
+    ASSERT_TRUE(engine.ReplaceDailyIrrigationSchedules(
+        irrigation_system_id, {{irrigation_system_id, 0, "0630", 5000}}));
+    ASSERT_TRUE(engine.InsertSoilMoistureMeasurements({{sensor_id, 0.5f, 10}}));
+  }
+
+  SqliteStorageEngine engine;
+  Open(&engine);
+  EXPECT_TRUE(engine.ContainsRpi("rpi"));
+  EXPECT_TRUE(engine.ContainsPeripheral("sensor"));
+  EXPECT_TRUE(engine.ContainsSoilMoistureSensor(1));
+  EXPECT_TRUE(engine.ContainsIrrigationSystem(irrigation_system_id));
+
+  // Ids continue where the previous run left off
+  size_t rpi_id = 0;
+  ASSERT_TRUE(engine.InsertRpi("other", "shed", &rpi_id));
+  EXPECT_EQ(rpi_id, 2u);
+
+  std::vector<DailyIrrigationSchedule> schedules;
+  ASSERT_TRUE(engine.GetDailyIrrigationSchedules(&schedules));
+  ASSERT_EQ(schedules.size(), 1u);
+  EXPECT_EQ(schedules[0].water_time_military, "0630");
+
+  std::vector<int64_t> times;
+  std::vector<float> values;
+  ASSERT_TRUE(engine.GetSoilMoistureReadings(1, 0, 100, 10, &times, &values));
+  EXPECT_EQ(times, (std::vector<int64_t>{10}));
+  EXPECT_EQ(values, (std::vector<float>{0.5f}));
+
+  // The registry moves with the engine
+  SqliteStorageEngine moved = std::move(engine);
+  EXPECT_TRUE(moved.ContainsRpi("other"));
+}
+
+TEST_F(SqliteStorageEngineTest, SparesStaleHoursWhenPruning)
+{
+  SqliteStorageEngine engine;
+  Open(&engine);
+  RegisterSensorsThrough(&engine, 2);
+
+  ASSERT_TRUE(engine.InsertSoilMoistureMeasurements(
+      {{1, 0.1f, 10}, {1, 0.2f, HOUR_MS + 5}, {2, 0.3f, 2 * HOUR_MS + 1}, {1, 0.4f, 20}}));
+  EXPECT_EQ(SelectCount("SELECT COUNT(*) FROM soil_moisture_stale_rollups"), 3);
+
+  // Nothing is folded into the rollups yet, so every reading is kept
+  ASSERT_TRUE(engine.PruneSoilMoistureReadings(10 * HOUR_MS));
+  EXPECT_EQ(SelectCount("SELECT COUNT(*) FROM soil_moisture_readings"), 4);
+
+  ASSERT_TRUE(engine.RefreshSoilMoistureRollups());
+  EXPECT_EQ(SelectCount("SELECT COUNT(*) FROM soil_moisture_stale_rollups"), 0);
+  EXPECT_EQ(
+      SelectCount(
+          "SELECT reading_count FROM soil_moisture_rollups_1h "
+          "WHERE sensor_id = 1 AND bucket_ms = 0"),
+      2);
+  EXPECT_EQ(
+      SelectCount("SELECT reading_count FROM soil_moisture_rollups_1d WHERE sensor_id = 1"),
+      3);
+
+  // A late reading makes its hour stale again until the next refresh
+  ASSERT_TRUE(engine.InsertSoilMoistureMeasurements({{2, 0.5f, 9 * HOUR_MS}}));
+  ASSERT_TRUE(engine.PruneSoilMoistureReadings(10 * HOUR_MS));
+  EXPECT_EQ(SelectCount("SELECT COUNT(*) FROM soil_moisture_readings"), 1);
+
+  ASSERT_TRUE(engine.RefreshSoilMoistureRollups());
+  ASSERT_TRUE(engine.PruneSoilMoistureReadings(10 * HOUR_MS));
+  EXPECT_EQ(SelectCount("SELECT COUNT(*) FROM soil_moisture_readings"), 0);
+  EXPECT_EQ(SelectCount("SELECT COUNT(*) FROM soil_moisture_rollups_1m"), 4);
+}
+
+TEST_F(SqliteStorageEngineTest, KeepsRollupsOfPrunedMinutes)
+{
+  constexpr int64_t MINUTE_MS = 60 * 1000;
+  int64_t minute_ms = 5 * HOUR_MS + 30 * MINUTE_MS;
+  const std::string count_1m_sql =
+      "SELECT reading_count FROM soil_moisture_rollups_1m WHERE bucket_ms = " +
+      std::to_string(minute_ms);
+  const std::string count_1h_sql =
+      "SELECT reading_count FROM soil_moisture_rollups_1h WHERE bucket_ms = " +
+      std::to_string(5 * HOUR_MS);
+
+  {
+    SqliteStorageEngine engine;
+    Open(&engine);
+    RegisterSensorsThrough(&engine, 1);
+
+    ASSERT_TRUE(engine.InsertSoilMoistureMeasurements(
+        {{1, 0.1f, minute_ms + 1000}, {1, 0.2f, minute_ms + 2000}}));
+    ASSERT_TRUE(engine.RefreshSoilMoistureRollups());
+
+    // A cutoff inside the minute is rounded down to the hour
+    ASSERT_TRUE(engine.PruneSoilMoistureReadings(minute_ms + 1500));
+    EXPECT_EQ(SelectCount("SELECT COUNT(*) FROM soil_moisture_readings"), 2);
+
+    ASSERT_TRUE(engine.PruneSoilMoistureReadings(6 * HOUR_MS + 1500));
+    EXPECT_EQ(SelectCount("SELECT COUNT(*) FROM soil_moisture_readings"), 0);
+    EXPECT_EQ(SelectCount("SELECT pruned_before_ms FROM soil_moisture_prune_watermark"),
+              6 * HOUR_MS);
+
+    // A late reading in the pruned hour leaves the stored minute alone
+    ASSERT_TRUE(engine.InsertSoilMoistureMeasurements({{1, 0.3f, minute_ms + 3000}}));
+    ASSERT_TRUE(engine.RefreshSoilMoistureRollups());
+    EXPECT_EQ(SelectCount(count_1m_sql), 2);
+    EXPECT_EQ(SelectCount(count_1h_sql), 2);
+  }
+
+  // The watermark outlives the engine
+  SqliteStorageEngine engine;
+  Open(&engine);
+  ASSERT_TRUE(engine.InsertSoilMoistureMeasurements({{1, 0.4f, minute_ms + 4000}}));
+  ASSERT_TRUE(engine.RefreshSoilMoistureRollups());
+  EXPECT_EQ(SelectCount(count_1m_sql), 2);
+  EXPECT_EQ(SelectCount(count_1h_sql), 2);
+}
+
+TEST_F(SqliteStorageEngineTest, PrunesMoreThanOneChunk)
+{
+  SqliteStorageEngine engine;
+  Open(&engine);
+  RegisterSensorsThrough(&engine, 4);
+
+  // Several readings share each millisecond, so chunk edges fall on ties
+  std::vector<SoilMoistureMeasurement> batch;
+  for (int i = 0; i < 25000; ++i)
+  {
+    batch.push_back({3, 1.0f, i / 3, static_cast<uint32_t>(i % 3)});
+  }
+  for (int i = 0; i < 10; ++i)
+  {
+    batch.push_back({3, 1.0f, 20 * HOUR_MS + i});
+  }
+  batch.push_back({4, 1.0f, 5});
+
+  ASSERT_TRUE(engine.InsertSoilMoistureMeasurements(batch));
+  ASSERT_TRUE(engine.RefreshSoilMoistureRollups());
+  ASSERT_TRUE(engine.PruneSoilMoistureReadings(10 * HOUR_MS));
+
+  EXPECT_EQ(SelectCount("SELECT COUNT(*) FROM soil_moisture_readings WHERE sensor_id = 3"), 10);
+  EXPECT_EQ(SelectCount("SELECT COUNT(*) FROM soil_moisture_readings WHERE sensor_id = 4"), 0);
+}
+
+} // namespace
@@ -0,0 +1,88 @@
+#include "TimingWheel.h"
+
+#include <chrono>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace
+{
+using organicdump::TimingWheel;
+using std::chrono::milliseconds;
+
+// Ten 10ms slots, so one revolution is 100ms
+constexpr milliseconds TICK{10};
+constexpr size_t SLOT_COUNT = 10;
+
+class TimingWheelTest : public ::testing::Test
+{
+protected:
+  TimingWheel wheel_{TICK, SLOT_COUNT};
+  TimingWheel::Clock::time_point start_{TimingWheel::Clock::now()};
+  std::vector<TimingWheel::Entry> expired_;
+};
+
+TEST_F(TimingWheelTest, HasNoTimeoutWhenEmpty)
+{
+  EXPECT_EQ(wheel_.GetTimeoutMs(start_), -1);
+  EXPECT_EQ(wheel_.GetSize(), 0u);
+}
+
+TEST_F(TimingWheelTest, ExpiresEntriesWhenTheirDeadlinePasses)
+{
+  wheel_.Schedule(start_ + milliseconds{25}, {1, 11});
+  wheel_.Schedule(start_ - milliseconds{5}, {2, 22});
+  EXPECT_EQ(wheel_.GetSize(), 2u);
+
+  // Already due
+  int timeout_ms = wheel_.GetTimeoutMs(start_);
+  EXPECT_GE(timeout_ms, 0);
+  EXPECT_LE(timeout_ms, TICK.count());
+
+  wheel_.Advance(start_ + milliseconds{11}, &expired_);
+  ASSERT_EQ(expired_.size(), 1u);
+  EXPECT_EQ(expired_[0].fd, 2);
+  EXPECT_EQ(expired_[0].serial, 22u);
+  expired_.clear();
+
+  wheel_.Advance(start_ + milliseconds{20}, &expired_);
+  EXPECT_TRUE(expired_.empty());
+
+  wheel_.Advance(start_ + milliseconds{40}, &expired_);
+  ASSERT_EQ(expired_.size(), 1u);
+  EXPECT_EQ(expired_[0].fd, 1);
+  EXPECT_EQ(wheel_.GetSize(), 0u);
+}
+
+TEST_F(TimingWheelTest, KeepsDeadlinesBeyondOneRevolution)
+{
+  wheel_.Schedule(start_ + milliseconds{250}, {1, 1});
+
+  int timeout_ms = wheel_.GetTimeoutMs(start_);
+  EXPECT_GE(timeout_ms, 0);
+  EXPECT_LE(timeout_ms, 250);
+
+  // Passes the entry's slot twice without expiring it
+  wheel_.Advance(start_ + milliseconds{200}, &expired_);
+  EXPECT_TRUE(expired_.empty());
+  EXPECT_EQ(wheel_.GetSize(), 1u);
+
+  wheel_.Advance(start_ + milliseconds{260}, &expired_);
+  ASSERT_EQ(expired_.size(), 1u);
+  EXPECT_EQ(expired_[0].fd, 1);
+}
+
+TEST_F(TimingWheelTest, CatchesUpAfterALongGap)
+{
+  constexpr int ENTRY_COUNT = 10000;
+  for (int i = 0; i < ENTRY_COUNT; ++i)
+  {
+    wheel_.Schedule(start_ + milliseconds{i % 500}, {i, static_cast<uint64_t>(i)});
+  }
+
+  wheel_.Advance(start_ + milliseconds{2000}, &expired_);
+  EXPECT_EQ(expired_.size(), static_cast<size_t>(ENTRY_COUNT));
+  EXPECT_EQ(wheel_.GetSize(), 0u);
+}
+
+} // namespace
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <thread>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <mysqlx/xdevapi.h>
+
+#include "src/DbSessionPool.h"
+
+/**
+ * Copies soil_moisture_readings_legacy (left behind by
+ * migrate-soil-moisture-readings.sql) into the time-series
+ * soil_moisture_readings table, one legacy id range per transaction.
+ *
+ * Every chunk is an upsert, so the tool can be stopped and rerun, or resumed
+ * with --start_after_id, without duplicating rows.
+ */
+
+namespace
+{
+DEFINE_string(db_url, "mysqlx://trevor@localhost", "MySQL X Protocol URL");
+DEFINE_string(db_name, "plantsandthings", "MySQL schema");
+DEFINE_int32(chunk_size, 10000, "Legacy rows copied per transaction");
+DEFINE_int64(start_after_id, 0, "Resume after this legacy id");
+DEFINE_int32(pause_ms, 0, "Sleep between chunks to limit load on a live server");
+
+// The legacy time column holds MakeTimestamp() output: local time, with
+// hyphens between the time fields. Legacy timestamps have whole-second
+// precision, so the legacy id becomes the seq that keeps two same-second
+// readings from one sensor apart on the new key.
+constexpr const char *BACKFILL_CHUNK_SQL =
+    "INSERT INTO soil_moisture_readings (sensor_id, time_ms, seq, reading) "
+    "SELECT sensor_id, "
+    "       UNIX_TIMESTAMP(STR_TO_DATE(time, '%Y-%m-%d %H-%i-%s')) * 1000, "
+    "       id, "
+    "       reading "
+    "FROM soil_moisture_readings_legacy "
+    "WHERE id > ? AND id <= ? "
+    "ON DUPLICATE KEY UPDATE reading = VALUES(reading)";
+
+using organicdump::DbSessionLease;
+using organicdump::DbSessionPool;
+
+} // anonymous namespace
+
+int main(int argc, char **argv)
+{
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  FLAGS_logtostderr = 1;
+  google::InitGoogleLogging(argv[0]);
+
+  if (FLAGS_chunk_size <= 0)
+  {
+    LOG(ERROR) << "--chunk_size must be positive";
+    return EXIT_FAILURE;
+  }
+
+  DbSessionPool pool;
+  if (!DbSessionPool::Create(
+        FLAGS_db_url,
+        FLAGS_db_name,
+        1,
+        1,
+        std::chrono::milliseconds{60000},
+        std::chrono::milliseconds{5000},
+        &pool))
+  {
+    LOG(ERROR) << "Failed to create db session pool";
+    return EXIT_FAILURE;
+  }
+
+  DbSessionLease lease;
+  if (!pool.Checkout(&lease))
+  {
+    LOG(ERROR) << "Failed to check out db session";
+    return EXIT_FAILURE;
+  }
+
+  try
+  {
+    mysqlx::Session *session = lease.GetSession();
+
+    mysqlx::Row max_row = session
+        ->sql("SELECT COALESCE(MAX(id), 0) FROM soil_moisture_readings_legacy")
+        .execute()
+        .fetchOne();
+    int64_t max_id = max_row[0].get<int64_t>();
+
+    LOG(INFO) << "Backfilling legacy ids (" << FLAGS_start_after_id << ", "
+              << max_id << "]";
+
+    int64_t copied = 0;
+    for (int64_t low = FLAGS_start_after_id; low < max_id; low += FLAGS_chunk_size)
+    {
+      int64_t high = low + FLAGS_chunk_size;
+
+      session->startTransaction();
+      mysqlx::SqlResult result = session->sql(BACKFILL_CHUNK_SQL)
+          .bind(low, high)
+          .execute();
+      session->commit();
+
+      copied += static_cast<int64_t>(result.getAffectedItemsCount());
+
+      // Progress doubles as the --start_after_id to resume from
+      LOG(INFO) << "Backfilled legacy ids through " << std::min(high, max_id)
+                << " (" << copied << " rows affected)";
+
+      if (FLAGS_pause_ms > 0)
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds{FLAGS_pause_ms});
+      }
+    }
+  }
+  catch (const mysqlx::Error &e)
+  {
+    LOG(ERROR) << "Backfill failed. Error: " << e;
+    return EXIT_FAILURE;
+  }
+
+  LOG(INFO) << "Backfill complete. Compare row counts before dropping "
+            << "soil_moisture_readings_legacy.";
+  return EXIT_SUCCESS;
+}